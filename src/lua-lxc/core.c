@@ -329,6 +329,41 @@ not_found:
     return 1;
 }
 
+static int container_get_cgroup_stats(lua_State *L)
+{
+    struct lxc_container *c = lua_unboxpointer(L, 1, CONTAINER_TYPENAME);
+    struct lxc_cgroup_stats stats;
+
+    if (c->get_cgroup_stats(c, &stats, sizeof(stats)) < 0) {
+	lua_pushnil(L);
+	return 1;
+    }
+
+    lua_newtable(L);
+#define STAT(member) \
+    (lua_pushnumber(L, (lua_Number)stats.member), lua_setfield(L, -2, #member))
+    STAT(valid);
+    STAT(mem_used);
+    STAT(mem_limit);
+    STAT(mem_cache);
+    STAT(mem_rss);
+    STAT(kmem_used);
+    STAT(kmem_limit);
+    STAT(memsw_used);
+    STAT(memsw_limit);
+    STAT(cpu_use_nanos);
+    STAT(cpu_use_user);
+    STAT(cpu_use_sys);
+    STAT(blkio_read);
+    STAT(blkio_write);
+    STAT(blkio);
+    STAT(blkio_ios);
+    STAT(pids_current);
+    STAT(pids_max);
+#undef STAT
+    return 1;
+}
+
 static int container_get_config_item(lua_State *L)
 {
     struct lxc_container *c = lua_unboxpointer(L, 1, CONTAINER_TYPENAME);
@@ -513,6 +548,7 @@ static luaL_Reg lxc_container_methods[] =
     {"load_config",		container_load_config},
     {"save_config",		container_save_config},
     {"get_cgroup_item",		container_get_cgroup_item},
+    {"get_cgroup_stats",	container_get_cgroup_stats},
     {"set_cgroup_item",		container_set_cgroup_item},
     {"get_config_path",		container_get_config_path},
     {"set_config_path",		container_set_config_path},
@@ -560,6 +596,32 @@ not_found:
     return 1;
 }
 
+static int list_defined(lua_State *L)
+{
+    const char *lxcpath = NULL;
+    char **names;
+    int i, count;
+
+    if (lua_gettop(L) > 0)
+	lxcpath = luaL_checkstring(L, 1);
+
+    /* names only, no container config is parsed */
+    count = list_defined_containers_parallel(lxcpath, &names, NULL, 1);
+    if (count < 0) {
+	lua_pushnil(L);
+	return 1;
+    }
+
+    lua_createtable(L, count, 0);
+    for (i = 0; i < count; i++) {
+	lua_pushstring(L, names[i]);
+	lua_rawseti(L, -2, i + 1);
+	free(names[i]);
+    }
+    free(names);
+    return 1;
+}
+
 /* utility functions */
 static int lxc_util_usleep(lua_State *L) {
     usleep((useconds_t)luaL_checkunsigned(L, 1));
@@ -577,6 +639,7 @@ static luaL_Reg lxc_lib_methods[] = {
     {"default_config_path_get",	lxc_default_config_path_get},
     {"cmd_get_config_item",	cmd_get_config_item},
     {"container_new",		container_new},
+    {"list_defined_containers",	list_defined},
     {"usleep",			lxc_util_usleep},
     {"dirname",			lxc_util_dirname},
     {NULL, NULL}
@@ -306,18 +306,19 @@ function container:stat_match_get_int(item, match, column)
     return val
 end
 
+-- all counters in one call, nil if the container isn't running
+function container:get_cgroup_stats()
+    return self.core:get_cgroup_stats()
+end
+
 function container:stats_get(total)
-    local stat = {}
-    stat.mem_used      = self:stat_get_int("memory.usage_in_bytes")
-    stat.mem_limit     = self:stat_get_int("memory.limit_in_bytes")
-    stat.memsw_used    = self:stat_get_int("memory.memsw.usage_in_bytes")
-    stat.memsw_limit   = self:stat_get_int("memory.memsw.limit_in_bytes")
-    stat.kmem_used     = self:stat_get_int("memory.kmem.usage_in_bytes")
-    stat.kmem_limit    = self:stat_get_int("memory.kmem.limit_in_bytes")
-    stat.cpu_use_nanos = self:stat_get_int("cpuacct.usage")
-    stat.cpu_use_user,
-    stat.cpu_use_sys   = self:stat_get_ints("cpuacct.stat", {{1, 2}, {2, 2}})
-    stat.blkio         = self:stat_match_get_int("blkio.throttle.io_service_bytes", "Total", 2)
+    local stat = self:get_cgroup_stats()
+
+    if (stat == nil) then
+	stat = { mem_used = 0, mem_limit = 0, memsw_used = 0, memsw_limit = 0,
+		 kmem_used = 0, kmem_limit = 0, cpu_use_nanos = 0,
+		 cpu_use_user = 0, cpu_use_sys = 0, blkio = 0 }
+    end
 
     if (total) then
 	total.mem_used      = total.mem_used      + stat.mem_used
@@ -353,27 +354,19 @@ end
 function M.containers_configured(names_only)
     local containers = {}
 
-    for dir in lfs.dir(lxc_path) do
-	if (dir ~= "." and dir ~= "..")
-	then
-	    local cfgfile = lxc_path .. "/" .. dir .. "/config"
-	    local cfgattr = lfs.attributes(cfgfile)
-
-	    if (cfgattr and cfgattr.mode == "file") then
-		if (names_only) then
-		    -- note, this is a "mixed" table, ie both dictionary and list
-		    containers[dir] = true
-		    table.insert(containers, dir)
-		else
-		    local ct = container:new(dir)
-		    -- note, this is a "mixed" table, ie both dictionary and list
-		    containers[dir] = ct
-		    table.insert(containers, dir)
-		end
-	    end
+    for _,dir in ipairs(core.list_defined_containers(lxc_path) or {}) do
+	if (names_only) then
+	    -- note, this is a "mixed" table, ie both dictionary and list
+	    containers[dir] = true
+	    table.insert(containers, dir)
+	else
+	    local ct = container:new(dir)
+	    -- note, this is a "mixed" table, ie both dictionary and list
+	    containers[dir] = ct
+	    table.insert(containers, dir)
 	end
     end
-    table.sort(containers, function (a,b) return (a < b) end)
+    -- already sorted by name
     return containers
 end
 
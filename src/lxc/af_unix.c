@@ -71,7 +71,7 @@ int lxc_abstract_unix_open(const char *path, int type, int flags)
 		return -1;
 	}
 
-	if (type == SOCK_STREAM && listen(fd, 100)) {
+	if ((type == SOCK_STREAM || type == SOCK_SEQPACKET) && listen(fd, 100)) {
 		int tmp = errno;
 		close(fd);
 		errno = tmp;
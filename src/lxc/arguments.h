@@ -80,6 +80,7 @@ struct lxc_arguments {
 
 	/* for lxc-destroy */
 	int force;
+	int background;
 
 	/* close fds from parent? */
 	int close_all_fds;
@@ -90,6 +91,7 @@ struct lxc_arguments {
 	uint64_t fssize;
 	char *lvname, *vgname, *thinpool;
 	char *rbdname, *rbdpool;
+	int prealloc;
 	char *zfsroot, *lowerdir, *dir;
 
 	/* lxc-execute */
@@ -100,6 +102,7 @@ struct lxc_arguments {
 	int all;
 	int ignore_auto;
 	int list;
+	unsigned int jobs; /* containers acted on at once, 0 for one per cpu */
 	char *groups; /* also used by lxc-ls */
 
 	/* lxc-snapshot and lxc-copy */
@@ -124,12 +127,14 @@ struct lxc_arguments {
 	char *ls_fancy_format;
 	char *ls_filter;
 	unsigned int ls_nesting; /* maximum allowed nesting level */
+	unsigned int ls_threads; /* containers queried at once, 0 for one per cpu */
 	bool ls_active;
 	bool ls_fancy;
 	bool ls_frozen;
 	bool ls_line;
 	bool ls_running;
 	bool ls_stopped;
+	bool ls_stream;
 
 	/* lxc-copy */
 	bool tmpfs;
@@ -782,6 +782,12 @@ int lxc_attach(const char* name, const char* lxcpath, lxc_attach_exec_t exec_fun
 	if (!init_ctx->container)
 		return -1;
 
+	if (!lxc_container_load_pending_config(init_ctx->container)) {
+		ERROR("Failed to load the container configuration");
+		lxc_proc_put_context_info(init_ctx);
+		return -1;
+	}
+
 	if (!fetch_seccomp(init_ctx->container, options))
 		WARN("Failed to get seccomp policy");
 
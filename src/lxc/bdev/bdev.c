@@ -54,6 +54,7 @@
 #include "lxc.h"
 #include "lxcaufs.h"
 #include "lxcbtrfs.h"
+#include "lxccopy.h"
 #include "lxcdir.h"
 #include "lxclock.h"
 #include "lxclvm.h"
@@ -83,6 +84,7 @@ static const struct bdev_ops aufs_ops = {
 	.create = &aufs_create,
 	.can_snapshot = true,
 	.can_backup = true,
+	.can_trim = false,
 };
 
 /* btrfs */
@@ -95,6 +97,7 @@ static const struct bdev_ops btrfs_ops = {
 	.create = &btrfs_create,
 	.can_snapshot = true,
 	.can_backup = true,
+	.can_trim = false,
 };
 
 /* dir */
@@ -107,6 +110,7 @@ static const struct bdev_ops dir_ops = {
 	.create = &dir_create,
 	.can_snapshot = false,
 	.can_backup = true,
+	.can_trim = false,
 };
 
 /* loop */
@@ -119,6 +123,7 @@ static const struct bdev_ops loop_ops = {
 	.create = &loop_create,
 	.can_snapshot = false,
 	.can_backup = true,
+	.can_trim = true,
 };
 
 /* lvm */
@@ -131,6 +136,7 @@ static const struct bdev_ops lvm_ops = {
 	.create = &lvm_create,
 	.can_snapshot = true,
 	.can_backup = false,
+	.can_trim = true,
 };
 
 /* nbd */
@@ -143,6 +149,7 @@ const struct bdev_ops nbd_ops = {
 	.create = &nbd_create,
 	.can_snapshot = true,
 	.can_backup = false,
+	.can_trim = false,
 };
 
 /* overlay */
@@ -155,6 +162,7 @@ static const struct bdev_ops ovl_ops = {
 	.create = &ovl_create,
 	.can_snapshot = true,
 	.can_backup = true,
+	.can_trim = false,
 };
 
 /* rbd */
@@ -167,6 +175,7 @@ static const struct bdev_ops rbd_ops = {
 	.create = &rbd_create,
 	.can_snapshot = false,
 	.can_backup = false,
+	.can_trim = true,
 };
 
 /* zfs */
@@ -179,6 +188,7 @@ static const struct bdev_ops zfs_ops = {
 	.create = &zfs_create,
 	.can_snapshot = true,
 	.can_backup = true,
+	.can_trim = false,
 };
 
 struct bdev_type {
@@ -204,7 +214,7 @@ static const size_t numbdevs = sizeof(bdevs) / sizeof(struct bdev_type);
 static const struct bdev_type *bdev_query(struct lxc_conf *conf, const char *src);
 static struct bdev *bdev_get(const char *type);
 static struct bdev *do_bdev_create(const char *dest, const char *type,
-		const char *cname, struct bdev_specs *specs);
+		const char *cname, struct bdev_specs *specs, int flags);
 static int find_fstype_cb(char *buffer, void *data);
 static char *linkderef(char *path, char *dest);
 static bool unpriv_snap_allowed(struct bdev *b, const char *t, bool snap,
@@ -288,6 +298,18 @@ bool bdev_can_backup(struct lxc_conf *conf)
 	return ret;
 }
 
+bool bdev_can_trim(struct lxc_conf *conf)
+{
+	struct bdev *bdev = bdev_init(conf, NULL, NULL, NULL);
+	bool ret;
+
+	if (!bdev)
+		return false;
+	ret = bdev->ops->can_trim;
+	bdev_put(bdev);
+	return ret;
+}
+
 /*
  * If we're not snaphotting, then bdev_copy becomes a simple case of mount
  * the original, mount the new, and rsync the contents.
@@ -354,6 +376,20 @@ struct bdev *bdev_copy(struct lxc_container *c0, const char *cname,
 	if (maybe_snap && keepbdevtype && !bdevtype && !orig->ops->can_snapshot)
 		snap = false;
 
+	/*
+	 * When asked to, a directory on a filesystem which can share extents
+	 * (xfs with reflink=1, btrfs outside of subvolumes) is snapshotted as
+	 * a copy reflinking all file data: as cheap to create as an overlay,
+	 * but with no mount to pay for at runtime and no tie to the original.
+	 * Not by default, ephemeral containers rely on getting an overlay.
+	 */
+	if (snap && (flags & LXC_CLONE_REFLINK) && !bdevtype &&
+	    strcmp(orig->type, "dir") == 0 &&
+	    lxc_can_reflink(orig->src, lxcpath)) {
+		INFO("Snapshotting %s as a reflinked copy", orig->src);
+		snap = false;
+	}
+
 	/*
 	 * If newtype is NULL and snapshot is set, then use overlayfs
 	 */
@@ -459,22 +495,23 @@ err:
  * @type: the bdevtype (dir, btrfs, zfs, rbd, etc)
  * @cname: the container name
  * @specs: details about the backing store to create, like fstype
+ * @flags: LXC_CREATE_* flags
  */
 struct bdev *bdev_create(const char *dest, const char *type, const char *cname,
-		struct bdev_specs *specs)
+		struct bdev_specs *specs, int flags)
 {
 	struct bdev *bdev;
 	char *best_options[] = {"btrfs", "zfs", "lvm", "dir", "rbd", NULL};
 
 	if (!type)
-		return do_bdev_create(dest, "dir", cname, specs);
+		return do_bdev_create(dest, "dir", cname, specs, flags);
 
 	if (strcmp(type, "best") == 0) {
 		int i;
 		// try for the best backing store type, according to our
 		// opinionated preferences
 		for (i = 0; best_options[i]; i++) {
-			if ((bdev = do_bdev_create(dest, best_options[i], cname, specs)))
+			if ((bdev = do_bdev_create(dest, best_options[i], cname, specs, flags)))
 				return bdev;
 		}
 		return NULL;  // 'dir' should never fail, so this shouldn't happen
@@ -486,12 +523,12 @@ struct bdev *bdev_create(const char *dest, const char *type, const char *cname,
 		strcpy(dup, type);
 		for (token = strtok_r(dup, ",", &saveptr); token;
 				token = strtok_r(NULL, ",", &saveptr)) {
-			if ((bdev = do_bdev_create(dest, token, cname, specs)))
+			if ((bdev = do_bdev_create(dest, token, cname, specs, flags)))
 				return bdev;
 		}
 	}
 
-	return do_bdev_create(dest, type, cname, specs);
+	return do_bdev_create(dest, type, cname, specs, flags);
 }
 
 bool bdev_destroy(struct lxc_conf *conf)
@@ -805,13 +842,14 @@ bool rootfs_is_blockdev(struct lxc_conf *conf)
 }
 
 static struct bdev *do_bdev_create(const char *dest, const char *type,
-		const char *cname, struct bdev_specs *specs)
+		const char *cname, struct bdev_specs *specs, int flags)
 {
 
 	struct bdev *bdev = bdev_get(type);
 	if (!bdev) {
 		return NULL;
 	}
+	bdev->prealloc = flags & LXC_CREATE_PREALLOC;
 
 	if (bdev->ops->create(bdev, dest, cname, specs) < 0) {
 		 bdev_put(bdev);
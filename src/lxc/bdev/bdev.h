@@ -78,6 +78,8 @@ struct bdev_ops {
 			int snap, uint64_t newsize, struct lxc_conf *conf);
 	bool can_snapshot;
 	bool can_backup;
+	/* a block device of its own, FITRIM does not reach the host's fs */
+	bool can_trim;
 };
 
 /*
@@ -98,10 +100,13 @@ struct bdev {
 	int lofd;
 	// index for the connected nbd device
 	int nbd_idx;
+	// create: reserve the whole loop image, LXC_CREATE_PREALLOC
+	bool prealloc;
 };
 
 bool bdev_is_dir(struct lxc_conf *conf, const char *path);
 bool bdev_can_backup(struct lxc_conf *conf);
+bool bdev_can_trim(struct lxc_conf *conf);
 
 /*
  * Instantiate a bdev object.  The src is used to determine which blockdev
@@ -122,7 +127,7 @@ struct bdev *bdev_copy(struct lxc_container *c0, const char *cname,
 			int flags, const char *bdevdata, uint64_t newsize,
 			int *needs_rdep);
 struct bdev *bdev_create(const char *dest, const char *type,
-			const char *cname, struct bdev_specs *specs);
+			const char *cname, struct bdev_specs *specs, int flags);
 void bdev_put(struct bdev *bdev);
 bool bdev_destroy(struct lxc_conf *conf);
 /* callback function to be used with userns_exec_1() */
@@ -0,0 +1,766 @@
+/*
+ * lxc: linux Container library
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#define _GNU_SOURCE
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <linux/fs.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/xattr.h>
+
+#include "log.h"
+#include "lxccopy.h"
+#include "utils.h"
+
+lxc_log_define(lxccopy, lxc);
+
+#ifndef FICLONE
+#define FICLONE _IOW(0x94, 9, int)
+#endif
+
+#define COPY_MAX_WORKERS 16
+#define COPY_LINK_BUCKETS 4096
+
+/* A directory still to be copied, relative to both roots. */
+struct copy_dir {
+	struct copy_dir *next;
+	bool prune; /* the destination existed, it may hold stale entries */
+	char path[];
+};
+
+/* First destination path of an inode with several links. */
+struct copy_link {
+	struct copy_link *next;
+	dev_t dev;
+	ino_t ino;
+	char path[];
+};
+
+struct copy_tree {
+	int srcfd;
+	int destfd;
+
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	struct copy_dir *queue;
+	unsigned int busy; /* directories being copied right now */
+	bool failed;
+
+	pthread_mutex_t link_lock;
+	struct copy_link *links[COPY_LINK_BUCKETS];
+};
+
+struct copy_worker {
+	struct copy_tree *tree;
+	bool reflink; /* FICLONE is still worth trying */
+	struct lxc_copy_state copy; /* buffer and fallbacks of copy_range() */
+	unsigned long files;
+	unsigned long long bytes;
+};
+
+static char *join_path(const char *dir, const char *name)
+{
+	char *path;
+
+	if (!*dir)
+		return strdup(name);
+	if (asprintf(&path, "%s/%s", dir, name) < 0)
+		return NULL;
+	return path;
+}
+
+static int queue_dir(struct copy_tree *tree, const char *dir,
+		     const char *name, bool prune)
+{
+	struct copy_dir *d;
+	size_t dlen = strlen(dir), nlen = strlen(name);
+
+	d = malloc(sizeof(*d) + dlen + nlen + 2);
+	if (!d)
+		return -1;
+
+	d->prune = prune;
+	if (dlen) {
+		memcpy(d->path, dir, dlen);
+		d->path[dlen++] = '/';
+	}
+	memcpy(d->path + dlen, name, nlen + 1);
+
+	/* LIFO: walking depth first keeps the queue short */
+	pthread_mutex_lock(&tree->lock);
+	d->next = tree->queue;
+	tree->queue = d;
+	pthread_cond_signal(&tree->cond);
+	pthread_mutex_unlock(&tree->lock);
+
+	return 0;
+}
+
+static unsigned int link_hash(dev_t dev, ino_t ino)
+{
+	return (unsigned int)((ino * 2654435761U) ^ dev) % COPY_LINK_BUCKETS;
+}
+
+static struct copy_link *find_link(struct copy_tree *tree, const struct stat *st)
+{
+	struct copy_link *l;
+
+	for (l = tree->links[link_hash(st->st_dev, st->st_ino)]; l; l = l->next)
+		if (l->dev == st->st_dev && l->ino == st->st_ino)
+			return l;
+	return NULL;
+}
+
+static int add_link(struct copy_tree *tree, const struct stat *st,
+		    const char *path)
+{
+	struct copy_link *l;
+	unsigned int h = link_hash(st->st_dev, st->st_ino);
+
+	l = malloc(sizeof(*l) + strlen(path) + 1);
+	if (!l)
+		return -1;
+
+	l->dev = st->st_dev;
+	l->ino = st->st_ino;
+	strcpy(l->path, path);
+	l->next = tree->links[h];
+	tree->links[h] = l;
+
+	return 0;
+}
+
+/* Remove @name below @dirfd, whatever it is. */
+static int remove_at(int dirfd, const char *name)
+{
+	struct dirent *direntp;
+	DIR *dir;
+	int fd, ret = 0;
+
+	if (unlinkat(dirfd, name, 0) == 0 || errno == ENOENT)
+		return 0;
+	if (errno != EISDIR) {
+		SYSERROR("Failed to remove %s", name);
+		return -1;
+	}
+
+	fd = openat(dirfd, name, O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+	if (fd < 0) {
+		SYSERROR("Failed to open %s", name);
+		return -1;
+	}
+	dir = fdopendir(fd);
+	if (!dir) {
+		close(fd);
+		return -1;
+	}
+
+	while ((direntp = readdir(dir))) {
+		if (!strcmp(direntp->d_name, ".") ||
+		    !strcmp(direntp->d_name, ".."))
+			continue;
+		if (remove_at(fd, direntp->d_name) < 0)
+			ret = -1;
+	}
+	closedir(dir);
+
+	if (ret == 0 && unlinkat(dirfd, name, AT_REMOVEDIR) < 0) {
+		SYSERROR("Failed to remove %s", name);
+		ret = -1;
+	}
+
+	return ret;
+}
+
+/* Remove what @destfd holds beyond the entries of @srcfd. */
+static int prune_dir(int srcfd, int destfd)
+{
+	struct dirent *direntp;
+	struct stat st;
+	DIR *dir;
+	int fd, ret = 0;
+
+	fd = dup(destfd);
+	if (fd < 0)
+		return -1;
+	dir = fdopendir(fd);
+	if (!dir) {
+		close(fd);
+		return -1;
+	}
+
+	while ((direntp = readdir(dir))) {
+		if (!strcmp(direntp->d_name, ".") ||
+		    !strcmp(direntp->d_name, ".."))
+			continue;
+		if (fstatat(srcfd, direntp->d_name, &st, AT_SYMLINK_NOFOLLOW) == 0 ||
+		    errno != ENOENT)
+			continue;
+		if (remove_at(destfd, direntp->d_name) < 0)
+			ret = -1;
+	}
+	closedir(dir);
+
+	return ret;
+}
+
+/*
+ * Copy the extended attributes, through the file descriptors when given and
+ * through the (not followed) paths otherwise.
+ */
+static int copy_xattrs(int srcfd, const char *srcpath, int destfd,
+		       const char *destpath)
+{
+	char *list = NULL, *value = NULL, *name;
+	ssize_t len, vlen;
+	size_t vsize = 0;
+	int ret = -1;
+
+	len = srcfd >= 0 ? flistxattr(srcfd, NULL, 0) : llistxattr(srcpath, NULL, 0);
+	if (len <= 0)
+		return (len == 0 || errno == ENOTSUP) ? 0 : -1;
+
+	list = malloc(len);
+	if (!list)
+		return -1;
+	len = srcfd >= 0 ? flistxattr(srcfd, list, len) : llistxattr(srcpath, list, len);
+	if (len < 0)
+		goto out;
+
+	for (name = list; name < list + len; name += strlen(name) + 1) {
+		vlen = srcfd >= 0 ? fgetxattr(srcfd, name, NULL, 0)
+				  : lgetxattr(srcpath, name, NULL, 0);
+		if (vlen < 0)
+			goto out;
+		if ((size_t)vlen > vsize) {
+			char *tmp = realloc(value, vlen);
+			if (!tmp)
+				goto out;
+			value = tmp;
+			vsize = vlen;
+		}
+		vlen = srcfd >= 0 ? fgetxattr(srcfd, name, value, vsize)
+				  : lgetxattr(srcpath, name, value, vsize);
+		if (vlen < 0)
+			goto out;
+
+		if ((destfd >= 0 ? fsetxattr(destfd, name, value, vlen, 0)
+				 : lsetxattr(destpath, name, value, vlen, 0)) == 0)
+			continue;
+		/*
+		 * The target may not support them, or not let us set every
+		 * namespace (trusted.* when running in a user namespace).
+		 */
+		if (errno != ENOTSUP && errno != EPERM)
+			goto out;
+		WARN("Failed to copy extended attribute %s of %s: %s", name,
+		     destpath, strerror(errno));
+	}
+	ret = 0;
+
+out:
+	if (ret < 0)
+		SYSERROR("Failed to copy extended attributes of %s", destpath);
+	free(list);
+	free(value);
+	return ret;
+}
+
+/* Copy @len bytes at @off, in the kernel when possible. */
+static int copy_range(struct copy_worker *w, int in, int out, off_t off,
+		      off_t len)
+{
+	off_t nr;
+
+	nr = lxc_copy_range(&w->copy, in, out, off, len);
+	if (nr < 0)
+		return -1;
+	w->bytes += nr;
+	return 0;
+}
+
+/* Copy the data of a regular file, keeping its holes. */
+static int copy_data(struct copy_worker *w, int in, int out, off_t size)
+{
+	off_t data, hole = 0;
+
+	if (size == 0)
+		return 0;
+
+	if (w->reflink) {
+		if (ioctl(out, FICLONE, in) == 0) {
+			w->bytes += size;
+			return 0;
+		}
+		if (errno == EOPNOTSUPP || errno == ENOTTY ||
+		    errno == EXDEV || errno == EINVAL)
+			w->reflink = false;
+	}
+
+	for (;;) {
+		data = lseek(in, hole, SEEK_DATA);
+		if (data < 0) {
+			if (errno == ENXIO)
+				break;
+			if (errno != EINVAL)
+				return -1;
+			/* no SEEK_DATA support, the whole rest is data */
+			data = hole;
+			hole = size;
+		} else {
+			hole = lseek(in, data, SEEK_HOLE);
+			if (hole < 0)
+				return -1;
+		}
+
+		if (copy_range(w, in, out, data, hole - data) < 0)
+			return -1;
+		if (hole >= size)
+			break;
+	}
+
+	/* trailing holes */
+	return ftruncate(out, size);
+}
+
+/*
+ * Give the new entry the owner and mode of the original. This has to come
+ * before the extended attributes, chown() drops security.capability.
+ */
+static int copy_owner(int dirfd, const char *name, int fd,
+		      const struct stat *st)
+{
+	if (fd >= 0) {
+		if (fchown(fd, st->st_uid, st->st_gid) < 0 ||
+		    fchmod(fd, st->st_mode & 07777) < 0)
+			return -1;
+		return 0;
+	}
+
+	if (fchownat(dirfd, name, st->st_uid, st->st_gid, AT_SYMLINK_NOFOLLOW) < 0)
+		return -1;
+	if (!S_ISLNK(st->st_mode) && fchmodat(dirfd, name, st->st_mode & 07777, 0) < 0)
+		return -1;
+	return 0;
+}
+
+/* Timestamps go last, when nothing else changes the entry any more. */
+static int copy_times(int dirfd, const char *name, int fd,
+		      const struct stat *st)
+{
+	struct timespec times[2] = { st->st_atim, st->st_mtim };
+
+	if (fd >= 0)
+		return futimens(fd, times);
+	return utimensat(dirfd, name, times, AT_SYMLINK_NOFOLLOW);
+}
+
+static int copy_file(struct copy_worker *w, int srcdirfd, int destfd,
+		     const char *name, const struct stat *st)
+{
+	int in, ret;
+
+	in = openat(srcdirfd, name, O_RDONLY | O_NOFOLLOW | O_CLOEXEC);
+	if (in < 0) {
+		SYSERROR("Failed to open %s", name);
+		return -1;
+	}
+
+	ret = copy_data(w, in, destfd, st->st_size);
+	if (ret < 0) {
+		SYSERROR("Failed to copy data of %s", name);
+		goto out;
+	}
+	ret = copy_owner(-1, NULL, destfd, st);
+	if (ret < 0) {
+		SYSERROR("Failed to set owner of %s", name);
+		goto out;
+	}
+	ret = copy_xattrs(in, NULL, destfd, name);
+
+out:
+	close(in);
+	return ret;
+}
+
+static int copy_special(int srcdirfd, int destdirfd, const char *name,
+			const struct stat *st)
+{
+	char target[PATH_MAX];
+	ssize_t len;
+
+	if (!S_ISLNK(st->st_mode))
+		return mknodat(destdirfd, name, st->st_mode, st->st_rdev);
+
+	len = readlinkat(srcdirfd, name, target, sizeof(target) - 1);
+	if (len < 0)
+		return -1;
+	target[len] = '\0';
+
+	return symlinkat(target, destdirfd, name);
+}
+
+/*
+ * Copy anything but a directory. Unless @stale, the destination directory was
+ * just created and cannot hold anything in the way.
+ */
+static int copy_nondir(struct copy_worker *w, int srcdirfd, int destdirfd,
+		       const char *dir, const char *name, const struct stat *st,
+		       bool stale)
+{
+	struct copy_tree *tree = w->tree;
+	struct copy_link *l;
+	char *path = NULL;
+	char srcpath[PATH_MAX], destpath[PATH_MAX];
+	int fd = -1, ret = -1;
+	bool linked = st->st_nlink > 1;
+
+	if (stale && remove_at(destdirfd, name) < 0)
+		return -1;
+
+	if (linked) {
+		path = join_path(dir, name);
+		if (!path)
+			return -1;
+
+		pthread_mutex_lock(&tree->link_lock);
+		l = find_link(tree, st);
+		if (l) {
+			ret = linkat(tree->destfd, l->path, destdirfd, name, 0);
+			pthread_mutex_unlock(&tree->link_lock);
+			if (ret < 0)
+				SYSERROR("Failed to link %s to %s", path, l->path);
+			free(path);
+			return ret;
+		}
+	}
+
+	/*
+	 * The first link of an inode is created under the lock so that the
+	 * other ones never see a path that does not exist yet.
+	 */
+	if (S_ISREG(st->st_mode)) {
+		fd = openat(destdirfd, name,
+			    O_WRONLY | O_CREAT | O_EXCL | O_NOFOLLOW | O_CLOEXEC,
+			    0600);
+		ret = fd < 0 ? -1 : 0;
+	} else {
+		ret = copy_special(srcdirfd, destdirfd, name, st);
+	}
+
+	if (linked) {
+		if (ret == 0 && add_link(tree, st, path) < 0)
+			ret = -1;
+		pthread_mutex_unlock(&tree->link_lock);
+		free(path);
+	}
+
+	if (ret < 0) {
+		SYSERROR("Failed to create %s", name);
+		goto out;
+	}
+
+	w->files++;
+	if (fd >= 0) {
+		ret = copy_file(w, srcdirfd, fd, name, st);
+	} else {
+		ret = copy_owner(destdirfd, name, -1, st);
+		if (ret < 0) {
+			SYSERROR("Failed to set owner of %s", name);
+			goto out;
+		}
+		snprintf(srcpath, sizeof(srcpath), "/proc/self/fd/%d/%s", srcdirfd, name);
+		snprintf(destpath, sizeof(destpath), "/proc/self/fd/%d/%s", destdirfd, name);
+		ret = copy_xattrs(-1, srcpath, -1, destpath);
+	}
+	if (ret < 0)
+		goto out;
+
+	ret = copy_times(destdirfd, name, fd, st);
+	if (ret < 0)
+		SYSERROR("Failed to set times of %s", name);
+
+out:
+	if (fd >= 0)
+		close(fd);
+	return ret;
+}
+
+static int copy_subdir(struct copy_worker *w, int destdirfd, const char *dir,
+		       const char *name)
+{
+	struct stat st;
+	bool prune = false;
+
+	if (mkdirat(destdirfd, name, 0700) < 0) {
+		if (errno != EEXIST)
+			goto err;
+
+		if (fstatat(destdirfd, name, &st, AT_SYMLINK_NOFOLLOW) == 0 &&
+		    S_ISDIR(st.st_mode)) {
+			prune = true;
+		} else if (remove_at(destdirfd, name) < 0 ||
+			   mkdirat(destdirfd, name, 0700) < 0) {
+			goto err;
+		}
+	}
+
+	if (queue_dir(w->tree, dir, name, prune) < 0)
+		return -1;
+	return 0;
+
+err:
+	SYSERROR("Failed to create directory %s", name);
+	return -1;
+}
+
+/*
+ * Copy the entries of one directory, handing its subdirectories back to the
+ * pool. The directory's own attributes are set last: nothing touches it once
+ * its entries exist, the subdirectories only change themselves.
+ */
+static int copy_dir(struct copy_worker *w, struct copy_dir *d)
+{
+	struct copy_tree *tree = w->tree;
+	const char *path = *d->path ? d->path : ".";
+	struct dirent *direntp;
+	struct stat st, dst;
+	DIR *dir = NULL;
+	int srcfd, destfd, ret = -1;
+
+	srcfd = openat(tree->srcfd, path, O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+	if (srcfd < 0) {
+		SYSERROR("Failed to open %s", path);
+		return -1;
+	}
+	destfd = openat(tree->destfd, path, O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+	if (destfd < 0) {
+		SYSERROR("Failed to open %s", path);
+		close(srcfd);
+		return -1;
+	}
+
+	if (fstat(srcfd, &st) < 0)
+		goto out;
+	dir = fdopendir(srcfd);
+	if (!dir)
+		goto out;
+
+	while ((direntp = readdir(dir))) {
+		if (!strcmp(direntp->d_name, ".") ||
+		    !strcmp(direntp->d_name, ".."))
+			continue;
+		if (tree->failed)
+			goto out;
+
+		if (fstatat(srcfd, direntp->d_name, &dst, AT_SYMLINK_NOFOLLOW) < 0) {
+			SYSERROR("Failed to stat %s/%s", path, direntp->d_name);
+			goto out;
+		}
+
+		if (S_ISDIR(dst.st_mode))
+			ret = copy_subdir(w, destfd, d->path, direntp->d_name);
+		else
+			ret = copy_nondir(w, srcfd, destfd, d->path,
+					  direntp->d_name, &dst, d->prune);
+		if (ret < 0)
+			goto out;
+	}
+
+	ret = -1;
+	if (d->prune && prune_dir(srcfd, destfd) < 0)
+		goto out;
+	if (copy_owner(-1, NULL, destfd, &st) < 0 ||
+	    copy_xattrs(srcfd, NULL, destfd, path) < 0 ||
+	    copy_times(-1, NULL, destfd, &st) < 0) {
+		SYSERROR("Failed to set attributes of %s", path);
+		goto out;
+	}
+	ret = 0;
+
+out:
+	if (dir)
+		closedir(dir);
+	else
+		close(srcfd);
+	close(destfd);
+	return ret;
+}
+
+static void *copy_worker(void *arg)
+{
+	struct copy_worker *w = arg;
+	struct copy_tree *tree = w->tree;
+	struct copy_dir *d;
+	int ret;
+
+	for (;;) {
+		pthread_mutex_lock(&tree->lock);
+		while (!tree->queue && tree->busy > 0 && !tree->failed)
+			pthread_cond_wait(&tree->cond, &tree->lock);
+		if (!tree->queue || tree->failed) {
+			/* done, or given up: let the others know too */
+			pthread_cond_broadcast(&tree->cond);
+			pthread_mutex_unlock(&tree->lock);
+			return NULL;
+		}
+		d = tree->queue;
+		tree->queue = d->next;
+		tree->busy++;
+		pthread_mutex_unlock(&tree->lock);
+
+		ret = copy_dir(w, d);
+		free(d);
+
+		pthread_mutex_lock(&tree->lock);
+		tree->busy--;
+		if (ret < 0)
+			tree->failed = true;
+		if (tree->busy == 0 || tree->failed)
+			pthread_cond_broadcast(&tree->cond);
+		pthread_mutex_unlock(&tree->lock);
+	}
+}
+
+int lxc_copy_tree(const char *src, const char *dest)
+{
+	struct copy_tree tree = {
+		.srcfd = -1,
+		.destfd = -1,
+		.lock = PTHREAD_MUTEX_INITIALIZER,
+		.cond = PTHREAD_COND_INITIALIZER,
+		.link_lock = PTHREAD_MUTEX_INITIALIZER,
+	};
+	struct copy_worker workers[COPY_MAX_WORKERS] = {};
+	pthread_t tids[COPY_MAX_WORKERS];
+	unsigned long files = 0;
+	unsigned long long bytes = 0;
+	long nr;
+	int i, started = 0, ret = -1;
+
+	tree.srcfd = open(src, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+	if (tree.srcfd < 0) {
+		SYSERROR("Failed to open %s", src);
+		return -1;
+	}
+	tree.destfd = open(dest, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+	if (tree.destfd < 0) {
+		SYSERROR("Failed to open %s", dest);
+		goto out;
+	}
+
+	if (queue_dir(&tree, "", "", true) < 0)
+		goto out;
+
+	nr = sysconf(_SC_NPROCESSORS_ONLN);
+	if (nr < 1)
+		nr = 1;
+	if (nr > COPY_MAX_WORKERS)
+		nr = COPY_MAX_WORKERS;
+
+	for (i = 0; i < nr; i++) {
+		workers[i].tree = &tree;
+		workers[i].reflink = true;
+	}
+
+	/* the calling thread is the first worker */
+	for (i = 1; i < nr; i++) {
+		if (pthread_create(&tids[i], NULL, copy_worker, &workers[i]) != 0)
+			break;
+		started++;
+	}
+	copy_worker(&workers[0]);
+	for (i = 1; i <= started; i++)
+		pthread_join(tids[i], NULL);
+
+	for (i = 0; i < nr; i++) {
+		files += workers[i].files;
+		bytes += workers[i].bytes;
+	}
+
+	if (!tree.failed) {
+		DEBUG("Copied %lu files (%llu bytes) from %s to %s with %d threads",
+		      files, bytes, src, dest, started + 1);
+		ret = 0;
+	}
+
+out:
+	while (tree.queue) {
+		struct copy_dir *d = tree.queue;
+		tree.queue = d->next;
+		free(d);
+	}
+	for (i = 0; i < COPY_LINK_BUCKETS; i++) {
+		while (tree.links[i]) {
+			struct copy_link *l = tree.links[i];
+			tree.links[i] = l->next;
+			free(l);
+		}
+	}
+	for (i = 0; i < COPY_MAX_WORKERS; i++)
+		lxc_copy_state_free(&workers[i].copy);
+	if (tree.destfd >= 0)
+		close(tree.destfd);
+	close(tree.srcfd);
+
+	return ret;
+}
+
+bool lxc_can_reflink(const char *src, const char *dest)
+{
+	char buf[4096];
+	struct stat sst, dst;
+	int in = -1, out = -1;
+	bool ret = false;
+
+	if (stat(src, &sst) < 0 || stat(dest, &dst) < 0)
+		return false;
+	if (sst.st_dev != dst.st_dev)
+		return false;
+
+	/* anonymous files, nothing to clean up if we get interrupted */
+	in = open(dest, O_TMPFILE | O_RDWR | O_CLOEXEC, 0600);
+	if (in < 0)
+		goto out;
+	out = open(dest, O_TMPFILE | O_RDWR | O_CLOEXEC, 0600);
+	if (out < 0)
+		goto out;
+
+	memset(buf, 'x', sizeof(buf));
+	if (write(in, buf, sizeof(buf)) != sizeof(buf))
+		goto out;
+	ret = ioctl(out, FICLONE, in) == 0;
+
+out:
+	if (in >= 0)
+		close(in);
+	if (out >= 0)
+		close(out);
+	DEBUG("%s and %s %s share extents", src, dest, ret ? "can" : "cannot");
+	return ret;
+}
@@ -0,0 +1,42 @@
+/*
+ * lxc: linux Container library
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifndef __LXC_COPY_H
+#define __LXC_COPY_H
+
+#include <stdbool.h>
+
+/*
+ * Copy the contents of the directory @src into the existing directory @dest,
+ * the way "rsync -aHXS --delete src/ dest" does: ownership, permissions,
+ * timestamps, extended attributes (and with them ACLs), hardlinks and holes
+ * are preserved, and whatever in @dest has no counterpart in @src is removed.
+ * Directories are spread over a pool of threads, file data is reflinked or
+ * copied in the kernel when the filesystems allow it.
+ * Returns 0 on success, -1 on error.
+ */
+int lxc_copy_tree(const char *src, const char *dest);
+
+/*
+ * Whether files under @src can be reflinked (FICLONE) into the directory
+ * @dest, i.e. both are on one filesystem able to share extents. A copy by
+ * lxc_copy_tree() between them then only duplicates metadata.
+ */
+bool lxc_can_reflink(const char *src, const char *dest);
+
+#endif // __LXC_COPY_H
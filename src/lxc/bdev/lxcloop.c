@@ -23,6 +23,9 @@
 
 #define _GNU_SOURCE
 #include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
 #include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
@@ -43,12 +46,33 @@
 #define LOOP_CTL_GET_FREE 0x4C82
 #endif
 
+#ifndef LOOP_SET_DIRECT_IO
+#define LOOP_SET_DIRECT_IO 0x4C08
+#endif
+
 lxc_log_define(lxcloop, lxc);
 
-static int do_loop_create(const char *path, uint64_t size, const char *fstype);
+static int do_loop_create(const char *path, uint64_t size, const char *fstype,
+		bool prealloc);
 static int find_free_loopdev_no_control(int *retfd, char *namep);
 static int find_free_loopdev(int *retfd, char *namep);
 
+/*
+ * Whether images are to be preallocated ("full") rather than left sparse,
+ * as asked for by @alloc or else by lxc.bdev.loop.alloc. -1 if unknown.
+ */
+int loop_prealloc(const char *alloc)
+{
+	if (!alloc)
+		alloc = lxc_global_config_value("lxc.bdev.loop.alloc");
+	if (strcmp(alloc, "full") == 0)
+		return 1;
+	if (strcmp(alloc, "sparse") == 0)
+		return 0;
+	ERROR("Invalid loop image allocation \"%s\", use sparse or full", alloc);
+	return -1;
+}
+
 /*
  * No idea what the original blockdev will be called, but the copy will be
  * called $lxcpath/$lxcname/rootdev
@@ -59,7 +83,7 @@ int loop_clonepaths(struct bdev *orig, struct bdev *new, const char *oldname,
 {
 	char fstype[100];
 	uint64_t size = newsize;
-	int len, ret;
+	int len, ret, prealloc;
 	char *srcdev;
 
 	if (snap) {
@@ -109,7 +133,11 @@ int loop_clonepaths(struct bdev *orig, struct bdev *new, const char *oldname,
 		if (!newsize)
 			size = DEFAULT_FS_SIZE;
 	}
-	return do_loop_create(srcdev, size, fstype);
+
+	prealloc = loop_prealloc(NULL);
+	if (prealloc < 0)
+		return -1;
+	return do_loop_create(srcdev, size, fstype, prealloc);
 }
 
 int loop_create(struct bdev *bdev, const char *dest, const char *n,
@@ -117,12 +145,16 @@ int loop_create(struct bdev *bdev, const char *dest, const char *n,
 {
 	const char *fstype;
 	uint64_t sz;
-	int ret, len;
+	int ret, len, prealloc;
 	char *srcdev;
 
 	if (!specs)
 		return -1;
 
+	prealloc = bdev->prealloc ? 1 : loop_prealloc(NULL);
+	if (prealloc < 0)
+		return -1;
+
 	// dest is passed in as $lxcpath / $lxcname / rootfs
 	// srcdev will be:      $lxcpath / $lxcname / rootdev
 	// src will be 'loop:$srcdev'
@@ -157,7 +189,7 @@ int loop_create(struct bdev *bdev, const char *dest, const char *n,
 		return -1;
 	}
 
-	return do_loop_create(srcdev, sz, fstype);
+	return do_loop_create(srcdev, sz, fstype, prealloc);
 }
 
 int loop_destroy(struct bdev *orig)
@@ -201,6 +233,9 @@ int loop_mount(struct bdev *bdev)
 		SYSERROR("Error setting autoclear on loop dev");
 		goto out;
 	}
+	/* bypass the page cache, the filesystem on top caches already */
+	if (ioctl(lfd, LOOP_SET_DIRECT_IO, 1) < 0)
+		INFO("No direct I/O on %s for %s", loname, bdev->src);
 
 	ret = mount_unknown_fs(loname, bdev->dest, bdev->mntopts);
 	if (ret < 0)
@@ -234,36 +269,48 @@ int loop_umount(struct bdev *bdev)
 	return ret;
 }
 
-static int do_loop_create(const char *path, uint64_t size, const char *fstype)
+static int do_loop_create(const char *path, uint64_t size, const char *fstype,
+		bool prealloc)
 {
 	int fd, ret;
 	// create the new loopback file.
 	fd = creat(path, S_IRUSR|S_IWUSR);
 	if (fd < 0)
 		return -1;
-	if (lseek(fd, size, SEEK_SET) < 0) {
-		SYSERROR("Error seeking to set new loop file size");
+	if (ftruncate(fd, size) < 0) {
+		SYSERROR("Error setting new loop file size");
 		close(fd);
 		return -1;
 	}
-	if (write(fd, "1", 1) != 1) {
-		SYSERROR("Error creating new loop file");
+
+	// create an fs in the loopback file
+	if (do_mkfs(path, fstype) < 0) {
+		ERROR("Error creating filesystem type %s on %s", fstype,
+			path);
 		close(fd);
 		return -1;
 	}
+
+	/*
+	 * Reserve the remaining blocks once mkfs is done, as it discards the
+	 * whole device first. A preallocated image hardly fragments.
+	 */
+	if (prealloc && fallocate(fd, 0, 0, size) < 0) {
+		if (errno != EOPNOTSUPP) {
+			SYSERROR("Error allocating %" PRIu64 " bytes for %s",
+				size, path);
+			close(fd);
+			return -1;
+		}
+		WARN("Cannot preallocate %s, leaving it sparse", path);
+	}
+
 	ret = close(fd);
 	if (ret < 0) {
 		SYSERROR("Error closing new loop file");
 		return -1;
 	}
 
-	// create an fs in the loopback file
-	if (do_mkfs(path, fstype) < 0) {
-		ERROR("Error creating filesystem type %s on %s", fstype,
-			path);
-		return -1;
-	}
-
 	return 0;
 }
 
@@ -48,5 +48,6 @@ int loop_destroy(struct bdev *orig);
 int loop_detect(const char *path);
 int loop_mount(struct bdev *bdev);
 int loop_umount(struct bdev *bdev);
+int loop_prealloc(const char *alloc);
 
 #endif /* __LXC_LOOP_H */
@@ -34,35 +34,19 @@
 
 #include "bdev.h"
 #include "log.h"
+#include "lxccopy.h"
 #include "lxcrsync.h"
 #include "utils.h"
 
 lxc_log_define(lxcrsync, lxc);
 
-/* the bulk of this needs to become a common helper */
+/*
+ * Formerly an exec of "rsync -aHXS --delete src/ dest", now done natively so
+ * the copy runs on several threads and doesn't depend on rsync being around.
+ */
 int do_rsync(const char *src, const char *dest)
 {
-	// call out to rsync
-	pid_t pid;
-	char *s;
-	size_t l;
-
-	pid = fork();
-	if (pid < 0)
-		return -1;
-	if (pid > 0)
-		return wait_for_pid(pid);
-
-	l = strlen(src) + 2;
-	s = malloc(l);
-	if (!s)
-		exit(1);
-	strcpy(s, src);
-	s[l-2] = '/';
-	s[l-1] = '\0';
-
-	execlp("rsync", "rsync", "-aHXS", "--delete", s, dest, (char *)NULL);
-	exit(1);
+	return lxc_copy_tree(src, dest);
 }
 
 int rsync_delta(struct rsync_data_char *data)
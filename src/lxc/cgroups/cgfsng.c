@@ -38,6 +38,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <errno.h>
+#include <fcntl.h>
 #include <sys/types.h>
 #include <unistd.h>
 #include <dirent.h>
@@ -1572,6 +1573,70 @@ static int cgfsng_get(const char *filename, char *value, size_t len, const char
 	return ret;
 }
 
+/*
+ * Called externally to open the container's cgroup directory in each of
+ * @subsystems with a single command round trip. @fds[i] is -1 where the
+ * subsystem is not mounted. Returns the number of directories opened, -1 if
+ * the container is not running.
+ */
+static int cgfsng_open_dirs(const char *name, const char *lxcpath,
+			    const char **subsystems, int *fds)
+{
+	struct lxc_cmd_status_bundle bundle;
+	const char **keys;
+	const char *path;
+	char *fullpath, *oldpath = NULL;
+	struct hierarchy *h;
+	int i, n, ret, opened = 0;
+
+	for (n = 0; subsystems[n]; n++)
+		fds[n] = -1;
+
+	keys = alloca((n + 1) * sizeof(*keys));
+	for (i = 0; i < n; i++) {
+		char *key = alloca(strlen(subsystems[i]) + 8);
+		sprintf(key, "cgroup.%s", subsystems[i]);
+		keys[i] = key;
+	}
+	keys[n] = NULL;
+
+	ret = lxc_cmd_get_status_bundle(name, lxcpath, keys, &bundle);
+	if (ret < 0 && errno != ENOSYS)
+		return -1;
+	if (ret == 0 && bundle.state == STOPPED) {
+		lxc_cmd_status_bundle_free(&bundle);
+		return -1;
+	}
+
+	for (i = 0; i < n; i++) {
+		h = get_hierarchy(subsystems[i]);
+		if (!h)
+			continue;
+
+		if (ret == 0) {
+			path = lxc_cmd_status_bundle_get(&bundle, keys[i]);
+		} else {
+			/* monitor without status bundles */
+			free(oldpath);
+			path = oldpath = lxc_cmd_get_cgroup_path(name, lxcpath,
+								 subsystems[i]);
+		}
+		if (!path)
+			continue;
+
+		fullpath = build_full_cgpath_from_monitorpath(h, path, NULL);
+		fds[i] = open(fullpath, O_PATH | O_DIRECTORY | O_CLOEXEC);
+		if (fds[i] >= 0)
+			opened++;
+		free(fullpath);
+	}
+
+	free(oldpath);
+	if (ret == 0)
+		lxc_cmd_status_bundle_free(&bundle);
+	return opened;
+}
+
 /*
  * Called externally (i.e. from 'lxc-cgroup') to set new cgroup limits.
  * Here we don't have a cgroup_data set up, so we ask the running
@@ -1628,6 +1693,31 @@ static int lxc_cgroup_set_data(const char *filename, const char *value, struct c
 	return ret;
 }
 
+/*
+ * Called from the container's monitor, e.g. to answer status queries, where
+ * the cgroup_data is available and no command round trip is needed.
+ */
+static int cgfsng_get_data(void *hdata, const char *filename, char *value,
+			   size_t len)
+{
+	char *subsystem = NULL, *p;
+	int ret = -1;
+	struct hierarchy *h;
+
+	subsystem = alloca(strlen(filename) + 1);
+	strcpy(subsystem, filename);
+	if ((p = strchr(subsystem, '.')) != NULL)
+		*p = '\0';
+
+	h = get_hierarchy(subsystem);
+	if (h && h->fullcgpath) {
+		char *fullpath = must_make_path(h->fullcgpath, filename, NULL);
+		ret = lxc_read_from_file(fullpath, value, len);
+		free(fullpath);
+	}
+	return ret;
+}
+
 static bool cgfsng_setup_limits(void *hdata, struct lxc_list *cgroup_settings,
 				  bool do_devices)
 {
@@ -1685,6 +1775,8 @@ static struct cgroup_ops cgfsng_ops = {
 	.get_cgroup = cgfsng_get_cgroup,
 	.get = cgfsng_get,
 	.set = cgfsng_set,
+	.get_data = cgfsng_get_data,
+	.open_dirs = cgfsng_open_dirs,
 	.unfreeze = cgfsng_unfreeze,
 	.setup_limits = cgfsng_setup_limits,
 	.name = "cgroupfs-ng",
@@ -21,13 +21,23 @@
  * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
  */
 
+#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
 #include <unistd.h>
 #include <sys/types.h>
 
 #include "cgroup.h"
 #include "conf.h"
 #include "log.h"
+#include "lxc.h"
+#include "lxccontainer.h"
 #include "start.h"
+#include "utils.h"
 
 lxc_log_define(lxc_cgroup, lxc);
 
@@ -112,6 +122,18 @@ const char *cgroup_get_cgroup(struct lxc_handler *handler, const char *subsystem
 	return NULL;
 }
 
+/*
+ * Read a cgroup file of a container we have the cgroup_data for. Drivers which
+ * do not implement this make callers fall back to lxc_cgroup_get().
+ */
+int cgroup_get_data(struct lxc_handler *handler, const char *filename,
+		    char *value, size_t len)
+{
+	if (ops && ops->get_data)
+		return ops->get_data(handler->cgroup_data, filename, value, len);
+	return -1;
+}
+
 bool cgroup_escape(struct lxc_handler *handler)
 {
 	if (ops)
@@ -197,6 +219,531 @@ int lxc_cgroup_get(const char *filename, char *value, size_t len, const char *na
 	return -1;
 }
 
+/*
+ * Counters of lxc_cgroup_get_stats(). Single value files are stored at
+ * @offset, the others are "key value" lines (blkio files prefix them with
+ * "maj:min") of which @keys are picked up.
+ */
+struct cgroup_stat_key {
+	const char *key;
+	size_t offset;
+	bool per_device; /* summed over the "maj:min key value" lines */
+};
+
+struct cgroup_stat_file {
+	int subsystem;
+	const char *filename;
+	unsigned int valid;
+	size_t offset;
+	const struct cgroup_stat_key *keys;
+};
+
+#define STAT_OFF(member) offsetof(struct lxc_cgroup_stats, member)
+
+static const char *cgroup_stat_subsystems[] = {
+	"memory", "cpuacct", "blkio", "pids", NULL
+};
+
+static const struct cgroup_stat_key memory_stat_keys[] = {
+	{ "total_cache", STAT_OFF(mem_cache) },
+	{ "total_rss", STAT_OFF(mem_rss) },
+	{ NULL },
+};
+
+static const struct cgroup_stat_key cpuacct_stat_keys[] = {
+	{ "user", STAT_OFF(cpu_use_user) },
+	{ "system", STAT_OFF(cpu_use_sys) },
+	{ NULL },
+};
+
+static const struct cgroup_stat_key blkio_bytes_keys[] = {
+	{ "Read", STAT_OFF(blkio_read), true },
+	{ "Write", STAT_OFF(blkio_write), true },
+	{ "Total", STAT_OFF(blkio) },
+	{ NULL },
+};
+
+static const struct cgroup_stat_key blkio_ios_keys[] = {
+	{ "Total", STAT_OFF(blkio_ios) },
+	{ NULL },
+};
+
+static const struct cgroup_stat_file cgroup_stat_files[] = {
+	{ 0, "memory.usage_in_bytes", LXC_CGROUP_STATS_MEMORY, STAT_OFF(mem_used) },
+	{ 0, "memory.limit_in_bytes", LXC_CGROUP_STATS_MEMORY, STAT_OFF(mem_limit) },
+	{ 0, "memory.stat", LXC_CGROUP_STATS_MEMORY, 0, memory_stat_keys },
+	{ 0, "memory.kmem.usage_in_bytes", LXC_CGROUP_STATS_KMEM, STAT_OFF(kmem_used) },
+	{ 0, "memory.kmem.limit_in_bytes", LXC_CGROUP_STATS_KMEM, STAT_OFF(kmem_limit) },
+	{ 0, "memory.memsw.usage_in_bytes", LXC_CGROUP_STATS_MEMSW, STAT_OFF(memsw_used) },
+	{ 0, "memory.memsw.limit_in_bytes", LXC_CGROUP_STATS_MEMSW, STAT_OFF(memsw_limit) },
+	{ 1, "cpuacct.usage", LXC_CGROUP_STATS_CPUACCT, STAT_OFF(cpu_use_nanos) },
+	{ 1, "cpuacct.stat", LXC_CGROUP_STATS_CPUACCT, 0, cpuacct_stat_keys },
+	{ 2, "blkio.throttle.io_service_bytes", LXC_CGROUP_STATS_BLKIO, 0, blkio_bytes_keys },
+	{ 2, "blkio.throttle.io_serviced", LXC_CGROUP_STATS_BLKIO, 0, blkio_ios_keys },
+	{ 3, "pids.current", LXC_CGROUP_STATS_PIDS, STAT_OFF(pids_current) },
+	{ 3, "pids.max", LXC_CGROUP_STATS_PIDS, STAT_OFF(pids_max) },
+};
+
+#define NR_STAT_SUBSYSTEMS (sizeof(cgroup_stat_subsystems) / sizeof(char *) - 1)
+#define NR_STAT_FILES (sizeof(cgroup_stat_files) / sizeof(cgroup_stat_files[0]))
+
+static bool stat_parse_u64(const char *s, uint64_t *v)
+{
+	uint64_t n = 0;
+
+	if (strncmp(s, "max", 3) == 0) {
+		*v = UINT64_MAX;
+		return true;
+	}
+
+	if (!isdigit(*s))
+		return false;
+	while (isdigit(*s))
+		n = n * 10 + (*s++ - '0');
+	*v = n;
+	return true;
+}
+
+static bool stat_parse_line(const struct cgroup_stat_file *f, char *line,
+			    struct lxc_cgroup_stats *stats)
+{
+	const struct cgroup_stat_key *k;
+	bool per_device = false;
+	char *key, *val;
+	uint64_t v, *p;
+
+	if (!f->keys) {
+		if (!stat_parse_u64(line, &v))
+			return false;
+		*(uint64_t *)((char *)stats + f->offset) = v;
+		return true;
+	}
+
+	key = line;
+	if (isdigit(*key)) {
+		key = strchr(key, ' ');
+		if (!key)
+			return false;
+		key++;
+		per_device = true;
+	}
+
+	val = strchr(key, ' ');
+	if (!val)
+		return false;
+	*val++ = '\0';
+
+	for (k = f->keys; k->key; k++) {
+		if (k->per_device != per_device || strcmp(k->key, key) != 0)
+			continue;
+		if (!stat_parse_u64(val, &v))
+			return false;
+		p = (uint64_t *)((char *)stats + k->offset);
+		if (per_device)
+			*p += v;
+		else
+			*p = v;
+		return true;
+	}
+
+	/* a valid line we don't care about */
+	return true;
+}
+
+/*
+ * Parse the complete lines in @buf, and at @eof the trailing partial one.
+ * Returns the number of bytes consumed.
+ */
+static size_t stat_parse_lines(const struct cgroup_stat_file *f, char *buf,
+			       size_t len, bool eof,
+			       struct lxc_cgroup_stats *stats, int *found)
+{
+	char *line = buf, *nl, *end = buf + len;
+
+	while (line < end) {
+		nl = memchr(line, '\n', end - line);
+		if (!nl) {
+			if (!eof)
+				break;
+			nl = end;
+		}
+		*nl = '\0';
+		if (*line && stat_parse_line(f, line, stats))
+			(*found)++;
+		line = nl < end ? nl + 1 : end;
+	}
+
+	return line - buf;
+}
+
+static int stat_read_at(int dirfd, const struct cgroup_stat_file *f,
+			struct lxc_cgroup_stats *stats)
+{
+	char buf[4096], *nl;
+	size_t have = 0, used;
+	ssize_t ret;
+	int fd, found = 0;
+	bool skip = false;
+
+	fd = openat(dirfd, f->filename, O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+		return -1;
+
+	for (;;) {
+		ret = read(fd, buf + have, sizeof(buf) - 1 - have);
+		if (ret < 0) {
+			if (errno == EINTR)
+				continue;
+			break;
+		}
+		have += ret;
+		buf[have] = '\0';
+
+		/* the rest of an overlong line is not a line of its own */
+		if (skip) {
+			nl = memchr(buf, '\n', have);
+			if (!nl) {
+				have = 0;
+				if (ret == 0)
+					break;
+				continue;
+			}
+			have -= nl + 1 - buf;
+			memmove(buf, nl + 1, have + 1);
+			skip = false;
+		}
+
+		used = stat_parse_lines(f, buf, have, ret == 0, stats, &found);
+		if (ret == 0)
+			break;
+
+		/* keep the partial line for the next read, drop overlong ones */
+		have -= used;
+		memmove(buf, buf + used, have);
+		if (have == sizeof(buf) - 1) {
+			have = 0;
+			skip = true;
+		}
+	}
+
+	close(fd);
+	return found > 0 && ret == 0 ? 0 : -1;
+}
+
+int cgroup_read_stat_file(int dirfd, const char *filename,
+			  struct lxc_cgroup_stats *stats)
+{
+	size_t i;
+
+	for (i = 0; i < NR_STAT_FILES; i++)
+		if (strcmp(cgroup_stat_files[i].filename, filename) == 0)
+			return stat_read_at(dirfd, &cgroup_stat_files[i], stats);
+
+	errno = EINVAL;
+	return -1;
+}
+
+/* drivers without open_dirs, one command round trip per file */
+static int stat_read_cmd(const char *name, const char *lxcpath,
+			 const struct cgroup_stat_file *f,
+			 struct lxc_cgroup_stats *stats)
+{
+	char buf[4096];
+	int ret, found = 0;
+
+	ret = ops->get(f->filename, buf, sizeof(buf) - 1, name, lxcpath);
+	if (ret < 0)
+		return -1;
+	buf[ret] = '\0';
+
+	stat_parse_lines(f, buf, ret, true, stats, &found);
+	return found > 0 ? 0 : -1;
+}
+
+/*
+ * A handle keeps the container's cgroup directories open, so repeated reads
+ * and writes skip the get_cgroup round trip and the path walk. Directories
+ * are resolved on first use of a subsystem. When the container stops, its
+ * cgroups are removed and the cached fds go stale; that is noticed on the
+ * next ENOENT and the directories are resolved again, which also picks up
+ * the cgroups of a restarted container.
+ */
+struct lxc_cgroup_handle {
+	char *name;
+	char *lxcpath;
+	int nr_dirs;
+	struct cgroup_handle_dir {
+		char *subsystem;
+		int fd;
+	} *dirs;
+};
+
+struct lxc_cgroup_handle *lxc_cgroup_handle_new(const char *name,
+						const char *lxcpath)
+{
+	struct lxc_cgroup_handle *h;
+
+	h = malloc(sizeof(*h));
+	if (!h)
+		return NULL;
+	memset(h, 0, sizeof(*h));
+
+	h->name = strdup(name);
+	h->lxcpath = strdup(lxcpath);
+	if (!h->name || !h->lxcpath) {
+		lxc_cgroup_handle_free(h);
+		return NULL;
+	}
+
+	return h;
+}
+
+static void cgroup_handle_reset(struct lxc_cgroup_handle *h)
+{
+	int i;
+
+	for (i = 0; i < h->nr_dirs; i++) {
+		free(h->dirs[i].subsystem);
+		if (h->dirs[i].fd >= 0)
+			close(h->dirs[i].fd);
+	}
+	free(h->dirs);
+	h->dirs = NULL;
+	h->nr_dirs = 0;
+}
+
+void lxc_cgroup_handle_free(struct lxc_cgroup_handle *h)
+{
+	if (!h)
+		return;
+
+	cgroup_handle_reset(h);
+	free(h->name);
+	free(h->lxcpath);
+	free(h);
+}
+
+/* the cgroup directory itself is gone, not just a file in it */
+static bool cgroup_handle_stale(int dirfd)
+{
+	return faccessat(dirfd, "cgroup.procs", F_OK, 0) < 0 && errno == ENOENT;
+}
+
+/*
+ * Fill @fds with the directory of each of @subsystems, resolving all the
+ * uncached ones with one open_dirs call. Returns -1 if the container is not
+ * running.
+ */
+static int cgroup_handle_dirs(struct lxc_cgroup_handle *h,
+			      const char **subsystems, int *fds)
+{
+	struct cgroup_handle_dir *tmp;
+	const char **missing;
+	int *missing_fds;
+	int i, j, n = 0;
+
+	for (i = 0; subsystems[i]; i++)
+		;
+	missing = alloca((i + 1) * sizeof(*missing));
+	missing_fds = alloca(i * sizeof(*missing_fds));
+
+	for (i = 0; subsystems[i]; i++) {
+		fds[i] = -1;
+		for (j = 0; j < h->nr_dirs; j++)
+			if (strcmp(h->dirs[j].subsystem, subsystems[i]) == 0)
+				break;
+		if (j < h->nr_dirs)
+			fds[i] = h->dirs[j].fd;
+		else
+			missing[n++] = subsystems[i];
+	}
+	if (n == 0)
+		return 0;
+	missing[n] = NULL;
+
+	if (ops->open_dirs(h->name, h->lxcpath, missing, missing_fds) < 0) {
+		for (i = 0; i < n; i++)
+			if (missing_fds[i] >= 0)
+				close(missing_fds[i]);
+		return -1;
+	}
+
+	tmp = realloc(h->dirs, (h->nr_dirs + n) * sizeof(*h->dirs));
+	if (tmp)
+		h->dirs = tmp;
+
+	/* unmounted subsystems are cached as -1 too */
+	for (j = 0; j < n; j++) {
+		for (i = 0; subsystems[i]; i++)
+			if (strcmp(subsystems[i], missing[j]) == 0)
+				fds[i] = missing_fds[j];
+
+		if (tmp)
+			h->dirs[h->nr_dirs].subsystem = strdup(missing[j]);
+		if (!tmp || !h->dirs[h->nr_dirs].subsystem) {
+			ERROR("Out of memory caching the %s cgroup of %s",
+			      missing[j], h->name);
+			for (i = 0; subsystems[i]; i++)
+				if (fds[i] == missing_fds[j])
+					fds[i] = -1;
+			if (missing_fds[j] >= 0)
+				close(missing_fds[j]);
+			continue;
+		}
+		h->dirs[h->nr_dirs++].fd = missing_fds[j];
+	}
+
+	return 0;
+}
+
+static int cgroup_handle_open(struct lxc_cgroup_handle *h,
+			      const char *filename, int flags)
+{
+	const char *subsystems[2] = { NULL, NULL };
+	char *subsystem, *p;
+	int dirfd, fd, retry;
+
+	subsystem = alloca(strlen(filename) + 1);
+	strcpy(subsystem, filename);
+	if ((p = strchr(subsystem, '.')) != NULL)
+		*p = '\0';
+	subsystems[0] = subsystem;
+
+	for (retry = 0; retry < 2; retry++) {
+		if (cgroup_handle_dirs(h, subsystems, &dirfd) < 0 || dirfd < 0)
+			return -1;
+
+		fd = openat(dirfd, filename, flags | O_CLOEXEC);
+		if (fd >= 0 || errno != ENOENT || !cgroup_handle_stale(dirfd))
+			return fd;
+
+		cgroup_handle_reset(h);
+	}
+
+	return -1;
+}
+
+/* same semantics as lxc_cgroup_get() */
+int lxc_cgroup_handle_get(struct lxc_cgroup_handle *h, const char *filename,
+			  char *value, size_t len)
+{
+	char buf[100];
+	ssize_t ret;
+	size_t total = 0;
+	int fd, saved_errno;
+
+	if (!ops)
+		return -1;
+	if (!ops->open_dirs)
+		return lxc_cgroup_get(filename, value, len, h->name, h->lxcpath);
+
+	fd = cgroup_handle_open(h, filename, O_RDONLY);
+	if (fd < 0)
+		return -1;
+
+	if (!value || !len) {
+		while ((ret = read(fd, buf, sizeof(buf))) > 0)
+			total += ret;
+		if (ret >= 0)
+			ret = total;
+	} else {
+		memset(value, 0, len);
+		ret = read(fd, value, len);
+	}
+
+	saved_errno = errno;
+	close(fd);
+	errno = saved_errno;
+	return ret;
+}
+
+/* same semantics as lxc_cgroup_set() */
+int lxc_cgroup_handle_set(struct lxc_cgroup_handle *h, const char *filename,
+			  const char *value)
+{
+	ssize_t ret;
+	size_t len = strlen(value);
+	int fd, saved_errno;
+
+	if (!ops)
+		return -1;
+	if (!ops->open_dirs)
+		return lxc_cgroup_set(filename, value, h->name, h->lxcpath);
+
+	fd = cgroup_handle_open(h, filename, O_WRONLY);
+	if (fd < 0)
+		return -1;
+
+	ret = lxc_write_nointr(fd, value, len);
+
+	saved_errno = errno;
+	close(fd);
+	errno = saved_errno;
+	return ret == (ssize_t)len ? 0 : -1;
+}
+
+int lxc_cgroup_handle_get_stats(struct lxc_cgroup_handle *h,
+				struct lxc_cgroup_stats *stats)
+{
+	int fds[NR_STAT_SUBSYSTEMS];
+	const struct cgroup_stat_file *f;
+	int retry, stale;
+	size_t i;
+
+	memset(stats, 0, sizeof(*stats));
+	if (!ops)
+		return -1;
+
+	if (!ops->open_dirs) {
+		for (i = 0; i < NR_STAT_FILES; i++) {
+			f = &cgroup_stat_files[i];
+			if (stat_read_cmd(h->name, h->lxcpath, f, stats) == 0)
+				stats->valid |= f->valid;
+		}
+		return stats->valid ? 0 : -1;
+	}
+
+	for (retry = 0; retry < 2; retry++) {
+		if (cgroup_handle_dirs(h, cgroup_stat_subsystems, fds) < 0)
+			return -1;
+
+		stale = 0;
+		for (i = 0; i < NR_STAT_FILES; i++) {
+			f = &cgroup_stat_files[i];
+			if (fds[f->subsystem] < 0)
+				continue;
+			if (stat_read_at(fds[f->subsystem], f, stats) == 0) {
+				stats->valid |= f->valid;
+			} else if (errno == ENOENT &&
+				   cgroup_handle_stale(fds[f->subsystem])) {
+				stale = 1;
+				break;
+			}
+		}
+		if (!stale)
+			return 0;
+
+		cgroup_handle_reset(h);
+		memset(stats, 0, sizeof(*stats));
+	}
+
+	return -1;
+}
+
+int lxc_cgroup_get_stats(const char *name, const char *lxcpath,
+			 struct lxc_cgroup_stats *stats)
+{
+	struct lxc_cgroup_handle *h;
+	int ret;
+
+	h = lxc_cgroup_handle_new(name, lxcpath);
+	if (!h)
+		return -1;
+	ret = lxc_cgroup_handle_get_stats(h, stats);
+	lxc_cgroup_handle_free(h);
+	return ret;
+}
+
 void cgroup_disconnect(void)
 {
 	if (ops && ops->disconnect)
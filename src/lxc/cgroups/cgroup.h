@@ -31,6 +31,8 @@
 struct lxc_handler;
 struct lxc_conf;
 struct lxc_list;
+struct lxc_cgroup_stats;
+struct lxc_cgroup_handle;
 
 typedef enum {
 	CGFS,
@@ -52,6 +54,8 @@ struct cgroup_ops {
 	bool (*get_hierarchies)(int n, char ***out);
 	int (*set)(const char *filename, const char *value, const char *name, const char *lxcpath);
 	int (*get)(const char *filename, char *value, size_t len, const char *name, const char *lxcpath);
+	int (*get_data)(void *hdata, const char *filename, char *value, size_t len);
+	int (*open_dirs)(const char *name, const char *lxcpath, const char **subsystems, int *fds);
 	bool (*unfreeze)(void *hdata);
 	bool (*setup_limits)(void *hdata, struct lxc_list *cgroup_conf, bool with_devices);
 	bool (*chown)(void *hdata, struct lxc_conf *conf);
@@ -74,6 +78,8 @@ extern void cgroup_cleanup(struct lxc_handler *handler);
 extern bool cgroup_create_legacy(struct lxc_handler *handler);
 extern int cgroup_nrtasks(struct lxc_handler *handler);
 extern const char *cgroup_get_cgroup(struct lxc_handler *handler, const char *subsystem);
+extern int cgroup_get_data(struct lxc_handler *handler, const char *filename,
+			   char *value, size_t len);
 extern bool cgroup_escape();
 extern int cgroup_num_hierarchies();
 extern bool cgroup_get_hierarchies(int i, char ***out);
@@ -81,6 +87,24 @@ extern bool cgroup_unfreeze(struct lxc_handler *handler);
 extern void cgroup_disconnect(void);
 extern cgroup_driver_t cgroup_driver(void);
 
+/*
+ * Cached cgroup directories of a container for repeated reads and writes,
+ * from outside the container's monitor.
+ */
+extern struct lxc_cgroup_handle *lxc_cgroup_handle_new(const char *name,
+						       const char *lxcpath);
+extern void lxc_cgroup_handle_free(struct lxc_cgroup_handle *h);
+extern int lxc_cgroup_handle_get(struct lxc_cgroup_handle *h,
+				 const char *filename, char *value, size_t len);
+extern int lxc_cgroup_handle_set(struct lxc_cgroup_handle *h,
+				 const char *filename, const char *value);
+extern int lxc_cgroup_handle_get_stats(struct lxc_cgroup_handle *h,
+				       struct lxc_cgroup_stats *stats);
+
+/* Add the counters of one lxc_cgroup_get_stats() file read from @dirfd. */
+extern int cgroup_read_stat_file(int dirfd, const char *filename,
+				 struct lxc_cgroup_stats *stats);
+
 extern void prune_init_scope(char *cg);
 extern bool is_crucial_cgroup_subsystem(const char *s);
 
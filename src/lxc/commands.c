@@ -32,6 +32,7 @@
 #include <sys/un.h>
 #include <sys/param.h>
 #include <malloc.h>
+#include <stdbool.h>
 #include <stdlib.h>
 
 #include "log.h"
@@ -137,6 +138,8 @@ static const char *lxc_cmd_str(lxc_cmd_t cmd)
 		[LXC_CMD_GET_CONFIG_ITEM] = "get_config_item",
 		[LXC_CMD_GET_NAME]        = "get_name",
 		[LXC_CMD_GET_LXCPATH]     = "get_lxcpath",
+		[LXC_CMD_SESSION]         = "session",
+		[LXC_CMD_GET_STATUS_BUNDLE] = "get_status_bundle",
 	};
 
 	if (cmd >= LXC_CMD_MAX)
@@ -208,7 +211,7 @@ static int lxc_cmd_rsp_recv(int sock, struct lxc_cmd_rr *cmd)
 		      lxc_cmd_str(cmd->req.cmd));
 		return -1;
 	}
-	ret = recv(sock, rsp->data, rsp->datalen, 0);
+	ret = recv(sock, rsp->data, rsp->datalen, MSG_WAITALL);
 	if (ret != rsp->datalen) {
 		ERROR("command %s failed to receive response data",
 		      lxc_cmd_str(cmd->req.cmd));
@@ -268,14 +271,13 @@ static int lxc_cmd_rsp_send(int fd, struct lxc_cmd_rsp *rsp)
  * then free the slot with lxc_cmd_fd_cleanup(). The socket fd will be
  * returned in the cmd response structure.
  */
-static int lxc_cmd(const char *name, struct lxc_cmd_rr *cmd, int *stopped,
-		   const char *lxcpath, const char *hashed_sock_name)
+static int lxc_cmd_connect(const char *name, lxc_cmd_t cmd, int *stopped,
+			   const char *lxcpath, const char *hashed_sock_name)
 {
-	int sock, ret = -1;
+	int sock;
 	char path[sizeof(((struct sockaddr_un *)0)->sun_path)] = { 0 };
 	char *offset = &path[1];
 	int len;
-	int stay_connected = cmd->req.cmd == LXC_CMD_CONSOLE;
 
 	*stopped = 0;
 
@@ -294,16 +296,31 @@ static int lxc_cmd(const char *name, struct lxc_cmd_rr *cmd, int *stopped,
 			*stopped = 1;
 		else
 			SYSERROR("command %s failed to connect to '@%s'",
-				 lxc_cmd_str(cmd->req.cmd), offset);
+				 lxc_cmd_str(cmd), offset);
 		return -1;
 	}
 
+	return sock;
+}
+
+static int lxc_cmd(const char *name, struct lxc_cmd_rr *cmd, int *stopped,
+		   const char *lxcpath, const char *hashed_sock_name)
+{
+	int sock, ret = -1;
+	int stay_connected = cmd->req.cmd == LXC_CMD_CONSOLE;
+
+	sock = lxc_cmd_connect(name, cmd->req.cmd, stopped, lxcpath,
+			       hashed_sock_name);
+	if (sock < 0)
+		return -1;
+
 	ret = lxc_abstract_unix_send_credential(sock, &cmd->req, sizeof(cmd->req));
 	if (ret != sizeof(cmd->req)) {
 		if (errno == EPIPE)
 			goto epipe;
-		SYSERROR("command %s failed to send req to '@%s' %d",
-			 lxc_cmd_str(cmd->req.cmd), offset, ret);
+		SYSERROR("command %s failed to send req to '%s' %d",
+			 lxc_cmd_str(cmd->req.cmd),
+			 name ? name : hashed_sock_name, ret);
 		if (ret >=0)
 			ret = -1;
 		goto out;
@@ -314,8 +331,9 @@ static int lxc_cmd(const char *name, struct lxc_cmd_rr *cmd, int *stopped,
 		if (ret != cmd->req.datalen) {
 			if (errno == EPIPE)
 				goto epipe;
-			SYSERROR("command %s failed to send request data to '@%s' %d",
-				 lxc_cmd_str(cmd->req.cmd), offset, ret);
+			SYSERROR("command %s failed to send request data to '%s' %d",
+				 lxc_cmd_str(cmd->req.cmd),
+				 name ? name : hashed_sock_name, ret);
 			if (ret >=0)
 				ret = -1;
 			goto out;
@@ -835,6 +853,456 @@ static int lxc_cmd_get_lxcpath_callback(int fd, struct lxc_cmd_req *req,
 	return lxc_cmd_rsp_send(fd, &rsp);
 }
 
+/*
+ * lxc_cmd_get_status_bundle: Get state, init pid, cgroup paths and config
+ * items of a running container in a single request
+ *
+ * @name      : name of container to connect to
+ * @lxcpath   : the lxcpath in which the container is running
+ * @keys      : NULL terminated list of config keys and "cgroup.<subsystem>"
+ *              names to include, may be NULL
+ * @bundle    : out: the reply, release with lxc_cmd_status_bundle_free()
+ *
+ * Returns 0 on success, < 0 on failure. A container which is not running is
+ * reported as STOPPED. errno is set to ENOSYS when the monitor predates this
+ * command, callers should then fall back to the individual commands.
+ */
+int lxc_cmd_get_status_bundle(const char *name, const char *lxcpath,
+			      const char **keys,
+			      struct lxc_cmd_status_bundle *bundle)
+{
+	int i, ret, stopped, len = 0;
+	char *reqdata = NULL;
+	const char *val;
+	struct lxc_cmd_rr cmd = {
+		.req = { .cmd = LXC_CMD_GET_STATUS_BUNDLE },
+	};
+
+	memset(bundle, 0, sizeof(*bundle));
+	bundle->state = -1;
+	bundle->init_pid = -1;
+
+	for (i = 0; keys && keys[i]; i++)
+		len += strlen(keys[i]) + 1;
+	if (len > LXC_CMD_DATA_MAX) {
+		errno = EINVAL;
+		return -1;
+	}
+	if (len > 0) {
+		reqdata = alloca(len);
+		for (i = 0, len = 0; keys[i]; i++) {
+			strcpy(reqdata + len, keys[i]);
+			len += strlen(keys[i]) + 1;
+		}
+		cmd.req.data = reqdata;
+		cmd.req.datalen = len;
+	}
+
+	ret = lxc_cmd(name, &cmd, &stopped, lxcpath, NULL);
+	if (stopped) {
+		bundle->state = STOPPED;
+		return 0;
+	}
+	if (ret < 0)
+		return -1;
+
+	/* older monitors close the connection on unknown commands */
+	if (ret == 0) {
+		errno = ENOSYS;
+		return -1;
+	}
+
+	if (cmd.rsp.ret < 0 || cmd.rsp.datalen <= 0 ||
+	    ((char *)cmd.rsp.data)[cmd.rsp.datalen - 1] != '\0') {
+		ERROR("command %s failed for '%s'", lxc_cmd_str(cmd.req.cmd),
+		      name);
+		free(cmd.rsp.data);
+		errno = EPROTO;
+		return -1;
+	}
+
+	bundle->data = cmd.rsp.data;
+	bundle->datalen = cmd.rsp.datalen;
+
+	val = lxc_cmd_status_bundle_get(bundle, "state");
+	if (val)
+		bundle->state = lxc_str2state(val);
+	val = lxc_cmd_status_bundle_get(bundle, "init_pid");
+	if (val)
+		bundle->init_pid = atoi(val);
+	val = lxc_cmd_status_bundle_get(bundle, "freezer.state");
+	if (val && bundle->state == RUNNING) {
+		lxc_state_t freezer = lxc_str2state(val);
+		if (freezer == FROZEN || freezer == FREEZING)
+			bundle->state = freezer;
+	}
+
+	return 0;
+}
+
+const char *lxc_cmd_status_bundle_get(struct lxc_cmd_status_bundle *bundle,
+				      const char *key)
+{
+	char *p = bundle->data, *end = bundle->data + bundle->datalen;
+
+	while (p && p < end) {
+		char *val = p + strlen(p) + 1;
+		if (val >= end)
+			break;
+		if (strcmp(p, key) == 0)
+			return val;
+		p = val + strlen(val) + 1;
+	}
+
+	return NULL;
+}
+
+void lxc_cmd_status_bundle_free(struct lxc_cmd_status_bundle *bundle)
+{
+	free(bundle->data);
+	bundle->data = NULL;
+	bundle->datalen = 0;
+}
+
+static bool lxc_cmd_bundle_append(char *buf, int *len, const char *key,
+				  const char *val)
+{
+	size_t keylen, vallen;
+
+	if (!val)
+		return false;
+
+	keylen = strlen(key) + 1;
+	vallen = strlen(val) + 1;
+	if (*len + keylen + vallen > LXC_CMD_DATA_MAX) {
+		WARN("no room left for '%s' in status bundle", key);
+		return false;
+	}
+
+	memcpy(buf + *len, key, keylen);
+	memcpy(buf + *len + keylen, val, vallen);
+	*len += keylen + vallen;
+	return true;
+}
+
+static int lxc_cmd_get_status_bundle_callback(int fd, struct lxc_cmd_req *req,
+					      struct lxc_handler *handler)
+{
+	int len = 0, ret;
+	char buf[LXC_CMD_DATA_MAX], v[100];
+	const char *key, *end;
+	struct lxc_cmd_rsp rsp;
+
+	memset(&rsp, 0, sizeof(rsp));
+	if (req->datalen > 0 && ((const char *)req->data)[req->datalen - 1]) {
+		rsp.ret = -EINVAL;
+		return lxc_cmd_rsp_send(fd, &rsp);
+	}
+
+	lxc_cmd_bundle_append(buf, &len, "state", lxc_state2str(handler->state));
+	snprintf(v, sizeof(v), "%d", handler->pid);
+	lxc_cmd_bundle_append(buf, &len, "init_pid", v);
+
+	/* saves the client a get_cgroup round trip to check the freezer */
+	ret = cgroup_get_data(handler, "freezer.state", v, sizeof(v) - 1);
+	if (ret > 0) {
+		/* v still holds the init pid past what was read */
+		v[ret] = '\0';
+		v[strcspn(v, "\n")] = '\0';
+		lxc_cmd_bundle_append(buf, &len, "freezer.state", v);
+	}
+
+	end = (const char *)req->data + req->datalen;
+	for (key = req->data; req->datalen > 0 && key < end;
+	     key += strlen(key) + 1) {
+		if (strncmp(key, "cgroup.", 7) == 0) {
+			const char *path = cgroup_get_cgroup(handler, key + 7);
+			if (path)
+				lxc_cmd_bundle_append(buf, &len, key, path);
+		} else {
+			int cilen;
+			char *cidata;
+
+			cilen = lxc_get_config_item(handler->conf, key, NULL, 0);
+			if (cilen <= 0 || cilen >= LXC_CMD_DATA_MAX)
+				continue;
+
+			cidata = malloc(cilen + 1);
+			if (!cidata)
+				continue;
+			if (lxc_get_config_item(handler->conf, key, cidata, cilen + 1) == cilen) {
+				cidata[cilen] = '\0';
+				lxc_cmd_bundle_append(buf, &len, key, cidata);
+			}
+			free(cidata);
+		}
+	}
+
+	rsp.data = buf;
+	rsp.datalen = len;
+	return lxc_cmd_rsp_send(fd, &rsp);
+}
+
+/*
+ * lxc_cmd_session_open: Open a persistent connection to a running container
+ * and switch it to the tagged session protocol
+ *
+ * @name      : name of container to connect to
+ * @lxcpath   : the lxcpath in which the container is running
+ *
+ * Returns the session on success, NULL on failure. errno is set to
+ * ECONNREFUSED when the container is not running and to ENOSYS when its
+ * monitor predates the session protocol, in which case the caller should fall
+ * back to the one-shot commands.
+ */
+struct lxc_cmd_session *lxc_cmd_session_open(const char *name,
+					     const char *lxcpath)
+{
+	int ret, sock, stopped;
+	struct lxc_cmd_session *session;
+	struct lxc_cmd_rr cmd = {
+		.req = {
+			.cmd = LXC_CMD_SESSION,
+			.data = INT_TO_PTR(LXC_CMD_SESSION_VERSION),
+		},
+	};
+
+	sock = lxc_cmd_connect(name, cmd.req.cmd, &stopped, lxcpath, NULL);
+	if (sock < 0) {
+		if (stopped)
+			errno = ECONNREFUSED;
+		return NULL;
+	}
+
+	ret = lxc_abstract_unix_send_credential(sock, &cmd.req, sizeof(cmd.req));
+	if (ret != sizeof(cmd.req)) {
+		SYSERROR("command %s failed to send req to '%s' %d",
+			 lxc_cmd_str(cmd.req.cmd), name, ret);
+		goto out_close;
+	}
+
+	ret = lxc_cmd_rsp_recv(sock, &cmd);
+	if (ret < 0)
+		goto out_close;
+
+	/* older monitors close the connection on unknown commands */
+	if (ret == 0) {
+		INFO("'%s' does not support command sessions", name);
+		close(sock);
+		errno = ENOSYS;
+		return NULL;
+	}
+
+	if (cmd.rsp.ret < 0) {
+		ERROR("command %s failed for '%s': %s",
+		      lxc_cmd_str(cmd.req.cmd), name, strerror(-cmd.rsp.ret));
+		close(sock);
+		errno = -cmd.rsp.ret;
+		return NULL;
+	}
+
+	session = malloc(sizeof(*session));
+	if (!session)
+		goto out_close;
+
+	session->sock = sock;
+	session->version = PTR_TO_INT(cmd.rsp.data);
+	session->next_tag = 0;
+	session->inflight = 0;
+	DEBUG("opened command session version %d to '%s'", session->version,
+	      name);
+	return session;
+
+out_close:
+	close(sock);
+	return NULL;
+}
+
+void lxc_cmd_session_close(struct lxc_cmd_session *session)
+{
+	if (!session)
+		return;
+
+	close(session->sock);
+	free(session);
+}
+
+/*
+ * lxc_cmd_session_send: Queue a request on a session without waiting for
+ * the response
+ *
+ * @session   : session returned by lxc_cmd_session_open()
+ * @cmd       : command with initialized request to send, its tag is set here
+ *
+ * Returns 0 on success, < 0 on failure. At most LXC_CMD_SESSION_MAX_INFLIGHT
+ * requests may be outstanding; beyond that errno is set to EAGAIN and the
+ * caller has to collect responses first.
+ */
+int lxc_cmd_session_send(struct lxc_cmd_session *session,
+			 struct lxc_cmd_rr *cmd)
+{
+	int ret;
+	struct lxc_cmd_session_req sreq;
+
+	if (session->inflight >= LXC_CMD_SESSION_MAX_INFLIGHT) {
+		errno = EAGAIN;
+		return -1;
+	}
+
+	sreq.tag = session->next_tag++;
+	sreq.req = cmd->req;
+	cmd->tag = sreq.tag;
+
+	ret = lxc_abstract_unix_send_credential(session->sock, &sreq,
+						sizeof(sreq));
+	if (ret != sizeof(sreq)) {
+		SYSERROR("command %s failed to send session req %d",
+			 lxc_cmd_str(cmd->req.cmd), ret);
+		return -1;
+	}
+
+	if (cmd->req.datalen > 0) {
+		ret = send(session->sock, cmd->req.data, cmd->req.datalen,
+			   MSG_NOSIGNAL);
+		if (ret != cmd->req.datalen) {
+			SYSERROR("command %s failed to send session request data %d",
+				 lxc_cmd_str(cmd->req.cmd), ret);
+			return -1;
+		}
+	}
+
+	session->inflight++;
+	return 0;
+}
+
+/*
+ * lxc_cmd_session_recv: Collect the response to the oldest outstanding
+ * request on a session
+ *
+ * @session   : session returned by lxc_cmd_session_open()
+ * @cmd       : the command passed to lxc_cmd_session_send()
+ *
+ * Returns the size of the response message on success, 0 if the container
+ * closed the session and < 0 on failure. Responses arrive in the order the
+ * requests were sent, so after a failure the session is out of sync and must
+ * be closed.
+ */
+int lxc_cmd_session_recv(struct lxc_cmd_session *session,
+			 struct lxc_cmd_rr *cmd)
+{
+	int ret;
+	uint32_t tag;
+
+	ret = recv(session->sock, &tag, sizeof(tag), MSG_WAITALL);
+	if (ret == 0)
+		return 0;
+	if (ret != sizeof(tag)) {
+		WARN("command %s failed to receive session response",
+		     lxc_cmd_str(cmd->req.cmd));
+		return -1;
+	}
+	session->inflight--;
+
+	if (tag != cmd->tag) {
+		ERROR("command %s got response for tag %u, expected %u",
+		      lxc_cmd_str(cmd->req.cmd), tag, cmd->tag);
+		errno = EPROTO;
+		return -1;
+	}
+
+	return lxc_cmd_rsp_recv(session->sock, cmd);
+}
+
+int lxc_cmd_session_call(struct lxc_cmd_session *session,
+			 struct lxc_cmd_rr *cmd)
+{
+	if (lxc_cmd_session_send(session, cmd) < 0)
+		return -1;
+
+	return lxc_cmd_session_recv(session, cmd);
+}
+
+/*
+ * lxc_cmd_get_config_items: Get several config items of the running container
+ *
+ * @name      : name of container to connect to
+ * @lxcpath   : the lxcpath in which the container is running
+ * @session   : session to pipeline the requests on, NULL to send them one
+ *              connection at a time
+ * @items     : NULL terminated list of items to retrieve
+ * @values    : set to the item or NULL where it cannot be read, the caller
+ *              must free() them
+ *
+ * Returns 0 on success, < 0 if the session failed, in which case it must be
+ * closed and no value is set.
+ */
+int lxc_cmd_get_config_items(const char *name, const char *lxcpath,
+			     struct lxc_cmd_session *session,
+			     const char **items, char **values)
+{
+	int i, nr, sent, ret;
+	struct lxc_cmd_rr *cmds;
+
+	for (nr = 0; items[nr]; nr++)
+		values[nr] = NULL;
+
+	if (!session) {
+		for (i = 0; i < nr; i++)
+			values[i] = lxc_cmd_get_config_item(name, items[i], lxcpath);
+		return 0;
+	}
+
+	cmds = alloca(nr * sizeof(*cmds));
+	memset(cmds, 0, nr * sizeof(*cmds));
+	for (sent = i = 0; i < nr; i++) {
+		/* keep the pipe full, responses come back in order */
+		while (sent < nr && session->inflight < LXC_CMD_SESSION_MAX_INFLIGHT) {
+			cmds[sent].req.cmd = LXC_CMD_GET_CONFIG_ITEM;
+			cmds[sent].req.data = items[sent];
+			cmds[sent].req.datalen = strlen(items[sent]) + 1;
+			if (lxc_cmd_session_send(session, &cmds[sent]) < 0)
+				goto err;
+			sent++;
+		}
+
+		ret = lxc_cmd_session_recv(session, &cmds[i]);
+		if (ret <= 0)
+			goto err;
+		if (cmds[i].rsp.ret == 0)
+			values[i] = cmds[i].rsp.data;
+		else if (cmds[i].rsp.datalen > 0)
+			free(cmds[i].rsp.data);
+	}
+
+	return 0;
+
+err:
+	for (i = 0; i < nr; i++) {
+		free(values[i]);
+		values[i] = NULL;
+	}
+	return -1;
+}
+
+static int lxc_cmd_session_callback(int fd, struct lxc_cmd_req *req,
+				    struct lxc_handler *handler)
+{
+	int ret, version = PTR_TO_INT(req->data);
+	struct lxc_cmd_rsp rsp;
+
+	memset(&rsp, 0, sizeof(rsp));
+	if (version < 1)
+		rsp.ret = -EINVAL;
+	else
+		rsp.data = INT_TO_PTR(MIN(version, LXC_CMD_SESSION_VERSION));
+
+	ret = lxc_cmd_rsp_send(fd, &rsp);
+	if (ret < 0 || rsp.ret < 0)
+		return 1;
+
+	return 0;
+}
+
 static int lxc_cmd_process(int fd, struct lxc_cmd_req *req,
 			   struct lxc_handler *handler)
 {
@@ -851,6 +1319,8 @@ static int lxc_cmd_process(int fd, struct lxc_cmd_req *req,
 		[LXC_CMD_GET_CONFIG_ITEM] = lxc_cmd_get_config_item_callback,
 		[LXC_CMD_GET_NAME]        = lxc_cmd_get_name_callback,
 		[LXC_CMD_GET_LXCPATH]     = lxc_cmd_get_lxcpath_callback,
+		[LXC_CMD_SESSION]         = lxc_cmd_session_callback,
+		[LXC_CMD_GET_STATUS_BUNDLE] = lxc_cmd_get_status_bundle_callback,
 	};
 
 	if (req->cmd >= LXC_CMD_MAX) {
@@ -868,18 +1338,55 @@ static void lxc_cmd_fd_cleanup(int fd, struct lxc_handler *handler,
 	close(fd);
 }
 
-static int lxc_cmd_handler(int fd, uint32_t events, void *data,
-			   struct lxc_epoll_descr *descr)
+static int lxc_cmd_session_handler(int fd, uint32_t events, void *data,
+				   struct lxc_epoll_descr *descr);
+
+static int lxc_cmd_tag_send(int fd, uint32_t tag)
 {
 	int ret;
-	struct lxc_cmd_req req;
-	struct lxc_handler *handler = data;
 
-	ret = lxc_abstract_unix_rcv_credential(fd, &req, sizeof(req));
+	ret = send(fd, &tag, sizeof(tag), MSG_NOSIGNAL);
+	if (ret != sizeof(tag)) {
+		ERROR("failed to send command response tag %d %s", ret,
+		      strerror(errno));
+		return -1;
+	}
+
+	return 0;
+}
+
+/*
+ * lxc_cmd_serve: Handle one request on a client connection
+ *
+ * @session : whether the connection speaks the tagged session protocol
+ *
+ * Pipelined requests are left in the socket, the mainloop calls us again for
+ * each of them, so they are served in order without re-accepting.
+ */
+static int lxc_cmd_serve(int fd, struct lxc_handler *handler,
+			 struct lxc_epoll_descr *descr, bool session)
+{
+	int ret;
+	size_t hdrlen;
+	void *hdr;
+	struct lxc_cmd_session_req sreq;
+	struct lxc_cmd_req *req = &sreq.req;
+
+	if (session) {
+		hdr = &sreq;
+		hdrlen = sizeof(sreq);
+	} else {
+		hdr = req;
+		hdrlen = sizeof(*req);
+	}
+
+	ret = lxc_abstract_unix_rcv_credential(fd, hdr, hdrlen);
 	if (ret == -EACCES) {
 		/* we don't care for the peer, just send and close */
 		struct lxc_cmd_rsp rsp = { .ret = ret };
 
+		if (session && lxc_cmd_tag_send(fd, sreq.tag) < 0)
+			goto out_close;
 		lxc_cmd_rsp_send(fd, &rsp);
 		goto out_close;
 	}
@@ -894,38 +1401,68 @@ static int lxc_cmd_handler(int fd, uint32_t events, void *data,
 		goto out_close;
 	}
 
-	if (ret != sizeof(req)) {
+	if (ret != hdrlen) {
 		WARN("partial request, ignored");
 		ret = -1;
 		goto out_close;
 	}
 
-	if (req.datalen > LXC_CMD_DATA_MAX) {
-		ERROR("cmd data length %d too large", req.datalen);
+	if (req->datalen > LXC_CMD_DATA_MAX) {
+		ERROR("cmd data length %d too large", req->datalen);
 		ret = -1;
 		goto out_close;
 	}
 
-	if (req.datalen > 0) {
+	if (req->datalen > 0) {
 		void *reqdata;
 
-		reqdata = alloca(req.datalen);
-		ret = recv(fd, reqdata, req.datalen, 0);
-		if (ret != req.datalen) {
+		reqdata = alloca(req->datalen);
+		ret = recv(fd, reqdata, req->datalen, MSG_WAITALL);
+		if (ret != req->datalen) {
 			WARN("partial request, ignored");
 			ret = -1;
 			goto out_close;
 		}
-		req.data = reqdata;
+		req->data = reqdata;
 	}
 
-	ret = lxc_cmd_process(fd, &req, handler);
+	if (session) {
+		ret = lxc_cmd_tag_send(fd, sreq.tag);
+		if (ret < 0)
+			goto out_close;
+
+		/* these depend on owning the connection, see lxc_cmd() */
+		if (req->cmd == LXC_CMD_CONSOLE || req->cmd == LXC_CMD_STOP ||
+		    req->cmd == LXC_CMD_SESSION) {
+			struct lxc_cmd_rsp rsp = { .ret = -EINVAL };
+
+			ERROR("command %s is not allowed in a session",
+			      lxc_cmd_str(req->cmd));
+			ret = lxc_cmd_rsp_send(fd, &rsp);
+			if (ret < 0)
+				goto out_close;
+			goto out;
+		}
+	}
+
+	ret = lxc_cmd_process(fd, req, handler);
 	if (ret) {
 		/* this is not an error, but only a request to close fd */
 		ret = 0;
 		goto out_close;
 	}
 
+	if (!session && req->cmd == LXC_CMD_SESSION) {
+		/* all further requests on this connection carry a tag */
+		lxc_mainloop_del_handler(descr, fd);
+		ret = lxc_mainloop_add_handler(descr, fd, lxc_cmd_session_handler,
+					       handler);
+		if (ret) {
+			ERROR("failed to add session handler");
+			goto out_close;
+		}
+	}
+
 out:
 	return ret;
 out_close:
@@ -933,6 +1470,18 @@ out_close:
 	goto out;
 }
 
+static int lxc_cmd_handler(int fd, uint32_t events, void *data,
+			   struct lxc_epoll_descr *descr)
+{
+	return lxc_cmd_serve(fd, data, descr, false);
+}
+
+static int lxc_cmd_session_handler(int fd, uint32_t events, void *data,
+				   struct lxc_epoll_descr *descr)
+{
+	return lxc_cmd_serve(fd, data, descr, true);
+}
+
 static int lxc_cmd_accept(int fd, uint32_t events, void *data,
 			  struct lxc_epoll_descr *descr)
 {
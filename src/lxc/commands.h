@@ -24,10 +24,17 @@
 #ifndef __LXC_COMMANDS_H
 #define __LXC_COMMANDS_H
 
+#include <stdint.h>
+
 #include "state.h"
 
 #define LXC_CMD_DATA_MAX (MAXPATHLEN*2)
 
+/* Version of the tagged session protocol negotiated by LXC_CMD_SESSION. */
+#define LXC_CMD_SESSION_VERSION 1
+/* Bound on pipelined requests so neither side blocks on a full socket. */
+#define LXC_CMD_SESSION_MAX_INFLIGHT 16
+
 /* https://developer.gnome.org/glib/2.28/glib-Type-Conversion-Macros.html */
 #define INT_TO_PTR(n) ((void *) (long) (n))
 #define PTR_TO_INT(p) ((int) (long) (p))
@@ -43,6 +50,8 @@ typedef enum {
 	LXC_CMD_GET_CONFIG_ITEM,
 	LXC_CMD_GET_NAME,
 	LXC_CMD_GET_LXCPATH,
+	LXC_CMD_SESSION,
+	LXC_CMD_GET_STATUS_BUNDLE,
 	LXC_CMD_MAX,
 } lxc_cmd_t;
 
@@ -61,6 +70,23 @@ struct lxc_cmd_rsp {
 struct lxc_cmd_rr {
 	struct lxc_cmd_req req;
 	struct lxc_cmd_rsp rsp;
+	uint32_t tag; /* only used on session connections */
+};
+
+/* Request header sent on a connection switched to the session protocol. The
+ * server echoes @tag in front of each response and answers strictly in the
+ * order the requests were received.
+ */
+struct lxc_cmd_session_req {
+	uint32_t tag;
+	struct lxc_cmd_req req;
+};
+
+struct lxc_cmd_session {
+	int sock;
+	int version;
+	uint32_t next_tag;
+	int inflight;
 };
 
 struct lxc_cmd_console_rsp_data {
@@ -68,6 +94,21 @@ struct lxc_cmd_console_rsp_data {
 	int ttynum;
 };
 
+/*
+ * Reply to LXC_CMD_GET_STATUS_BUNDLE. @data holds "key\0value\0" records:
+ * "state" and "init_pid" are always present, "freezer.state" when the monitor
+ * could read it, followed by one record per requested key that could be
+ * answered. Requested keys are either config keys ("lxc.group") or
+ * "cgroup.<subsystem>" for the container's cgroup path in that subsystem.
+ * @state already accounts for a frozen freezer cgroup.
+ */
+struct lxc_cmd_status_bundle {
+	lxc_state_t state;
+	pid_t init_pid;
+	int datalen;
+	char *data;
+};
+
 extern int lxc_cmd_console_winch(const char *name, const char *lxcpath);
 extern int lxc_cmd_console(const char *name, int *ttynum, int *fd,
 			   const char *lxcpath);
@@ -84,6 +125,32 @@ extern char *lxc_cmd_get_lxcpath(const char *hashed_sock);
 extern pid_t lxc_cmd_get_init_pid(const char *name, const char *lxcpath);
 extern lxc_state_t lxc_cmd_get_state(const char *name, const char *lxcpath);
 extern int lxc_cmd_stop(const char *name, const char *lxcpath);
+extern int lxc_cmd_get_status_bundle(const char *name, const char *lxcpath,
+				     const char **keys,
+				     struct lxc_cmd_status_bundle *bundle);
+extern const char *lxc_cmd_status_bundle_get(struct lxc_cmd_status_bundle *bundle,
+					     const char *key);
+extern void lxc_cmd_status_bundle_free(struct lxc_cmd_status_bundle *bundle);
+
+/*
+ * Persistent connections: a session stays connected to the container's
+ * command socket and carries any number of tagged requests, which may be
+ * pipelined by calling lxc_cmd_session_send() several times before collecting
+ * the responses in the same order with lxc_cmd_session_recv().
+ * LXC_CMD_CONSOLE and LXC_CMD_STOP are not available on a session.
+ */
+extern struct lxc_cmd_session *lxc_cmd_session_open(const char *name,
+						    const char *lxcpath);
+extern void lxc_cmd_session_close(struct lxc_cmd_session *session);
+extern int lxc_cmd_session_send(struct lxc_cmd_session *session,
+				struct lxc_cmd_rr *cmd);
+extern int lxc_cmd_session_recv(struct lxc_cmd_session *session,
+				struct lxc_cmd_rr *cmd);
+extern int lxc_cmd_session_call(struct lxc_cmd_session *session,
+				struct lxc_cmd_rr *cmd);
+extern int lxc_cmd_get_config_items(const char *name, const char *lxcpath,
+				    struct lxc_cmd_session *session,
+				    const char **items, char **values);
 
 struct lxc_epoll_descr;
 struct lxc_handler;
@@ -29,6 +29,7 @@
 #include <fcntl.h>
 #include <ctype.h>
 #include <signal.h>
+#include <sys/mman.h>
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <sys/param.h>
@@ -116,79 +117,121 @@ static int config_init_gid(const char *, const char *, struct lxc_conf *);
 static int config_ephemeral(const char *, const char *, struct lxc_conf *);
 static int config_no_new_privs(const char *, const char *, struct lxc_conf *);
 
+static int get_config_arch(const char *, char *, int, struct lxc_conf *);
+static int get_config_pts(const char *, char *, int, struct lxc_conf *);
+static int get_config_tty(const char *, char *, int, struct lxc_conf *);
+static int get_config_ttydir(const char *, char *, int, struct lxc_conf *);
+static int get_config_lsm_aa_profile(const char *, char *, int, struct lxc_conf *);
+static int get_config_lsm_aa_incomplete(const char *, char *, int, struct lxc_conf *);
+static int get_config_lsm_se_context(const char *, char *, int, struct lxc_conf *);
+static int get_config_cgroup(const char *, char *, int, struct lxc_conf *);
+static int get_config_loglevel(const char *, char *, int, struct lxc_conf *);
+static int get_config_logfile(const char *, char *, int, struct lxc_conf *);
+static int get_config_mount(const char *, char *, int, struct lxc_conf *);
+static int get_config_mount_auto(const char *, char *, int, struct lxc_conf *);
+static int get_config_fstab(const char *, char *, int, struct lxc_conf *);
+static int get_config_rootfs_mount(const char *, char *, int, struct lxc_conf *);
+static int get_config_rootfs_options(const char *, char *, int, struct lxc_conf *);
+static int get_config_rootfs_backend(const char *, char *, int, struct lxc_conf *);
+static int get_config_rootfs(const char *, char *, int, struct lxc_conf *);
+static int get_config_utsname(const char *, char *, int, struct lxc_conf *);
+static int get_config_network(const char *, char *, int, struct lxc_conf *);
+static int get_config_cap_drop(const char *, char *, int, struct lxc_conf *);
+static int get_config_cap_keep(const char *, char *, int, struct lxc_conf *);
+static int get_config_console_logfile(const char *, char *, int, struct lxc_conf *);
+static int get_config_console(const char *, char *, int, struct lxc_conf *);
+static int get_config_seccomp(const char *, char *, int, struct lxc_conf *);
+static int get_config_start_auto(const char *, char *, int, struct lxc_conf *);
+static int get_config_start_delay(const char *, char *, int, struct lxc_conf *);
+static int get_config_start_order(const char *, char *, int, struct lxc_conf *);
+static int get_config_monitor(const char *, char *, int, struct lxc_conf *);
+static int get_config_group(const char *, char *, int, struct lxc_conf *);
+static int get_config_environment(const char *, char *, int, struct lxc_conf *);
+static int get_config_init_cmd(const char *, char *, int, struct lxc_conf *);
+static int get_config_init_uid(const char *, char *, int, struct lxc_conf *);
+static int get_config_init_gid(const char *, char *, int, struct lxc_conf *);
+static int get_config_ephemeral(const char *, char *, int, struct lxc_conf *);
+static int get_config_syslog(const char *, char *, int, struct lxc_conf *);
+static int get_config_no_new_privs(const char *, char *, int, struct lxc_conf *);
+static int clr_config_network(const char *, struct lxc_conf *);
+static int clr_config_cap_drop(const char *, struct lxc_conf *);
+static int clr_config_cap_keep(const char *, struct lxc_conf *);
+static int clr_config_mount(const char *, struct lxc_conf *);
+static int clr_config_mount_auto(const char *, struct lxc_conf *);
+
 static struct lxc_config_t config[] = {
 
-	{ "lxc.arch",                 config_personality          },
-	{ "lxc.pts",                  config_pts                  },
-	{ "lxc.tty",                  config_tty                  },
-	{ "lxc.devttydir",            config_ttydir               },
-	{ "lxc.kmsg",                 config_kmsg                 },
-	{ "lxc.aa_profile",           config_lsm_aa_profile       },
-	{ "lxc.aa_allow_incomplete",  config_lsm_aa_incomplete    },
-	{ "lxc.se_context",           config_lsm_se_context       },
-	{ "lxc.cgroup",               config_cgroup               },
-	{ "lxc.id_map",               config_idmap                },
-	{ "lxc.loglevel",             config_loglevel             },
-	{ "lxc.logfile",              config_logfile              },
-	{ "lxc.mount.entry",          config_mount                },
-	{ "lxc.mount.auto",           config_mount_auto           },
-	{ "lxc.mount",                config_fstab                },
-	{ "lxc.rootfs.mount",         config_rootfs_mount         },
-	{ "lxc.rootfs.options",       config_rootfs_options       },
-	{ "lxc.rootfs.backend",       config_rootfs_backend       },
-	{ "lxc.rootfs",               config_rootfs               },
-	{ "lxc.pivotdir",             config_pivotdir             },
-	{ "lxc.utsname",              config_utsname              },
-	{ "lxc.hook.pre-start",       config_hook                 },
-	{ "lxc.hook.pre-mount",       config_hook                 },
-	{ "lxc.hook.mount",           config_hook                 },
-	{ "lxc.hook.autodev",         config_hook                 },
-	{ "lxc.hook.start",           config_hook                 },
-	{ "lxc.hook.stop",            config_hook                 },
-	{ "lxc.hook.post-stop",       config_hook                 },
-	{ "lxc.hook.clone",           config_hook                 },
-	{ "lxc.hook.destroy",         config_hook                 },
-	{ "lxc.hook",                 config_hook                 },
-	{ "lxc.network.type",         config_network_type         },
-	{ "lxc.network.flags",        config_network_flags        },
-	{ "lxc.network.link",         config_network_link         },
-	{ "lxc.network.name",         config_network_name         },
-	{ "lxc.network.macvlan.mode", config_network_macvlan_mode },
-	{ "lxc.network.veth.pair",    config_network_veth_pair    },
-	{ "lxc.network.script.up",    config_network_script_up    },
-	{ "lxc.network.script.down",  config_network_script_down  },
-	{ "lxc.network.hwaddr",       config_network_hwaddr       },
-	{ "lxc.network.mtu",          config_network_mtu          },
-	{ "lxc.network.vlan.id",      config_network_vlan_id      },
-	{ "lxc.network.ipv4.gateway", config_network_ipv4_gateway },
-	{ "lxc.network.ipv4",         config_network_ipv4         },
-	{ "lxc.network.ipv6.gateway", config_network_ipv6_gateway },
-	{ "lxc.network.ipv6",         config_network_ipv6         },
+	{ "lxc.arch",                  config_personality,          get_config_arch,               NULL                   },
+	{ "lxc.pts",                   config_pts,                  get_config_pts,                NULL                   },
+	{ "lxc.tty",                   config_tty,                  get_config_tty,                NULL                   },
+	{ "lxc.devttydir",             config_ttydir,               get_config_ttydir,             NULL                   },
+	{ "lxc.kmsg",                  config_kmsg,                 NULL,                          NULL                   },
+	{ "lxc.aa_profile",            config_lsm_aa_profile,       get_config_lsm_aa_profile,     NULL                   },
+	{ "lxc.aa_allow_incomplete",   config_lsm_aa_incomplete,    get_config_lsm_aa_incomplete,  NULL                   },
+	{ "lxc.se_context",            config_lsm_se_context,       get_config_lsm_se_context,     NULL                   },
+	{ "lxc.cgroup",                config_cgroup,               get_config_cgroup,             NULL                   },
+	{ "lxc.id_map",                config_idmap,                NULL,                          NULL                   },
+	{ "lxc.loglevel",              config_loglevel,             get_config_loglevel,           NULL                   },
+	{ "lxc.logfile",               config_logfile,              get_config_logfile,            NULL                   },
+	{ "lxc.mount.entry",           config_mount,                get_config_mount,              clr_config_mount       },
+	{ "lxc.mount.auto",            config_mount_auto,           get_config_mount_auto,         clr_config_mount_auto  },
+	{ "lxc.mount",                 config_fstab,                get_config_fstab,              NULL                   },
+	{ "lxc.rootfs.mount",          config_rootfs_mount,         get_config_rootfs_mount,       NULL                   },
+	{ "lxc.rootfs.options",        config_rootfs_options,       get_config_rootfs_options,     NULL                   },
+	{ "lxc.rootfs.backend",        config_rootfs_backend,       get_config_rootfs_backend,     NULL                   },
+	{ "lxc.rootfs",                config_rootfs,               get_config_rootfs,             NULL                   },
+	{ "lxc.pivotdir",              config_pivotdir,             NULL,                          NULL                   },
+	{ "lxc.utsname",               config_utsname,              get_config_utsname,            NULL                   },
+	{ "lxc.hook.pre-start",        config_hook,                 NULL,                          NULL                   },
+	{ "lxc.hook.pre-mount",        config_hook,                 NULL,                          NULL                   },
+	{ "lxc.hook.mount",            config_hook,                 NULL,                          NULL                   },
+	{ "lxc.hook.autodev",          config_hook,                 NULL,                          NULL                   },
+	{ "lxc.hook.start",            config_hook,                 NULL,                          NULL                   },
+	{ "lxc.hook.stop",             config_hook,                 NULL,                          NULL                   },
+	{ "lxc.hook.post-stop",        config_hook,                 NULL,                          NULL                   },
+	{ "lxc.hook.clone",            config_hook,                 NULL,                          NULL                   },
+	{ "lxc.hook.destroy",          config_hook,                 NULL,                          NULL                   },
+	{ "lxc.hook",                  config_hook,                 NULL,                          NULL                   },
+	{ "lxc.network.type",          config_network_type,         NULL,                          NULL                   },
+	{ "lxc.network.flags",         config_network_flags,        NULL,                          NULL                   },
+	{ "lxc.network.link",          config_network_link,         NULL,                          NULL                   },
+	{ "lxc.network.name",          config_network_name,         NULL,                          NULL                   },
+	{ "lxc.network.macvlan.mode",  config_network_macvlan_mode, NULL,                          NULL                   },
+	{ "lxc.network.veth.pair",     config_network_veth_pair,    NULL,                          NULL                   },
+	{ "lxc.network.script.up",     config_network_script_up,    NULL,                          NULL                   },
+	{ "lxc.network.script.down",   config_network_script_down,  NULL,                          NULL                   },
+	{ "lxc.network.hwaddr",        config_network_hwaddr,       NULL,                          NULL                   },
+	{ "lxc.network.mtu",           config_network_mtu,          NULL,                          NULL                   },
+	{ "lxc.network.vlan.id",       config_network_vlan_id,      NULL,                          NULL                   },
+	{ "lxc.network.ipv4.gateway",  config_network_ipv4_gateway, NULL,                          NULL                   },
+	{ "lxc.network.ipv4",          config_network_ipv4,         NULL,                          NULL                   },
+	{ "lxc.network.ipv6.gateway",  config_network_ipv6_gateway, NULL,                          NULL                   },
+	{ "lxc.network.ipv6",          config_network_ipv6,         NULL,                          NULL                   },
 	/* config_network_nic must come after all other 'lxc.network.*' entries */
-	{ "lxc.network.",             config_network_nic          },
-	{ "lxc.network",              config_network              },
-	{ "lxc.cap.drop",             config_cap_drop             },
-	{ "lxc.cap.keep",             config_cap_keep             },
-	{ "lxc.console.logfile",      config_console_logfile      },
-	{ "lxc.console",              config_console              },
-	{ "lxc.seccomp",              config_seccomp              },
-	{ "lxc.include",              config_includefile          },
-	{ "lxc.autodev",              config_autodev              },
-	{ "lxc.haltsignal",           config_haltsignal           },
-	{ "lxc.rebootsignal",         config_rebootsignal         },
-	{ "lxc.stopsignal",           config_stopsignal           },
-	{ "lxc.start.auto",           config_start                },
-	{ "lxc.start.delay",          config_start                },
-	{ "lxc.start.order",          config_start                },
-	{ "lxc.monitor.unshare",      config_monitor              },
-	{ "lxc.group",                config_group                },
-	{ "lxc.environment",          config_environment          },
-	{ "lxc.init_cmd",             config_init_cmd             },
-	{ "lxc.init_uid",             config_init_uid             },
-	{ "lxc.init_gid",             config_init_gid             },
-	{ "lxc.ephemeral",            config_ephemeral            },
-	{ "lxc.syslog",               config_syslog               },
-	{ "lxc.no_new_privs",	      config_no_new_privs	  },
+	{ "lxc.network.",              config_network_nic,          NULL,                          NULL                   },
+	{ "lxc.network",               config_network,              get_config_network,            clr_config_network     },
+	{ "lxc.cap.drop",              config_cap_drop,             get_config_cap_drop,           clr_config_cap_drop    },
+	{ "lxc.cap.keep",              config_cap_keep,             get_config_cap_keep,           clr_config_cap_keep    },
+	{ "lxc.console.logfile",       config_console_logfile,      get_config_console_logfile,    NULL                   },
+	{ "lxc.console",               config_console,              get_config_console,            NULL                   },
+	{ "lxc.seccomp",               config_seccomp,              get_config_seccomp,            NULL                   },
+	{ "lxc.include",               config_includefile,          NULL,                          NULL                   },
+	{ "lxc.autodev",               config_autodev,              NULL,                          NULL                   },
+	{ "lxc.haltsignal",            config_haltsignal,           NULL,                          NULL                   },
+	{ "lxc.rebootsignal",          config_rebootsignal,         NULL,                          NULL                   },
+	{ "lxc.stopsignal",            config_stopsignal,           NULL,                          NULL                   },
+	{ "lxc.start.auto",            config_start,                get_config_start_auto,         NULL                   },
+	{ "lxc.start.delay",           config_start,                get_config_start_delay,        NULL                   },
+	{ "lxc.start.order",           config_start,                get_config_start_order,        NULL                   },
+	{ "lxc.monitor.unshare",       config_monitor,              get_config_monitor,            NULL                   },
+	{ "lxc.group",                 config_group,                get_config_group,              NULL                   },
+	{ "lxc.environment",           config_environment,          get_config_environment,        NULL                   },
+	{ "lxc.init_cmd",              config_init_cmd,             get_config_init_cmd,           NULL                   },
+	{ "lxc.init_uid",              config_init_uid,             get_config_init_uid,           NULL                   },
+	{ "lxc.init_gid",              config_init_gid,             get_config_init_gid,           NULL                   },
+	{ "lxc.ephemeral",             config_ephemeral,            get_config_ephemeral,          NULL                   },
+	{ "lxc.syslog",                config_syslog,               get_config_syslog,             NULL                   },
+	{ "lxc.no_new_privs",          config_no_new_privs,         get_config_no_new_privs,       NULL                   },
 };
 
 struct signame {
@@ -277,14 +320,112 @@ static const struct signame signames[] = {
 
 static const size_t config_size = sizeof(config)/sizeof(struct lxc_config_t);
 
+/*
+ * Hash index over config[], built once when the library is loaded.
+ *
+ * Keys are matched by their longest prefix in the table, which for the
+ * way config[] is ordered is the same entry the former linear scan found
+ * first. Only prefixes whose length is the length of some table entry are
+ * hashed, and since no entry is longer than LXC_CONFIG_KEY_MAX the hashes
+ * of all candidate prefixes come out of a single pass over the key.
+ */
+#define LXC_CONFIG_KEY_MAX	32
+#define LXC_CONFIG_INDEX_SIZE	256	/* power of two, > 2 * config_size */
+
+struct lxc_config_slot {
+	uint32_t hash;
+	uint32_t len;
+	struct lxc_config_t *config;
+};
+
+static struct lxc_config_slot config_index[LXC_CONFIG_INDEX_SIZE];
+static uint64_t config_index_lens;	/* bit n set: some entry has length n */
+
+static inline uint32_t config_hash_step(uint32_t hash, char c)
+{
+	/* FNV-1a */
+	return (hash ^ (unsigned char)c) * 16777619;
+}
+
+__attribute__((constructor))
+static void config_index_init(void)
+{
+	size_t i, len, slot;
+	uint32_t hash;
+
+	for (i = 0; i < config_size; i++) {
+		len = strlen(config[i].name);
+		if (len > LXC_CONFIG_KEY_MAX) {
+			/* cannot happen unless config[] grows a longer key */
+			ERROR("config key %s too long for the index", config[i].name);
+			continue;
+		}
+
+		hash = 2166136261U;
+		for (slot = 0; slot < len; slot++)
+			hash = config_hash_step(hash, config[i].name[slot]);
+
+		slot = hash & (LXC_CONFIG_INDEX_SIZE - 1);
+		while (config_index[slot].config)
+			slot = (slot + 1) & (LXC_CONFIG_INDEX_SIZE - 1);
+
+		config_index[slot].hash = hash;
+		config_index[slot].len = len;
+		config_index[slot].config = &config[i];
+		config_index_lens |= 1ULL << len;
+	}
+}
+
+static struct lxc_config_t *config_index_find(const char *key, size_t len,
+					      uint32_t hash)
+{
+	struct lxc_config_slot *e;
+	size_t slot = hash & (LXC_CONFIG_INDEX_SIZE - 1);
+
+	for (; (e = &config_index[slot])->config;
+	     slot = (slot + 1) & (LXC_CONFIG_INDEX_SIZE - 1))
+		if (e->hash == hash && e->len == len &&
+		    !memcmp(e->config->name, key, len))
+			return e->config;
+
+	return NULL;
+}
+
+/* Returns the entry named exactly @key, NULL if there is none. */
+static struct lxc_config_t *lxc_config_find(const char *key)
+{
+	uint32_t hash = 2166136261U;
+	size_t len;
+
+	for (len = 0; key[len]; len++) {
+		if (len == LXC_CONFIG_KEY_MAX)
+			return NULL;
+		hash = config_hash_step(hash, key[len]);
+	}
+
+	return config_index_find(key, len, hash);
+}
+
 extern struct lxc_config_t *lxc_getconfig(const char *key)
 {
-	size_t i;
+	uint32_t hash[LXC_CONFIG_KEY_MAX + 1];
+	struct lxc_config_t *config;
+	size_t len;
+
+	hash[0] = 2166136261U;
+	for (len = 0; len < LXC_CONFIG_KEY_MAX && key[len]; len++)
+		hash[len + 1] = config_hash_step(hash[len], key[len]);
+
+	/* longest prefix first */
+	for (; len > 0; len--) {
+		if (!(config_index_lens & (1ULL << len)))
+			continue;
+
+		config = config_index_find(key, len, hash[len]);
+		if (config)
+			return config;
+	}
 
-	for (i = 0; i < config_size; i++)
-		if (!strncmp(config[i].name, key,
-			     strlen(config[i].name)))
-			return &config[i];
 	return NULL;
 }
 
@@ -1764,30 +1905,253 @@ static void update_hwaddr(const char *line)
 	rand_complete_hwaddr(p);
 }
 
+/*
+ * The buffer grows geometrically and the line is copied to its known end,
+ * so appending the lines of a config is linear in its size.
+ */
 int append_unexp_config_line(const char *line, struct lxc_conf *conf)
 {
 	size_t len = conf->unexpanded_len, linelen = strlen(line);
 
 	update_hwaddr(line);
 
-	while (conf->unexpanded_alloced <= len + linelen + 2) {
-		char *tmp = realloc(conf->unexpanded_config, conf->unexpanded_alloced + 1024);
+	if (conf->unexpanded_alloced < len + linelen + 2) {
+		size_t alloced = conf->unexpanded_alloced ? conf->unexpanded_alloced : 1024;
+		char *tmp;
+
+		while (alloced < len + linelen + 2)
+			alloced *= 2;
+		tmp = realloc(conf->unexpanded_config, alloced);
 		if (!tmp)
 			return -1;
-		if (!conf->unexpanded_config)
-			*tmp = '\0';
 		conf->unexpanded_config = tmp;
-		conf->unexpanded_alloced += 1024;
-	}
-	strcat(conf->unexpanded_config, line);
-	conf->unexpanded_len += linelen;
-	if (line[linelen-1] != '\n') {
-		strcat(conf->unexpanded_config, "\n");
-		conf->unexpanded_len++;
+		conf->unexpanded_alloced = alloced;
+	}
+	memcpy(conf->unexpanded_config + len, line, linelen);
+	len += linelen;
+	if (!linelen || line[linelen-1] != '\n')
+		conf->unexpanded_config[len++] = '\n';
+	conf->unexpanded_config[len] = '\0';
+	conf->unexpanded_len = len;
+	return 0;
+}
+
+/*
+ * Cache of a parsed container config, enabled with lxc.config.cache.
+ *
+ * The cache holds every line parse_line() was given for the config, with
+ * the includes expanded, and the device, inode, size and times of every
+ * file and include directory which was read. As long as none of these
+ * changed, loading the config is replaying the lines from one mmap()ed
+ * file without opening, reading or listing any of the sources again.
+ * Replaying goes through parse_line() so the result, including the
+ * completion of lxc.network.hwaddr templates, is the same as parsing.
+ */
+#define LXC_CONFIG_CACHE_MAGIC		0x4c584343	/* LXCC */
+#define LXC_CONFIG_CACHE_VERSION	1
+#define LXC_CONFIG_CACHE_INCLUDED	1		/* line from an lxc.include */
+
+struct lxc_config_cache_header {
+	uint32_t magic;
+	uint32_t version;
+	uint64_t size;			/* of the whole cache file */
+	uint32_t nr_deps;
+	uint32_t nr_lines;
+	char lxc_version[32];
+};
+
+/* followed by the NUL terminated path, padded to 8 bytes */
+struct lxc_config_cache_dep {
+	uint64_t dev;
+	uint64_t ino;
+	uint64_t size;
+	int64_t mtime_sec;
+	int64_t mtime_nsec;
+	int64_t ctime_sec;
+	int64_t ctime_nsec;
+	uint32_t path_len;
+	uint32_t pad;
+};
+
+/* followed by the NUL terminated line, padded to 8 bytes */
+struct lxc_config_cache_line {
+	uint32_t len;
+	uint32_t flags;
+};
+
+struct lxc_config_cache_buf {
+	char *data;
+	size_t len;
+	size_t alloced;
+};
+
+struct lxc_config_recorder {
+	struct lxc_config_cache_buf deps;
+	struct lxc_config_cache_buf lines;
+	uint32_t nr_deps;
+	uint32_t nr_lines;
+	bool failed;
+};
+
+/*
+ * Set while a top level config is parsed to build its cache.  Without
+ * thread local storage another thread's lines would end up in it, so the
+ * cache is only used with it.
+ */
+#ifdef HAVE_TLS
+static __thread struct lxc_config_recorder *config_recorder;
+#else
+static struct lxc_config_recorder *config_recorder;
+#endif
+
+static bool config_cache_enabled(void)
+{
+#ifdef HAVE_TLS
+	const char *v = lxc_global_config_value("lxc.config.cache");
+
+	return v && strcmp(v, "1") == 0;
+#else
+	return false;
+#endif
+}
+
+static int config_cache_buf_append(struct lxc_config_cache_buf *b,
+				   const void *data, size_t len)
+{
+	size_t padded = (len + 7) & ~(size_t)7;
+
+	if (b->len + padded > b->alloced) {
+		size_t alloced = b->alloced ? b->alloced : 4096;
+		char *tmp;
+
+		while (alloced < b->len + padded)
+			alloced *= 2;
+		tmp = realloc(b->data, alloced);
+		if (!tmp)
+			return -1;
+		b->data = tmp;
+		b->alloced = alloced;
 	}
+
+	memcpy(b->data + b->len, data, len);
+	memset(b->data + b->len + len, 0, padded - len);
+	b->len += padded;
 	return 0;
 }
 
+static void config_cache_fill_dep(struct lxc_config_cache_dep *dep,
+				  const struct stat *st)
+{
+	memset(dep, 0, sizeof(*dep));
+	dep->dev = st->st_dev;
+	dep->ino = st->st_ino;
+	dep->size = st->st_size;
+	dep->mtime_sec = st->st_mtim.tv_sec;
+	dep->mtime_nsec = st->st_mtim.tv_nsec;
+	dep->ctime_sec = st->st_ctim.tv_sec;
+	dep->ctime_nsec = st->st_ctim.tv_nsec;
+}
+
+/*
+ * Record a file or directory the config is read from. It is stat()ed
+ * before it is read, so a change made while reading it invalidates the
+ * cache the next time around.
+ */
+static void config_cache_add_dep(const char *path)
+{
+	struct lxc_config_recorder *r = config_recorder;
+	struct lxc_config_cache_dep dep;
+	struct stat st;
+
+	if (!r || r->failed)
+		return;
+
+	if (stat(path, &st) < 0) {
+		r->failed = true;
+		return;
+	}
+
+	config_cache_fill_dep(&dep, &st);
+	dep.path_len = strlen(path) + 1;
+	if (config_cache_buf_append(&r->deps, &dep, sizeof(dep)) < 0 ||
+	    config_cache_buf_append(&r->deps, path, dep.path_len) < 0) {
+		r->failed = true;
+		return;
+	}
+	r->nr_deps++;
+}
+
+static void config_cache_add_line(const char *line, bool from_include)
+{
+	struct lxc_config_recorder *r = config_recorder;
+	struct lxc_config_cache_line rec;
+
+	if (!r || r->failed)
+		return;
+
+	rec.len = strlen(line) + 1;
+	rec.flags = from_include ? LXC_CONFIG_CACHE_INCLUDED : 0;
+	if (config_cache_buf_append(&r->lines, &rec, sizeof(rec)) < 0 ||
+	    config_cache_buf_append(&r->lines, line, rec.len) < 0) {
+		r->failed = true;
+		return;
+	}
+	r->nr_lines++;
+}
+
+static char *config_cache_path(const char *file)
+{
+	size_t len = strlen(file) + 7;
+	char *path;
+
+	path = malloc(len);
+	if (!path)
+		return NULL;
+	snprintf(path, len, "%s.cache", file);
+	return path;
+}
+
+static void config_cache_write(const char *file, struct lxc_config_recorder *r)
+{
+	struct lxc_config_cache_header hdr;
+	char *path, *tmp;
+	int fd;
+
+	path = config_cache_path(file);
+	if (!path)
+		return;
+	tmp = alloca(strlen(path) + 8);
+	sprintf(tmp, "%s.XXXXXX", path);
+
+	fd = mkstemp(tmp);
+	if (fd < 0) {
+		/* not being able to write next to the config is fine */
+		DEBUG("failed to create config cache for %s: %s", file,
+		      strerror(errno));
+		free(path);
+		return;
+	}
+
+	memset(&hdr, 0, sizeof(hdr));
+	hdr.magic = LXC_CONFIG_CACHE_MAGIC;
+	hdr.version = LXC_CONFIG_CACHE_VERSION;
+	hdr.size = sizeof(hdr) + r->deps.len + r->lines.len;
+	hdr.nr_deps = r->nr_deps;
+	hdr.nr_lines = r->nr_lines;
+	strncpy(hdr.lxc_version, VERSION, sizeof(hdr.lxc_version) - 1);
+
+	if (lxc_write_nointr(fd, &hdr, sizeof(hdr)) != sizeof(hdr) ||
+	    lxc_write_nointr(fd, r->deps.data, r->deps.len) != r->deps.len ||
+	    lxc_write_nointr(fd, r->lines.data, r->lines.len) != r->lines.len ||
+	    fsync(fd) < 0 || rename(tmp, path) < 0) {
+		WARN("failed to write config cache %s: %s", path, strerror(errno));
+		unlink(tmp);
+	}
+
+	close(fd);
+	free(path);
+}
+
 static int do_includedir(const char *dirp, struct lxc_conf *lxc_conf)
 {
 	struct dirent *direntp;
@@ -1800,6 +2164,7 @@ static int do_includedir(const char *dirp, struct lxc_conf *lxc_conf)
 		SYSERROR("failed to open '%s'", dirp);
 		return -1;
 	}
+	config_cache_add_dep(dirp);
 
 	while ((direntp = readdir(dir))) {
 		const char *fnam;
@@ -1913,6 +2278,7 @@ static int config_utsname(const char *key, const char *value,
 struct parse_line_conf {
 	struct lxc_conf *conf;
 	bool from_include;
+	bool replay;		/* lines come from the config cache */
 };
 
 static int parse_line(char *buffer, void *data)
@@ -1928,6 +2294,8 @@ static int parse_line(char *buffer, void *data)
 	if (lxc_is_line_empty(buffer))
 		return 0;
 
+	config_cache_add_line(buffer, plc->from_include);
+
 	/* we have to dup the buffer otherwise, at the re-exec for
 	 * reboot we modified the original string on the stack by
 	 * replacing '=' by '\0' below
@@ -1983,6 +2351,12 @@ static int parse_line(char *buffer, void *data)
 		goto out;
 	}
 
+	/* the lines of the included files follow in the cache */
+	if (plc->replay && config->cb == config_includefile) {
+		ret = 0;
+		goto out;
+	}
+
 	ret = config->cb(key, value, plc->conf);
 
 out:
@@ -1996,26 +2370,172 @@ static int lxc_config_readline(char *buffer, struct lxc_conf *conf)
 
 	c.conf = conf;
 	c.from_include = false;
+	c.replay = false;
 
 	return parse_line(buffer, &c);
 }
 
+static bool config_cache_dep_valid(const struct lxc_config_cache_dep *dep,
+				   const char *path, struct stat *st)
+{
+	struct lxc_config_cache_dep now;
+
+	if (stat(path, st) < 0)
+		return false;
+
+	config_cache_fill_dep(&now, st);
+	now.path_len = dep->path_len;
+	return memcmp(&now, dep, sizeof(now)) == 0;
+}
+
+/*
+ * Load @file from its cache. Returns false if there is no valid cache, and
+ * the config has to be parsed, otherwise the result of the replay is
+ * stored in @ret.
+ */
+static bool config_cache_load(const char *file, struct lxc_conf *conf,
+			      int *ret)
+{
+	const struct lxc_config_cache_header *hdr;
+	const struct lxc_config_cache_dep *dep;
+	const struct lxc_config_cache_line *rec;
+	struct parse_line_conf c;
+	struct stat st, cst;
+	size_t pos, lines;
+	char *path, *map;
+	bool valid = false;
+	uint32_t i;
+	int fd;
+
+	path = config_cache_path(file);
+	if (!path)
+		return false;
+	fd = open(path, O_RDONLY | O_CLOEXEC);
+	free(path);
+	if (fd < 0)
+		return false;
+
+	if (fstat(fd, &cst) < 0 || cst.st_size < sizeof(*hdr)) {
+		close(fd);
+		return false;
+	}
+
+	map = mmap(NULL, cst.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (map == MAP_FAILED)
+		return false;
+
+	hdr = (struct lxc_config_cache_header *)map;
+	if (hdr->magic != LXC_CONFIG_CACHE_MAGIC ||
+	    hdr->version != LXC_CONFIG_CACHE_VERSION ||
+	    hdr->size != cst.st_size || hdr->nr_deps == 0 ||
+	    strncmp(hdr->lxc_version, VERSION, sizeof(hdr->lxc_version)) != 0)
+		goto out;
+
+	pos = sizeof(*hdr);
+	for (i = 0; i < hdr->nr_deps; i++) {
+		if (pos + sizeof(*dep) > cst.st_size)
+			goto out;
+		dep = (struct lxc_config_cache_dep *)(map + pos);
+		pos += sizeof(*dep);
+		if (dep->path_len == 0 || pos + dep->path_len > cst.st_size ||
+		    map[pos + dep->path_len - 1] != '\0')
+			goto out;
+
+		/* the cache must be for this config and written either by us
+		 * or by the owner of the config
+		 */
+		if (i == 0 && strcmp(map + pos, file) != 0)
+			goto out;
+		if (!config_cache_dep_valid(dep, map + pos, &st))
+			goto out;
+		if (i == 0 && cst.st_uid != st.st_uid && cst.st_uid != geteuid())
+			goto out;
+
+		pos += (dep->path_len + 7) & ~7;
+	}
+
+	/* check the whole line section before anything is applied */
+	lines = pos;
+	for (i = 0; i < hdr->nr_lines; i++) {
+		if (pos + sizeof(*rec) > cst.st_size)
+			goto out;
+		rec = (struct lxc_config_cache_line *)(map + pos);
+		pos += sizeof(*rec);
+		if (rec->len == 0 || pos + rec->len > cst.st_size ||
+		    map[pos + rec->len - 1] != '\0')
+			goto out;
+		pos += (rec->len + 7) & ~7;
+	}
+	valid = true;
+
+	if (!conf->rcfile)
+		conf->rcfile = strdup(file);
+
+	c.conf = conf;
+	c.replay = true;
+	*ret = 0;
+	for (pos = lines, i = 0; i < hdr->nr_lines; i++) {
+		rec = (struct lxc_config_cache_line *)(map + pos);
+		pos += sizeof(*rec);
+
+		/* parse_line() only reads the line */
+		c.from_include = rec->flags & LXC_CONFIG_CACHE_INCLUDED;
+		*ret = parse_line(map + pos, &c);
+		if (*ret) {
+			if (*ret < 0)
+				ERROR("Failed to parse config: %s", map + pos);
+			break;
+		}
+		pos += (rec->len + 7) & ~7;
+	}
+
+out:
+	munmap(map, cst.st_size);
+	return valid;
+}
+
 int lxc_config_read(const char *file, struct lxc_conf *conf, bool from_include)
 {
+	struct lxc_config_recorder rec;
 	struct parse_line_conf c;
+	int ret;
 
 	c.conf = conf;
 	c.from_include = from_include;
+	c.replay = false;
 
 	if( access(file, R_OK) == -1 ) {
 		return -1;
 	}
 
-	/* Catch only the top level config file name in the structure */
+	if (from_include || config_recorder || !config_cache_enabled()) {
+		/* Catch only the top level config file name in the structure */
+		if(!conf->rcfile)
+			conf->rcfile = strdup(file);
+
+		config_cache_add_dep(file);
+		return lxc_file_for_each_line(file, parse_line, &c);
+	}
+
+	if (config_cache_load(file, conf, &ret))
+		return ret;
+
 	if(!conf->rcfile)
 		conf->rcfile = strdup(file);
 
-	return lxc_file_for_each_line(file, parse_line, &c);
+	memset(&rec, 0, sizeof(rec));
+	config_recorder = &rec;
+	config_cache_add_dep(file);
+	ret = lxc_file_for_each_line(file, parse_line, &c);
+	config_recorder = NULL;
+
+	if (ret == 0 && !rec.failed)
+		config_cache_write(file, &rec);
+	free(rec.deps.data);
+	free(rec.lines.data);
+
+	return ret;
 }
 
 int lxc_config_define_add(struct lxc_list *defines, char* arg)
@@ -2483,114 +3003,169 @@ static int lxc_get_item_network(struct lxc_conf *c, char *retv, int inlen)
 	return fulllen;
 }
 
+static int lxc_get_conf_str(char *retv, int inlen, const char *v)
+{
+	if (!v)
+		return 0;
+	if (retv && inlen >= strlen(v) + 1)
+		strncpy(retv, v, strlen(v)+1);
+	return strlen(v);
+}
+
+/*
+ * Getters for the config[] entries which are a plain string or int of
+ * struct lxc_conf.
+ */
+#define lxc_config_get_str(name, expr)					\
+static int get_config_##name(const char *key, char *retv, int inlen,	\
+			     struct lxc_conf *c)			\
+{									\
+	return lxc_get_conf_str(retv, inlen, (expr));			\
+}
+
+#define lxc_config_get_int(name, expr)					\
+static int get_config_##name(const char *key, char *retv, int inlen,	\
+			     struct lxc_conf *c)			\
+{									\
+	return lxc_get_conf_int(c, retv, inlen, (expr));		\
+}
+
+lxc_config_get_str(fstab, c->fstab)
+lxc_config_get_str(ttydir, c->ttydir)
+lxc_config_get_str(lsm_aa_profile, c->lsm_aa_profile)
+lxc_config_get_str(lsm_se_context, c->lsm_se_context)
+lxc_config_get_str(logfile, c->logfile)
+lxc_config_get_str(loglevel, lxc_log_priority_to_string(c->loglevel))
+lxc_config_get_str(utsname, c->utsname ? c->utsname->nodename : NULL)
+lxc_config_get_str(console_logfile, c->console.log_path)
+lxc_config_get_str(console, c->console.path)
+lxc_config_get_str(rootfs_mount, c->rootfs.mount)
+lxc_config_get_str(rootfs_backend, c->rootfs.bdev_type)
+lxc_config_get_str(rootfs_options, c->rootfs.options)
+lxc_config_get_str(rootfs, c->rootfs.path)
+lxc_config_get_str(seccomp, c->seccomp)
+lxc_config_get_str(init_cmd, c->init_cmd)
+lxc_config_get_str(syslog, c->syslog)
+
+lxc_config_get_int(tty, c->tty)
+lxc_config_get_int(pts, c->pts)
+lxc_config_get_int(lsm_aa_incomplete, c->lsm_aa_allow_incomplete)
+lxc_config_get_int(start_auto, c->start_auto)
+lxc_config_get_int(start_delay, c->start_delay)
+lxc_config_get_int(start_order, c->start_order)
+lxc_config_get_int(monitor, c->monitor_unshare)
+lxc_config_get_int(init_uid, c->init_uid)
+lxc_config_get_int(init_gid, c->init_gid)
+lxc_config_get_int(ephemeral, c->ephemeral)
+lxc_config_get_int(no_new_privs, c->no_new_privs)
+
+static int get_config_mount(const char *key, char *retv, int inlen,
+			    struct lxc_conf *c)
+{
+	return lxc_get_mount_entries(c, retv, inlen);
+}
+
+static int get_config_mount_auto(const char *key, char *retv, int inlen,
+				 struct lxc_conf *c)
+{
+	return lxc_get_auto_mounts(c, retv, inlen);
+}
+
+static int get_config_arch(const char *key, char *retv, int inlen,
+			   struct lxc_conf *c)
+{
+	return lxc_get_arch_entry(c, retv, inlen);
+}
+
+static int get_config_cgroup(const char *key, char *retv, int inlen,
+			     struct lxc_conf *c)
+{
+	return lxc_get_cgroup_entry(c, retv, inlen, "all");
+}
+
+static int get_config_cap_drop(const char *key, char *retv, int inlen,
+			       struct lxc_conf *c)
+{
+	return lxc_get_item_cap_drop(c, retv, inlen);
+}
+
+static int get_config_cap_keep(const char *key, char *retv, int inlen,
+			       struct lxc_conf *c)
+{
+	return lxc_get_item_cap_keep(c, retv, inlen);
+}
+
+static int get_config_network(const char *key, char *retv, int inlen,
+			      struct lxc_conf *c)
+{
+	return lxc_get_item_network(c, retv, inlen);
+}
+
+static int get_config_group(const char *key, char *retv, int inlen,
+			    struct lxc_conf *c)
+{
+	return lxc_get_item_groups(c, retv, inlen);
+}
+
+static int get_config_environment(const char *key, char *retv, int inlen,
+				  struct lxc_conf *c)
+{
+	return lxc_get_item_environment(c, retv, inlen);
+}
+
 int lxc_get_config_item(struct lxc_conf *c, const char *key, char *retv,
 			int inlen)
 {
-	const char *v = NULL;
-
-	if (strcmp(key, "lxc.mount.entry") == 0)
-		return lxc_get_mount_entries(c, retv, inlen);
-	else if (strcmp(key, "lxc.mount.auto") == 0)
-		return lxc_get_auto_mounts(c, retv, inlen);
-	else if (strcmp(key, "lxc.mount") == 0)
-		v = c->fstab;
-	else if (strcmp(key, "lxc.tty") == 0)
-		return lxc_get_conf_int(c, retv, inlen, c->tty);
-	else if (strcmp(key, "lxc.pts") == 0)
-		return lxc_get_conf_int(c, retv, inlen, c->pts);
-	else if (strcmp(key, "lxc.devttydir") == 0)
-		v = c->ttydir;
-	else if (strcmp(key, "lxc.arch") == 0)
-		return lxc_get_arch_entry(c, retv, inlen);
-	else if (strcmp(key, "lxc.aa_profile") == 0)
-		v = c->lsm_aa_profile;
-	else if (strcmp(key, "lxc.aa_allow_incomplete") == 0)
-		return lxc_get_conf_int(c, retv, inlen, c->lsm_aa_allow_incomplete);
-	else if (strcmp(key, "lxc.se_context") == 0)
-		v = c->lsm_se_context;
-	else if (strcmp(key, "lxc.logfile") == 0)
-		v = c->logfile;
-	else if (strcmp(key, "lxc.loglevel") == 0)
-		v = lxc_log_priority_to_string(c->loglevel);
-	else if (strcmp(key, "lxc.cgroup") == 0) // all cgroup info
-		return lxc_get_cgroup_entry(c, retv, inlen, "all");
-	else if (strncmp(key, "lxc.cgroup.", 11) == 0) // specific cgroup info
+	struct lxc_config_t *config;
+
+	/* keys with a variable part, everything else is looked up exactly */
+	if (strncmp(key, "lxc.cgroup.", 11) == 0) // specific cgroup info
 		return lxc_get_cgroup_entry(c, retv, inlen, key + 11);
-	else if (strcmp(key, "lxc.utsname") == 0)
-		v = c->utsname ? c->utsname->nodename : NULL;
-	else if (strcmp(key, "lxc.console.logfile") == 0)
-		v = c->console.log_path;
-	else if (strcmp(key, "lxc.console") == 0)
-		v = c->console.path;
-	else if (strcmp(key, "lxc.rootfs.mount") == 0)
-		v = c->rootfs.mount;
-	else if (strcmp(key, "lxc.rootfs.backend") == 0)
-		v = c->rootfs.bdev_type;
-	else if (strcmp(key, "lxc.rootfs.options") == 0)
-		v = c->rootfs.options;
-	else if (strcmp(key, "lxc.rootfs") == 0)
-		v = c->rootfs.path;
-	else if (strcmp(key, "lxc.cap.drop") == 0)
-		return lxc_get_item_cap_drop(c, retv, inlen);
-	else if (strcmp(key, "lxc.cap.keep") == 0)
-		return lxc_get_item_cap_keep(c, retv, inlen);
 	else if (strncmp(key, "lxc.hook", 8) == 0)
 		return lxc_get_item_hooks(c, retv, inlen, key);
-	else if (strcmp(key, "lxc.network") == 0)
-		return lxc_get_item_network(c, retv, inlen);
 	else if (strncmp(key, "lxc.network.", 12) == 0)
 		return lxc_get_item_nic(c, retv, inlen, key + 12);
-	else if (strcmp(key, "lxc.start.auto") == 0)
-		return lxc_get_conf_int(c, retv, inlen, c->start_auto);
-	else if (strcmp(key, "lxc.start.delay") == 0)
-		return lxc_get_conf_int(c, retv, inlen, c->start_delay);
-	else if (strcmp(key, "lxc.start.order") == 0)
-		return lxc_get_conf_int(c, retv, inlen, c->start_order);
-	else if (strcmp(key, "lxc.monitor.unshare") == 0)
-		return lxc_get_conf_int(c, retv, inlen, c->monitor_unshare);
-	else if (strcmp(key, "lxc.group") == 0)
-		return lxc_get_item_groups(c, retv, inlen);
-	else if (strcmp(key, "lxc.seccomp") == 0)
-		v = c->seccomp;
-	else if (strcmp(key, "lxc.environment") == 0)
-		return lxc_get_item_environment(c, retv, inlen);
-	else if (strcmp(key, "lxc.init_cmd") == 0)
-		v = c->init_cmd;
-	else if (strcmp(key, "lxc.init_uid") == 0)
-		return lxc_get_conf_int(c, retv, inlen, c->init_uid);
-	else if (strcmp(key, "lxc.init_gid") == 0)
-		return lxc_get_conf_int(c, retv, inlen, c->init_gid);
-	else if (strcmp(key, "lxc.ephemeral") == 0)
-		return lxc_get_conf_int(c, retv, inlen, c->ephemeral);
-	else if (strcmp(key, "lxc.syslog") == 0)
-		v = c->syslog;
-	else if (strcmp(key, "lxc.no_new_privs") == 0)
-		return lxc_get_conf_int(c, retv, inlen, c->no_new_privs);
-	else return -1;
 
-	if (!v)
-		return 0;
-	if (retv && inlen >= strlen(v) + 1)
-		strncpy(retv, v, strlen(v)+1);
-	return strlen(v);
+	config = lxc_config_find(key);
+	if (!config || !config->get)
+		return -1;
+
+	return config->get(key, retv, inlen, c);
+}
+
+static int clr_config_network(const char *key, struct lxc_conf *c)
+{
+	return lxc_clear_config_network(c);
+}
+
+static int clr_config_cap_drop(const char *key, struct lxc_conf *c)
+{
+	return lxc_clear_config_caps(c);
+}
+
+static int clr_config_cap_keep(const char *key, struct lxc_conf *c)
+{
+	return lxc_clear_config_keepcaps(c);
+}
+
+static int clr_config_mount(const char *key, struct lxc_conf *c)
+{
+	return lxc_clear_mount_entries(c);
+}
+
+static int clr_config_mount_auto(const char *key, struct lxc_conf *c)
+{
+	return lxc_clear_automounts(c);
 }
 
 int lxc_clear_config_item(struct lxc_conf *c, const char *key)
 {
-	if (strcmp(key, "lxc.network") == 0)
-		return lxc_clear_config_network(c);
-	else if (strncmp(key, "lxc.network.", 12) == 0)
+	struct lxc_config_t *config;
+
+	if (strncmp(key, "lxc.network.", 12) == 0)
 		return lxc_clear_nic(c, key + 12);
-	else if (strcmp(key, "lxc.cap.drop") == 0)
-		return lxc_clear_config_caps(c);
-	else if (strcmp(key, "lxc.cap.keep") == 0)
-		return lxc_clear_config_keepcaps(c);
 	else if (strncmp(key, "lxc.cgroup", 10) == 0)
 		return lxc_clear_cgroups(c, key);
-	else if (strcmp(key, "lxc.mount.entry") == 0)
-		return lxc_clear_mount_entries(c);
-	else if (strcmp(key, "lxc.mount.auto") == 0)
-		return lxc_clear_automounts(c);
 	else if (strncmp(key, "lxc.hook", 8) == 0)
 		return lxc_clear_hooks(c, key);
 	else if (strncmp(key, "lxc.group", 9) == 0)
@@ -2599,7 +3174,12 @@ int lxc_clear_config_item(struct lxc_conf *c, const char *key)
 		return lxc_clear_environment(c);
 	else if (strncmp(key, "lxc.id_map", 10) == 0)
 		return lxc_clear_idmaps(c);
-	return -1;
+
+	config = lxc_config_find(key);
+	if (!config || !config->clr)
+		return -1;
+
+	return config->clr(key, c);
 }
 
 /*
@@ -2634,37 +3214,39 @@ bool do_append_unexp_config_line(struct lxc_conf *conf, const char *key, const c
 	return true;
 }
 
+/*
+ * Lines which are kept are moved down over the removed ones as the buffer is
+ * walked, so each byte is moved at most once however many lines match.
+ */
 void clear_unexp_config_line(struct lxc_conf *conf, const char *key, bool rm_subkeys)
 {
-	char *lstart = conf->unexpanded_config, *lend;
+	char *lstart = conf->unexpanded_config, *lend, *dst;
+	size_t keylen = strlen(key);
+	char v;
 
 	if (!conf->unexpanded_config)
 		return;
+	dst = lstart;
 	while (*lstart) {
 		lend = strchr(lstart, '\n');
-		char v;
 		if (!lend)
 			lend = lstart + strlen(lstart);
 		else
 			lend++;
-		if (strncmp(lstart, key, strlen(key)) != 0) {
-			lstart = lend;
-			continue;
-		}
-		if (!rm_subkeys) {
-			v = lstart[strlen(key)];
-			if (!isspace(v) && v != '=') {
+		if (strncmp(lstart, key, keylen) == 0) {
+			v = lstart[keylen];
+			if (rm_subkeys || isspace(v) || v == '=') {
 				lstart = lend;
 				continue;
 			}
 		}
-		conf->unexpanded_len -= (lend - lstart);
-		if (*lend == '\0') {
-			*lstart = '\0';
-			return;
-		}
-		memmove(lstart, lend, strlen(lend)+1);
+		if (dst != lstart)
+			memmove(dst, lstart, lend - lstart);
+		dst += lend - lstart;
+		lstart = lend;
 	}
+	*dst = '\0';
+	conf->unexpanded_len = dst - conf->unexpanded_config;
 }
 
 bool clone_update_unexp_ovl_paths(struct lxc_conf *conf, const char *oldpath,
@@ -32,9 +32,13 @@ struct lxc_conf;
 struct lxc_list;
 
 typedef int (*config_cb)(const char *, const char *, struct lxc_conf *);
+typedef int (*config_get_cb)(const char *, char *, int, struct lxc_conf *);
+typedef int (*config_clr_cb)(const char *, struct lxc_conf *);
 struct lxc_config_t {
 	char *name;
 	config_cb cb;
+	config_get_cb get;	/* NULL if the key cannot be read back */
+	config_clr_cb clr;	/* NULL if the key cannot be cleared */
 };
 
 extern struct lxc_config_t *lxc_getconfig(const char *key);
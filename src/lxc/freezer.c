@@ -50,38 +50,87 @@ lxc_state_t freezer_state(const char *name, const char *lxcpath)
 	return lxc_str2state(v);
 }
 
-static int do_freeze_thaw(int freeze, const char *name, const char *lxcpath)
+/* Freezing usually completes within milliseconds, so the state is polled
+ * with a backoff starting at FREEZER_POLL_MIN_US rather than once a second.
+ * The v1 freezer has no notification for state changes.
+ */
+#define FREEZER_POLL_MIN_US 1000
+#define FREEZER_POLL_MAX_US 100000
+
+enum {
+	FREEZER_FAILED,
+	FREEZER_PENDING,
+	FREEZER_DONE,
+};
+
+/*
+ * Request the new state for every container first and only then wait, so
+ * the kernel freezes (or thaws) all of them concurrently.
+ */
+int lxc_freeze_thaw_all(int freeze, int count, const char **names,
+			const char **lxcpaths, bool *done)
 {
-	char v[100];
 	const char *state = freeze ? "FROZEN" : "THAWED";
+	int i, pending = 0, ndone = 0;
+	useconds_t delay = FREEZER_POLL_MIN_US;
+	char v[100], *status;
 
-	if (lxc_cgroup_set("freezer.state", state, name, lxcpath) < 0) {
-		ERROR("Failed to freeze %s:%s", lxcpath, name);
+	status = calloc(count ? count : 1, sizeof(*status));
+	if (!status)
 		return -1;
-	}
-	while (1) {
-		if (lxc_cgroup_get("freezer.state", v, 100, name, lxcpath) < 0) {
-			ERROR("Failed to get new freezer state for %s:%s", lxcpath, name);
-			return -1;
+
+	for (i = 0; i < count; i++) {
+		if (freeze && names[i])
+			lxc_monitor_send_state(names[i], FREEZING, lxcpaths[i]);
+		if (lxc_cgroup_set("freezer.state", state, names[i], lxcpaths[i]) < 0) {
+			ERROR("Failed to freeze %s:%s", lxcpaths[i], names[i]);
+			continue;
 		}
-		if (v[strlen(v)-1] == '\n')
-			v[strlen(v)-1] = '\0';
-		if (strncmp(v, state, strlen(state)) == 0) {
-			if (name)
-				lxc_monitor_send_state(name, freeze ? FROZEN : THAWED, lxcpath);
-			return 0;
+		status[i] = FREEZER_PENDING;
+		pending++;
+	}
+
+	while (pending) {
+		for (i = 0; i < count; i++) {
+			if (status[i] != FREEZER_PENDING)
+				continue;
+
+			if (lxc_cgroup_get("freezer.state", v, 100, names[i], lxcpaths[i]) < 0) {
+				ERROR("Failed to get new freezer state for %s:%s", lxcpaths[i], names[i]);
+				status[i] = FREEZER_FAILED;
+				pending--;
+				continue;
+			}
+			if (v[strlen(v)-1] == '\n')
+				v[strlen(v)-1] = '\0';
+			if (strncmp(v, state, strlen(state)) != 0)
+				continue;
+
+			if (names[i])
+				lxc_monitor_send_state(names[i], freeze ? FROZEN : THAWED, lxcpaths[i]);
+			status[i] = FREEZER_DONE;
+			pending--;
+			ndone++;
 		}
-		sleep(1);
+		if (!pending)
+			break;
+
+		usleep(delay);
+		delay = delay * 2 < FREEZER_POLL_MAX_US ? delay * 2 : FREEZER_POLL_MAX_US;
 	}
+
+	for (i = 0; done && i < count; i++)
+		done[i] = status[i] == FREEZER_DONE;
+	free(status);
+	return ndone;
 }
 
 int lxc_freeze(const char *name, const char *lxcpath)
 {
-	lxc_monitor_send_state(name, FREEZING, lxcpath);
-	return do_freeze_thaw(1, name, lxcpath);
+	return lxc_freeze_thaw_all(1, 1, &name, &lxcpath, NULL) == 1 ? 0 : -1;
 }
 
 int lxc_unfreeze(const char *name, const char *lxcpath)
 {
-	return do_freeze_thaw(0, name, lxcpath);
+	return lxc_freeze_thaw_all(0, 1, &name, &lxcpath, NULL) == 1 ? 0 : -1;
 }
@@ -92,10 +92,14 @@ const char *lxc_global_config_value(const char *option_name)
 		{ "lxc.bdev.lvm.thin_pool", DEFAULT_THIN_POOL },
 		{ "lxc.bdev.zfs.root",      DEFAULT_ZFSROOT },
 		{ "lxc.bdev.rbd.rbdpool",   DEFAULT_RBDPOOL },
+		{ "lxc.bdev.loop.alloc",    "sparse"        },
 		{ "lxc.lxcpath",            NULL            },
 		{ "lxc.default_config",     NULL            },
 		{ "lxc.cgroup.pattern",     NULL            },
 		{ "lxc.cgroup.use",         NULL            },
+		{ "lxc.log.format",         "text"          },
+		{ "lxc.log.buffered",       "0"             },
+		{ "lxc.config.cache",       "0"             },
 		{ NULL, NULL },
 	};
 
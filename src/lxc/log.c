@@ -27,6 +27,7 @@
 #include <unistd.h>
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <sys/uio.h>
 #include <string.h>
 #include <pthread.h>
 #include <time.h>
@@ -44,9 +45,13 @@
 #include "utils.h"
 
 #define LXC_LOG_DATEFOMAT_SIZE  15
+#define LXC_LOG_RING_SIZE	(16 * LXC_LOG_BUFFER_SIZE)
 
 int lxc_log_fd = -1;
+unsigned int lxc_log_generation = 1;
 static int syslog_enable = 0;
+static int log_buffered;
+static int log_binary;
 int lxc_quiet_specified;
 int lxc_log_use_global_fd;
 static int lxc_loglevel_specified;
@@ -57,6 +62,188 @@ static char *log_vmname = NULL;
 
 lxc_log_define(lxc_log, lxc);
 
+/*
+ * Per thread state of the logfile appender.
+ *
+ * The date is only formatted again when the second changes. With
+ * lxc.log.buffered, records are collected in @buf and written out with a
+ * single writev() when it fills up, when a record of priority ERROR or
+ * higher comes in, when the second changes and when lxc_log_flush() is
+ * called, so at most about a second worth of low priority records is
+ * held back.
+ */
+struct lxc_log_ring {
+	time_t date_sec;
+	char date[LXC_LOG_DATEFOMAT_SIZE];
+	int fd;			/* where the buffered records go */
+	pid_t pid;		/* a forked child drops what it inherited */
+	size_t head;		/* oldest unwritten byte */
+	size_t len;		/* unwritten bytes */
+	char buf[LXC_LOG_RING_SIZE];
+};
+
+/*
+ * Without thread local storage there is no ring: records are written as they
+ * come and dates are formatted for each of them.
+ */
+#ifdef HAVE_TLS
+static __thread struct lxc_log_ring *log_ring;
+#else
+static struct lxc_log_ring *log_ring;
+#endif
+
+#if defined(HAVE_TLS) && !defined(NO_LXC_CONF)
+static pthread_key_t log_ring_key;
+static pthread_once_t log_ring_once = PTHREAD_ONCE_INIT;
+
+static void log_ring_free(void *ring)
+{
+	log_ring = ring;
+	lxc_log_flush();
+	log_ring = NULL;
+	free(ring);
+}
+
+static void log_ring_key_create(void)
+{
+	pthread_key_create(&log_ring_key, log_ring_free);
+}
+#endif
+
+static struct lxc_log_ring *log_ring_get(void)
+{
+#ifdef HAVE_TLS
+	if (log_ring)
+		return log_ring;
+
+	/* the date cache is useful even when not buffering, so allocate the
+	 * whole thing and just leave the buffer unused
+	 */
+	log_ring = calloc(1, sizeof(*log_ring));
+	if (!log_ring)
+		return NULL;
+	log_ring->date_sec = -1;
+	log_ring->fd = -1;
+	log_ring->pid = getpid();
+
+#ifndef NO_LXC_CONF
+	pthread_once(&log_ring_once, log_ring_key_create);
+	pthread_setspecific(log_ring_key, log_ring);
+#endif
+	return log_ring;
+#else
+	return NULL;
+#endif
+}
+
+static void log_ring_flush(struct lxc_log_ring *r)
+{
+	struct iovec iov[2];
+	size_t first;
+	ssize_t ret;
+	int cnt;
+
+	while (r->len) {
+		first = LXC_LOG_RING_SIZE - r->head;
+		if (first > r->len)
+			first = r->len;
+
+		iov[0].iov_base = r->buf + r->head;
+		iov[0].iov_len = first;
+		iov[1].iov_base = r->buf;
+		iov[1].iov_len = r->len - first;
+		cnt = iov[1].iov_len ? 2 : 1;
+
+		ret = writev(r->fd, iov, cnt);
+		if (ret < 0 && errno == EINTR)
+			continue;
+		if (ret <= 0)
+			break;
+
+		r->head = (r->head + ret) % LXC_LOG_RING_SIZE;
+		r->len -= ret;
+	}
+
+	r->head = 0;
+	r->len = 0;
+}
+
+void lxc_log_flush(void)
+{
+	if (log_ring && log_ring->len && log_ring->pid == getpid())
+		log_ring_flush(log_ring);
+}
+
+static int log_write(int fd, const char *buf, size_t n, int priority)
+{
+	struct lxc_log_ring *r = log_ring;
+	size_t tail, first;
+
+	if (!log_buffered || !r || n > LXC_LOG_RING_SIZE)
+		return write(fd, buf, n);
+
+	if (r->pid != getpid()) {
+		/* the parent still holds these and writes them out */
+		r->pid = getpid();
+		r->head = r->len = 0;
+	}
+
+	if (r->len && (r->fd != fd || r->len + n > LXC_LOG_RING_SIZE))
+		log_ring_flush(r);
+
+	r->fd = fd;
+	tail = (r->head + r->len) % LXC_LOG_RING_SIZE;
+	first = LXC_LOG_RING_SIZE - tail;
+	if (first > n)
+		first = n;
+	memcpy(r->buf + tail, buf, first);
+	memcpy(r->buf, buf + first, n - first);
+	r->len += n;
+
+	if (priority >= LXC_LOG_PRIORITY_ERROR)
+		log_ring_flush(r);
+	return n;
+}
+
+/*
+ * Note that a record of second @sec is being logged, which flushes the batch
+ * of an earlier second.  Returns the per thread state, or NULL.
+ */
+static struct lxc_log_ring *log_tick(time_t sec)
+{
+	struct lxc_log_ring *r;
+
+	r = log_ring_get();
+	if (!r)
+		return NULL;
+
+	if (r->date_sec != sec) {
+		/* keep batches within the second their records were logged */
+		if (log_buffered && r->len && r->pid == getpid())
+			log_ring_flush(r);
+		r->date[0] = '\0';
+		r->date_sec = sec;
+	}
+	return r;
+}
+
+/* Cached "%Y%m%d%H%M%S" of @sec, NULL if no per thread state is available. */
+static const char *log_date(time_t sec)
+{
+	struct lxc_log_ring *r;
+	struct tm tm;
+
+	r = log_tick(sec);
+	if (!r)
+		return NULL;
+
+	if (!r->date[0]) {
+		localtime_r(&sec, &tm);
+		strftime(r->date, sizeof(r->date), "%Y%m%d%H%M%S", &tm);
+	}
+	return r->date;
+}
+
 static int lxc_log_priority_to_syslog(int priority)
 {
 	switch (priority) {
@@ -134,12 +321,87 @@ static int log_append_stderr(const struct lxc_log_appender *appender,
 }
 
 /*---------------------------------------------------------------------------*/
+static size_t log_binary_str(char *buf, size_t pos, const char *str,
+			     uint16_t *len)
+{
+	size_t n = str ? strlen(str) : 0;
+
+	/* no log_prefix or log_vmname, and memcpy() wants no NULL */
+	if (!n) {
+		*len = 0;
+		return pos;
+	}
+	if (n > LXC_LOG_BUFFER_SIZE)
+		n = LXC_LOG_BUFFER_SIZE;
+	if (pos + n > LXC_LOG_BINARY_MAX)
+		n = pos < LXC_LOG_BINARY_MAX ? LXC_LOG_BINARY_MAX - pos : 0;
+	memcpy(buf + pos, str, n);
+	*len = n;
+	return pos + n;
+}
+
+/*
+ * Binary records skip the date formatting and the padding entirely, they
+ * are turned into the usual text by lxc_log_decode().
+ */
+static int log_append_binary(int fd, struct lxc_log_event *event)
+{
+	char buffer[LXC_LOG_BINARY_MAX];
+	struct lxc_log_record *rec = (struct lxc_log_record *)buffer;
+	size_t pos = sizeof(*rec);
+	int n;
+
+	memset(rec, 0, sizeof(*rec));
+	rec->magic = LXC_LOG_BINARY_MAGIC;
+	rec->version = LXC_LOG_BINARY_VERSION;
+	rec->priority = event->priority;
+	rec->line = event->locinfo->line;
+	rec->sec = event->timestamp.tv_sec;
+	rec->usec = event->timestamp.tv_usec;
+	rec->pid = getpid();
+
+	pos = log_binary_str(buffer, pos, log_prefix, &rec->prefix_len);
+	pos = log_binary_str(buffer, pos, log_vmname, &rec->vmname_len);
+	pos = log_binary_str(buffer, pos, event->category, &rec->category_len);
+	pos = log_binary_str(buffer, pos, event->locinfo->file, &rec->file_len);
+	pos = log_binary_str(buffer, pos, event->locinfo->func, &rec->func_len);
+
+	n = vsnprintf(buffer + pos, sizeof(buffer) - pos, event->fmt,
+		      *event->vap);
+	if (n < 0)
+		n = 0;
+	if (n >= sizeof(buffer) - pos)
+		n = sizeof(buffer) - pos - 1;
+	rec->msg_len = n;
+	rec->len = pos + n;
+
+	return log_write(fd, buffer, rec->len, event->priority);
+}
+
+static int log_format_text(char *buffer, size_t size, const char *prefix,
+			   const char *vmname, const char *date, int ms,
+			   int priority, const char *category,
+			   const char *file, const char *func, int line)
+{
+	return snprintf(buffer, size,
+			"%15s%s%s %10s.%03d %-8s %s - %s:%s:%d - ",
+			prefix,
+			vmname ? " " : "",
+			vmname ? vmname : "",
+			date,
+			ms,
+			lxc_log_priority_to_string(priority),
+			category,
+			file, func,
+			line);
+}
+
 static int log_append_logfile(const struct lxc_log_appender *appender,
 			      struct lxc_log_event *event)
 {
-	char date[LXC_LOG_DATEFOMAT_SIZE] = "20150427012246";
+	char fallback_date[LXC_LOG_DATEFOMAT_SIZE] = "20150427012246";
 	char buffer[LXC_LOG_BUFFER_SIZE];
-	const struct tm *t;
+	const char *date;
 	int n;
 	int ms;
 	int fd_to_use = -1;
@@ -155,20 +417,25 @@ static int log_append_logfile(const struct lxc_log_appender *appender,
 	if (fd_to_use == -1)
 		return 0;
 
-	t = localtime(&event->timestamp.tv_sec);
-	strftime(date, sizeof(date), "%Y%m%d%H%M%S", t);
+	if (log_binary) {
+		/* the reader formats the timestamp */
+		log_tick(event->timestamp.tv_sec);
+		return log_append_binary(fd_to_use, event);
+	}
+
+	date = log_date(event->timestamp.tv_sec);
+	if (!date) {
+		struct tm tm;
+
+		localtime_r(&event->timestamp.tv_sec, &tm);
+		strftime(fallback_date, sizeof(fallback_date), "%Y%m%d%H%M%S", &tm);
+		date = fallback_date;
+	}
 	ms = event->timestamp.tv_usec / 1000;
-	n = snprintf(buffer, sizeof(buffer),
-		     "%15s%s%s %10s.%03d %-8s %s - %s:%s:%d - ",
-		     log_prefix,
-		     log_vmname ? " " : "",
-		     log_vmname ? log_vmname : "",
-		     date,
-		     ms,
-		     lxc_log_priority_to_string(event->priority),
-		     event->category,
-		     event->locinfo->file, event->locinfo->func,
-		     event->locinfo->line);
+	n = log_format_text(buffer, sizeof(buffer), log_prefix, log_vmname,
+			    date, ms, event->priority, event->category,
+			    event->locinfo->file, event->locinfo->func,
+			    event->locinfo->line);
 
 	n += vsnprintf(buffer + n, sizeof(buffer) - n, event->fmt,
 		       *event->vap);
@@ -181,7 +448,7 @@ static int log_append_logfile(const struct lxc_log_appender *appender,
 
 	buffer[n] = '\n';
 
-	return write(fd_to_use, buffer, n + 1);
+	return log_write(fd_to_use, buffer, n + 1, event->priority);
 }
 
 static struct lxc_log_appender log_appender_syslog = {
@@ -328,6 +595,7 @@ static char *build_log_path(const char *name, const char *lxcpath)
 
 extern void lxc_log_close(void)
 {
+	lxc_log_flush();
 	closelog();
 	free(log_vmname);
 	log_vmname = NULL;
@@ -427,6 +695,7 @@ extern int lxc_log_init(const char *name, const char *file,
 			const char *lxcpath)
 {
 	int lxc_priority = LXC_LOG_PRIORITY_ERROR;
+	const char *buffered;
 	int ret;
 
 	if (lxc_log_fd != -1) {
@@ -439,6 +708,7 @@ extern int lxc_log_init(const char *name, const char *file,
 
 	if (!lxc_loglevel_specified) {
 		lxc_log_category_lxc.priority = lxc_priority;
+		lxc_log_generation++;
 		lxc_loglevel_specified = 1;
 	}
 
@@ -450,6 +720,10 @@ extern int lxc_log_init(const char *name, const char *file,
 	if (prefix)
 		lxc_log_set_prefix(prefix);
 
+	lxc_log_set_format(lxc_global_config_value("lxc.log.format"));
+	buffered = lxc_global_config_value("lxc.log.buffered");
+	lxc_log_set_buffered(buffered && !strcmp(buffered, "1"));
+
 	if (name)
 		log_vmname = strdup(name);
 
@@ -561,6 +835,110 @@ extern const char *lxc_log_get_prefix(void)
 	return log_prefix;
 }
 
+extern int lxc_log_set_format(const char *format)
+{
+	if (!format || !strcmp(format, "text")) {
+		log_binary = 0;
+	} else if (!strcmp(format, "binary")) {
+		log_binary = 1;
+	} else {
+		ERROR("invalid log format '%s'", format);
+		return -1;
+	}
+	return 0;
+}
+
+extern void lxc_log_set_buffered(bool buffered)
+{
+	if (!buffered)
+		lxc_log_flush();
+	log_buffered = buffered;
+}
+
+/* flush what the exiting thread still holds, other threads flush from
+ * their pthread key destructor
+ */
+static void __attribute__((destructor)) lxc_log_fini(void)
+{
+	lxc_log_flush();
+}
+
+/* copy a string of a record to @*dst, terminated, and move @*dst past it */
+static char *log_decode_string(char **dst, const char *src, size_t len)
+{
+	char *str = *dst;
+
+	memcpy(str, src, len);
+	str[len] = '\0';
+	*dst += len + 1;
+	return str;
+}
+
+/*
+ * Turn the records written with lxc.log.format = binary back into the text
+ * format of the logfile appender.
+ */
+extern int lxc_log_decode(FILE *in, FILE *out)
+{
+	char buffer[LXC_LOG_BINARY_MAX + 1], date[LXC_LOG_DATEFOMAT_SIZE];
+	/* the five strings before the message, each with a terminator */
+	char strings[LXC_LOG_BINARY_MAX + 5], *next;
+	char *prefix, *vmname, *category, *file, *func, *msg;
+	struct lxc_log_record *rec = (struct lxc_log_record *)buffer;
+	char text[LXC_LOG_BUFFER_SIZE];
+	time_t sec;
+	struct tm tm;
+	size_t pos;
+
+	while (fread(rec, sizeof(*rec), 1, in) == 1) {
+		if (rec->magic != LXC_LOG_BINARY_MAGIC ||
+		    rec->version != LXC_LOG_BINARY_VERSION ||
+		    rec->len < sizeof(*rec) || rec->len > LXC_LOG_BINARY_MAX ||
+		    sizeof(*rec) + rec->prefix_len + rec->vmname_len +
+		    rec->category_len + rec->file_len + rec->func_len +
+		    rec->msg_len != rec->len) {
+			errno = EINVAL;
+			return -1;
+		}
+
+		if (fread(buffer + sizeof(*rec), rec->len - sizeof(*rec), 1, in) != 1 &&
+		    rec->len > sizeof(*rec)) {
+			errno = EINVAL;
+			return -1;
+		}
+
+		/* the strings are not terminated in the record, copy them
+		 * out one after another with a terminator
+		 */
+		next = strings;
+		pos = sizeof(*rec);
+		prefix = log_decode_string(&next, buffer + pos, rec->prefix_len);
+		pos += rec->prefix_len;
+		vmname = log_decode_string(&next, buffer + pos, rec->vmname_len);
+		pos += rec->vmname_len;
+		category = log_decode_string(&next, buffer + pos, rec->category_len);
+		pos += rec->category_len;
+		file = log_decode_string(&next, buffer + pos, rec->file_len);
+		pos += rec->file_len;
+		func = log_decode_string(&next, buffer + pos, rec->func_len);
+		pos += rec->func_len;
+		msg = buffer + pos;
+		msg[rec->msg_len] = '\0';
+
+		sec = rec->sec;
+		localtime_r(&sec, &tm);
+		strftime(date, sizeof(date), "%Y%m%d%H%M%S", &tm);
+
+		log_format_text(text, sizeof(text), prefix,
+				rec->vmname_len ? vmname : NULL, date,
+				rec->usec / 1000, rec->priority, category,
+				file, func, rec->line);
+		fprintf(out, "%s%s\n", text, msg);
+	}
+
+	return ferror(in) ? -1 : 0;
+}
+
 extern void lxc_log_options_no_override()
 {
 	lxc_quiet_specified = 1;
@@ -33,6 +33,7 @@
 #include <string.h>
 #include <strings.h>
 #include <stdbool.h>
+#include <stdint.h>
 #include <syslog.h>
 
 #include "conf.h"
@@ -48,6 +49,10 @@
 #define LXC_LOG_PREFIX_SIZE	32
 #define LXC_LOG_BUFFER_SIZE	1024
 
+#define LXC_LOG_BINARY_MAGIC	0x4c43584c	/* "LXCL" */
+#define LXC_LOG_BINARY_VERSION	1
+#define LXC_LOG_BINARY_MAX	(4 * LXC_LOG_BUFFER_SIZE)
+
 /* This attribute is required to silence clang warnings */
 #if defined(__GNUC__)
 #define ATTR_UNUSED __attribute__ ((unused))
@@ -69,6 +74,14 @@ enum lxc_loglevel {
 	LXC_LOG_PRIORITY_NOTSET,
 };
 
+/*
+ * Calls below this priority are compiled out, see --with-log-min-level.
+ * Their arguments are not evaluated either.
+ */
+#ifndef LXC_LOG_MIN_PRIORITY
+#define LXC_LOG_MIN_PRIORITY LXC_LOG_PRIORITY_TRACE
+#endif
+
 /* location information of the logging event */
 struct lxc_log_locinfo {
 	const char	*file;
@@ -89,6 +102,28 @@ struct lxc_log_event {
 	va_list			*vap;
 };
 
+/*
+ * Record written by the logfile appender with lxc.log.format = binary.
+ * The header is followed by the prefix, the container name, the category,
+ * the file, the function and the message, none of them NUL terminated.
+ */
+struct lxc_log_record {
+	uint32_t magic;
+	uint16_t version;
+	uint16_t priority;
+	uint32_t len;		/* whole record, header included */
+	uint32_t line;
+	int64_t sec;
+	int32_t usec;
+	int32_t pid;
+	uint16_t prefix_len;
+	uint16_t vmname_len;
+	uint16_t category_len;
+	uint16_t file_len;
+	uint16_t func_len;
+	uint16_t msg_len;
+};
+
 /* log appender object */
 struct lxc_log_appender {
 	const char*	name;
@@ -106,25 +141,50 @@ struct lxc_log_category {
 	int				priority;
 	struct lxc_log_appender		*appender;
 	const struct lxc_log_category	*parent;
+	int				effective;	/* priority of the chain, cached */
+	unsigned int			generation;	/* lxc_log_generation it was cached at */
 };
 
+/* bumped whenever a category priority changes, invalidating the caches */
+extern unsigned int lxc_log_generation;
+
 #ifndef NO_LXC_CONF
 extern int lxc_log_use_global_fd;
 #endif
 
+/*
+ * Returns the priority of the first category in the chain which has one set.
+ * The result is cached in the category until lxc_log_generation changes, so
+ * the parent chain is only walked again after a priority was changed.
+ */
+static inline int
+lxc_log_category_effective(struct lxc_log_category* category)
+{
+	const struct lxc_log_category *c = category;
+
+	if (category->generation == lxc_log_generation)
+		return category->effective;
+
+	while (c->priority == LXC_LOG_PRIORITY_NOTSET && c->parent)
+		c = c->parent;
+
+	category->effective = c->priority;
+	category->generation = lxc_log_generation;
+	return category->effective;
+}
+
 /*
  * Returns true if the chained priority is equal to or higher than
  * given priority.
  */
 static inline int
-lxc_log_priority_is_enabled(const struct lxc_log_category* category,
+lxc_log_priority_is_enabled(struct lxc_log_category* category,
 			   int priority)
 {
-	while (category->priority == LXC_LOG_PRIORITY_NOTSET &&
-	       category->parent)
-		category = category->parent;
+	if (priority < LXC_LOG_MIN_PRIORITY)
+		return 0;
 
-	int cmp_prio = category->priority;
+	int cmp_prio = lxc_log_category_effective(category);
 #ifndef NO_LXC_CONF
 	if (!lxc_log_use_global_fd && current_config &&
 			current_config->loglevel != LXC_LOG_PRIORITY_NOTSET)
@@ -231,7 +291,8 @@ __lxc_log(const struct lxc_log_category* category,
 }
 
 /*
- * Helper macro to define log functions.
+ * Helper macro to define log functions. The enabled check is done by the
+ * TRACE() ... FATAL() macros before the arguments are evaluated.
  */
 #define lxc_log_priority_define(acategory, PRIORITY)			\
 									\
@@ -241,23 +302,20 @@ ATTR_UNUSED static inline void LXC_##PRIORITY(struct lxc_log_locinfo *,		\
 ATTR_UNUSED static inline void LXC_##PRIORITY(struct lxc_log_locinfo* locinfo,	\
 				  const char* format, ...)		\
 {									\
-	if (lxc_log_priority_is_enabled(acategory, 			\
-					LXC_LOG_PRIORITY_##PRIORITY)) {	\
-		struct lxc_log_event evt = {				\
-			.category	= (acategory)->name,		\
-			.priority	= LXC_LOG_PRIORITY_##PRIORITY,	\
-			.fmt		= format,			\
-			.locinfo	= locinfo			\
-		};							\
-		va_list va_ref;						\
+	struct lxc_log_event evt = {					\
+		.category	= (acategory)->name,			\
+		.priority	= LXC_LOG_PRIORITY_##PRIORITY,		\
+		.fmt		= format,				\
+		.locinfo	= locinfo				\
+	};								\
+	va_list va_ref;							\
 									\
-		gettimeofday(&evt.timestamp, NULL);			\
+	gettimeofday(&evt.timestamp, NULL);				\
 									\
-		va_start(va_ref, format);				\
-		evt.vap = &va_ref;					\
-		__lxc_log(acategory, &evt);				\
-		va_end(va_ref);						\
-	}								\
+	va_start(va_ref, format);					\
+	evt.vap = &va_ref;						\
+	__lxc_log(acategory, &evt);					\
+	va_end(va_ref);							\
 }
 
 /*
@@ -275,6 +333,12 @@ ATTR_UNUSED static inline void LXC_##PRIORITY(struct lxc_log_locinfo* locinfo,	\
 #define lxc_log_define(name, parent)					\
 	lxc_log_category_define(name, parent)				\
 									\
+ATTR_UNUSED static inline int lxc_log_enabled(int priority)		\
+{									\
+	return lxc_log_priority_is_enabled(&lxc_log_category_##name,	\
+					   priority);			\
+}									\
+									\
 	lxc_log_priority_define(&lxc_log_category_##name, TRACE)	\
 	lxc_log_priority_define(&lxc_log_category_##name, DEBUG)	\
 	lxc_log_priority_define(&lxc_log_category_##name, INFO)		\
@@ -292,48 +356,66 @@ ATTR_UNUSED static inline void LXC_##PRIORITY(struct lxc_log_locinfo* locinfo,	\
  * top categories
  */
 #define TRACE(format, ...) do {						\
-	struct lxc_log_locinfo locinfo = LXC_LOG_LOCINFO_INIT;		\
-	LXC_TRACE(&locinfo, format, ##__VA_ARGS__);			\
+	if (lxc_log_enabled(LXC_LOG_PRIORITY_TRACE)) {			\
+		struct lxc_log_locinfo locinfo = LXC_LOG_LOCINFO_INIT;	\
+		LXC_TRACE(&locinfo, format, ##__VA_ARGS__);		\
+	}								\
 } while (0)
 
 #define DEBUG(format, ...) do {						\
-	struct lxc_log_locinfo locinfo = LXC_LOG_LOCINFO_INIT;		\
-	LXC_DEBUG(&locinfo, format, ##__VA_ARGS__);			\
+	if (lxc_log_enabled(LXC_LOG_PRIORITY_DEBUG)) {			\
+		struct lxc_log_locinfo locinfo = LXC_LOG_LOCINFO_INIT;	\
+		LXC_DEBUG(&locinfo, format, ##__VA_ARGS__);		\
+	}								\
 } while (0)
 
 #define INFO(format, ...) do {						\
-	struct lxc_log_locinfo locinfo = LXC_LOG_LOCINFO_INIT;		\
-	LXC_INFO(&locinfo, format, ##__VA_ARGS__);			\
+	if (lxc_log_enabled(LXC_LOG_PRIORITY_INFO)) {			\
+		struct lxc_log_locinfo locinfo = LXC_LOG_LOCINFO_INIT;	\
+		LXC_INFO(&locinfo, format, ##__VA_ARGS__);		\
+	}								\
 } while (0)
 
 #define NOTICE(format, ...) do {					\
-	struct lxc_log_locinfo locinfo = LXC_LOG_LOCINFO_INIT;		\
-	LXC_NOTICE(&locinfo, format, ##__VA_ARGS__);			\
+	if (lxc_log_enabled(LXC_LOG_PRIORITY_NOTICE)) {			\
+		struct lxc_log_locinfo locinfo = LXC_LOG_LOCINFO_INIT;	\
+		LXC_NOTICE(&locinfo, format, ##__VA_ARGS__);		\
+	}								\
 } while (0)
 
 #define WARN(format, ...) do {						\
-	struct lxc_log_locinfo locinfo = LXC_LOG_LOCINFO_INIT;		\
-	LXC_WARN(&locinfo, format, ##__VA_ARGS__);			\
+	if (lxc_log_enabled(LXC_LOG_PRIORITY_WARN)) {			\
+		struct lxc_log_locinfo locinfo = LXC_LOG_LOCINFO_INIT;	\
+		LXC_WARN(&locinfo, format, ##__VA_ARGS__);		\
+	}								\
 } while (0)
 
 #define ERROR(format, ...) do {						\
-	struct lxc_log_locinfo locinfo = LXC_LOG_LOCINFO_INIT;		\
-	LXC_ERROR(&locinfo, format, ##__VA_ARGS__);			\
+	if (lxc_log_enabled(LXC_LOG_PRIORITY_ERROR)) {			\
+		struct lxc_log_locinfo locinfo = LXC_LOG_LOCINFO_INIT;	\
+		LXC_ERROR(&locinfo, format, ##__VA_ARGS__);		\
+	}								\
 } while (0)
 
 #define CRIT(format, ...) do {						\
-	struct lxc_log_locinfo locinfo = LXC_LOG_LOCINFO_INIT;		\
-	LXC_CRIT(&locinfo, format, ##__VA_ARGS__);			\
+	if (lxc_log_enabled(LXC_LOG_PRIORITY_CRIT)) {			\
+		struct lxc_log_locinfo locinfo = LXC_LOG_LOCINFO_INIT;	\
+		LXC_CRIT(&locinfo, format, ##__VA_ARGS__);		\
+	}								\
 } while (0)
 
 #define ALERT(format, ...) do {						\
-	struct lxc_log_locinfo locinfo = LXC_LOG_LOCINFO_INIT;		\
-	LXC_ALERT(&locinfo, format, ##__VA_ARGS__);			\
+	if (lxc_log_enabled(LXC_LOG_PRIORITY_ALERT)) {			\
+		struct lxc_log_locinfo locinfo = LXC_LOG_LOCINFO_INIT;	\
+		LXC_ALERT(&locinfo, format, ##__VA_ARGS__);		\
+	}								\
 } while (0)
 
 #define FATAL(format, ...) do {						\
-	struct lxc_log_locinfo locinfo = LXC_LOG_LOCINFO_INIT;		\
-	LXC_FATAL(&locinfo, format, ##__VA_ARGS__);			\
+	if (lxc_log_enabled(LXC_LOG_PRIORITY_FATAL)) {			\
+		struct lxc_log_locinfo locinfo = LXC_LOG_LOCINFO_INIT;	\
+		LXC_FATAL(&locinfo, format, ##__VA_ARGS__);		\
+	}								\
 } while (0)
 
 
@@ -358,4 +440,8 @@ extern int lxc_log_get_level(void);
 extern bool lxc_log_has_valid_level(void);
 extern const char *lxc_log_get_prefix(void);
 extern void lxc_log_options_no_override();
+extern int lxc_log_set_format(const char *format);
+extern void lxc_log_set_buffered(bool buffered);
+extern void lxc_log_flush(void);
+extern int lxc_log_decode(FILE *in, FILE *out);
 #endif
@@ -36,6 +36,7 @@ extern "C" {
 struct lxc_msg;
 struct lxc_conf;
 struct lxc_arguments;
+struct lxc_cgroup_stats;
 
 /**
  Following code is for liblxc.
@@ -88,6 +89,18 @@ extern int lxc_freeze(const char *name, const char *lxcpath);
  */
 extern int lxc_unfreeze(const char *name, const char *lxcpath);
 
+/*
+ * Freeze or unfreeze several containers concurrently
+ * @freeze   : 1 to freeze, 0 to unfreeze
+ * @count    : the number of containers
+ * @names    : the container names
+ * @lxcpaths : the lxcpath of each container
+ * @done     : if not NULL, set for each container which reached the state
+ * Returns the number of containers which reached the state, < 0 on error
+ */
+extern int lxc_freeze_thaw_all(int freeze, int count, const char **names,
+			       const char **lxcpaths, bool *done);
+
 /*
  * Retrieve the container state
  * @name : the name of the container
@@ -118,6 +131,17 @@ extern int lxc_cgroup_set(const char *filename, const char *value, const char *n
  */
 extern int lxc_cgroup_get(const char *filename, char *value, size_t len, const char *name, const char *lxcpath);
 
+/*
+ * Read the memory, cpuacct, blkio and pids counters of a container, each
+ * cgroup file once.
+ * @name      : the name of the container
+ * @lxcpath   : lxc config path for container
+ * @stats     : the counters, zeroed first
+ * Returns 0 on success, < 0 if the container is not running
+ */
+extern int lxc_cgroup_get_stats(const char *name, const char *lxcpath,
+				struct lxc_cgroup_stats *stats);
+
 /*
  * Retrieve the error string associated with the error returned by
  * the function.
@@ -28,7 +28,10 @@
 #include <unistd.h>
 #include <string.h>
 #include <stdlib.h>
+#include <stdbool.h>
 #include <fcntl.h>
+#include <fnmatch.h>
+#include <time.h>
 #include <sys/epoll.h>
 #include <sys/types.h>
 #include <sys/stat.h>
@@ -45,26 +48,58 @@
 #include "utils.h"
 
 #define CLIENTFDS_CHUNK 64
+#define CLIENT_QUEUE_MIN 4096
+#define CLIENT_QUEUE_MAX (256 * 1024)
 
 lxc_log_define(lxc_monitord, lxc);
 
 static void lxc_monitord_cleanup(void);
 
+/*
+ * A subscriber
+ * @fd         : the accepted connection
+ * @events     : whether it reads struct lxc_event rather than struct lxc_msg
+ * @stream_seq : sequence number of the next event for this subscriber
+ * @subscribed : whether @sub was received, until then everything matches
+ * @sub        : the events the subscriber asked for
+ * @queue      : messages not written yet, between @head and @tail
+ * @size       : allocated size of @queue
+ * @pollout    : whether the mainloop waits for the socket to be writable
+ * @dropped    : messages dropped because @queue was full
+ */
+struct lxc_monitor_client {
+	int fd;
+	bool events;
+	uint64_t stream_seq;
+	bool subscribed;
+	struct lxc_monitor_subscription sub;
+	char *queue;
+	size_t head;
+	size_t tail;
+	size_t size;
+	bool pollout;
+	unsigned long dropped;
+};
+
 /*
  * Defines the structure to store the monitor information
  * @lxcpath        : the path being monitored
  * @fifofd         : the file descriptor for publishers (containers) to write state
+ * @publishfd      : the datagram socket publishers send struct lxc_event to
  * @listenfd       : the file descriptor for subscribers (lxc-monitors) to connect
- * @clientfds      : accepted client file descriptors
- * @clientfds_size : number of file descriptors clientfds can hold
- * @clientfds_cnt  : the count of valid fds in clientfds
+ * @eventsfd       : the file descriptor for event stream subscribers to connect
+ * @clientfds      : accepted clients
+ * @clientfds_size : number of clients clientfds can hold
+ * @clientfds_cnt  : the count of valid clients in clientfds
  * @descr          : the lxc_mainloop state
  */
 struct lxc_monitor {
 	const char *lxcpath;
 	int fifofd;
+	int publishfd;
 	int listenfd;
-	int *clientfds;
+	int eventsfd;
+	struct lxc_monitor_client *clientfds;
 	int clientfds_size;
 	int clientfds_cnt;
 	struct lxc_epoll_descr descr;
@@ -122,6 +157,17 @@ static int lxc_monitord_fifo_delete(struct lxc_monitor *mon)
 	return 0;
 }
 
+static struct lxc_monitor_client *lxc_monitord_client(struct lxc_monitor *mon,
+						      int fd)
+{
+	int i;
+
+	for (i = 0; i < mon->clientfds_cnt; i++)
+		if (mon->clientfds[i].fd == fd)
+			return &mon->clientfds[i];
+	return NULL;
+}
+
 static void lxc_monitord_sockfd_remove(struct lxc_monitor *mon, int fd) {
 	int i;
 
@@ -130,7 +176,7 @@ static void lxc_monitord_sockfd_remove(struct lxc_monitor *mon, int fd) {
 	close(fd);
 
 	for (i = 0; i < mon->clientfds_cnt; i++) {
-		if (mon->clientfds[i] == fd)
+		if (mon->clientfds[i].fd == fd)
 			break;
 	}
 	if (i >= mon->clientfds_cnt) {
@@ -139,26 +185,145 @@ static void lxc_monitord_sockfd_remove(struct lxc_monitor *mon, int fd) {
 		exit(EXIT_FAILURE);
 	}
 
+	if (mon->clientfds[i].dropped)
+		WARN("client fd:%d missed %lu messages", fd, mon->clientfds[i].dropped);
+	free(mon->clientfds[i].queue);
+
 	memmove(&mon->clientfds[i], &mon->clientfds[i+1],
 		(mon->clientfds_cnt - i - 1) * sizeof(mon->clientfds[0]));
 	mon->clientfds_cnt--;
 }
 
+/*
+ * Write out as much of the client queue as the socket takes without
+ * blocking, and have the mainloop tell us when it takes more.
+ */
+static int lxc_monitord_client_flush(struct lxc_monitor *mon,
+				     struct lxc_monitor_client *client)
+{
+	ssize_t ret;
+	size_t len;
+
+	while (client->head < client->tail) {
+		len = client->tail - client->head;
+		/* one event per packet on the seqpacket stream */
+		if (client->events)
+			len = sizeof(struct lxc_event);
+
+		ret = send(client->fd, client->queue + client->head, len,
+			   MSG_DONTWAIT | MSG_NOSIGNAL);
+		if (ret < 0) {
+			if (errno == EINTR)
+				continue;
+			if (errno == EAGAIN || errno == EWOULDBLOCK)
+				break;
+			ERROR("write failed to client sock:%d %d %s",
+			      client->fd, errno, strerror(errno));
+			return -1;
+		}
+		client->head += ret;
+	}
+
+	if (client->head == client->tail)
+		client->head = client->tail = 0;
+
+	if (client->pollout != (client->tail > 0)) {
+		client->pollout = client->tail > 0;
+		if (lxc_mainloop_mod_handler(&mon->descr, client->fd,
+					     client->pollout ? EPOLLIN | EPOLLOUT : EPOLLIN))
+			SYSERROR("failed to update events for client fd:%d", client->fd);
+	}
+	return 0;
+}
+
+static void lxc_monitord_client_queue(struct lxc_monitor_client *client,
+				      const void *buf, size_t len)
+{
+	size_t size;
+	char *queue;
+
+	if (client->tail + len > client->size && client->head) {
+		memmove(client->queue, client->queue + client->head,
+			client->tail - client->head);
+		client->tail -= client->head;
+		client->head = 0;
+	}
+
+	if (client->tail + len > client->size) {
+		size = client->size ? client->size : CLIENT_QUEUE_MIN;
+		while (size < client->tail + len)
+			size *= 2;
+		if (size > CLIENT_QUEUE_MAX ||
+		    !(queue = realloc(client->queue, size))) {
+			client->dropped++;
+			return;
+		}
+		client->queue = queue;
+		client->size = size;
+	}
+
+	memcpy(client->queue + client->tail, buf, len);
+	client->tail += len;
+}
+
+static bool lxc_monitord_match(struct lxc_monitor_client *client,
+			       struct lxc_event *ev)
+{
+	struct lxc_monitor_subscription *sub = &client->sub;
+
+	if (!client->subscribed)
+		return true;
+
+	if (sub->types && (ev->type >= 32 || !(sub->types & (1U << ev->type))))
+		return false;
+
+	if (ev->type == lxc_msg_state && sub->states &&
+	    (ev->value < 0 || ev->value >= 32 || !(sub->states & (1U << ev->value))))
+		return false;
+
+	if (!sub->name[0])
+		return true;
+	if (sub->flags & LXC_MONITOR_SUB_GLOB)
+		return fnmatch(sub->name, ev->name, 0) == 0;
+	return strcmp(sub->name, ev->name) == 0;
+}
+
 static int lxc_monitord_sock_handler(int fd, uint32_t events, void *data,
 				     struct lxc_epoll_descr *descr)
 {
 	struct lxc_monitor *mon = data;
+	struct lxc_monitor_client *client;
+
+	client = lxc_monitord_client(mon, fd);
+	if (!client) {
+		CRIT("fd:%d not found in clients array", fd);
+		return 0;
+	}
 
 	if (events & EPOLLIN) {
 		int rc;
-		char buf[4];
+		struct lxc_monitor_subscription sub;
 
-		rc = read(fd, buf, sizeof(buf));
-		if (rc > 0 && !strncmp(buf, "quit", 4))
+		/* event clients send either "quit" or a subscription as a
+		 * single packet, legacy clients only ever send "quit"
+		 */
+		rc = recv(fd, &sub, client->events ? sizeof(sub) : 4, 0);
+		if (rc == 4 && !strncmp((char *)&sub, "quit", 4)) {
 			quit = 1;
+		} else if (client->events && rc == sizeof(sub) &&
+			   sub.version == LXC_EVENT_VERSION) {
+			sub.name[sizeof(sub.name) - 1] = '\0';
+			client->sub = sub;
+			client->subscribed = true;
+			INFO("client fd:%d subscribed to '%s' types:%#x states:%#x",
+			     fd, sub.name, sub.types, sub.states);
+		}
 	}
 
-	if (events & EPOLLHUP)
+	if ((events & EPOLLOUT) && lxc_monitord_client_flush(mon, client) < 0)
+		events |= EPOLLHUP;
+
+	if (events & (EPOLLHUP | EPOLLERR))
 		lxc_monitord_sockfd_remove(mon, fd);
 	return quit;
 }
@@ -168,6 +333,7 @@ static int lxc_monitord_sock_accept(int fd, uint32_t events, void *data,
 {
 	int ret,clientfd;
 	struct lxc_monitor *mon = data;
+	struct lxc_monitor_client *client;
 	struct ucred cred;
 	socklen_t credsz = sizeof(cred);
 
@@ -195,7 +361,7 @@ static int lxc_monitord_sock_accept(int fd, uint32_t events, void *data,
 	}
 
 	if (mon->clientfds_cnt + 1 > mon->clientfds_size) {
-		int *clientfds;
+		struct lxc_monitor_client *clientfds;
 		DEBUG("realloc space for %d clientfds",
 		      mon->clientfds_size + CLIENTFDS_CHUNK);
 		clientfds = realloc(mon->clientfds,
@@ -216,8 +382,20 @@ static int lxc_monitord_sock_accept(int fd, uint32_t events, void *data,
 		goto err1;
 	}
 
-	mon->clientfds[mon->clientfds_cnt++] = clientfd;
-	INFO("accepted client fd:%d clients:%d", clientfd, mon->clientfds_cnt);
+	client = &mon->clientfds[mon->clientfds_cnt++];
+	memset(client, 0, sizeof(*client));
+	client->fd = clientfd;
+	client->events = fd == mon->eventsfd;
+
+	/* clients are never waited for, output is queued while their socket
+	 * is full and dropped once the queue is, which event clients see as
+	 * a gap in stream_seq
+	 */
+	if (fcntl(clientfd, F_SETFL, fcntl(clientfd, F_GETFL) | O_NONBLOCK))
+		SYSERROR("failed to make client fd:%d non blocking", clientfd);
+
+	INFO("accepted %sclient fd:%d clients:%d", client->events ? "event " : "",
+	     clientfd, mon->clientfds_cnt);
 	goto out;
 
 err1:
@@ -241,6 +419,32 @@ static int lxc_monitord_sock_create(struct lxc_monitor *mon)
 	}
 
 	mon->listenfd = fd;
+
+	if (lxc_monitor_events_sock_name(mon->lxcpath, &addr) < 0)
+		return -1;
+
+	fd = lxc_abstract_unix_open(addr.sun_path, SOCK_SEQPACKET, O_TRUNC);
+	if (fd < 0) {
+		ERROR("failed to open event unix socket : %s", strerror(errno));
+		return -1;
+	}
+	mon->eventsfd = fd;
+
+	if (lxc_monitor_publish_sock_name(mon->lxcpath, &addr) < 0)
+		return -1;
+
+	fd = lxc_abstract_unix_open(addr.sun_path, SOCK_DGRAM, O_TRUNC);
+	if (fd < 0) {
+		ERROR("failed to open publish unix socket : %s", strerror(errno));
+		return -1;
+	}
+	mon->publishfd = fd;
+
+	/* the sender credentials are checked for every event */
+	if (setsockopt(fd, SOL_SOCKET, SO_PASSCRED, &(int){1}, sizeof(int))) {
+		SYSERROR("failed to enable credentials on publish socket");
+		return -1;
+	}
 	return 0;
 }
 
@@ -273,6 +477,10 @@ static void lxc_monitord_delete(struct lxc_monitor *mon)
 
 	lxc_mainloop_del_handler(&mon->descr, mon->listenfd);
 	close(mon->listenfd);
+	lxc_mainloop_del_handler(&mon->descr, mon->eventsfd);
+	close(mon->eventsfd);
+	lxc_mainloop_del_handler(&mon->descr, mon->publishfd);
+	close(mon->publishfd);
 	lxc_monitord_sock_delete(mon);
 
 	lxc_mainloop_del_handler(&mon->descr, mon->fifofd);
@@ -280,17 +488,52 @@ static void lxc_monitord_delete(struct lxc_monitor *mon)
 	close(mon->fifofd);
 
 	for (i = 0; i < mon->clientfds_cnt; i++) {
-		lxc_mainloop_del_handler(&mon->descr, mon->clientfds[i]);
-		close(mon->clientfds[i]);
+		lxc_mainloop_del_handler(&mon->descr, mon->clientfds[i].fd);
+		close(mon->clientfds[i].fd);
+		free(mon->clientfds[i].queue);
 	}
 	mon->clientfds_cnt = 0;
 }
 
+static void lxc_monitord_broadcast(struct lxc_monitor *mon,
+				   struct lxc_event *ev)
+{
+	struct lxc_monitor_client *client;
+	struct lxc_msg msglxc;
+	int i;
+
+	memset(&msglxc, 0, sizeof(msglxc));
+	msglxc.type = ev->type;
+	msglxc.value = ev->value;
+	memcpy(msglxc.name, ev->name, sizeof(msglxc.name));
+
+	for (i = 0; i < mon->clientfds_cnt; i++) {
+		client = &mon->clientfds[i];
+		if (!lxc_monitord_match(client, ev))
+			continue;
+
+		DEBUG("writing client fd:%d", client->fd);
+		if (client->events) {
+			ev->stream_seq = client->stream_seq++;
+			lxc_monitord_client_queue(client, ev, sizeof(*ev));
+		} else {
+			lxc_monitord_client_queue(client, &msglxc, sizeof(msglxc));
+		}
+
+		/* a failing client is removed on EPOLLHUP */
+		if (!client->pollout)
+			lxc_monitord_client_flush(mon, client);
+	}
+}
+
+/* legacy publishers, without timestamps nor sequence numbers */
 static int lxc_monitord_fifo_handler(int fd, uint32_t events, void *data,
 				     struct lxc_epoll_descr *descr)
 {
-	int ret,i;
+	int ret;
 	struct lxc_msg msglxc;
+	struct lxc_event ev;
+	struct timespec ts;
 	struct lxc_monitor *mon = data;
 
 	ret = read(fd, &msglxc, sizeof(msglxc));
@@ -299,15 +542,66 @@ static int lxc_monitord_fifo_handler(int fd, uint32_t events, void *data,
 		return 1;
 	}
 
-	for (i = 0; i < mon->clientfds_cnt; i++) {
-		DEBUG("writing client fd:%d", mon->clientfds[i]);
-		ret = write(mon->clientfds[i], &msglxc, sizeof(msglxc));
-		if (ret < 0) {
-			ERROR("write failed to client sock:%d %d %s",
-			      mon->clientfds[i], errno, strerror(errno));
-		}
+	memset(&ev, 0, sizeof(ev));
+	ev.version = LXC_EVENT_VERSION;
+	ev.type = msglxc.type;
+	ev.value = msglxc.value;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	ev.timestamp = (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+	memcpy(ev.name, msglxc.name, sizeof(ev.name));
+	ev.name[sizeof(ev.name) - 1] = '\0';
+
+	lxc_monitord_broadcast(mon, &ev);
+	return 0;
+}
+
+static int lxc_monitord_publish_handler(int fd, uint32_t events, void *data,
+					struct lxc_epoll_descr *descr)
+{
+	char cmsgbuf[CMSG_SPACE(sizeof(struct ucred))];
+	struct lxc_monitor *mon = data;
+	struct cmsghdr *cmsg;
+	struct ucred *cred = NULL;
+	struct lxc_event ev;
+	struct msghdr msg;
+	struct iovec iov;
+	ssize_t ret;
+
+	memset(&msg, 0, sizeof(msg));
+	iov.iov_base = &ev;
+	iov.iov_len = sizeof(ev);
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	msg.msg_control = cmsgbuf;
+	msg.msg_controllen = sizeof(cmsgbuf);
+
+	ret = recvmsg(fd, &msg, MSG_DONTWAIT);
+	if (ret < 0) {
+		if (errno != EAGAIN && errno != EINTR)
+			SYSERROR("failed to receive event");
+		return 0;
+	}
+
+	for (cmsg = CMSG_FIRSTHDR(&msg); cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg))
+		if (cmsg->cmsg_level == SOL_SOCKET &&
+		    cmsg->cmsg_type == SCM_CREDENTIALS)
+			cred = (struct ucred *)CMSG_DATA(cmsg);
+
+	if (!cred || (cred->uid && cred->uid != geteuid())) {
+		WARN("event denied for uid:%d", cred ? (int)cred->uid : -1);
+		return 0;
 	}
 
+	if (ret != sizeof(ev) || ev.version != LXC_EVENT_VERSION) {
+		WARN("dropping event of size %zd from pid:%d", ret, cred->pid);
+		return 0;
+	}
+
+	ev.name[sizeof(ev.name) - 1] = '\0';
+	ev.cgroup[sizeof(ev.cgroup) - 1] = '\0';
+	ev.monitor_pid = cred->pid;
+
+	lxc_monitord_broadcast(mon, &ev);
 	return 0;
 }
 
@@ -329,6 +623,20 @@ static int lxc_monitord_mainloop_add(struct lxc_monitor *mon)
 		return -1;
 	}
 
+	ret = lxc_mainloop_add_handler(&mon->descr, mon->eventsfd,
+				       lxc_monitord_sock_accept, mon);
+	if (ret < 0) {
+		ERROR("failed to add to mainloop monitor handler for event socket");
+		return -1;
+	}
+
+	ret = lxc_mainloop_add_handler(&mon->descr, mon->publishfd,
+				       lxc_monitord_publish_handler, mon);
+	if (ret < 0) {
+		ERROR("failed to add to mainloop monitor handler for publish socket");
+		return -1;
+	}
+
 	return 0;
 }
 
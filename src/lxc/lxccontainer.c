@@ -24,6 +24,7 @@
 #include <errno.h>
 #include <fcntl.h>
 #include <grp.h>
+#include <inttypes.h>
 #include <libgen.h>
 #include <pthread.h>
 #include <sched.h>
@@ -32,6 +33,11 @@
 #include <stdio.h>
 #include <unistd.h>
 #include <arpa/inet.h>
+#include <net/if.h>
+#include <linux/netlink.h>
+#include <linux/rtnetlink.h>
+#include <sys/file.h>
+#include <sys/ioctl.h>
 #include <sys/mman.h>
 #include <sys/mount.h>
 #include <sys/syscall.h>
@@ -56,17 +62,12 @@
 #include "monitor.h"
 #include "namespace.h"
 #include "network.h"
+#include "nl.h"
 #include "sync.h"
 #include "state.h"
 #include "utils.h"
 #include "version.h"
 
-#if HAVE_IFADDRS_H
-#include <ifaddrs.h>
-#else
-#include <../include/ifaddrs.h>
-#endif
-
 #if IS_BIONIC
 #include <../include/lxcmntent.h>
 #else
@@ -75,6 +76,16 @@
 
 #define MAX_BUFFER 4096
 
+/* FITRIM lives in linux/fs.h, which does not mix with sys/mount.h */
+#ifndef FITRIM
+struct fstrim_range {
+	uint64_t start;
+	uint64_t len;
+	uint64_t minlen;
+};
+#define FITRIM _IOWR('X', 121, struct fstrim_range)
+#endif
+
 #define NOT_SUPPORTED_ERROR "the requested function %s is not currently supported with unprivileged containers"
 
 /* Define faccessat() if missing from the C library */
@@ -101,19 +112,6 @@ static bool get_snappath_dir(struct lxc_container *c, char *snappath);
 static bool lxcapi_snapshot_destroy_all(struct lxc_container *c);
 static bool do_lxcapi_save_config(struct lxc_container *c, const char *alt_file);
 
-static bool config_file_exists(const char *lxcpath, const char *cname)
-{
-	/* $lxcpath + '/' + $cname + '/config' + \0 */
-	int ret, len = strlen(lxcpath) + strlen(cname) + 9;
-	char *fname = alloca(len);
-
-	ret = snprintf(fname, len,  "%s/%s/config", lxcpath, cname);
-	if (ret < 0 || ret >= len)
-		return false;
-
-	return file_exists(fname);
-}
-
 /*
  * A few functions to help detect when a container creation failed.
  * If a container creation was killed partway through, then trying
@@ -251,6 +249,8 @@ static void lxc_container_free(struct lxc_container *c)
 		lxc_conf_free(c->lxc_conf);
 		c->lxc_conf = NULL;
 	}
+	lxc_cgroup_handle_free(c->cgroup_handle);
+	c->cgroup_handle = NULL;
 	free(c->config_path);
 	c->config_path = NULL;
 
@@ -340,12 +340,20 @@ out:
 	return ret;
 }
 
-#define WRAP_API(rettype, fnname)					\
+/*
+ * The configuration file is read on the first call that needs it, the
+ * _NOLOAD variants are for calls answered without it (mostly over the
+ * command socket) so that state queries never parse it. The others fail
+ * with @err if it cannot be read.
+ */
+#define __WRAP_API(load, rettype, err, fnname)				\
 static rettype fnname(struct lxc_container *c)				\
 {									\
 	rettype ret;							\
 	bool reset_config = false;					\
 									\
+	if (load && !lxc_container_load_pending_config(c))		\
+		return err;						\
 	if (!current_config && c && c->lxc_conf) {			\
 		current_config = c->lxc_conf;				\
 		reset_config = true;					\
@@ -358,12 +366,14 @@ static rettype fnname(struct lxc_container *c)				\
 	return ret;							\
 }
 
-#define WRAP_API_1(rettype, fnname, t1)					\
+#define __WRAP_API_1(load, rettype, err, fnname, t1)				\
 static rettype fnname(struct lxc_container *c, t1 a1)			\
 {									\
 	rettype ret;							\
 	bool reset_config = false;					\
 									\
+	if (load && !lxc_container_load_pending_config(c))		\
+		return err;						\
 	if (!current_config && c && c->lxc_conf) {			\
 		current_config = c->lxc_conf;				\
 		reset_config = true;					\
@@ -376,12 +386,14 @@ static rettype fnname(struct lxc_container *c, t1 a1)			\
 	return ret;							\
 }
 
-#define WRAP_API_2(rettype, fnname, t1, t2)				\
+#define __WRAP_API_2(load, rettype, err, fnname, t1, t2)			\
 static rettype fnname(struct lxc_container *c, t1 a1, t2 a2)		\
 {									\
 	rettype ret;							\
 	bool reset_config = false;					\
 									\
+	if (load && !lxc_container_load_pending_config(c))		\
+		return err;						\
 	if (!current_config && c && c->lxc_conf) {			\
 		current_config = c->lxc_conf;				\
 		reset_config = true;					\
@@ -394,12 +406,14 @@ static rettype fnname(struct lxc_container *c, t1 a1, t2 a2)		\
 	return ret;							\
 }
 
-#define WRAP_API_3(rettype, fnname, t1, t2, t3)				\
+#define __WRAP_API_3(load, rettype, err, fnname, t1, t2, t3)			\
 static rettype fnname(struct lxc_container *c, t1 a1, t2 a2, t3 a3)	\
 {									\
 	rettype ret;							\
 	bool reset_config = false;					\
 									\
+	if (load && !lxc_container_load_pending_config(c))		\
+		return err;						\
 	if (!current_config && c && c->lxc_conf) {			\
 		current_config = c->lxc_conf;				\
 		reset_config = true;					\
@@ -412,7 +426,16 @@ static rettype fnname(struct lxc_container *c, t1 a1, t2 a2, t3 a3)	\
 	return ret;							\
 }
 
-WRAP_API(bool, lxcapi_is_defined)
+#define WRAP_API(rettype, err, fnname) __WRAP_API(true, rettype, err, fnname)
+#define WRAP_API_1(rettype, err, fnname, t1) __WRAP_API_1(true, rettype, err, fnname, t1)
+#define WRAP_API_2(rettype, err, fnname, t1, t2) __WRAP_API_2(true, rettype, err, fnname, t1, t2)
+#define WRAP_API_3(rettype, err, fnname, t1, t2, t3) __WRAP_API_3(true, rettype, err, fnname, t1, t2, t3)
+#define WRAP_API_NOLOAD(rettype, fnname) __WRAP_API(false, rettype, 0, fnname)
+#define WRAP_API_1_NOLOAD(rettype, fnname, t1) __WRAP_API_1(false, rettype, 0, fnname, t1)
+#define WRAP_API_2_NOLOAD(rettype, fnname, t1, t2) __WRAP_API_2(false, rettype, 0, fnname, t1, t2)
+#define WRAP_API_3_NOLOAD(rettype, fnname, t1, t2, t3) __WRAP_API_3(false, rettype, 0, fnname, t1, t2, t3)
+
+WRAP_API_NOLOAD(bool, lxcapi_is_defined)
 
 static const char *do_lxcapi_state(struct lxc_container *c)
 {
@@ -424,7 +447,7 @@ static const char *do_lxcapi_state(struct lxc_container *c)
 	return lxc_state2str(s);
 }
 
-WRAP_API(const char *, lxcapi_state)
+WRAP_API_NOLOAD(const char *, lxcapi_state)
 
 static bool is_stopped(struct lxc_container *c)
 {
@@ -445,7 +468,7 @@ static bool do_lxcapi_is_running(struct lxc_container *c)
 	return true;
 }
 
-WRAP_API(bool, lxcapi_is_running)
+WRAP_API_NOLOAD(bool, lxcapi_is_running)
 
 static bool do_lxcapi_freeze(struct lxc_container *c)
 {
@@ -459,7 +482,7 @@ static bool do_lxcapi_freeze(struct lxc_container *c)
 	return true;
 }
 
-WRAP_API(bool, lxcapi_freeze)
+WRAP_API_NOLOAD(bool, lxcapi_freeze)
 
 static bool do_lxcapi_unfreeze(struct lxc_container *c)
 {
@@ -473,7 +496,39 @@ static bool do_lxcapi_unfreeze(struct lxc_container *c)
 	return true;
 }
 
-WRAP_API(bool, lxcapi_unfreeze)
+WRAP_API_NOLOAD(bool, lxcapi_unfreeze)
+
+static int freeze_containers(struct lxc_container **cts, int count, int freeze)
+{
+	const char **names;
+	int i, ret;
+
+	if (count < 0 || (count && !cts))
+		return -1;
+
+	/* names followed by lxcpaths */
+	names = malloc((2 * count + 1) * sizeof(char *));
+	if (!names)
+		return -1;
+	for (i = 0; i < count; i++) {
+		names[i] = cts[i]->name;
+		names[count + i] = cts[i]->config_path;
+	}
+
+	ret = lxc_freeze_thaw_all(freeze, count, names, names + count, NULL);
+	free(names);
+	return ret;
+}
+
+int lxc_freeze_containers(struct lxc_container **cts, int count)
+{
+	return freeze_containers(cts, count, 1);
+}
+
+int lxc_unfreeze_containers(struct lxc_container **cts, int count)
+{
+	return freeze_containers(cts, count, 0);
+}
 
 static int do_lxcapi_console_getfd(struct lxc_container *c, int *ttynum, int *masterfd)
 {
@@ -485,7 +540,7 @@ static int do_lxcapi_console_getfd(struct lxc_container *c, int *ttynum, int *ma
 	return ttyfd;
 }
 
-WRAP_API_2(int, lxcapi_console_getfd, int *, int *)
+WRAP_API_2(int, -1, lxcapi_console_getfd, int *, int *)
 
 static int lxcapi_console(struct lxc_container *c, int ttynum, int stdinfd,
 			  int stdoutfd, int stderrfd, int escape)
@@ -495,6 +550,8 @@ static int lxcapi_console(struct lxc_container *c, int ttynum, int stdinfd,
 	if (!c)
 		return -1;
 
+	if (!lxc_container_load_pending_config(c))
+		return -1;
 	current_config = c->lxc_conf;
 	ret = lxc_console(c, ttynum, stdinfd, stdoutfd, stderrfd, escape);
 	current_config = NULL;
@@ -509,7 +566,7 @@ static pid_t do_lxcapi_init_pid(struct lxc_container *c)
 	return lxc_cmd_get_init_pid(c->name, c->config_path);
 }
 
-WRAP_API(pid_t, lxcapi_init_pid)
+WRAP_API_NOLOAD(pid_t, lxcapi_init_pid)
 
 static bool load_config_locked(struct lxc_container *c, const char *fname)
 {
@@ -522,6 +579,44 @@ static bool load_config_locked(struct lxc_container *c, const char *fname)
 	return true;
 }
 
+static bool load_pending_config_locked(struct lxc_container *c)
+{
+	bool ret = true;
+
+	/* another thread may have read it while we waited for the lock */
+	if (!c->config_pending)
+		return true;
+
+	if (file_exists(c->configfile))
+		ret = load_config_locked(c, c->configfile);
+
+	if (ret) {
+		__atomic_store_n(&c->config_pending, false, __ATOMIC_RELEASE);
+	} else {
+		ERROR("Failed to load the configuration of %s from %s",
+		      c->name, c->configfile);
+		/* don't leave a half parsed config around, retry next time */
+		lxc_conf_free(c->lxc_conf);
+		c->lxc_conf = NULL;
+	}
+	return ret;
+}
+
+bool lxc_container_load_pending_config(struct lxc_container *c)
+{
+	bool ret;
+
+	if (!c || !__atomic_load_n(&c->config_pending, __ATOMIC_ACQUIRE))
+		return true;
+
+	if (container_disk_lock(c))
+		return false;
+	ret = load_pending_config_locked(c);
+	container_disk_unlock(c);
+
+	return ret;
+}
+
 static bool do_lxcapi_load_config(struct lxc_container *c, const char *alt_file)
 {
 	bool ret = false, need_disklock = false;
@@ -542,6 +637,9 @@ static bool do_lxcapi_load_config(struct lxc_container *c, const char *alt_file)
 	 */
 	if (strcmp(fname, c->configfile) == 0)
 		need_disklock = true;
+	else if (!lxc_container_load_pending_config(c))
+		/* alt_file adds to the container's own config */
+		return false;
 
 	if (need_disklock)
 		lret = container_disk_lock(c);
@@ -550,7 +648,11 @@ static bool do_lxcapi_load_config(struct lxc_container *c, const char *alt_file)
 	if (lret)
 		return false;
 
-	ret = load_config_locked(c, fname);
+	/* the pending read of our own config is this one */
+	if (need_disklock && c->config_pending)
+		ret = file_exists(fname) && load_pending_config_locked(c);
+	else
+		ret = load_config_locked(c, fname);
 
 	if (need_disklock)
 		container_disk_unlock(c);
@@ -559,7 +661,7 @@ static bool do_lxcapi_load_config(struct lxc_container *c, const char *alt_file)
 	return ret;
 }
 
-WRAP_API_1(bool, lxcapi_load_config, const char *)
+WRAP_API_1_NOLOAD(bool, lxcapi_load_config, const char *)
 
 static bool do_lxcapi_want_daemonize(struct lxc_container *c, bool state)
 {
@@ -574,7 +676,7 @@ static bool do_lxcapi_want_daemonize(struct lxc_container *c, bool state)
 	return true;
 }
 
-WRAP_API_1(bool, lxcapi_want_daemonize, bool)
+WRAP_API_1(bool, false, lxcapi_want_daemonize, bool)
 
 static bool do_lxcapi_want_close_all_fds(struct lxc_container *c, bool state)
 {
@@ -589,7 +691,7 @@ static bool do_lxcapi_want_close_all_fds(struct lxc_container *c, bool state)
 	return true;
 }
 
-WRAP_API_1(bool, lxcapi_want_close_all_fds, bool)
+WRAP_API_1(bool, false, lxcapi_want_close_all_fds, bool)
 
 static bool do_lxcapi_wait(struct lxc_container *c, const char *state, int timeout)
 {
@@ -602,7 +704,7 @@ static bool do_lxcapi_wait(struct lxc_container *c, const char *state, int timeo
 	return ret == 0;
 }
 
-WRAP_API_2(bool, lxcapi_wait, const char *, int)
+WRAP_API_2_NOLOAD(bool, lxcapi_wait, const char *, int)
 
 static bool do_wait_on_daemonized_start(struct lxc_container *c, int pid)
 {
@@ -619,7 +721,7 @@ static bool do_wait_on_daemonized_start(struct lxc_container *c, int pid)
 	return do_lxcapi_wait(c, "RUNNING", timeout);
 }
 
-WRAP_API_1(bool, wait_on_daemonized_start, int)
+WRAP_API_1(bool, false, wait_on_daemonized_start, int)
 
 static bool am_single_threaded(void)
 {
@@ -897,6 +999,9 @@ out:
 static bool lxcapi_start(struct lxc_container *c, int useinit, char * const argv[])
 {
 	bool ret;
+
+	if (!lxc_container_load_pending_config(c))
+		return false;
 	current_config = c ? c->lxc_conf : NULL;
 	ret = do_lxcapi_start(c, useinit, argv);
 	current_config = NULL;
@@ -916,6 +1021,8 @@ static bool lxcapi_startl(struct lxc_container *c, int useinit, ...)
 	if (!c)
 		return false;
 
+	if (!lxc_container_load_pending_config(c))
+		return false;
 	current_config = c->lxc_conf;
 
 	va_start(ap, useinit);
@@ -954,7 +1061,7 @@ static bool do_lxcapi_stop(struct lxc_container *c)
 	return ret == 0;
 }
 
-WRAP_API(bool, lxcapi_stop)
+WRAP_API(bool, false, lxcapi_stop)
 
 static int do_create_container_dir(const char *path, struct lxc_conf *conf)
 {
@@ -1008,7 +1115,7 @@ static bool create_container_dir(struct lxc_container *c)
  * it returns a mounted bdev on success, NULL on error.
  */
 static struct bdev *do_bdev_create(struct lxc_container *c, const char *type,
-			 struct bdev_specs *specs)
+			 struct bdev_specs *specs, int flags)
 {
 	char *dest;
 	size_t len;
@@ -1030,7 +1137,7 @@ static struct bdev *do_bdev_create(struct lxc_container *c, const char *type,
 	if (ret < 0 || ret >= len)
 		return NULL;
 
-	bdev = bdev_create(dest, type, c->name, specs);
+	bdev = bdev_create(dest, type, c->name, specs, flags);
 	if (!bdev) {
 		ERROR("Failed to create backing store type %s", type);
 		return NULL;
@@ -1394,6 +1501,7 @@ out_error:
 static void lxcapi_clear_config(struct lxc_container *c)
 {
 	if (c) {
+		__atomic_store_n(&c->config_pending, false, __ATOMIC_RELEASE);
 		if (c->lxc_conf) {
 			lxc_conf_free(c->lxc_conf);
 			c->lxc_conf = NULL;
@@ -1506,7 +1614,7 @@ static bool do_lxcapi_create(struct lxc_container *c, const char *t,
 	if (pid == 0) { // child
 		struct bdev *bdev = NULL;
 
-		if (!(bdev = do_bdev_create(c, bdevtype, specs))) {
+		if (!(bdev = do_bdev_create(c, bdevtype, specs, flags))) {
 			ERROR("Error creating backing store type %s for %s",
 				bdevtype ? bdevtype : "(none)", c->name);
 			exit(1);
@@ -1562,6 +1670,8 @@ static bool lxcapi_create(struct lxc_container *c, const char *t,
 		char *const argv[])
 {
 	bool ret;
+	if (!lxc_container_load_pending_config(c))
+		return false;
 	current_config = c ? c->lxc_conf : NULL;
 	ret = do_lxcapi_create(c, t, bdevtype, specs, flags, argv);
 	current_config = NULL;
@@ -1588,7 +1698,7 @@ static bool do_lxcapi_reboot(struct lxc_container *c)
 
 }
 
-WRAP_API(bool, lxcapi_reboot)
+WRAP_API(bool, false, lxcapi_reboot)
 
 static bool do_lxcapi_shutdown(struct lxc_container *c, int timeout)
 {
@@ -1619,7 +1729,7 @@ static bool do_lxcapi_shutdown(struct lxc_container *c, int timeout)
 	return retv;
 }
 
-WRAP_API_1(bool, lxcapi_shutdown, int)
+WRAP_API_1(bool, false, lxcapi_shutdown, int)
 
 static bool lxcapi_createl(struct lxc_container *c, const char *t,
 		const char *bdevtype, struct bdev_specs *specs, int flags, ...)
@@ -1631,6 +1741,8 @@ static bool lxcapi_createl(struct lxc_container *c, const char *t,
 	if (!c)
 		return false;
 
+	if (!lxc_container_load_pending_config(c))
+		return false;
 	current_config = c->lxc_conf;
 
 	/*
@@ -1682,13 +1794,19 @@ static bool do_lxcapi_clear_config_item(struct lxc_container *c, const char *key
 	return ret == 0;
 }
 
-WRAP_API_1(bool, lxcapi_clear_config_item, const char *)
+WRAP_API_1(bool, false, lxcapi_clear_config_item, const char *)
+
+static inline bool netns_needs_userns(struct lxc_container *c)
+{
+	return (geteuid() != 0 || (c->lxc_conf && !lxc_list_empty(&c->lxc_conf->id_map))) &&
+	       access("/proc/self/ns/user", F_OK) == 0;
+}
 
 static inline bool enter_net_ns(struct lxc_container *c)
 {
 	pid_t pid = do_lxcapi_init_pid(c);
 
-	if ((geteuid() != 0 || (c->lxc_conf && !lxc_list_empty(&c->lxc_conf->id_map))) && access("/proc/self/ns/user", F_OK) == 0) {
+	if (netns_needs_userns(c)) {
 		if (!switch_to_ns(pid, "user"))
 			return false;
 	}
@@ -1766,213 +1884,270 @@ static bool remove_from_array(char ***names, char *cname, int size)
 	return false;
 }
 
-static char ** do_lxcapi_get_interfaces(struct lxc_container *c)
+/* interface names of a network namespace, by index */
+struct netns_link {
+	int index;
+	char name[IFNAMSIZ];
+};
+
+struct netns_links {
+	struct netns_link *link;
+	int nr;
+	int size;
+};
+
+struct netns_addrs {
+	struct netns_links *links;
+	const char *interface;
+	int scope;
+	char **addresses;
+	int nr;
+};
+
+static int netns_open(struct lxc_container *c, struct nl_handler *nlh)
 {
-	pid_t pid;
-	int i, count = 0, pipefd[2];
-	char **interfaces = NULL;
-	char interface[IFNAMSIZ];
+	pid_t pid = do_lxcapi_init_pid(c);
+	int ret;
 
-	if(pipe(pipefd) < 0) {
-		SYSERROR("pipe failed");
-		return NULL;
-	}
+	if (pid < 0)
+		return -1;
 
-	pid = fork();
-	if (pid < 0) {
-		SYSERROR("failed to fork task to get interfaces information");
-		close(pipefd[0]);
-		close(pipefd[1]);
-		return NULL;
+	ret = lxc_netns_netlink_open(nlh, pid, netns_needs_userns(c));
+	if (ret < 0) {
+		ERROR("failed to open a netlink socket in the network namespace of %s: %s",
+		      c->name, strerror(-ret));
+		return -1;
 	}
 
-	if (pid == 0) { // child
-		int ret = 1, nbytes;
-		struct ifaddrs *interfaceArray = NULL, *tempIfAddr = NULL;
+	return 0;
+}
 
-		/* close the read-end of the pipe */
-		close(pipefd[0]);
+static int netns_link_cb(struct nlmsghdr *msg, void *data)
+{
+	struct netns_links *links = data;
+	struct ifinfomsg *ifi = NLMSG_DATA(msg);
+	struct netns_link *link;
+	struct rtattr *rta;
+	int len;
 
-		if (!enter_net_ns(c)) {
-			SYSERROR("failed to enter namespace");
-			goto out;
-		}
+	if (msg->nlmsg_type != RTM_NEWLINK)
+		return 0;
 
-		/* Grab the list of interfaces */
-		if (getifaddrs(&interfaceArray)) {
-			SYSERROR("failed to get interfaces list");
-			goto out;
-		}
+	len = msg->nlmsg_len - NLMSG_LENGTH(sizeof(*ifi));
+	for (rta = IFLA_RTA(ifi); RTA_OK(rta, len); rta = RTA_NEXT(rta, len)) {
+		if (rta->rta_type != IFLA_IFNAME)
+			continue;
 
-		/* Iterate through the interfaces */
-		for (tempIfAddr = interfaceArray; tempIfAddr != NULL; tempIfAddr = tempIfAddr->ifa_next) {
-			nbytes = write(pipefd[1], tempIfAddr->ifa_name, IFNAMSIZ);
-			if (nbytes < 0) {
-				ERROR("write failed");
-				goto out;
-			}
-			count++;
+		if (links->nr == links->size) {
+			link = realloc(links->link, (links->size * 2 + 8) * sizeof(*link));
+			if (!link)
+				return -ENOMEM;
+			links->link = link;
+			links->size = links->size * 2 + 8;
 		}
-		ret = 0;
 
-	out:
-		if (interfaceArray)
-			freeifaddrs(interfaceArray);
+		link = &links->link[links->nr++];
+		link->index = ifi->ifi_index;
+		snprintf(link->name, sizeof(link->name), "%.*s",
+			 (int)RTA_PAYLOAD(rta), (char *)RTA_DATA(rta));
+		break;
+	}
 
-		/* close the write-end of the pipe, thus sending EOF to the reader */
-		close(pipefd[1]);
-		exit(ret);
+	return 0;
+}
+
+static int netns_get_links(struct nl_handler *nlh, struct netns_links *links)
+{
+	struct ifinfomsg ifi = { .ifi_family = AF_UNSPEC };
+
+	return netlink_dump(nlh, RTM_GETLINK, &ifi, sizeof(ifi),
+			    netns_link_cb, links);
+}
+
+static const char *netns_link_name(struct netns_links *links, int index)
+{
+	int i;
+
+	for (i = 0; i < links->nr; i++)
+		if (links->link[i].index == index)
+			return links->link[i].name;
+
+	return NULL;
+}
+
+/*
+ * Filter addresses the way getifaddrs() presents them: the local address
+ * of point to point links rather than the peer, IPv4 labels as interface
+ * names and link-local IPv6 addresses scoped to their interface.
+ */
+static int netns_addr_cb(struct nlmsghdr *msg, void *data)
+{
+	struct netns_addrs *addrs = data;
+	struct ifaddrmsg *ifa = NLMSG_DATA(msg);
+	struct rtattr *rta;
+	const char *ifname = NULL;
+	void *addr = NULL;
+	char buf[INET6_ADDRSTRLEN];
+	char **addresses;
+	size_t addrlen;
+	int len;
+
+	if (msg->nlmsg_type != RTM_NEWADDR)
+		return 0;
+
+	if (ifa->ifa_family == AF_INET)
+		addrlen = sizeof(struct in_addr);
+	else if (ifa->ifa_family == AF_INET6)
+		addrlen = sizeof(struct in6_addr);
+	else
+		return 0;
+
+	len = IFA_PAYLOAD(msg);
+	for (rta = IFA_RTA(ifa); RTA_OK(rta, len); rta = RTA_NEXT(rta, len)) {
+		switch (rta->rta_type) {
+		case IFA_LOCAL:
+			if (RTA_PAYLOAD(rta) == addrlen)
+				addr = RTA_DATA(rta);
+			break;
+		case IFA_ADDRESS:
+			if (!addr && RTA_PAYLOAD(rta) == addrlen)
+				addr = RTA_DATA(rta);
+			break;
+		case IFA_LABEL:
+			if (ifa->ifa_family == AF_INET)
+				ifname = RTA_DATA(rta);
+			break;
+		}
 	}
 
-	/* close the write-end of the pipe */
-	close(pipefd[1]);
+	if (!addr)
+		return 0;
 
-	while (read(pipefd[0], &interface, IFNAMSIZ) == IFNAMSIZ) {
-		if (array_contains(&interfaces, interface, count))
-				continue;
+	if (ifa->ifa_family == AF_INET6) {
+		struct in6_addr *in6 = addr;
+		int scope_id = 0;
 
-		if(!add_to_array(&interfaces, interface, count))
-			ERROR("PARENT: add_to_array failed");
-		count++;
+		if (IN6_IS_ADDR_LINKLOCAL(in6) || IN6_IS_ADDR_MC_LINKLOCAL(in6))
+			scope_id = ifa->ifa_index;
+		if (scope_id != addrs->scope)
+			return 0;
 	}
 
-	if (wait_for_pid(pid) != 0) {
-		for(i=0;i<count;i++)
-			free(interfaces[i]);
-		free(interfaces);
-		interfaces = NULL;
+	if (!ifname)
+		ifname = netns_link_name(addrs->links, ifa->ifa_index);
+
+	if (addrs->interface) {
+		if (!ifname || strcmp(addrs->interface, ifname))
+			return 0;
+	} else if (ifname && strcmp("lo", ifname) == 0) {
+		return 0;
 	}
 
-	/* close the read-end of the pipe */
-	close(pipefd[0]);
+	if (!inet_ntop(ifa->ifa_family, addr, buf, sizeof(buf)))
+		return 0;
 
-	/* Append NULL to the array */
-	if(interfaces)
-		interfaces = (char **)lxc_append_null_to_array((void **)interfaces, count);
+	addresses = realloc(addrs->addresses, (addrs->nr + 2) * sizeof(char *));
+	if (!addresses)
+		return -ENOMEM;
+	addrs->addresses = addresses;
 
-	return interfaces;
-}
+	addresses[addrs->nr] = strdup(buf);
+	if (!addresses[addrs->nr])
+		return -ENOMEM;
+	addresses[++addrs->nr] = NULL;
 
-WRAP_API(char **, lxcapi_get_interfaces)
+	return 0;
+}
 
-static char** do_lxcapi_get_ips(struct lxc_container *c, const char* interface, const char* family, int scope)
+static char ** do_lxcapi_get_interfaces(struct lxc_container *c)
 {
-	pid_t pid;
-	int i, count = 0, pipefd[2];
-	char **addresses = NULL;
-	char address[INET6_ADDRSTRLEN];
+	struct nl_handler nlh;
+	struct netns_links links = { NULL, 0, 0 };
+	char **interfaces = NULL;
+	int i, ret;
 
-	if(pipe(pipefd) < 0) {
-		SYSERROR("pipe failed");
+	if (!c)
 		return NULL;
-	}
 
-	pid = fork();
-	if (pid < 0) {
-		SYSERROR("failed to fork task to get container ips");
-		close(pipefd[0]);
-		close(pipefd[1]);
+	if (netns_open(c, &nlh) < 0)
 		return NULL;
-	}
 
-	if (pid == 0) { // child
-		int ret = 1, nbytes;
-		struct ifaddrs *interfaceArray = NULL, *tempIfAddr = NULL;
-		char addressOutputBuffer[INET6_ADDRSTRLEN];
-		void *tempAddrPtr = NULL;
-		char *address = NULL;
+	ret = netns_get_links(&nlh, &links);
+	netlink_close(&nlh);
+	if (ret < 0) {
+		ERROR("failed to get interfaces list: %s", strerror(-ret));
+		goto out;
+	}
 
-		/* close the read-end of the pipe */
-		close(pipefd[0]);
+	if (!links.nr)
+		goto out;
 
-		if (!enter_net_ns(c)) {
-			SYSERROR("failed to enter namespace");
-			goto out;
-		}
+	interfaces = malloc((links.nr + 1) * sizeof(char *));
+	if (!interfaces)
+		goto out;
 
-		/* Grab the list of interfaces */
-		if (getifaddrs(&interfaceArray)) {
-			SYSERROR("failed to get interfaces list");
+	for (i = 0; i < links.nr; i++) {
+		interfaces[i] = strdup(links.link[i].name);
+		if (!interfaces[i]) {
+			lxc_free_array((void **)interfaces, free);
+			interfaces = NULL;
 			goto out;
 		}
+		interfaces[i + 1] = NULL;
+	}
 
-		/* Iterate through the interfaces */
-		for (tempIfAddr = interfaceArray; tempIfAddr != NULL; tempIfAddr = tempIfAddr->ifa_next) {
-			if (tempIfAddr->ifa_addr == NULL)
-				continue;
-
-			if(tempIfAddr->ifa_addr->sa_family == AF_INET) {
-				if (family && strcmp(family, "inet"))
-					continue;
-				tempAddrPtr = &((struct sockaddr_in *)tempIfAddr->ifa_addr)->sin_addr;
-			}
-			else {
-				if (family && strcmp(family, "inet6"))
-					continue;
-
-				if (((struct sockaddr_in6 *)tempIfAddr->ifa_addr)->sin6_scope_id != scope)
-					continue;
-
-				tempAddrPtr = &((struct sockaddr_in6 *)tempIfAddr->ifa_addr)->sin6_addr;
-			}
+	qsort(interfaces, links.nr, sizeof(char *), (int (*)(const void *,const void *))string_cmp);
 
-			if (interface && strcmp(interface, tempIfAddr->ifa_name))
-				continue;
-			else if (!interface && strcmp("lo", tempIfAddr->ifa_name) == 0)
-				continue;
+out:
+	free(links.link);
+	return interfaces;
+}
 
-			address = (char *)inet_ntop(tempIfAddr->ifa_addr->sa_family,
-						tempAddrPtr,
-						addressOutputBuffer,
-						sizeof(addressOutputBuffer));
-			if (!address)
-					continue;
+WRAP_API(char **, NULL, lxcapi_get_interfaces)
 
-			nbytes = write(pipefd[1], address, INET6_ADDRSTRLEN);
-			if (nbytes < 0) {
-				ERROR("write failed");
-				goto out;
-			}
-			count++;
-		}
-		ret = 0;
+static char** do_lxcapi_get_ips(struct lxc_container *c, const char* interface, const char* family, int scope)
+{
+	struct nl_handler nlh;
+	struct netns_links links = { NULL, 0, 0 };
+	struct netns_addrs addrs = { &links, interface, scope, NULL, 0 };
+	struct ifaddrmsg ifa = { .ifa_family = AF_UNSPEC };
+	int ret;
 
-	out:
-		if(interfaceArray)
-			freeifaddrs(interfaceArray);
+	if (!c)
+		return NULL;
 
-		/* close the write-end of the pipe, thus sending EOF to the reader */
-		close(pipefd[1]);
-		exit(ret);
+	if (family) {
+		if (strcmp(family, "inet") == 0)
+			ifa.ifa_family = AF_INET;
+		else if (strcmp(family, "inet6") == 0)
+			ifa.ifa_family = AF_INET6;
+		else
+			return NULL;
 	}
 
-	/* close the write-end of the pipe */
-	close(pipefd[1]);
+	if (netns_open(c, &nlh) < 0)
+		return NULL;
 
-	while (read(pipefd[0], &address, INET6_ADDRSTRLEN) == INET6_ADDRSTRLEN) {
-		if(!add_to_array(&addresses, address, count))
-			ERROR("PARENT: add_to_array failed");
-		count++;
-	}
+	ret = netns_get_links(&nlh, &links);
+	if (ret == 0)
+		ret = netlink_dump(&nlh, RTM_GETADDR, &ifa, sizeof(ifa),
+				   netns_addr_cb, &addrs);
+	netlink_close(&nlh);
+	free(links.link);
 
-	if (wait_for_pid(pid) != 0) {
-		for(i=0;i<count;i++)
-			free(addresses[i]);
-		free(addresses);
-		addresses = NULL;
+	if (ret < 0) {
+		ERROR("failed to get addresses list: %s", strerror(-ret));
+		lxc_free_array((void **)addrs.addresses, free);
+		return NULL;
 	}
 
-	/* close the read-end of the pipe */
-	close(pipefd[0]);
+	if (addrs.addresses)
+		qsort(addrs.addresses, addrs.nr, sizeof(char *), (int (*)(const void *,const void *))string_cmp);
 
-	/* Append NULL to the array */
-	if(addresses)
-		addresses = (char **)lxc_append_null_to_array((void **)addresses, count);
-
-	return addresses;
+	return addrs.addresses;
 }
 
-WRAP_API_3(char **, lxcapi_get_ips, const char *, const char *, int)
+WRAP_API_3(char **, NULL, lxcapi_get_ips, const char *, const char *, int)
 
 static int do_lxcapi_get_config_item(struct lxc_container *c, const char *key, char *retv, int inlen)
 {
@@ -1987,7 +2162,7 @@ static int do_lxcapi_get_config_item(struct lxc_container *c, const char *key, c
 	return ret;
 }
 
-WRAP_API_3(int, lxcapi_get_config_item, const char *, char *, int)
+WRAP_API_3(int, -1, lxcapi_get_config_item, const char *, char *, int)
 
 static char* do_lxcapi_get_running_config_item(struct lxc_container *c, const char *key)
 {
@@ -2002,7 +2177,7 @@ static char* do_lxcapi_get_running_config_item(struct lxc_container *c, const ch
 	return ret;
 }
 
-WRAP_API_1(char *, lxcapi_get_running_config_item, const char *)
+WRAP_API_1(char *, NULL, lxcapi_get_running_config_item, const char *)
 
 static int do_lxcapi_get_keys(struct lxc_container *c, const char *key, char *retv, int inlen)
 {
@@ -2024,7 +2199,7 @@ static int do_lxcapi_get_keys(struct lxc_container *c, const char *key, char *re
 	return ret;
 }
 
-WRAP_API_3(int, lxcapi_get_keys, const char *, char *, int)
+WRAP_API_3(int, -1, lxcapi_get_keys, const char *, char *, int)
 
 static bool do_lxcapi_save_config(struct lxc_container *c, const char *alt_file)
 {
@@ -2079,7 +2254,7 @@ out:
 	return ret;
 }
 
-WRAP_API_1(bool, lxcapi_save_config, const char *)
+WRAP_API_1(bool, false, lxcapi_save_config, const char *)
 
 
 static bool mod_rdep(struct lxc_container *c0, struct lxc_container *c, bool inc)
@@ -2324,88 +2499,313 @@ static int lxc_rmdir_onedev_wrapper(void *data)
 	return lxc_rmdir_onedev(arg, "snaps");
 }
 
-static bool container_destroy(struct lxc_container *c)
+/*
+ * Rename @src to a fresh hidden directory next to it, where it is out of
+ * the way (lxc-ls skips hidden entries) until it gets removed.
+ * Returns the new path, or NULL if @src has to be removed in place.
+ */
+static char *move_to_trash(const char *src)
 {
-	bool bret = false;
-	int ret = 0;
-	struct lxc_conf *conf;
+	const char *base;
+	char *trash;
+	size_t len;
 
-	if (!c || !do_lxcapi_is_defined(c))
-		return false;
+	base = strrchr(src, '/');
+	if (!base || !base[1])
+		return NULL;
 
-	conf = c->lxc_conf;
-	if (container_disk_lock(c))
-		return false;
+	len = strlen(src) + sizeof("/..trash.XXXXXX");
+	trash = malloc(len);
+	if (!trash)
+		return NULL;
+	snprintf(trash, len, "%.*s/.%s.trash.XXXXXX", (int)(base - src), src, base + 1);
 
-	if (!is_stopped(c)) {
-		// we should queue some sort of error - in c->error_string?
-		ERROR("container %s is not stopped", c->name);
-		goto out;
+	if (!mkdtemp(trash)) {
+		SYSERROR("Failed to create %s", trash);
+		free(trash);
+		return NULL;
 	}
+	if (rename(src, trash) < 0) {
+		SYSERROR("Failed to move %s to %s", src, trash);
+		rmdir(trash);
+		free(trash);
+		return NULL;
+	}
+	return trash;
+}
 
-	if (conf && !lxc_list_empty(&conf->hooks[LXCHOOK_DESTROY])) {
-		/* Start of environment variable setup for hooks */
-		if (c->name && setenv("LXC_NAME", c->name, 1)) {
-			SYSERROR("failed to set environment variable for container name");
-		}
-		if (conf->rcfile && setenv("LXC_CONFIG_FILE", conf->rcfile, 1)) {
-			SYSERROR("failed to set environment variable for config path");
-		}
-		if (conf->rootfs.mount && setenv("LXC_ROOTFS_MOUNT", conf->rootfs.mount, 1)) {
-			SYSERROR("failed to set environment variable for rootfs mount");
-		}
-		if (conf->rootfs.path && setenv("LXC_ROOTFS_PATH", conf->rootfs.path, 1)) {
-			SYSERROR("failed to set environment variable for rootfs mount");
-		}
-		if (conf->console.path && setenv("LXC_CONSOLE", conf->console.path, 1)) {
-			SYSERROR("failed to set environment variable for console path");
-		}
-		if (conf->console.log_path && setenv("LXC_CONSOLE_LOGPATH", conf->console.log_path, 1)) {
-			SYSERROR("failed to set environment variable for console log");
-		}
-		/* End of environment variable setup for hooks */
+/*
+ * A reaper holds a flock on each trash directory while removing it, so a
+ * trash directory nobody holds a lock on was left behind by a reaper that
+ * died.
+ */
+static int lock_trash(const char *trash, bool wait)
+{
+	int fd;
 
-		if (run_lxc_hooks(c->name, "destroy", conf, c->get_config_path(c), NULL)) {
-			ERROR("Error executing clone hook for %s", c->name);
-			goto out;
-		}
+	fd = open(trash, O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+	if (fd < 0)
+		return -1;
+	if (flock(fd, wait ? LOCK_EX : LOCK_EX | LOCK_NB) < 0) {
+		close(fd);
+		return -1;
 	}
+	return fd;
+}
 
-	if (current_config && conf == current_config) {
-		current_config = NULL;
-		if (conf->logfd != -1) {
-			close(conf->logfd);
-			conf->logfd = -1;
+static int remove_trash(struct lxc_conf *conf, char **trash, int nr)
+{
+	int err, fd, i, ret = 0;
+
+	for (i = 0; i < nr; i++) {
+		/* another reaper may have swept it up already */
+		fd = lock_trash(trash[i], true);
+		if (fd < 0 && errno == ENOENT)
+			continue;
+		if (fd >= 0 && access(trash[i], F_OK) < 0) {
+			close(fd);
+			continue;
 		}
-	}
 
-	if (conf && conf->rootfs.path && conf->rootfs.mount) {
-		if (!do_destroy_container(conf)) {
-			ERROR("Error destroying rootfs for %s", c->name);
+		if (am_unpriv())
+			err = userns_exec_1(conf, lxc_rmdir_onedev_wrapper, trash[i]);
+		else
+			err = lxc_rmdir_onedev(trash[i], "snaps");
+		if (err < 0) {
+			ERROR("Failed to remove %s, it is left behind", trash[i]);
+			ret = -1;
+		}
+		if (fd >= 0)
+			close(fd);
+	}
+	return ret;
+}
+
+/*
+ * Add the trash directories in @dir whose reaper is gone to the @nr entries
+ * of @trash, which are skipped.  Returns the new number of entries.
+ */
+static int find_stale_trash(const char *dir, char ***trash, int nr)
+{
+	struct dirent *direntp;
+	char *path, **tmp;
+	size_t len;
+	DIR *d;
+	int fd, i, own = nr;
+
+	d = opendir(dir);
+	if (!d)
+		return nr;
+
+	while ((direntp = readdir(d))) {
+		const char *name = direntp->d_name;
+
+		/* .<name>.trash.XXXXXX */
+		len = strlen(name);
+		if (name[0] != '.' || len < sizeof("..trash.XXXXXX") - 1 ||
+		    strncmp(name + len - 13, ".trash.", 7) != 0)
+			continue;
+		if (direntp->d_type != DT_DIR && direntp->d_type != DT_UNKNOWN)
+			continue;
+
+		if (asprintf(&path, "%s/%s", dir, name) < 0)
+			break;
+		for (i = 0; i < own; i++)
+			if (strcmp((*trash)[i], path) == 0)
+				break;
+		if (i < own) {
+			free(path);
+			continue;
+		}
+		fd = lock_trash(path, false);
+		if (fd < 0) {
+			free(path);
+			continue;
+		}
+		close(fd);
+
+		tmp = realloc(*trash, (nr + 1) * sizeof(**trash));
+		if (!tmp) {
+			free(path);
+			break;
+		}
+		*trash = tmp;
+		(*trash)[nr++] = path;
+		INFO("Removing %s left behind by an earlier destroy", path);
+	}
+
+	closedir(d);
+	return nr;
+}
+
+/*
+ * Remove the trashed directories from a detached grandchild, so the caller
+ * only waits for the first fork. Without a child they are removed here.
+ */
+static int reap_trash(struct lxc_conf *conf, char **trash, int nr)
+{
+	pid_t pid;
+
+	pid = fork();
+	if (pid < 0) {
+		SYSERROR("Failed to fork, removing %s in the foreground", trash[0]);
+		return remove_trash(conf, trash, nr);
+	}
+
+	if (pid == 0) {
+		/* without a second fork the first child does the work */
+		pid = fork();
+		if (pid > 0)
+			_exit(EXIT_SUCCESS);
+		if (chdir("/") < 0)
+			_exit(EXIT_FAILURE);
+		/* conf is NULL for a container without a config file, in which
+		 * case only lxc.close_all_fds does not apply
+		 */
+		lxc_check_inherited(conf, true, -1);
+		if (null_stdfds() < 0)
+			_exit(EXIT_FAILURE);
+		setsid();
+		_exit(remove_trash(conf, trash, nr) < 0 ? EXIT_FAILURE : EXIT_SUCCESS);
+	}
+
+	return wait_for_pid(pid);
+}
+
+static bool container_destroy(struct lxc_container *c)
+{
+	bool bret = false, background;
+	int ret = 0, nr_trash = 0;
+	char **trash;
+	struct lxc_conf *conf;
+
+	if (!c || !do_lxcapi_is_defined(c))
+		return false;
+
+	background = c->background_destroy;
+
+	/* room for the rootfs and the container directory */
+	trash = malloc(2 * sizeof(*trash));
+	if (!trash)
+		return false;
+
+	conf = c->lxc_conf;
+	if (container_disk_lock(c)) {
+		free(trash);
+		return false;
+	}
+
+	if (!is_stopped(c)) {
+		// we should queue some sort of error - in c->error_string?
+		ERROR("container %s is not stopped", c->name);
+		goto out;
+	}
+
+	if (conf && !lxc_list_empty(&conf->hooks[LXCHOOK_DESTROY])) {
+		/* Start of environment variable setup for hooks */
+		if (c->name && setenv("LXC_NAME", c->name, 1)) {
+			SYSERROR("failed to set environment variable for container name");
+		}
+		if (conf->rcfile && setenv("LXC_CONFIG_FILE", conf->rcfile, 1)) {
+			SYSERROR("failed to set environment variable for config path");
+		}
+		if (conf->rootfs.mount && setenv("LXC_ROOTFS_MOUNT", conf->rootfs.mount, 1)) {
+			SYSERROR("failed to set environment variable for rootfs mount");
+		}
+		if (conf->rootfs.path && setenv("LXC_ROOTFS_PATH", conf->rootfs.path, 1)) {
+			SYSERROR("failed to set environment variable for rootfs mount");
+		}
+		if (conf->console.path && setenv("LXC_CONSOLE", conf->console.path, 1)) {
+			SYSERROR("failed to set environment variable for console path");
+		}
+		if (conf->console.log_path && setenv("LXC_CONSOLE_LOGPATH", conf->console.log_path, 1)) {
+			SYSERROR("failed to set environment variable for console log");
+		}
+		/* End of environment variable setup for hooks */
+
+		if (run_lxc_hooks(c->name, "destroy", conf, c->get_config_path(c), NULL)) {
+			ERROR("Error executing clone hook for %s", c->name);
 			goto out;
 		}
-		INFO("Destroyed rootfs for %s", c->name);
 	}
 
-	mod_all_rdeps(c, false);
+	if (current_config && conf == current_config) {
+		current_config = NULL;
+		if (conf->logfd != -1) {
+			close(conf->logfd);
+			conf->logfd = -1;
+		}
+	}
 
 	const char *p1 = do_lxcapi_get_config_path(c);
 	char *path = alloca(strlen(p1) + strlen(c->name) + 2);
 	sprintf(path, "%s/%s", p1, c->name);
-	if (am_unpriv())
-		ret = userns_exec_1(conf, lxc_rmdir_onedev_wrapper, path);
-	else
-		ret = lxc_rmdir_onedev(path, "snaps");
-	if (ret < 0) {
-		ERROR("Error destroying container directory for %s", c->name);
+
+	if (background) {
+		/* snapshots kept in the container directory have to stay */
+		char *snaps = alloca(strlen(path) + sizeof("/snaps"));
+		sprintf(snaps, "%s/snaps", path);
+		if (rmdir(snaps) < 0 && errno != ENOENT) {
+			INFO("%s has snapshots, destroying it in the foreground", c->name);
+			background = false;
+		}
+	}
+
+	if (conf && conf->rootfs.path && conf->rootfs.mount) {
+		const char *rootfs = NULL;
+		size_t len = strlen(path);
+
+		if (background && bdev_is_dir(conf, conf->rootfs.path)) {
+			rootfs = conf->rootfs.path;
+			if (strncmp(rootfs, "dir:", 4) == 0)
+				rootfs += 4;
+		}
+
+		/* a rootfs within the container directory goes along with it */
+		if (rootfs && strncmp(rootfs, path, len) == 0 && rootfs[len] == '/') {
+			INFO("Moving rootfs for %s along with its directory", c->name);
+		} else if (rootfs && (trash[nr_trash] = move_to_trash(rootfs))) {
+			INFO("Moved rootfs for %s to %s", c->name, trash[nr_trash]);
+			nr_trash++;
+		} else {
+			if (!do_destroy_container(conf)) {
+				ERROR("Error destroying rootfs for %s", c->name);
+				goto out;
+			}
+			INFO("Destroyed rootfs for %s", c->name);
+		}
+	}
+
+	mod_all_rdeps(c, false);
+
+	if (background && (trash[nr_trash] = move_to_trash(path))) {
+		INFO("Moved directory for %s to %s", c->name, trash[nr_trash]);
+		nr_trash++;
+	} else {
+		if (am_unpriv())
+			ret = userns_exec_1(conf, lxc_rmdir_onedev_wrapper, path);
+		else
+			ret = lxc_rmdir_onedev(path, "snaps");
+		if (ret < 0) {
+			ERROR("Error destroying container directory for %s", c->name);
+			goto out;
+		}
+		INFO("Destroyed directory for %s", c->name);
+	}
+
+	nr_trash = find_stale_trash(p1, &trash, nr_trash);
+	if (nr_trash && reap_trash(conf, trash, nr_trash) < 0) {
+		ERROR("Error removing the trashed files of %s", c->name);
 		goto out;
 	}
-	INFO("Destroyed directory for %s", c->name);
 
 	bret = true;
 
 out:
 	container_disk_unlock(c);
+	while (nr_trash > 0)
+		free(trash[--nr_trash]);
+	free(trash);
 	return bret;
 }
 
@@ -2426,7 +2826,7 @@ static bool do_lxcapi_destroy(struct lxc_container *c)
 	return container_destroy(c);
 }
 
-WRAP_API(bool, lxcapi_destroy)
+WRAP_API(bool, false, lxcapi_destroy)
 
 static bool do_lxcapi_destroy_with_snapshots(struct lxc_container *c)
 {
@@ -2439,12 +2839,15 @@ static bool do_lxcapi_destroy_with_snapshots(struct lxc_container *c)
 	return lxcapi_destroy(c);
 }
 
-WRAP_API(bool, lxcapi_destroy_with_snapshots)
+WRAP_API(bool, false, lxcapi_destroy_with_snapshots)
 
 static bool set_config_item_locked(struct lxc_container *c, const char *key, const char *v)
 {
 	struct lxc_config_t *config;
 
+	/* never start over from an empty config when ours failed to parse */
+	if (c->config_pending)
+		return false;
 	if (!c->lxc_conf)
 		c->lxc_conf = lxc_conf_init();
 	if (!c->lxc_conf)
@@ -2473,7 +2876,7 @@ static bool do_lxcapi_set_config_item(struct lxc_container *c, const char *key,
 	return b;
 }
 
-WRAP_API_2(bool, lxcapi_set_config_item, const char *, const char *)
+WRAP_API_2(bool, false, lxcapi_set_config_item, const char *, const char *)
 
 static char *lxcapi_config_file_name(struct lxc_container *c)
 {
@@ -2553,6 +2956,13 @@ static bool do_lxcapi_set_config_path(struct lxc_container *c, const char *path)
 		free(c->config_path);
 		c->config_path = oldpath;
 		oldpath = NULL;
+	} else if (c->cgroup_handle) {
+		/* the cached cgroups belong to the old lxcpath */
+		lxc_cgroup_handle_free(c->cgroup_handle);
+		c->cgroup_handle = lxc_cgroup_handle_new(c->name, c->config_path);
+		if (!c->cgroup_handle)
+			ERROR("Failed to create a cgroup handle for %s, cgroups are no longer cached",
+			      c->name);
 	}
 err:
 	free(oldpath);
@@ -2560,7 +2970,7 @@ err:
 	return b;
 }
 
-WRAP_API_1(bool, lxcapi_set_config_path, const char *)
+WRAP_API_1(bool, false, lxcapi_set_config_path, const char *)
 
 static bool do_lxcapi_set_cgroup_item(struct lxc_container *c, const char *subsys, const char *value)
 {
@@ -2572,6 +2982,15 @@ static bool do_lxcapi_set_cgroup_item(struct lxc_container *c, const char *subsy
 	if (is_stopped(c))
 		return false;
 
+	if (container_mem_lock(c))
+		return false;
+	if (c->cgroup_handle) {
+		ret = lxc_cgroup_handle_set(c->cgroup_handle, subsys, value);
+		container_mem_unlock(c);
+		return ret == 0;
+	}
+	container_mem_unlock(c);
+
 	if (container_disk_lock(c))
 		return false;
 
@@ -2581,7 +3000,7 @@ static bool do_lxcapi_set_cgroup_item(struct lxc_container *c, const char *subsy
 	return ret == 0;
 }
 
-WRAP_API_2(bool, lxcapi_set_cgroup_item, const char *, const char *)
+WRAP_API_2_NOLOAD(bool, lxcapi_set_cgroup_item, const char *, const char *)
 
 static int do_lxcapi_get_cgroup_item(struct lxc_container *c, const char *subsys, char *retv, int inlen)
 {
@@ -2593,6 +3012,15 @@ static int do_lxcapi_get_cgroup_item(struct lxc_container *c, const char *subsys
 	if (is_stopped(c))
 		return -1;
 
+	if (container_mem_lock(c))
+		return -1;
+	if (c->cgroup_handle) {
+		ret = lxc_cgroup_handle_get(c->cgroup_handle, subsys, retv, inlen);
+		container_mem_unlock(c);
+		return ret;
+	}
+	container_mem_unlock(c);
+
 	if (container_disk_lock(c))
 		return -1;
 
@@ -2602,77 +3030,227 @@ static int do_lxcapi_get_cgroup_item(struct lxc_container *c, const char *subsys
 	return ret;
 }
 
-WRAP_API_3(int, lxcapi_get_cgroup_item, const char *, char *, int)
+WRAP_API_3_NOLOAD(int, lxcapi_get_cgroup_item, const char *, char *, int)
 
-const char *lxc_get_global_config_item(const char *key)
+/*
+ * Unlike get_cgroup_item this takes no disk lock and does no separate state
+ * query, metrics collectors call it for many containers at a time.
+ */
+static int do_lxcapi_get_cgroup_stats(struct lxc_container *c,
+				      struct lxc_cgroup_stats *stats,
+				      unsigned int size)
 {
-	return lxc_global_config_value(key);
+	struct lxc_cgroup_stats s;
+	int ret;
+
+	if (!c || !stats || size > sizeof(s))
+		return -1;
+
+	if (container_mem_lock(c))
+		return -1;
+	if (c->cgroup_handle) {
+		ret = lxc_cgroup_handle_get_stats(c->cgroup_handle, &s);
+		container_mem_unlock(c);
+	} else {
+		container_mem_unlock(c);
+		ret = lxc_cgroup_get_stats(c->name, c->config_path, &s);
+	}
+	if (ret < 0)
+		return -1;
+
+	memcpy(stats, &s, size);
+	return 0;
 }
 
-const char *lxc_get_version(void)
+WRAP_API_2_NOLOAD(int, lxcapi_get_cgroup_stats, struct lxc_cgroup_stats *, unsigned int)
+
+static bool do_lxcapi_want_cgroup_cache(struct lxc_container *c, bool state)
 {
-	return LXC_VERSION;
+	bool ret;
+
+	if (!c)
+		return false;
+	if (container_mem_lock(c)) {
+		ERROR("Error getting mem lock");
+		return false;
+	}
+
+	if (state && !c->cgroup_handle) {
+		c->cgroup_handle = lxc_cgroup_handle_new(c->name, c->config_path);
+	} else if (!state) {
+		lxc_cgroup_handle_free(c->cgroup_handle);
+		c->cgroup_handle = NULL;
+	}
+	ret = !state || c->cgroup_handle;
+
+	container_mem_unlock(c);
+	return ret;
 }
 
-static int copy_file(const char *old, const char *new)
-{
-	int in, out;
-	ssize_t len, ret;
-	char buf[8096];
-	struct stat sbuf;
+WRAP_API_1_NOLOAD(bool, lxcapi_want_cgroup_cache, bool)
 
-	if (file_exists(new)) {
-		ERROR("copy destination %s exists", new);
-		return -1;
+static bool do_lxcapi_want_background_destroy(struct lxc_container *c, bool state)
+{
+	if (!c)
+		return false;
+	if (container_mem_lock(c)) {
+		ERROR("Error getting mem lock");
+		return false;
 	}
-	ret = stat(old, &sbuf);
-	if (ret < 0) {
-		INFO("Error stat'ing %s", old);
+	c->background_destroy = state;
+	container_mem_unlock(c);
+	return true;
+}
+
+WRAP_API_1_NOLOAD(bool, lxcapi_want_background_destroy, bool)
+
+/* Discard the free blocks of the filesystem holding @path. */
+static int trim_fs(const char *path, uint64_t *trimmed)
+{
+	struct fstrim_range range;
+	int fd, ret;
+
+	fd = open(path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+	if (fd < 0) {
+		SYSERROR("Failed to open %s", path);
 		return -1;
 	}
 
-	in = open(old, O_RDONLY);
-	if (in < 0) {
-		SYSERROR("Error opening original file %s", old);
+	/* blocks freed since the last journal commit cannot be trimmed yet */
+	if (syncfs(fd) < 0)
+		WARN("Failed to sync %s", path);
+
+	memset(&range, 0, sizeof(range));
+	range.len = UINT64_MAX;
+	ret = ioctl(fd, FITRIM, &range);
+	if (ret < 0)
+		SYSERROR("Failed to trim %s", path);
+	else
+		*trimmed = range.len;
+	close(fd);
+
+	return ret;
+}
+
+/* Mount the rootfs of a stopped container in a private namespace to trim it. */
+static int trim_stopped(struct lxc_container *c, uint64_t *trimmed)
+{
+	int p[2], ret;
+	pid_t pid;
+
+	if (pipe2(p, O_CLOEXEC) < 0) {
+		SYSERROR("Failed to create pipe");
 		return -1;
 	}
-	out = open(new, O_CREAT | O_EXCL | O_WRONLY, 0644);
-	if (out < 0) {
-		SYSERROR("Error opening new file %s", new);
-		close(in);
+
+	pid = fork();
+	if (pid < 0) {
+		SYSERROR("Failed to fork");
+		close(p[0]);
+		close(p[1]);
 		return -1;
 	}
 
-	while (1) {
-		len = read(in, buf, 8096);
-		if (len < 0) {
-			SYSERROR("Error reading old file %s", old);
-			goto err;
+	if (pid == 0) {
+		struct bdev *bdev;
+		uint64_t n = 0;
+
+		close(p[0]);
+		if (unshare(CLONE_NEWNS) < 0) {
+			SYSERROR("Failed to unshare mount namespace");
+			_exit(EXIT_FAILURE);
 		}
-		if (len == 0)
-			break;
-		ret = write(out, buf, len);
-		if (ret < len) { // should we retry?
-			SYSERROR("Error: write to new file %s was interrupted", new);
-			goto err;
+		if (detect_shared_rootfs()) {
+			if (mount(NULL, "/", NULL, MS_SLAVE|MS_REC, NULL)) {
+				SYSERROR("Failed to make / rslave");
+				_exit(EXIT_FAILURE);
+			}
+		}
+		bdev = bdev_init(c->lxc_conf, c->lxc_conf->rootfs.path,
+				 c->lxc_conf->rootfs.mount, NULL);
+		if (!bdev || bdev->ops->mount(bdev) < 0) {
+			ERROR("Failed to mount the rootfs of %s", c->name);
+			_exit(EXIT_FAILURE);
 		}
+		if (trim_fs(bdev->dest, &n) < 0)
+			_exit(EXIT_FAILURE);
+		if (lxc_write_nointr(p[1], &n, sizeof(n)) != sizeof(n))
+			_exit(EXIT_FAILURE);
+		_exit(EXIT_SUCCESS);
 	}
-	close(in);
-	close(out);
 
-	// we set mode, but not owner/group
-	ret = chmod(new, sbuf.st_mode);
-	if (ret) {
-		SYSERROR("Error setting mode on %s", new);
+	close(p[1]);
+	ret = lxc_read_nointr(p[0], trimmed, sizeof(*trimmed));
+	close(p[0]);
+	if (wait_for_pid(pid) < 0 || ret != sizeof(*trimmed))
 		return -1;
-	}
 
 	return 0;
+}
 
-err:
-	close(in);
-	close(out);
-	return -1;
+static bool do_lxcapi_trim(struct lxc_container *c, uint64_t *trimmed)
+{
+	char path[MAXPATHLEN];
+	uint64_t n = 0;
+	pid_t pid;
+	int ret;
+
+	if (!c || !c->lxc_conf || !c->lxc_conf->rootfs.path)
+		return false;
+
+	if (am_unpriv()) {
+		ERROR(NOT_SUPPORTED_ERROR, __FUNCTION__);
+		return false;
+	}
+
+	/*
+	 * Directories, btrfs and zfs datasets and overlay or aufs upper dirs
+	 * live on a filesystem shared with the host, which is not ours to trim.
+	 */
+	if (!bdev_can_trim(c->lxc_conf)) {
+		ERROR("The rootfs of %s has no block device of its own to trim",
+		      c->name);
+		return false;
+	}
+
+	/* keep clone and destroy away from the image while it is mounted */
+	if (container_disk_lock(c))
+		return false;
+
+	pid = do_lxcapi_init_pid(c);
+	if (pid > 0) {
+		ret = snprintf(path, MAXPATHLEN, "/proc/%d/root", pid);
+		if (ret < 0 || ret >= MAXPATHLEN)
+			ret = -1;
+		else
+			ret = trim_fs(path, &n);
+	} else if (is_stopped(c)) {
+		ret = trim_stopped(c, &n);
+	} else {
+		ERROR("%s is neither running nor stopped", c->name);
+		ret = -1;
+	}
+
+	container_disk_unlock(c);
+	if (ret < 0)
+		return false;
+
+	INFO("Trimmed %" PRIu64 " bytes from the rootfs of %s", n, c->name);
+	if (trimmed)
+		*trimmed = n;
+	return true;
+}
+
+WRAP_API_1(bool, false, lxcapi_trim, uint64_t *)
+
+const char *lxc_get_global_config_item(const char *key)
+{
+	return lxc_global_config_value(key);
+}
+
+const char *lxc_get_version(void)
+{
+	return LXC_VERSION;
 }
 
 static int copyhooks(struct lxc_container *oldc, struct lxc_container *c)
@@ -2703,7 +3281,7 @@ static int copyhooks(struct lxc_container *oldc, struct lxc_container *c)
 					c->config_path, c->name, fname+1);
 			if (ret < 0 || ret >= MAXPATHLEN)
 				return -1;
-			ret = copy_file(it->elem, tmppath);
+			ret = lxc_copy_file(it->elem, tmppath);
 			if (ret < 0)
 				return -1;
 			free(it->elem);
@@ -2750,7 +3328,7 @@ static int copy_fstab(struct lxc_container *oldc, struct lxc_container *c)
 		return -1;
 	}
 
-	if (copy_file(oldpath, newpath) < 0) {
+	if (lxc_copy_file(oldpath, newpath) < 0) {
 		ERROR("error: copying %s to %s", oldpath, newpath);
 		return -1;
 	}
@@ -2785,7 +3363,7 @@ static void copy_rdepends(struct lxc_container *c, struct lxc_container *c0)
 		WARN("Error copying reverse dependencies");
 		return;
 	}
-	if (copy_file(path0, path1) < 0) {
+	if (lxc_copy_file(path0, path1) < 0) {
 		INFO("Error copying reverse dependencies");
 		return;
 	}
@@ -3132,6 +3710,10 @@ static struct lxc_container *do_lxcapi_clone(struct lxc_container *c, const char
 	}
 
 	c2 = lxc_container_new(newname, lxcpath);
+	if (c2 && !lxc_container_load_pending_config(c2)) {
+		lxc_container_put(c2);
+		c2 = NULL;
+	}
 	if (!c2) {
 		ERROR("clone: failed to create new container (%s %s)", newname,
 				lxcpath);
@@ -3229,6 +3811,9 @@ static struct lxc_container *lxcapi_clone(struct lxc_container *c, const char *n
 		char **hookargs)
 {
 	struct lxc_container * ret;
+
+	if (!lxc_container_load_pending_config(c))
+		return NULL;
 	current_config = c ? c->lxc_conf : NULL;
 	ret = do_lxcapi_clone(c, newname, lxcpath, flags, bdevtype, bdevdata, newsize, hookargs);
 	current_config = NULL;
@@ -3270,7 +3855,7 @@ static bool do_lxcapi_rename(struct lxc_container *c, const char *newname)
 	return true;
 }
 
-WRAP_API_1(bool, lxcapi_rename, const char *)
+WRAP_API_1(bool, false, lxcapi_rename, const char *)
 
 static int lxcapi_attach(struct lxc_container *c, lxc_attach_exec_t exec_function, void *exec_payload, lxc_attach_options_t *options, pid_t *attached_process)
 {
@@ -3279,6 +3864,8 @@ static int lxcapi_attach(struct lxc_container *c, lxc_attach_exec_t exec_functio
 	if (!c)
 		return -1;
 
+	if (!lxc_container_load_pending_config(c))
+		return -1;
 	current_config = c->lxc_conf;
 
 	ret = lxc_attach(c->name, c->config_path, exec_function, exec_payload, options, attached_process);
@@ -3308,6 +3895,9 @@ static int do_lxcapi_attach_run_wait(struct lxc_container *c, lxc_attach_options
 static int lxcapi_attach_run_wait(struct lxc_container *c, lxc_attach_options_t *options, const char *program, const char * const argv[])
 {
 	int ret;
+
+	if (!lxc_container_load_pending_config(c))
+		return -1;
 	current_config = c ? c->lxc_conf : NULL;
 	ret = do_lxcapi_attach_run_wait(c, options, program, argv);
 	current_config = NULL;
@@ -3441,13 +4031,13 @@ static int do_lxcapi_snapshot(struct lxc_container *c, const char *commentfile)
 		int len = strlen(snappath) + strlen(newname) + 10;
 		char *path = alloca(len);
 		sprintf(path, "%s/%s/comment", snappath, newname);
-		return copy_file(commentfile, path) < 0 ? -1 : i;
+		return lxc_copy_file(commentfile, path) < 0 ? -1 : i;
 	}
 
 	return i;
 }
 
-WRAP_API_1(int, lxcapi_snapshot, const char *)
+WRAP_API_1(int, -1, lxcapi_snapshot, const char *)
 
 static void lxcsnap_free(struct lxc_snapshot *s)
 {
@@ -3579,7 +4169,7 @@ out_free:
 	return -1;
 }
 
-WRAP_API_1(int, lxcapi_snapshot_list, struct lxc_snapshot **)
+WRAP_API_1(int, -1, lxcapi_snapshot_list, struct lxc_snapshot **)
 
 static bool do_lxcapi_snapshot_restore(struct lxc_container *c, const char *snapname, const char *newname)
 {
@@ -3642,7 +4232,7 @@ static bool do_lxcapi_snapshot_restore(struct lxc_container *c, const char *snap
 	return b;
 }
 
-WRAP_API_2(bool, lxcapi_snapshot_restore, const char *, const char *)
+WRAP_API_2(bool, false, lxcapi_snapshot_restore, const char *, const char *)
 
 static bool do_snapshot_destroy(const char *snapname, const char *clonelxcpath)
 {
@@ -3650,7 +4240,7 @@ static bool do_snapshot_destroy(const char *snapname, const char *clonelxcpath)
 	bool bret = false;
 
 	snap = lxc_container_new(snapname, clonelxcpath);
-	if (!snap) {
+	if (!snap || !lxc_container_load_pending_config(snap)) {
 		ERROR("Could not find snapshot %s", snapname);
 		goto err;
 	}
@@ -3712,7 +4302,7 @@ static bool do_lxcapi_snapshot_destroy(struct lxc_container *c, const char *snap
 	return do_snapshot_destroy(snapname, clonelxcpath);
 }
 
-WRAP_API_1(bool, lxcapi_snapshot_destroy, const char *)
+WRAP_API_1(bool, false, lxcapi_snapshot_destroy, const char *)
 
 static bool do_lxcapi_snapshot_destroy_all(struct lxc_container *c)
 {
@@ -3727,14 +4317,14 @@ static bool do_lxcapi_snapshot_destroy_all(struct lxc_container *c)
 	return remove_all_snapshots(clonelxcpath);
 }
 
-WRAP_API(bool, lxcapi_snapshot_destroy_all)
+WRAP_API(bool, false, lxcapi_snapshot_destroy_all)
 
 static bool do_lxcapi_may_control(struct lxc_container *c)
 {
 	return lxc_try_cmd(c->name, c->config_path) == 0;
 }
 
-WRAP_API(bool, lxcapi_may_control)
+WRAP_API_NOLOAD(bool, lxcapi_may_control)
 
 static bool do_add_remove_node(pid_t init_pid, const char *path, bool add,
 		struct stat *st)
@@ -3851,7 +4441,7 @@ static bool do_lxcapi_add_device_node(struct lxc_container *c, const char *src_p
 	return add_remove_device_node(c, src_path, dest_path, true);
 }
 
-WRAP_API_2(bool, lxcapi_add_device_node, const char *, const char *)
+WRAP_API_2(bool, false, lxcapi_add_device_node, const char *, const char *)
 
 static bool do_lxcapi_remove_device_node(struct lxc_container *c, const char *src_path, const char *dest_path)
 {
@@ -3862,7 +4452,7 @@ static bool do_lxcapi_remove_device_node(struct lxc_container *c, const char *sr
 	return add_remove_device_node(c, src_path, dest_path, false);
 }
 
-WRAP_API_2(bool, lxcapi_remove_device_node, const char *, const char *)
+WRAP_API_2(bool, false, lxcapi_remove_device_node, const char *, const char *)
 
 static bool do_lxcapi_attach_interface(struct lxc_container *c, const char *ifname,
 				const char *dst_ifname)
@@ -3897,7 +4487,7 @@ err:
 	return false;
 }
 
-WRAP_API_2(bool, lxcapi_attach_interface, const char *, const char *)
+WRAP_API_2(bool, false, lxcapi_attach_interface, const char *, const char *)
 
 static bool do_lxcapi_detach_interface(struct lxc_container *c, const char *ifname,
 					const char *dst_ifname)
@@ -3954,7 +4544,7 @@ static bool do_lxcapi_detach_interface(struct lxc_container *c, const char *ifna
 	return true;
 }
 
-WRAP_API_2(bool, lxcapi_detach_interface, const char *, const char *)
+WRAP_API_2(bool, false, lxcapi_detach_interface, const char *, const char *)
 
 static int do_lxcapi_migrate(struct lxc_container *c, unsigned int cmd,
 			     struct migrate_opts *opts, unsigned int size)
@@ -4013,7 +4603,7 @@ static int do_lxcapi_migrate(struct lxc_container *c, unsigned int cmd,
 	return ret;
 }
 
-WRAP_API_3(int, lxcapi_migrate, unsigned int, struct migrate_opts *, unsigned int)
+WRAP_API_3(int, -1, lxcapi_migrate, unsigned int, struct migrate_opts *, unsigned int)
 
 static bool do_lxcapi_checkpoint(struct lxc_container *c, char *directory, bool stop, bool verbose)
 {
@@ -4028,7 +4618,7 @@ static bool do_lxcapi_checkpoint(struct lxc_container *c, char *directory, bool
 	return !do_lxcapi_migrate(c, MIGRATE_DUMP, &opts, sizeof(opts));
 }
 
-WRAP_API_3(bool, lxcapi_checkpoint, char *, bool, bool)
+WRAP_API_3(bool, false, lxcapi_checkpoint, char *, bool, bool)
 
 static bool do_lxcapi_restore(struct lxc_container *c, char *directory, bool verbose)
 {
@@ -4042,7 +4632,7 @@ static bool do_lxcapi_restore(struct lxc_container *c, char *directory, bool ver
 	return !do_lxcapi_migrate(c, MIGRATE_RESTORE, &opts, sizeof(opts));
 }
 
-WRAP_API_2(bool, lxcapi_restore, char *, bool)
+WRAP_API_2(bool, false, lxcapi_restore, char *, bool)
 
 static int lxcapi_attach_run_waitl(struct lxc_container *c, lxc_attach_options_t *options, const char *program, const char *arg, ...)
 {
@@ -4053,6 +4643,8 @@ static int lxcapi_attach_run_waitl(struct lxc_container *c, lxc_attach_options_t
 	if (!c)
 		return -1;
 
+	if (!lxc_container_load_pending_config(c))
+		return -1;
 	current_config = c->lxc_conf;
 
 	va_start(ap, arg);
@@ -4121,11 +4713,13 @@ struct lxc_container *lxc_container_new(const char *name, const char *configpath
 		goto err;
 	}
 
-	if (file_exists(c->configfile) && !lxcapi_load_config(c, NULL))
-		goto err;
+	/* read on first use, state queries don't need it */
+	c->config_pending = true;
 
 	if (ongoing_create(c) == 2) {
 		ERROR("Error: %s creation was not completed", c->name);
+		if (!lxc_container_load_pending_config(c))
+			goto err;
 		container_destroy(c);
 		lxcapi_clear_config(c);
 	}
@@ -4186,6 +4780,10 @@ struct lxc_container *lxc_container_new(const char *name, const char *configpath
 	c->checkpoint = lxcapi_checkpoint;
 	c->restore = lxcapi_restore;
 	c->migrate = lxcapi_migrate;
+	c->get_cgroup_stats = lxcapi_get_cgroup_stats;
+	c->want_cgroup_cache = lxcapi_want_cgroup_cache;
+	c->want_background_destroy = lxcapi_want_background_destroy;
+	c->trim = lxcapi_trim;
 
 	return c;
 
@@ -4208,116 +4806,243 @@ int lxc_get_wait_states(const char **states)
  * These next two could probably be done smarter with reusing a common function
  * with different iterators and tests...
  */
-int list_defined_containers(const char *lxcpath, char ***names, struct lxc_container ***cret)
+/*
+ * Collect the names of all directories under lxcpath which hold a config
+ * file.  Only a stat per entry, no config is parsed.
+ */
+static int scan_defined_containers(const char *lxcpath, char ***nret)
 {
 	DIR *dir;
-	int i, cfound = 0, nfound = 0;
+	int dfd, ret, nr = 0, size = 0;
+	char path[MAXPATHLEN], **names = NULL, **tmp;
 	struct dirent *direntp;
-	struct lxc_container *c;
-
-	if (!lxcpath)
-		lxcpath = lxc_global_config_value("lxc.lxcpath");
+	struct stat st;
 
 	dir = opendir(lxcpath);
 	if (!dir) {
 		SYSERROR("opendir on lxcpath");
 		return -1;
 	}
-
-	if (cret)
-		*cret = NULL;
-	if (names)
-		*names = NULL;
+	dfd = dirfd(dir);
 
 	while ((direntp = readdir(dir))) {
-		if (!direntp)
-			break;
-
 		// Ignore '.', '..' and any hidden directory
 		if (!strncmp(direntp->d_name, ".", 1))
 			continue;
 
-		if (!config_file_exists(lxcpath, direntp->d_name))
+		ret = snprintf(path, MAXPATHLEN, "%s/config", direntp->d_name);
+		if (ret < 0 || ret >= MAXPATHLEN)
+			continue;
+		if (fstatat(dfd, path, &st, 0) < 0)
 			continue;
 
-		if (names) {
-			if (!add_to_array(names, direntp->d_name, cfound))
+		if (nr == size) {
+			size = size ? size * 2 : 64;
+			tmp = realloc(names, size * sizeof(char *));
+			if (!tmp)
 				goto free_bad;
+			names = tmp;
 		}
-		cfound++;
+		names[nr] = strdup(direntp->d_name);
+		if (!names[nr])
+			goto free_bad;
+		nr++;
+	}
+	closedir(dir);
 
-		if (!cret) {
-			nfound++;
-			continue;
-		}
+	// sort once rather than on every insertion
+	qsort(names, nr, sizeof(char *), (int (*)(const void *,const void *))string_cmp);
+	*nret = names;
+	return nr;
+
+free_bad:
+	ERROR("Out of memory");
+	while (nr--)
+		free(names[nr]);
+	free(names);
+	closedir(dir);
+	return -1;
+}
+
+struct load_pool {
+	const char *lxcpath;
+	char **names;
+	struct lxc_container **cts;
+	int nr;
+	int next;	// next name to load, claimed atomically
+};
 
-		c = lxc_container_new(direntp->d_name, lxcpath);
+static void *load_worker(void *arg)
+{
+	struct load_pool *pool = arg;
+	struct lxc_container *c;
+	int i;
+
+	while ((i = __sync_fetch_and_add(&pool->next, 1)) < pool->nr) {
+		c = lxc_container_new(pool->names[i], pool->lxcpath);
 		if (!c) {
 			INFO("Container %s:%s has a config but could not be loaded",
-				lxcpath, direntp->d_name);
-			if (names)
-				if(!remove_from_array(names, direntp->d_name, cfound--))
-					goto free_bad;
+				pool->lxcpath, pool->names[i]);
 			continue;
 		}
 		if (!do_lxcapi_is_defined(c)) {
 			INFO("Container %s:%s has a config but is not defined",
-				lxcpath, direntp->d_name);
-			if (names)
-				if(!remove_from_array(names, direntp->d_name, cfound--))
-					goto free_bad;
+				pool->lxcpath, pool->names[i]);
 			lxc_container_put(c);
 			continue;
 		}
+		pool->cts[i] = c;
+	}
 
-		if (!add_to_clist(cret, c, nfound, true)) {
-			lxc_container_put(c);
-			goto free_bad;
+	return NULL;
+}
+
+/*
+ * Run @worker(@arg) from @threads threads, one per online CPU when @threads
+ * is not positive, but never more than the @nr items there are to process.
+ * The calling thread is one of the workers.  API calls set current_config,
+ * which is only per thread with thread local storage, so without it the
+ * calling thread does all the work.
+ */
+static void run_workers(void *(*worker)(void *), void *arg, int nr, int threads)
+{
+	pthread_t *tids;
+	int i, started = 0;
+
+#ifdef HAVE_TLS
+	if (threads <= 0)
+		threads = sysconf(_SC_NPROCESSORS_ONLN);
+#else
+	threads = 1;
+#endif
+	if (threads > nr)
+		threads = nr;
+
+	tids = NULL;
+	if (threads > 1)
+		tids = malloc((threads - 1) * sizeof(pthread_t));
+
+	for (i = 0; tids && i < threads - 1; i++) {
+		if (pthread_create(&tids[i], NULL, worker, arg) != 0) {
+			WARN("Failed to start worker thread, continuing with %d", started + 1);
+			break;
 		}
-		nfound++;
+		started++;
 	}
 
-	closedir(dir);
-	return nfound;
+	worker(arg);
 
-free_bad:
-	if (names && *names) {
-		for (i=0; i<cfound; i++)
-			free((*names)[i]);
-		free(*names);
+	for (i = 0; i < started; i++)
+		pthread_join(tids[i], NULL);
+	free(tids);
+}
+
+int list_defined_containers_parallel(const char *lxcpath, char ***names,
+				     struct lxc_container ***cret, int threads)
+{
+	int i, cfound, nfound = 0;
+	char **ct_name = NULL;
+	struct load_pool pool;
+
+	if (!lxcpath)
+		lxcpath = lxc_global_config_value("lxc.lxcpath");
+
+	if (cret)
+		*cret = NULL;
+	if (names)
+		*names = NULL;
+
+	cfound = scan_defined_containers(lxcpath, &ct_name);
+	if (cfound < 0)
+		return -1;
+
+	if (!cret) {
+		nfound = cfound;
+		goto out;
+	}
+
+	pool.lxcpath = lxcpath;
+	pool.names = ct_name;
+	pool.nr = cfound;
+	pool.next = 0;
+	pool.cts = calloc(cfound ? cfound : 1, sizeof(struct lxc_container *));
+	if (!pool.cts) {
+		ERROR("Out of memory");
+		nfound = -1;
+		goto out;
 	}
-	if (cret && *cret) {
-		for (i=0; i<nfound; i++)
-			lxc_container_put((*cret)[i]);
-		free(*cret);
+
+	/* slots of containers which could not be loaded are left NULL */
+	run_workers(load_worker, &pool, pool.nr, threads);
+
+	// names are sorted, compacting keeps the containers sorted too
+	for (i = 0; i < cfound; i++) {
+		if (!pool.cts[i]) {
+			free(ct_name[i]);
+			continue;
+		}
+		ct_name[nfound] = ct_name[i];
+		pool.cts[nfound] = pool.cts[i];
+		nfound++;
 	}
-	closedir(dir);
-	return -1;
+	cfound = nfound;
+
+	if (nfound)
+		*cret = pool.cts;
+	else
+		free(pool.cts);
+
+out:
+	if (names && nfound >= 0) {
+		*names = ct_name;
+		return nfound;
+	}
+
+	for (i = 0; i < cfound; i++)
+		free(ct_name[i]);
+	free(ct_name);
+	return nfound;
 }
 
-int list_active_containers(const char *lxcpath, char ***nret,
-			   struct lxc_container ***cret)
+int list_defined_containers(const char *lxcpath, char ***names, struct lxc_container ***cret)
 {
-	int i, ret = -1, cret_cnt = 0, ct_name_cnt = 0;
+	return list_defined_containers_parallel(lxcpath, names, cret, 1);
+}
+
+/*
+ * Add the containers of @lxcpath which hold a command socket to the @nr
+ * sorted names in @nret.  A hashed socket name which belongs to one of those
+ * names is recognized by its hash and costs no command round trips.
+ */
+static int scan_active_containers(const char *lxcpath, char ***nret, int nr)
+{
+	int i, ret = -1, ct_name_cnt = nr;
 	int lxcpath_len;
 	char *line = NULL;
-	char **ct_name = NULL;
+	char **ct_name = *nret;
+	char tmppath[MAXPATHLEN];
+	uint64_t *hashes = NULL, hash;
 	size_t len = 0;
-	struct lxc_container *c;
 	bool is_hashed;
 
-	if (!lxcpath)
-		lxcpath = lxc_global_config_value("lxc.lxcpath");
 	lxcpath_len = strlen(lxcpath);
 
-	if (cret)
-		*cret = NULL;
-	if (nret)
-		*nret = NULL;
-
 	FILE *f = fopen("/proc/net/unix", "r");
 	if (!f)
-		return -1;
+		return nr > 0 ? nr : -1;
+
+	if (nr > 0) {
+		hashes = malloc(nr * sizeof(*hashes));
+		if (!hashes)
+			goto free_ct_name;
+		for (i = 0; i < nr; i++) {
+			ret = snprintf(tmppath, sizeof(tmppath), "%s/%s", lxcpath, ct_name[i]);
+			if (ret < 0 || ret >= sizeof(tmppath))
+				ret = 0;
+			hashes[i] = fnv_64a_buf(tmppath, ret, FNV1A_64_INIT);
+		}
+		ret = -1;
+	}
 
 	while (getline(&line, &len, f) != -1) {
 
@@ -4349,6 +5074,12 @@ int list_active_containers(const char *lxcpath, char ***nret,
 		*p2 = '\0';
 
 		if (is_hashed) {
+			hash = strtoull(p, NULL, 16);
+			for (i = 0; i < nr; i++)
+				if (hashes[i] == hash)
+					break;
+			if (i < nr)
+				continue;
 			if (strncmp(lxcpath, lxc_cmd_get_lxcpath(p), lxcpath_len) != 0)
 				continue;
 			p = lxc_cmd_get_name(p);
@@ -4358,18 +5089,62 @@ int list_active_containers(const char *lxcpath, char ***nret,
 			continue;
 
 		if (!add_to_array(&ct_name, p, ct_name_cnt))
-			goto free_cret_list;
+			goto free_ct_name;
 
 		ct_name_cnt++;
+	}
 
-		if (!cret)
-			continue;
+	ret = ct_name_cnt;
+	*nret = ct_name;
+	goto out;
+
+free_ct_name:
+	if (ct_name) {
+		while (ct_name_cnt--)
+			free(ct_name[ct_name_cnt]);
+		free(ct_name);
+	}
+	*nret = NULL;
+
+out:
+	free(hashes);
+	free(line);
+
+	fclose(f);
+	return ret;
+}
+
+int list_active_containers(const char *lxcpath, char ***nret,
+			   struct lxc_container ***cret)
+{
+	int i, j, cret_cnt = 0, ct_name_cnt;
+	char **ct_name = NULL;
+	struct lxc_container *c;
 
-		c = lxc_container_new(p, lxcpath);
+	if (!lxcpath)
+		lxcpath = lxc_global_config_value("lxc.lxcpath");
+
+	if (cret)
+		*cret = NULL;
+	if (nret)
+		*nret = NULL;
+
+	/* Monitors of an older liblxc keep no record in the runtime registry,
+	 * so /proc/net/unix is still scanned for the containers it misses.
+	 */
+	ct_name_cnt = lxc_active_list(lxcpath, &ct_name);
+	if (ct_name_cnt < 0)
+		ct_name_cnt = 0;
+	ct_name_cnt = scan_active_containers(lxcpath, &ct_name, ct_name_cnt);
+	if (ct_name_cnt < 0)
+		return -1;
+
+	for (i = 0, j = 0; cret && i < ct_name_cnt; i++) {
+		c = lxc_container_new(ct_name[i], lxcpath);
 		if (!c) {
 			INFO("Container %s:%s is running but could not be loaded",
-				lxcpath, p);
-			remove_from_array(&ct_name, p, ct_name_cnt--);
+				lxcpath, ct_name[i]);
+			free(ct_name[i]);
 			continue;
 		}
 
@@ -4384,35 +5159,36 @@ int list_active_containers(const char *lxcpath, char ***nret,
 			goto free_cret_list;
 		}
 		cret_cnt++;
+		ct_name[j++] = ct_name[i];
 	}
+	if (cret)
+		ct_name_cnt = j;
 
 	assert(!nret || !cret || cret_cnt == ct_name_cnt);
-	ret = ct_name_cnt;
 	if (nret)
 		*nret = ct_name;
 	else
 		goto free_ct_name;
-	goto out;
+	return ct_name_cnt;
 
 free_cret_list:
-	if (cret && *cret) {
-		for (i = 0; i < cret_cnt; i++)
-			lxc_container_put((*cret)[i]);
-		free(*cret);
-	}
+	for (j = 0; j < cret_cnt; j++)
+		lxc_container_put((*cret)[j]);
+	free(*cret);
+	*cret = NULL;
+	/* names before i that were kept were compacted into [0, cret_cnt) */
+	for (j = 0; j < cret_cnt; j++)
+		free(ct_name[j]);
+	for (; i < ct_name_cnt; i++)
+		free(ct_name[i]);
+	free(ct_name);
+	return -1;
 
 free_ct_name:
-	if (ct_name) {
-		for (i = 0; i < ct_name_cnt; i++)
-			free(ct_name[i]);
-		free(ct_name);
-	}
-
-out:
-	free(line);
-
-	fclose(f);
-	return ret;
+	for (i = 0; i < ct_name_cnt; i++)
+		free(ct_name[i]);
+	free(ct_name);
+	return ct_name_cnt;
 }
 
 int list_all_containers(const char *lxcpath, char ***nret,
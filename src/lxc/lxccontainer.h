@@ -39,9 +39,11 @@ extern "C" {
 #define LXC_CLONE_SNAPSHOT        (1 << 2) /*!< Snapshot the original filesystem(s) */
 #define LXC_CLONE_KEEPBDEVTYPE    (1 << 3) /*!< Use the same bdev type */
 #define LXC_CLONE_MAYBE_SNAPSHOT  (1 << 4) /*!< Snapshot only if bdev supports it, else copy */
-#define LXC_CLONE_MAXFLAGS        (1 << 5) /*!< Number of \c LXC_CLONE_* flags */
+#define LXC_CLONE_REFLINK         (1 << 5) /*!< Snapshot a directory as a reflinked copy where possible */
+#define LXC_CLONE_MAXFLAGS        (1 << 6) /*!< Number of \c LXC_CLONE_* flags */
 #define LXC_CREATE_QUIET          (1 << 0) /*!< Redirect \c stdin to \c /dev/zero and \c stdout and \c stderr to \c /dev/null */
-#define LXC_CREATE_MAXFLAGS       (1 << 1) /*!< Number of \c LXC_CREATE* flags */
+#define LXC_CREATE_PREALLOC       (1 << 1) /*!< Reserve the whole image of a loop backed rootfs instead of leaving it sparse */
+#define LXC_CREATE_MAXFLAGS       (1 << 2) /*!< Number of \c LXC_CREATE* flags */
 
 struct bdev_specs;
 
@@ -51,6 +53,10 @@ struct lxc_lock;
 
 struct migrate_opts;
 
+struct lxc_cgroup_stats;
+
+struct lxc_cgroup_handle;
+
 /*!
  * An LXC container.
  *
@@ -310,8 +316,8 @@ struct lxc_container {
 	 * \param bdevtype Backing store type to use (if \c NULL, \c dir will be used).
 	 * \param specs Additional parameters for the backing store (for
 	 *  example LVM volume group to use).
-	 * \param flags \c LXC_CREATE_* options (currently only \ref
-	 *  LXC_CREATE_QUIET is supported).
+	 * \param flags \c LXC_CREATE_* options (\ref LXC_CREATE_QUIET and
+	 *  \ref LXC_CREATE_PREALLOC).
 	 * \param argv Arguments to pass to the template, terminated by \c NULL (if no
 	 *  arguments are required, just pass \c NULL).
 	 *
@@ -330,8 +336,8 @@ struct lxc_container {
 	 * \param bdevtype Backing store type to use (if \c NULL, \c dir will be used).
 	 * \param specs Additional parameters for the backing store (for
 	 *  example LVM volume group to use).
-	 * \param flags \c LXC_CREATE_* options (currently only \ref
-	 *  LXC_CREATE_QUIET is supported).
+	 * \param flags \c LXC_CREATE_* options (\ref LXC_CREATE_QUIET and
+	 *  \ref LXC_CREATE_PREALLOC).
 	 * \param ... Command-line to pass to init (must end in \c NULL).
 	 *
 	 * \return \c true on success, else \c false.
@@ -547,6 +553,7 @@ struct lxc_container {
 	 *  - \ref LXC_CLONE_KEEPNAME
 	 *  - \ref LXC_CLONE_KEEPMACADDR
 	 *  - \ref LXC_CLONE_SNAPSHOT
+	 *  - \ref LXC_CLONE_REFLINK
 	 * \param bdevtype Optionally force the cloned bdevtype to a specified plugin.
 	 *  By default the original is used (subject to snapshot requirements).
 	 * \param bdevdata Information about how to create the new storage
@@ -562,7 +569,9 @@ struct lxc_container {
 	 *
 	 * \note If devtype was not specified, and \p flags contains \ref
 	 * LXC_CLONE_SNAPSHOT then use the native \p bdevtype if possible,
-	 * else use an overlayfs.
+	 * else use an overlayfs. With \ref LXC_CLONE_REFLINK a directory
+	 * on a filesystem sharing extents is copied reflinking all data
+	 * instead of overlaid.
 	 */
 	struct lxc_container *(*clone)(struct lxc_container *c, const char *newname,
 			const char *lxcpath, int flags, const char *bdevtype,
@@ -823,6 +832,92 @@ struct lxc_container {
 	 * \return \c 0 on success, nonzero on failure.
 	 */
 	int (*migrate)(struct lxc_container *c, unsigned int cmd, struct migrate_opts *opts, unsigned int size);
+
+	/*!
+	 * \brief Read the memory, cpuacct, blkio and pids counters of a
+	 *  running container in one call.
+	 *
+	 * \param c Container.
+	 * \param[out] stats Counters, see \ref lxc_cgroup_stats.
+	 * \param size The size of the stats struct, i.e. sizeof(struct lxc_cgroup_stats).
+	 *
+	 * \return \c 0 on success, \c -1 if the container is not running
+	 *  or on error.
+	 *
+	 * \note Each cgroup file is read once and the container's
+	 *  configuration is not loaded.
+	 */
+	int (*get_cgroup_stats)(struct lxc_container *c, struct lxc_cgroup_stats *stats, unsigned int size);
+
+	/*!
+	 * \brief Keep the container's cgroup directories open between
+	 *  \ref get_cgroup_item, \ref set_cgroup_item and
+	 *  \ref get_cgroup_stats calls.
+	 *
+	 * \param c Container.
+	 * \param state Value for the cgroup cache (\c true or \c false).
+	 *
+	 * \return \c true on success, else \c false.
+	 *
+	 * \note With the cache the calls skip the command socket round trips
+	 *  to find the container's cgroups. The directories are looked up
+	 *  again once the container stopped or restarted.
+	 */
+	bool (*want_cgroup_cache)(struct lxc_container *c, bool state);
+
+	/*!
+	 * \private
+	 * The configuration file has not been read yet. It is read on
+	 * the first call which needs \ref lxc_conf, see
+	 * \ref lxc_container_load_pending_config().
+	 */
+	bool config_pending;
+
+	/*!
+	 * \private
+	 * Cached cgroup directories, see \ref want_cgroup_cache.
+	 * Only used with the mem lock held.
+	 */
+	struct lxc_cgroup_handle *cgroup_handle;
+
+	/*!
+	 * \brief Let \ref destroy return before the container's files
+	 *  are removed.
+	 *
+	 * \param c Container.
+	 * \param state Value for the background destroy (\c true or \c false).
+	 *
+	 * \return \c true on success, else \c false.
+	 *
+	 * \note The container directory, and a directory backed rootfs, are
+	 *  renamed to hidden directories next to them and removed by a
+	 *  detached process. A container keeping snapshots in its directory,
+	 *  or a rootfs which cannot be renamed, is removed in the foreground.
+	 */
+	bool (*want_background_destroy)(struct lxc_container *c, bool state);
+
+	/*!
+	 * \private
+	 * See \ref want_background_destroy.
+	 */
+	bool background_destroy;
+
+	/*!
+	 * \brief Discard the unused blocks of the container's rootfs.
+	 *
+	 * \param c Container.
+	 * \param[out] trimmed Number of bytes the filesystem discarded,
+	 *  may be \c NULL.
+	 *
+	 * \return \c true on success, else \c false.
+	 *
+	 * \note For a loop backed rootfs the image gets holes where files
+	 *  were deleted, so it shrinks on disk again. A running container
+	 *  is trimmed in place, a stopped one is mounted for the duration.
+	 *  Only loop, LVM and RBD backed rootfs can be trimmed, the others
+	 *  share their filesystem with the host.
+	 */
+	bool (*trim)(struct lxc_container *c, uint64_t *trimmed);
 };
 
 /*!
@@ -910,6 +1005,51 @@ struct migrate_opts {
 	uint64_t ghost_limit;
 };
 
+/*!
+ * \brief Bits of \ref lxc_cgroup_stats.valid, set for each group of
+ *  counters that could be read.
+ */
+enum {
+	LXC_CGROUP_STATS_MEMORY = 1 << 0,
+	LXC_CGROUP_STATS_KMEM = 1 << 1,
+	LXC_CGROUP_STATS_MEMSW = 1 << 2,
+	LXC_CGROUP_STATS_CPUACCT = 1 << 3,
+	LXC_CGROUP_STATS_BLKIO = 1 << 4,
+	LXC_CGROUP_STATS_PIDS = 1 << 5,
+};
+
+/*!
+ * \brief Counters returned by the get_cgroup_stats API call.
+ *
+ * Limits which are not set read as the kernel reports them, "max" is
+ * returned as UINT64_MAX.
+ */
+struct lxc_cgroup_stats {
+	/* new members should be added at the end */
+	unsigned int valid; /*!< LXC_CGROUP_STATS_* */
+
+	uint64_t mem_used; /*!< memory.usage_in_bytes */
+	uint64_t mem_limit; /*!< memory.limit_in_bytes */
+	uint64_t mem_cache; /*!< total_cache from memory.stat */
+	uint64_t mem_rss; /*!< total_rss from memory.stat */
+	uint64_t kmem_used; /*!< memory.kmem.usage_in_bytes */
+	uint64_t kmem_limit; /*!< memory.kmem.limit_in_bytes */
+	uint64_t memsw_used; /*!< memory.memsw.usage_in_bytes */
+	uint64_t memsw_limit; /*!< memory.memsw.limit_in_bytes */
+
+	uint64_t cpu_use_nanos; /*!< cpuacct.usage */
+	uint64_t cpu_use_user; /*!< user from cpuacct.stat, in USER_HZ */
+	uint64_t cpu_use_sys; /*!< system from cpuacct.stat, in USER_HZ */
+
+	uint64_t blkio_read; /*!< Read bytes of all devices */
+	uint64_t blkio_write; /*!< Write bytes of all devices */
+	uint64_t blkio; /*!< Total bytes, blkio.throttle.io_service_bytes */
+	uint64_t blkio_ios; /*!< Total requests, blkio.throttle.io_serviced */
+
+	uint64_t pids_current; /*!< pids.current */
+	uint64_t pids_max; /*!< pids.max */
+};
+
 /*!
  * \brief Create a new container.
  *
@@ -920,6 +1060,20 @@ struct migrate_opts {
  */
 struct lxc_container *lxc_container_new(const char *name, const char *configpath);
 
+/*!
+ * \brief Read the container configuration if it has not been read yet.
+ *
+ * \param c Container.
+ *
+ * \return \c true if the configuration is loaded (or there is none),
+ *  else \c false.
+ *
+ * \note \ref lxc_container_new() does not read the configuration file,
+ *  the API calls that need it do so on first use. Only callers that
+ *  access \c c->lxc_conf directly need to call this first.
+ */
+bool lxc_container_load_pending_config(struct lxc_container *c);
+
 /*!
  * \brief Add a reference to the specified container.
  *
@@ -985,6 +1139,26 @@ const char *lxc_get_version(void);
  */
 int list_defined_containers(const char *lxcpath, char ***names, struct lxc_container ***cret);
 
+/*!
+ * \brief Get a list of defined containers in a lxcpath, loading them
+ *  from several threads.
+ *
+ * \param lxcpath lxcpath under which to look.
+ * \param names If not \c NULL, then a list of container names will be returned here.
+ * \param cret If not \c NULL, then a list of lxc_containers will be returned here.
+ * \param threads Number of threads loading containers, \c 0 for one per
+ *  online CPU. Containers are loaded by the calling thread alone if liblxc
+ *  was built without thread local storage.
+ *
+ * \return Number of containers found, or \c -1 on error.
+ *
+ * \note When \p cret is \c NULL no container configuration is parsed,
+ *  names are those of the directories holding a \c config file.
+ * \note Values returned in \p names and \p cret are sorted by container name.
+ */
+int list_defined_containers_parallel(const char *lxcpath, char ***names,
+				     struct lxc_container ***cret, int threads);
+
 /*!
  * \brief Get a list of active containers for a given lxcpath.
  *
@@ -1017,6 +1191,29 @@ int list_active_containers(const char *lxcpath, char ***names, struct lxc_contai
  */
 int list_all_containers(const char *lxcpath, char ***names, struct lxc_container ***cret);
 
+/*!
+ * \brief Freeze a set of containers concurrently.
+ *
+ * \param cts Containers to freeze.
+ * \param count Number of containers in \p cts.
+ *
+ * \return Number of containers which were frozen, or \c -1 on error.
+ *
+ * \note All containers are asked to freeze before waiting for any of them,
+ *  so the total time is that of the slowest rather than of the sum.
+ */
+int lxc_freeze_containers(struct lxc_container **cts, int count);
+
+/*!
+ * \brief Unfreeze a set of containers concurrently.
+ *
+ * \param cts Containers to unfreeze.
+ * \param count Number of containers in \p cts.
+ *
+ * \return Number of containers which were thawed, or \c -1 on error.
+ */
+int lxc_unfreeze_containers(struct lxc_container **cts, int count);
+
 /*!
  * \brief Close log file.
  */
@@ -33,20 +33,76 @@
 struct mainloop_handler {
 	lxc_mainloop_callback_t callback;
 	int fd;
+	uint32_t generation;
 	void *data;
+	struct mainloop_handler *next_free;
 };
 
-#define MAX_EVENTS 10
+#define MAINLOOP_SLAB_SIZE 64
+
+struct mainloop_slab {
+	struct mainloop_slab *next;
+	struct mainloop_handler handlers[MAINLOOP_SLAB_SIZE];
+};
+
+#define MIN_EVENTS 16
+#define MAX_EVENTS 1024
+
+/*
+ * The epoll cookie carries the fd and the generation of its handler, so an
+ * event which was already queued when its handler got deleted (and maybe a
+ * new one registered for the same fd number) is dropped instead of being
+ * dispatched to the wrong record.
+ */
+static inline uint64_t handler_cookie(struct mainloop_handler *handler)
+{
+	return ((uint64_t)handler->generation << 32) | (uint32_t)handler->fd;
+}
+
+static struct mainloop_handler *lookup_handler(struct lxc_epoll_descr *descr,
+					       uint64_t cookie)
+{
+	int fd = (int)(uint32_t)cookie;
+	struct mainloop_handler *handler;
+
+	if (fd < 0 || fd >= descr->fds_size)
+		return NULL;
+
+	handler = descr->fds[fd];
+	if (!handler || handler->generation != (uint32_t)(cookie >> 32))
+		return NULL;
+
+	return handler;
+}
+
+static int grow_events(struct lxc_epoll_descr *descr)
+{
+	int max_events = descr->max_events * 2;
+	struct epoll_event *events;
+
+	if (max_events > MAX_EVENTS)
+		max_events = MAX_EVENTS;
+	if (max_events <= descr->max_events)
+		return 0;
+
+	events = realloc(descr->events, max_events * sizeof(*events));
+	if (!events)
+		return -1;
+
+	descr->events = events;
+	descr->max_events = max_events;
+	return 0;
+}
 
 int lxc_mainloop(struct lxc_epoll_descr *descr, int timeout_ms)
 {
 	int i, nfds;
 	struct mainloop_handler *handler;
-	struct epoll_event events[MAX_EVENTS];
 
 	for (;;) {
 
-		nfds = epoll_wait(descr->epfd, events, MAX_EVENTS, timeout_ms);
+		nfds = epoll_wait(descr->epfd, descr->events,
+				  descr->max_events, timeout_ms);
 		if (nfds < 0) {
 			if (errno == EINTR)
 				continue;
@@ -54,111 +110,209 @@ int lxc_mainloop(struct lxc_epoll_descr *descr, int timeout_ms)
 		}
 
 		for (i = 0; i < nfds; i++) {
-			handler =
-				(struct mainloop_handler *) events[i].data.ptr;
+			handler = lookup_handler(descr, descr->events[i].data.u64);
+			if (!handler)
+				continue;
 
 			/* If the handler returns a positive value, exit
 			   the mainloop */
-			if (handler->callback(handler->fd, events[i].events,
+			if (handler->callback(handler->fd, descr->events[i].events,
 					      handler->data, descr) > 0)
 				return 0;
 		}
 
+		/* A full batch means more events are likely pending, fetch
+		 * more of them per epoll_wait() from now on. */
+		if (nfds == descr->max_events && nfds < descr->nr_handlers)
+			grow_events(descr);
+
 		if (nfds == 0 && timeout_ms != 0)
 			return 0;
 
-		if (lxc_list_empty(&descr->handlers))
+		if (!descr->nr_handlers)
 			return 0;
 	}
 }
 
+static struct mainloop_handler *alloc_handler(struct lxc_epoll_descr *descr)
+{
+	int i;
+	struct mainloop_slab *slab;
+	struct mainloop_handler *handler;
+
+	if (!descr->free_handlers) {
+		slab = malloc(sizeof(*slab));
+		if (!slab)
+			return NULL;
+
+		slab->next = descr->slabs;
+		descr->slabs = slab;
+		for (i = MAINLOOP_SLAB_SIZE - 1; i >= 0; i--) {
+			slab->handlers[i].next_free = descr->free_handlers;
+			descr->free_handlers = &slab->handlers[i];
+		}
+	}
+
+	handler = descr->free_handlers;
+	descr->free_handlers = handler->next_free;
+	return handler;
+}
+
+static void free_handler(struct lxc_epoll_descr *descr,
+			 struct mainloop_handler *handler)
+{
+	handler->next_free = descr->free_handlers;
+	descr->free_handlers = handler;
+}
+
+static int grow_fds(struct lxc_epoll_descr *descr, int fd)
+{
+	int size = descr->fds_size ? descr->fds_size : 64;
+	struct mainloop_handler **fds;
+
+	while (size <= fd)
+		size *= 2;
+
+	fds = realloc(descr->fds, size * sizeof(*fds));
+	if (!fds)
+		return -1;
+
+	memset(fds + descr->fds_size, 0,
+	       (size - descr->fds_size) * sizeof(*fds));
+	descr->fds = fds;
+	descr->fds_size = size;
+	return 0;
+}
+
 int lxc_mainloop_add_handler(struct lxc_epoll_descr *descr, int fd,
 			     lxc_mainloop_callback_t callback, void *data)
 {
 	struct epoll_event ev;
 	struct mainloop_handler *handler;
-	struct lxc_list *item;
 
-	handler = malloc(sizeof(*handler));
+	if (fd < 0) {
+		errno = EBADF;
+		return -1;
+	}
+
+	if (fd >= descr->fds_size && grow_fds(descr, fd))
+		return -1;
+
+	handler = alloc_handler(descr);
 	if (!handler)
 		return -1;
 
 	handler->callback = callback;
 	handler->fd = fd;
+	handler->generation = descr->generation++;
 	handler->data = data;
 
 	ev.events = EPOLLIN;
-	ev.data.ptr = handler;
+	ev.data.u64 = handler_cookie(handler);
 
 	if (epoll_ctl(descr->epfd, EPOLL_CTL_ADD, fd, &ev) < 0)
 		goto out_free_handler;
 
-	item = malloc(sizeof(*item));
-	if (!item)
-		goto out_free_handler;
+	/* The fd was closed without deleting its handler, epoll forgot
+	 * about it already and so can we. */
+	if (descr->fds[fd]) {
+		free_handler(descr, descr->fds[fd]);
+		descr->nr_handlers--;
+	}
 
-	item->elem = handler;
-	lxc_list_add(&descr->handlers, item);
+	descr->fds[fd] = handler;
+	descr->nr_handlers++;
 	return 0;
 
 out_free_handler:
-	free(handler);
+	free_handler(descr, handler);
 	return -1;
 }
 
 int lxc_mainloop_del_handler(struct lxc_epoll_descr *descr, int fd)
 {
 	struct mainloop_handler *handler;
-	struct lxc_list *iterator;
 
-	lxc_list_for_each(iterator, &descr->handlers) {
-		handler = iterator->elem;
+	if (fd < 0 || fd >= descr->fds_size)
+		return -1;
 
-		if (handler->fd == fd) {
-			/* found */
-			if (epoll_ctl(descr->epfd, EPOLL_CTL_DEL, fd, NULL))
-				return -1;
+	handler = descr->fds[fd];
+	if (!handler)
+		return -1;
 
-			lxc_list_del(iterator);
-			free(iterator->elem);
-			free(iterator);
-			return 0;
-		}
-	}
+	if (epoll_ctl(descr->epfd, EPOLL_CTL_DEL, fd, NULL))
+		return -1;
 
-	return -1;
+	descr->fds[fd] = NULL;
+	descr->nr_handlers--;
+	free_handler(descr, handler);
+	return 0;
+}
+
+int lxc_mainloop_mod_handler(struct lxc_epoll_descr *descr, int fd,
+			     uint32_t events)
+{
+	struct epoll_event ev;
+	struct mainloop_handler *handler;
+
+	if (fd < 0 || fd >= descr->fds_size)
+		return -1;
+
+	handler = descr->fds[fd];
+	if (!handler)
+		return -1;
+
+	ev.events = events;
+	ev.data.u64 = handler_cookie(handler);
+	return epoll_ctl(descr->epfd, EPOLL_CTL_MOD, fd, &ev);
 }
 
 int lxc_mainloop_open(struct lxc_epoll_descr *descr)
 {
+	memset(descr, 0, sizeof(*descr));
+
+	descr->events = malloc(MIN_EVENTS * sizeof(*descr->events));
+	if (!descr->events)
+		return -1;
+	descr->max_events = MIN_EVENTS;
+
 	/* hint value passed to epoll create */
 	descr->epfd = epoll_create(2);
 	if (descr->epfd < 0)
-		return -1;
+		goto out_free_events;
 
 	if (fcntl(descr->epfd, F_SETFD, FD_CLOEXEC)) {
 		close(descr->epfd);
-		return -1;
+		goto out_free_events;
 	}
 
-	lxc_list_init(&descr->handlers);
 	return 0;
+
+out_free_events:
+	free(descr->events);
+	descr->events = NULL;
+	return -1;
 }
 
 int lxc_mainloop_close(struct lxc_epoll_descr *descr)
 {
-	struct lxc_list *iterator, *next;
-
-	iterator = descr->handlers.next;
-	while (iterator != &descr->handlers) {
-		next = iterator->next;
+	struct mainloop_slab *slab, *next;
 
-		lxc_list_del(iterator);
-		free(iterator->elem);
-		free(iterator);
-		iterator = next;
+	for (slab = descr->slabs; slab; slab = next) {
+		next = slab->next;
+		free(slab);
 	}
+	descr->slabs = NULL;
+	descr->free_handlers = NULL;
+
+	free(descr->fds);
+	descr->fds = NULL;
+	descr->fds_size = 0;
+	descr->nr_handlers = 0;
+
+	free(descr->events);
+	descr->events = NULL;
+	descr->max_events = 0;
 
 	return close(descr->epfd);
 }
-
@@ -25,11 +25,24 @@
 #define __LXC_MAINLOOP_H
 
 #include <stdint.h>
-#include "list.h"
+#include <sys/epoll.h>
+
+struct mainloop_handler;
+struct mainloop_slab;
 
 struct lxc_epoll_descr {
 	int epfd;
-	struct lxc_list handlers;
+	/* handlers indexed by fd */
+	struct mainloop_handler **fds;
+	int fds_size;
+	int nr_handlers;
+	/* handler records are carved out of slabs and recycled */
+	struct mainloop_slab *slabs;
+	struct mainloop_handler *free_handlers;
+	uint32_t generation;
+	/* epoll_wait() batch, grown while it comes back full */
+	struct epoll_event *events;
+	int max_events;
 };
 
 typedef int (*lxc_mainloop_callback_t)(int fd, uint32_t event, void *data,
@@ -43,6 +56,10 @@ extern int lxc_mainloop_add_handler(struct lxc_epoll_descr *descr, int fd,
 
 extern int lxc_mainloop_del_handler(struct lxc_epoll_descr *descr, int fd);
 
+/* Change the epoll events (EPOLLIN by default) a handler is called for. */
+extern int lxc_mainloop_mod_handler(struct lxc_epoll_descr *descr, int fd,
+				    uint32_t events);
+
 extern int lxc_mainloop_open(struct lxc_epoll_descr *descr);
 
 extern int lxc_mainloop_close(struct lxc_epoll_descr *descr);
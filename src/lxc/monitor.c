@@ -36,6 +36,7 @@
 #include <sys/param.h>
 #include <sys/socket.h>
 #include <sys/wait.h>
+#include <time.h>
 #include <netinet/in.h>
 #include <net/if.h>
 #include <poll.h>
@@ -122,26 +123,83 @@ static void lxc_monitor_fifo_send(struct lxc_msg *msg, const char *lxcpath)
 	close(fd);
 }
 
-void lxc_monitor_send_state(const char *name, lxc_state_t state, const char *lxcpath)
+/* One datagram socket per process, kept open for the lifetime of the
+ * process (for lxc-start, the lifetime of the container) so that publishing
+ * an event costs a single sendto().
+ */
+static int publish_fd = -1;
+static uint64_t publish_seq;
+
+static int lxc_monitor_publish(struct lxc_event *ev, const char *lxcpath)
 {
-	struct lxc_msg msg = { .type = lxc_msg_state,
-			       .value = state };
-	strncpy(msg.name, name, sizeof(msg.name));
-	msg.name[sizeof(msg.name) - 1] = 0;
+	struct sockaddr_un addr;
+	socklen_t len;
+	int fd;
 
-	lxc_monitor_fifo_send(&msg, lxcpath);
+	if (lxc_monitor_publish_sock_name(lxcpath, &addr) < 0)
+		return -1;
+	len = offsetof(struct sockaddr_un, sun_path) + strlen(&addr.sun_path[1]) + 1;
+
+	fd = publish_fd;
+	if (fd < 0) {
+		fd = socket(PF_UNIX, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+		if (fd < 0)
+			return -1;
+		if (!__sync_bool_compare_and_swap(&publish_fd, -1, fd)) {
+			close(fd);
+			fd = publish_fd;
+		}
+	}
+
+	if (sendto(fd, ev, sizeof(*ev), MSG_NOSIGNAL,
+		   (struct sockaddr *)&addr, len) != sizeof(*ev))
+		return -1;
+	return 0;
 }
 
-void lxc_monitor_send_exit_code(const char *name, int exit_code, const char *lxcpath)
+void lxc_monitor_send_event(const char *name, const char *lxcpath,
+			    lxc_msg_type_t type, int value,
+			    pid_t init_pid, const char *cgroup)
 {
-	struct lxc_msg msg = { .type = lxc_msg_exit_code,
-			       .value = exit_code };
-	strncpy(msg.name, name, sizeof(msg.name));
-	msg.name[sizeof(msg.name) - 1] = 0;
+	struct lxc_event ev;
+	struct lxc_msg msg;
+	struct timespec ts;
+
+	memset(&ev, 0, sizeof(ev));
+	ev.version = LXC_EVENT_VERSION;
+	ev.type = type;
+	ev.seq = __sync_fetch_and_add(&publish_seq, 1);
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	ev.timestamp = (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+	ev.value = value;
+	ev.monitor_pid = getpid();
+	ev.init_pid = init_pid;
+	strncpy(ev.name, name, sizeof(ev.name) - 1);
+	if (cgroup)
+		strncpy(ev.cgroup, cgroup, sizeof(ev.cgroup) - 1);
+
+	if (lxc_monitor_publish(&ev, lxcpath) == 0)
+		return;
+
+	/* no monitord, or one predating the event stream */
+	memset(&msg, 0, sizeof(msg));
+	msg.type = type;
+	msg.value = value;
+	strncpy(msg.name, name, sizeof(msg.name) - 1);
 
 	lxc_monitor_fifo_send(&msg, lxcpath);
 }
 
+void lxc_monitor_send_state(const char *name, lxc_state_t state, const char *lxcpath)
+{
+	lxc_monitor_send_event(name, lxcpath, lxc_msg_state, state, 0, NULL);
+}
+
+void lxc_monitor_send_exit_code(const char *name, int exit_code, const char *lxcpath)
+{
+	lxc_monitor_send_event(name, lxcpath, lxc_msg_exit_code, exit_code, 0, NULL);
+}
+
 
 /* routines used by monitor subscribers (lxc-monitor) */
 int lxc_monitor_close(int fd)
@@ -149,7 +207,9 @@ int lxc_monitor_close(int fd)
 	return close(fd);
 }
 
-int lxc_monitor_sock_name(const char *lxcpath, struct sockaddr_un *addr) {
+static int monitor_sock_name(const char *lxcpath, const char *suffix,
+			     struct sockaddr_un *addr)
+{
 	size_t len;
 	int ret;
 	char *sockname = &addr->sun_path[1];
@@ -161,9 +221,9 @@ int lxc_monitor_sock_name(const char *lxcpath, struct sockaddr_un *addr) {
 	 */
 	memset(addr, 0, sizeof(*addr));
 	addr->sun_family = AF_UNIX;
-	len = strlen(lxcpath) + 18;
+	len = strlen(lxcpath) + strlen(suffix) + 6;
 	path = alloca(len);
-	ret = snprintf(path, len, "lxc/%s/monitor-sock", lxcpath);
+	ret = snprintf(path, len, "lxc/%s/%s", lxcpath, suffix);
 	if (ret < 0 || ret >= len) {
 		ERROR("memory error creating monitor path");
 		return -1;
@@ -179,47 +239,93 @@ int lxc_monitor_sock_name(const char *lxcpath, struct sockaddr_un *addr) {
 	return 0;
 }
 
-int lxc_monitor_open(const char *lxcpath)
+int lxc_monitor_sock_name(const char *lxcpath, struct sockaddr_un *addr)
 {
-	struct sockaddr_un addr;
-	int fd,ret = 0;
-	int retry,backoff_ms[] = {10, 50, 100};
-	size_t len;
+	return monitor_sock_name(lxcpath, "monitor-sock", addr);
+}
 
-	if (lxc_monitor_sock_name(lxcpath, &addr) < 0)
-		return -1;
+int lxc_monitor_publish_sock_name(const char *lxcpath, struct sockaddr_un *addr)
+{
+	return monitor_sock_name(lxcpath, "monitor-publish", addr);
+}
 
-	fd = socket(PF_UNIX, SOCK_STREAM, 0);
+int lxc_monitor_events_sock_name(const char *lxcpath, struct sockaddr_un *addr)
+{
+	return monitor_sock_name(lxcpath, "monitor-events", addr);
+}
+
+/*
+ * @retry : back off and retry while nothing listens, for a monitord which is
+ *          still starting up
+ */
+static int monitor_connect(struct sockaddr_un *addr, int type, bool retry)
+{
+	int fd,ret = 0,saved_errno;
+	int i,backoff_ms[] = {10, 50, 100};
+	size_t len;
+
+	fd = socket(PF_UNIX, type, 0);
 	if (fd < 0) {
 		ERROR("socket : %s", strerror(errno));
 		return -1;
 	}
 
-	len = strlen(&addr.sun_path[1]) + 1;
-	if (len >= sizeof(addr.sun_path) - 1) {
+	len = strlen(&addr->sun_path[1]) + 1;
+	if (len >= sizeof(addr->sun_path) - 1) {
 		ret = -1;
 		errno = ENAMETOOLONG;
 		goto err1;
 	}
 
-	for (retry = 0; retry < sizeof(backoff_ms)/sizeof(backoff_ms[0]); retry++) {
-		ret = connect(fd, (struct sockaddr *)&addr, offsetof(struct sockaddr_un, sun_path) + len);
-		if (ret == 0 || errno != ECONNREFUSED)
+	for (i = 0; i < sizeof(backoff_ms)/sizeof(backoff_ms[0]); i++) {
+		ret = connect(fd, (struct sockaddr *)addr, offsetof(struct sockaddr_un, sun_path) + len);
+		if (ret == 0 || errno != ECONNREFUSED || !retry)
 			break;
-		ERROR("connect : backing off %d", backoff_ms[retry]);
-		usleep(backoff_ms[retry] * 1000);
+		ERROR("connect : backing off %d", backoff_ms[i]);
+		usleep(backoff_ms[i] * 1000);
 	}
 
 	if (ret < 0) {
-		ERROR("connect : %s", strerror(errno));
+		if (!retry && errno == ECONNREFUSED)
+			DEBUG("connect : nothing listens on %s", &addr->sun_path[1]);
+		else
+			ERROR("connect : %s", strerror(errno));
 		goto err1;
 	}
 	return fd;
 err1:
+	saved_errno = errno;
 	close(fd);
+	errno = saved_errno;
 	return ret;
 }
 
+int lxc_monitor_open(const char *lxcpath)
+{
+	struct sockaddr_un addr;
+
+	if (lxc_monitor_sock_name(lxcpath, &addr) < 0)
+		return -1;
+
+	return monitor_connect(&addr, SOCK_STREAM, true);
+}
+
+int lxc_monitor_open_events(const char *lxcpath)
+{
+	struct sockaddr_un addr;
+
+	if (lxc_monitor_events_sock_name(lxcpath, &addr) < 0)
+		return -1;
+
+	/* seqpacket keeps event boundaries even when monitord has to drop
+	 * events for a subscriber which does not keep up. Callers spawn
+	 * monitord and wait for it to listen first, so a refused connection
+	 * means one predating the event stream: don't back off, let them
+	 * fall back to lxc_monitor_open().
+	 */
+	return monitor_connect(&addr, SOCK_SEQPACKET, false);
+}
+
 int lxc_monitor_read_fdset(struct pollfd *fds, nfds_t nfds, struct lxc_msg *msg,
 			   int timeout)
 {
@@ -267,6 +373,59 @@ int lxc_monitor_read(int fd, struct lxc_msg *msg)
 	return lxc_monitor_read_timeout(fd, msg, -1);
 }
 
+int lxc_monitor_subscribe(int fd, const char *name, uint32_t flags,
+			  uint32_t types, uint32_t states)
+{
+	struct lxc_monitor_subscription sub;
+
+	memset(&sub, 0, sizeof(sub));
+	sub.version = LXC_EVENT_VERSION;
+	sub.flags = flags;
+	sub.types = types;
+	sub.states = states;
+	if (name) {
+		if (strlen(name) >= sizeof(sub.name)) {
+			errno = ENAMETOOLONG;
+			return -1;
+		}
+		strcpy(sub.name, name);
+	}
+
+	if (send(fd, &sub, sizeof(sub), MSG_NOSIGNAL) != sizeof(sub)) {
+		SYSERROR("failed to send monitor subscription");
+		return -1;
+	}
+	return 0;
+}
+
+int lxc_monitor_read_event(int fd, struct lxc_event *ev, int timeout)
+{
+	struct pollfd fds;
+	int ret;
+
+	fds.fd = fd;
+	fds.events = POLLIN | POLLPRI;
+	fds.revents = 0;
+
+	ret = poll(&fds, 1, timeout < 0 ? -1 : timeout * 1000);
+	if (ret == -1)
+		return -1;
+	else if (ret == 0)
+		return -2;  // timed out
+
+	ret = recv(fd, ev, sizeof(*ev), 0);
+	if (ret <= 0) {
+		SYSERROR("client failed to recv (monitord died?) %s",
+			 strerror(errno));
+		return -1;
+	}
+	if (ret != sizeof(*ev) || ev->version != LXC_EVENT_VERSION) {
+		ERROR("unexpected event of size %d, version %u", ret, ev->version);
+		return -1;
+	}
+	return ret;
+}
+
 
 #define LXC_MONITORD_PATH LIBEXECDIR "/lxc/lxc-monitord"
 
@@ -24,6 +24,7 @@
 #define __LXC_MONITOR_H
 
 #include <limits.h>
+#include <stdint.h>
 #include <sys/param.h>
 #include <sys/un.h>
 #include <poll.h>
@@ -42,13 +43,74 @@ struct lxc_msg {
 	int value;
 };
 
+#define LXC_EVENT_VERSION 1
+#define LXC_EVENT_CGROUP_MAX 512
+
+/*
+ * Versioned binary event. Publishers send these as datagrams to the
+ * monitord publish socket and monitord relays them to the subscribers which
+ * connected through lxc_monitor_open_events(). Fixed size, so a stream of
+ * them needs no further framing.
+ * @version     : LXC_EVENT_VERSION
+ * @type        : an lxc_msg_type_t
+ * @seq         : per publishing process, a gap means events were lost
+ *                before reaching monitord
+ * @stream_seq  : set by monitord per subscriber, a gap means the
+ *                subscriber fell behind and events were dropped
+ * @timestamp   : CLOCK_MONOTONIC at the publisher, in nanoseconds
+ * @value       : the state, or the wait status for lxc_msg_exit_code
+ * @monitor_pid : the publishing process, as seen by monitord
+ * @init_pid    : the container init, 0 if unknown
+ * @name        : the container name
+ * @cgroup      : the container cgroup, empty if unknown
+ */
+struct lxc_event {
+	uint32_t version;
+	uint32_t type;
+	uint64_t seq;
+	uint64_t stream_seq;
+	uint64_t timestamp;
+	int32_t value;
+	int32_t monitor_pid;
+	int32_t init_pid;
+	char name[NAME_MAX+1];
+	char cgroup[LXC_EVENT_CGROUP_MAX];
+};
+
+/* The name of a subscription is a glob(7) pattern rather than a name. */
+#define LXC_MONITOR_SUB_GLOB 0x1
+
+/*
+ * Sent by an event stream subscriber to have monitord deliver only the
+ * events it is interested in. Until then it gets every event.
+ * @version : LXC_EVENT_VERSION
+ * @flags   : LXC_MONITOR_SUB_* flags
+ * @types   : mask of (1 << lxc_msg_type_t), 0 for all types
+ * @states  : mask of (1 << lxc_state_t) for lxc_msg_state events, 0 for all
+ * @name    : the container name, empty for all containers
+ */
+struct lxc_monitor_subscription {
+	uint32_t version;
+	uint32_t flags;
+	uint32_t types;
+	uint32_t states;
+	char name[NAME_MAX+1];
+};
+
 extern int lxc_monitor_sock_name(const char *lxcpath, struct sockaddr_un *addr);
+extern int lxc_monitor_publish_sock_name(const char *lxcpath,
+					 struct sockaddr_un *addr);
+extern int lxc_monitor_events_sock_name(const char *lxcpath,
+					struct sockaddr_un *addr);
 extern int lxc_monitor_fifo_name(const char *lxcpath, char *fifo_path,
 				 size_t fifo_path_sz, int do_mkdirp);
 extern void lxc_monitor_send_state(const char *name, lxc_state_t state,
 			    const char *lxcpath);
 extern void lxc_monitor_send_exit_code(const char *name, int exit_code,
 			    const char *lxcpath);
+extern void lxc_monitor_send_event(const char *name, const char *lxcpath,
+				   lxc_msg_type_t type, int value,
+				   pid_t init_pid, const char *cgroup);
 extern int lxc_monitord_spawn(const char *lxcpath);
 
 /*
@@ -90,5 +152,33 @@ extern int lxc_monitor_read_timeout(int fd, struct lxc_msg *msg, int timeout);
 extern int lxc_monitor_read_fdset(struct pollfd *fds, nfds_t nfds, struct lxc_msg *msg,
 			   int timeout);
 
+/*
+ * Open the binary event stream of an lxcpath
+ * Returns a file descriptor on success, < 0 otherwise. errno is
+ * ECONNREFUSED, without any retry, when lxc-monitord predates the event
+ * stream; lxc_monitor_open() still works with it.
+ */
+extern int lxc_monitor_open_events(const char *lxcpath);
+
+/*
+ * Restrict the events delivered on an event stream
+ * @fd     : the file descriptor provided by lxc_monitor_open_events
+ * @name   : container name or, with LXC_MONITOR_SUB_GLOB, pattern; NULL for all
+ * @flags  : LXC_MONITOR_SUB_* flags
+ * @types  : mask of (1 << lxc_msg_type_t), 0 for all
+ * @states : mask of (1 << lxc_state_t), 0 for all
+ * Returns 0 on success, < 0 otherwise
+ */
+extern int lxc_monitor_subscribe(int fd, const char *name, uint32_t flags,
+				 uint32_t types, uint32_t states);
+
+/*
+ * Blocking read for the next event with timeout
+ * @fd      : the file descriptor provided by lxc_monitor_open_events
+ * @ev      : the variable which will be filled with the event
+ * @timeout : the timeout in seconds, -1 to wait forever
+ * Returns > 0 if an event was read, -2 on timeout, < 0 otherwise
+ */
+extern int lxc_monitor_read_event(int fd, struct lxc_event *ev, int timeout);
 
 #endif
@@ -30,7 +30,9 @@
 #include <string.h>
 #include <stdio.h>
 #include <ctype.h>
+#include <sched.h>
 #include <time.h>
+#include <sys/syscall.h>
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <sys/socket.h>
@@ -46,9 +48,11 @@
 #include <linux/rtnetlink.h>
 #include <linux/sockios.h>
 
+#include "af_unix.h"
 #include "nl.h"
 #include "network.h"
 #include "conf.h"
+#include "log.h"
 #include "utils.h"
 
 #if HAVE_IFADDRS_H
@@ -57,6 +61,8 @@
 #include <../include/ifaddrs.h>
 #endif
 
+lxc_log_define(lxc_network, lxc);
+
 #ifndef IFLA_LINKMODE
 #  define IFLA_LINKMODE 17
 #endif
@@ -1590,3 +1596,129 @@ int setup_private_host_hw_addr(char *veth1)
 
 	return 0;
 }
+
+/*
+ * Set once a thread failed to return to its own network namespace.  Its
+ * sockets would now be created in the wrong one, so it must not open any.
+ */
+#ifdef HAVE_TLS
+static __thread bool netns_stranded;
+#else
+static bool netns_stranded;
+#endif
+
+/* a netlink socket stays in the network namespace it was created in */
+static int netns_netlink_open_setns(struct nl_handler *handler, pid_t pid)
+{
+	char path[MAXPATHLEN];
+	int netns, self, err;
+
+	if (netns_stranded) {
+		ERROR("this thread is stuck in a foreign network namespace");
+		return -ENOTRECOVERABLE;
+	}
+
+	snprintf(path, sizeof(path), "/proc/%d/ns/net", pid);
+	netns = open(path, O_RDONLY | O_CLOEXEC);
+	if (netns < 0)
+		return -errno;
+
+	/* setns() only moves the calling thread */
+	snprintf(path, sizeof(path), "/proc/self/task/%ld/ns/net",
+		 (long)syscall(__NR_gettid));
+	self = open(path, O_RDONLY | O_CLOEXEC);
+	if (self < 0) {
+		err = -errno;
+		close(netns);
+		return err;
+	}
+
+	if (setns(netns, CLONE_NEWNET) < 0) {
+		err = -errno;
+		goto out;
+	}
+
+	err = netlink_open(handler, NETLINK_ROUTE);
+
+	if (setns(self, CLONE_NEWNET) < 0) {
+		SYSERROR("failed to return to the original network namespace");
+		netns_stranded = true;
+		if (err == 0)
+			netlink_close(handler);
+		err = -ENOTRECOVERABLE;
+	}
+
+out:
+	close(self);
+	close(netns);
+	return err;
+}
+
+/*
+ * Without privilege over the namespace, join it from a child which
+ * passes the socket back.
+ */
+static int netns_netlink_open_child(struct nl_handler *handler, pid_t pid,
+				    bool userns)
+{
+	socklen_t socklen;
+	pid_t child;
+	int sv[2], fd = -1, err;
+
+	if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, sv) < 0)
+		return -errno;
+
+	child = fork();
+	if (child < 0) {
+		err = -errno;
+		close(sv[0]);
+		close(sv[1]);
+		return err;
+	}
+
+	if (child == 0) {
+		close(sv[0]);
+
+		if (userns && !switch_to_ns(pid, "user"))
+			_exit(EXIT_FAILURE);
+		if (!switch_to_ns(pid, "net"))
+			_exit(EXIT_FAILURE);
+		if (netlink_open(handler, NETLINK_ROUTE) < 0)
+			_exit(EXIT_FAILURE);
+		if (lxc_abstract_unix_send_fd(sv[1], handler->fd, NULL, 0) < 0)
+			_exit(EXIT_FAILURE);
+		_exit(EXIT_SUCCESS);
+	}
+
+	close(sv[1]);
+	err = lxc_abstract_unix_recv_fd(sv[0], &fd, NULL, 0);
+	close(sv[0]);
+	if (wait_for_pid(child) < 0 || err < 0 || fd < 0) {
+		if (fd >= 0)
+			close(fd);
+		return -1;
+	}
+
+	memset(handler, 0, sizeof(*handler));
+	handler->fd = fd;
+	socklen = sizeof(handler->local);
+	if (getsockname(fd, (struct sockaddr *)&handler->local, &socklen) < 0) {
+		err = -errno;
+		close(fd);
+		return err;
+	}
+	handler->seq = time(NULL);
+
+	return 0;
+}
+
+int lxc_netns_netlink_open(struct nl_handler *handler, pid_t pid, bool userns)
+{
+	int err;
+
+	err = netns_netlink_open_setns(handler, pid);
+	if (err != -EPERM)
+		return err;
+
+	return netns_netlink_open_child(handler, pid, userns);
+}
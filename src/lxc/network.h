@@ -23,6 +23,10 @@
 #ifndef __LXC_NETWORK_H
 #define __LXC_NETWORK_H
 
+#include <stdbool.h>
+
+struct nl_handler;
+
 /*
  * Convert a string mac address to a socket structure
  */
@@ -141,4 +145,12 @@ extern char *lxc_mkifname(char *template);
 extern const char *lxc_net_type_to_str(int type);
 extern int setup_private_host_hw_addr(char *veth1);
 extern int netdev_get_mtu(int ifindex);
+
+/*
+ * Open a route netlink socket in the network namespace of @pid. Without
+ * privilege over that namespace a child joins it to create the socket,
+ * first joining the user namespace of @pid when @userns is set.
+ */
+extern int lxc_netns_netlink_open(struct nl_handler *handler, pid_t pid,
+				  bool userns);
 #endif
@@ -260,6 +260,80 @@ extern int netlink_transaction(struct nl_handler *handler,
 	return 0;
 }
 
+/* large enough for the biggest message the kernel puts in a dump */
+#define NLMSG_DUMP_SIZE 32768
+
+extern int netlink_dump(struct nl_handler *handler, int type,
+			const void *hdr, size_t hdrlen,
+			int (*cb)(struct nlmsghdr *msg, void *data), void *data)
+{
+	struct nlmsg *nlmsg = NULL, *answer = NULL;
+	struct nlmsghdr *msg;
+	void *payload;
+	int err, recv_len, answer_len;
+
+	err = -ENOMEM;
+	nlmsg = nlmsg_alloc(hdrlen);
+	if (!nlmsg)
+		goto out;
+
+	answer = nlmsg_alloc_reserve(NLMSG_DUMP_SIZE);
+	if (!answer)
+		goto out;
+	answer_len = answer->nlmsghdr->nlmsg_len;
+
+	nlmsg->nlmsghdr->nlmsg_flags = NLM_F_REQUEST|NLM_F_DUMP;
+	nlmsg->nlmsghdr->nlmsg_type = type;
+
+	payload = nlmsg_reserve(nlmsg, hdrlen);
+	if (!payload)
+		goto out;
+	memcpy(payload, hdr, hdrlen);
+
+	err = netlink_send(handler, nlmsg);
+	if (err < 0)
+		goto out;
+
+	for (;;) {
+		/* netlink_rcv() takes the buffer size from nlmsg_len, which
+		 * the header of the first message received overwrote
+		 */
+		answer->nlmsghdr->nlmsg_len = answer_len;
+
+		err = netlink_rcv(handler, answer);
+		if (err < 0)
+			goto out;
+		if (err == 0) {
+			err = -EIO;
+			goto out;
+		}
+
+		recv_len = err;
+		for (msg = answer->nlmsghdr; NLMSG_OK(msg, recv_len);
+		     msg = NLMSG_NEXT(msg, recv_len)) {
+			if (msg->nlmsg_type == NLMSG_DONE) {
+				err = 0;
+				goto out;
+			}
+
+			if (msg->nlmsg_type == NLMSG_ERROR) {
+				struct nlmsgerr *errmsg = NLMSG_DATA(msg);
+				err = errmsg->error;
+				goto out;
+			}
+
+			err = cb(msg, data);
+			if (err)
+				goto out;
+		}
+	}
+
+out:
+	nlmsg_free(answer);
+	nlmsg_free(nlmsg);
+	return err;
+}
+
 extern int netlink_open(struct nl_handler *handler, int protocol)
 {
 	socklen_t socklen;
@@ -125,6 +125,24 @@ int netlink_send(struct nl_handler *handler, struct nlmsg *nlmsg);
 int netlink_transaction(struct nl_handler *handler,
 			struct nlmsg *request, struct nlmsg *anwser);
 
+/*
+ * netlink_dump: send a dump request to the kernel and pass every message
+ *  of the answer to a callback, until the end of the dump.
+ *
+ * @handler: a handler to a opened netlink socket
+ * @type: the type of the request, e.g. RTM_GETLINK
+ * @hdr: the family specific header of the request
+ * @hdrlen: the size of @hdr
+ * @cb: the callback, a non zero return value stops the dump and is
+ *  returned; the rest of the answer is left unread on the socket
+ * @data: a pointer passed to @cb
+ *
+ * Returns 0 on success, < 0 otherwise
+ */
+int netlink_dump(struct nl_handler *handler, int type,
+		 const void *hdr, size_t hdrlen,
+		 int (*cb)(struct nlmsghdr *msg, void *data), void *data);
+
 /*
  * nla_put_string: copy a null terminated string to a netlink message
  *  attribute
@@ -358,10 +358,18 @@ static int signal_handler(int fd, uint32_t events, void *data,
 	return 1;
 }
 
+static const char *lxc_event_cgroup(struct lxc_handler *handler)
+{
+	if (!handler->cgroup_data)
+		return NULL;
+	return cgroup_get_cgroup(handler, "freezer");
+}
+
 int lxc_set_state(const char *name, struct lxc_handler *handler, lxc_state_t state)
 {
 	handler->state = state;
-	lxc_monitor_send_state(name, state, handler->lxcpath);
+	lxc_monitor_send_event(name, handler->lxcpath, lxc_msg_state, state,
+			       handler->pid, lxc_event_cgroup(handler));
 	return 0;
 }
 
@@ -441,6 +449,9 @@ struct lxc_handler *lxc_init(const char *name, struct lxc_conf *conf, const char
 	if (lxc_cmd_init(name, handler, lxcpath))
 		goto out_free_name;
 
+	if (lxc_active_add(name, lxcpath))
+		WARN("failed to register '%s' as active", name);
+
 	if (lxc_read_seccomp_config(conf) != 0) {
 		ERROR("failed loading seccomp policy");
 		goto out_close_maincmd_fd;
@@ -511,6 +522,7 @@ out_delete_tty:
 out_aborting:
 	lxc_set_state(name, handler, ABORTING);
 out_close_maincmd_fd:
+	lxc_active_del(name, lxcpath);
 	close(conf->maincmd_fd);
 	conf->maincmd_fd = -1;
 out_free_name:
@@ -581,6 +593,7 @@ void lxc_fini(const char *name, struct lxc_handler *handler)
 
 	lxc_console_delete(&handler->conf->console);
 	lxc_delete_tty(&handler->conf->tty_info);
+	lxc_active_del(name, handler->lxcpath);
 	close(handler->conf->maincmd_fd);
 	handler->conf->maincmd_fd = -1;
 	free(handler->name);
@@ -1433,7 +1446,8 @@ int __lxc_start(const char *name, struct lxc_conf *conf,
 		handler->pinfd = -1;
 	}
 
-	lxc_monitor_send_exit_code(name, status, handler->lxcpath);
+	lxc_monitor_send_event(name, handler->lxcpath, lxc_msg_exit_code,
+			       status, handler->pid, lxc_event_cgroup(handler));
 	err =  lxc_error_set_and_log(handler->pid, status);
 out_fini:
 	lxc_delete_network(handler);
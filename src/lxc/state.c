@@ -31,6 +31,7 @@
 #include <sys/param.h>
 #include <sys/stat.h>
 #include <sys/file.h>
+#include <dirent.h>
 
 #include "lxc.h"
 #include "log.h"
@@ -39,6 +40,7 @@
 #include "monitor.h"
 #include "commands.h"
 #include "config.h"
+#include "utils.h"
 
 lxc_log_define(lxc_state, lxc);
 
@@ -70,8 +72,23 @@ lxc_state_t lxc_str2state(const char *state)
 lxc_state_t lxc_getstate(const char *name, const char *lxcpath)
 {
 	extern lxc_state_t freezer_state(const char *name, const char *lxcpath);
+	struct lxc_cmd_status_bundle bundle;
+	lxc_state_t state;
+	bool done;
 
-	lxc_state_t state = freezer_state(name, lxcpath);
+	/* A single round trip unless the monitor could not read the freezer
+	 * state itself or predates the status bundle.
+	 */
+	if (lxc_cmd_get_status_bundle(name, lxcpath, NULL, &bundle) == 0) {
+		state = bundle.state;
+		done = state == STOPPED ||
+		       lxc_cmd_status_bundle_get(&bundle, "freezer.state");
+		lxc_cmd_status_bundle_free(&bundle);
+		if (done)
+			return state;
+	}
+
+	state = freezer_state(name, lxcpath);
 	if (state != FROZEN && state != FREEZING)
 		state = lxc_cmd_get_state(name, lxcpath);
 	return state;
@@ -103,11 +120,31 @@ static int fillwaitedstates(const char *strstates, int *states)
 	return 0;
 }
 
+static int lxc_wait_read(int fd, bool events, struct lxc_msg *msg, int timeout)
+{
+	struct lxc_event ev;
+	int ret;
+
+	if (!events)
+		return lxc_monitor_read_timeout(fd, msg, timeout);
+
+	ret = lxc_monitor_read_event(fd, &ev, timeout);
+	if (ret < 0)
+		return ret;
+
+	msg->type = ev.type;
+	msg->value = ev.value;
+	memcpy(msg->name, ev.name, sizeof(msg->name));
+	return ret;
+}
+
 extern int lxc_wait(const char *lxcname, const char *states, int timeout, const char *lxcpath)
 {
 	struct lxc_msg msg;
 	int state, ret;
 	int s[MAX_STATE] = { }, fd;
+	uint32_t mask = 0;
+	bool events;
 
 	if (fillwaitedstates(states, s))
 		return -1;
@@ -115,7 +152,24 @@ extern int lxc_wait(const char *lxcname, const char *states, int timeout, const
 	if (lxc_monitord_spawn(lxcpath))
 		return -1;
 
-	fd = lxc_monitor_open(lxcpath);
+	for (state = 0; state < MAX_STATE; state++)
+		if (s[state])
+			mask |= 1U << state;
+
+	/* Have monitord send only the state changes we wait for, unless it
+	 * predates the event stream.
+	 */
+	fd = lxc_monitor_open_events(lxcpath);
+	events = fd >= 0;
+	if (!events && errno == ECONNREFUSED)
+		DEBUG("lxc-monitord has no event stream, using its legacy socket");
+	if (events && lxc_monitor_subscribe(fd, lxcname, 0,
+					    1U << lxc_msg_state, mask) < 0) {
+		close(fd);
+		return -1;
+	}
+	if (!events)
+		fd = lxc_monitor_open(lxcpath);
 	if (fd < 0)
 		return -1;
 
@@ -144,7 +198,7 @@ extern int lxc_wait(const char *lxcname, const char *states, int timeout, const
 				goto out_close;
 			curtime = tv.tv_sec;
 		}
-		if (lxc_monitor_read_timeout(fd, &msg, timeout) < 0) {
+		if (lxc_wait_read(fd, events, &msg, timeout) < 0) {
 			/* try again if select interrupted by signal */
 			if (errno != EINTR)
 				goto out_close;
@@ -195,3 +249,214 @@ out_close:
 	lxc_monitor_close(fd);
 	return ret;
 }
+
+/*
+ * Registry of active containers.
+ *
+ * Every monitor drops a record named ".<name>" holding its pid and start time
+ * into <rundir>/lxc/active/<lxcpath> from lxc_init() and removes it again
+ * from lxc_fini(), so listing the running containers of an lxcpath only has to
+ * look up the running containers' records.  Monitors of an older liblxc
+ * keep no record, so list_active_containers() still cross-checks the
+ * registry against /proc/net/unix; the records save it the command round
+ * trips for hashed socket names.  lxc_active_list() fails if no monitor
+ * of the lxcpath is running.
+ */
+static int active_path(char *path, const char *lxcpath, const char *name)
+{
+	char *rundir;
+	int ret;
+
+	rundir = get_rundir();
+	if (!rundir)
+		return -1;
+
+	if (name)
+		ret = snprintf(path, MAXPATHLEN, "%s/lxc/active/%s/.%s", rundir, lxcpath, name);
+	else
+		ret = snprintf(path, MAXPATHLEN, "%s/lxc/active/%s", rundir, lxcpath);
+	free(rundir);
+	if (ret < 0 || ret >= MAXPATHLEN)
+		return -1;
+	return 0;
+}
+
+/*
+ * Start time of @pid in clock ticks since boot, field 22 of /proc/<pid>/stat,
+ * or 0 if the process is gone.  A pid alone does not identify a monitor once
+ * the pid has been reused.
+ */
+static unsigned long long active_starttime(pid_t pid)
+{
+	char path[32], buf[1024], *p;
+	unsigned long long starttime;
+	int fd, i;
+	ssize_t len;
+
+	snprintf(path, sizeof(path), "/proc/%d/stat", pid);
+	fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+		return 0;
+	len = read(fd, buf, sizeof(buf) - 1);
+	close(fd);
+	if (len <= 0)
+		return 0;
+	buf[len] = '\0';
+
+	/* the command name may contain spaces, count from its closing paren */
+	p = strrchr(buf, ')');
+	if (!p)
+		return 0;
+	for (i = 2; i < 22 && p; i++)
+		p = strchr(p + 1, ' ');
+	if (!p || sscanf(p, "%llu", &starttime) != 1)
+		return 0;
+	return starttime;
+}
+
+static int active_write(int dirfd, const char *name, pid_t pid)
+{
+	char entry[MAXPATHLEN], buf[64];
+	int fd, len, ret;
+
+	ret = snprintf(entry, sizeof(entry), ".%s", name);
+	if (ret < 0 || ret >= sizeof(entry))
+		return -1;
+
+	fd = openat(dirfd, entry, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+	if (fd < 0)
+		return -1;
+
+	len = snprintf(buf, sizeof(buf), "%d %llu\n", pid, active_starttime(pid));
+	ret = write(fd, buf, len) == len ? 0 : -1;
+	close(fd);
+	return ret;
+}
+
+int lxc_active_add(const char *name, const char *lxcpath)
+{
+	char dir[MAXPATHLEN];
+	int dirfd, i, ret = -1;
+
+	if (active_path(dir, lxcpath, NULL) < 0)
+		return -1;
+
+	/* lxc_active_del() of the last record removes the directory, retry if
+	 * that happened under us
+	 */
+	for (i = 0; i < 3 && ret < 0; i++) {
+		if (mkdir_p(dir, 0755) < 0)
+			return -1;
+
+		dirfd = open(dir, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+		if (dirfd < 0) {
+			if (errno == ENOENT)
+				continue;
+			return -1;
+		}
+
+		ret = active_write(dirfd, name, getpid());
+		close(dirfd);
+		if (ret < 0 && errno != ENOENT)
+			break;
+	}
+	return ret;
+}
+
+void lxc_active_del(const char *name, const char *lxcpath)
+{
+	char path[MAXPATHLEN];
+
+	if (active_path(path, lxcpath, name) < 0)
+		return;
+
+	if (unlink(path) < 0 && errno != ENOENT)
+		WARN("failed to remove %s: %s", path, strerror(errno));
+
+	/* drop the directory with the last record, lxcpaths come and go */
+	*strrchr(path, '/') = '\0';
+	rmdir(path);
+}
+
+static bool active_alive(int dirfd, const char *entry, const char *lxcpath)
+{
+	char buf[64];
+	unsigned long long starttime;
+	pid_t pid;
+	int fd;
+	ssize_t len;
+
+	fd = openat(dirfd, entry, O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+		return false;
+
+	len = read(fd, buf, sizeof(buf) - 1);
+	close(fd);
+	if (len < 0)
+		return false;
+	buf[len] = '\0';
+
+	/* Records caught mid-write carry no pid or start time, ask the
+	 * monitor instead.
+	 */
+	if (sscanf(buf, "%d %llu", &pid, &starttime) != 2 || pid <= 0 || !starttime)
+		return lxc_cmd_get_state(entry + 1, lxcpath) != STOPPED;
+
+	return active_starttime(pid) == starttime;
+}
+
+static int string_cmp(const void *a, const void *b)
+{
+	return strcmp(*(char * const *)a, *(char * const *)b);
+}
+
+int lxc_active_list(const char *lxcpath, char ***names)
+{
+	char dir[MAXPATHLEN], **list = NULL, **tmp;
+	struct dirent *direntp;
+	DIR *d;
+	int dfd, nr = 0;
+
+	if (active_path(dir, lxcpath, NULL) < 0)
+		return -1;
+
+	d = opendir(dir);
+	if (!d)
+		return -1;
+	dfd = dirfd(d);
+
+	while ((direntp = readdir(d))) {
+		if (direntp->d_name[0] != '.' || !direntp->d_name[1])
+			continue;
+		if (!strcmp(direntp->d_name, ".."))
+			continue;
+
+		if (!active_alive(dfd, direntp->d_name, lxcpath)) {
+			/* the monitor went away without lxc_fini() */
+			unlinkat(dfd, direntp->d_name, 0);
+			continue;
+		}
+
+		tmp = realloc(list, (nr + 1) * sizeof(*list));
+		if (!tmp)
+			goto err;
+		list = tmp;
+
+		list[nr] = strdup(direntp->d_name + 1);
+		if (!list[nr])
+			goto err;
+		nr++;
+	}
+	closedir(d);
+
+	qsort(list, nr, sizeof(*list), string_cmp);
+	*names = list;
+	return nr;
+
+err:
+	while (nr--)
+		free(list[nr]);
+	free(list);
+	closedir(d);
+	return -1;
+}
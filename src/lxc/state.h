@@ -35,4 +35,8 @@ extern lxc_state_t lxc_str2state(const char *state);
 extern const char *lxc_state2str(lxc_state_t state);
 extern int lxc_wait(const char *lxcname, const char *states, int timeout, const char *lxcpath);
 
+extern int lxc_active_add(const char *name, const char *lxcpath);
+extern void lxc_active_del(const char *name, const char *lxcpath);
+extern int lxc_active_list(const char *lxcpath, char ***names);
+
 #endif
@@ -18,8 +18,13 @@
  *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
  */
 
+#include <errno.h>
+#include <limits.h>
 #include <string.h>
+#include <time.h>
 #include <unistd.h>
+#include <sys/types.h>
+#include <sys/wait.h>
 
 #include <lxc/lxccontainer.h>
 
@@ -34,6 +39,9 @@ struct lxc_list *cmd_groups_list = NULL;
 
 static int my_parser(struct lxc_arguments* args, int c, char* arg)
 {
+	unsigned long m;
+	char *invalid;
+
 	switch (c) {
 	case 'k': args->hardstop = 1; break;
 	case 'L': args->list = 1; break;
@@ -43,6 +51,15 @@ static int my_parser(struct lxc_arguments* args, int c, char* arg)
 	case 'A': args->ignore_auto = 1; break;
 	case 'g': cmd_groups_list = accumulate_list( arg, ",", cmd_groups_list); break;
 	case 't': args->timeout = atoi(arg); break;
+	case 'j':
+		errno = 0;
+		m = strtoul(arg, &invalid, 0);
+		if (errno || (*invalid != '\0') || (*arg == '-') || (m > UINT_MAX)) {
+			fprintf(stderr, "Invalid number of jobs: %s\n", arg);
+			return -1;
+		}
+		args->jobs = m;
+		break;
 	}
 	return 0;
 }
@@ -56,6 +73,7 @@ static const struct option my_longopts[] = {
 	{"ignore-auto", no_argument, 0, 'A'},
 	{"groups", required_argument, 0, 'g'},
 	{"timeout", required_argument, 0, 't'},
+	{"jobs", required_argument, 0, 'j'},
 	{"help", no_argument, 0, 'h'},
 	LXC_COMMON_OPTIONS
 };
@@ -75,7 +93,8 @@ Options:\n\
   -a, --all         list all auto-started containers (ignore groups)\n\
   -A, --ignore-auto ignore lxc.start.auto and select all matching containers\n\
   -g, --groups      list of groups (comma separated) to select\n\
-  -t, --timeout=T   wait T seconds before hard-stopping\n",
+  -t, --timeout=T   wait T seconds before hard-stopping\n\
+  -j, --jobs=NUM    act on up to NUM containers at once (default is one per CPU)\n",
 	.options  = my_longopts,
 	.parser   = my_parser,
 	.checker  = NULL,
@@ -324,14 +343,170 @@ static int toss_list( struct lxc_list *c_groups_list ) {
 	return 1;
 }
 
+/*
+ * The selected containers, in the order they are acted upon. Entries of the
+ * same group pass and lxc.start.order form a batch: the containers of a
+ * batch are handled concurrently, batches strictly one after another.
+ */
+struct autostart_entry {
+	struct lxc_container *c;
+	int pass;
+	int order;
+	int delay;
+};
+
+/* shared deadline of all shutdowns, only meaningful with a timeout >= 0 */
+static struct timespec shutdown_deadline;
+
+static int shutdown_timeout_left(void)
+{
+	struct timespec now;
+
+	if (my_args.timeout < 0)
+		return -1;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	if (now.tv_sec >= shutdown_deadline.tv_sec)
+		return 0;
+	return shutdown_deadline.tv_sec - now.tv_sec;
+}
+
+static bool autostart_start(struct lxc_container *c)
+{
+	const char *state;
+
+	if (c->start(c, 0, NULL))
+		return true;
+
+	/*
+	 * start() only follows the monitor for a few seconds, which a host
+	 * starting many containers at once may not make; keep waiting for
+	 * RUNNING as long as the container is still on its way there.
+	 */
+	state = c->state(c);
+	if (!state || strcmp(state, "STARTING") != 0)
+		return false;
+	return c->wait(c, "RUNNING", my_args.timeout);
+}
+
+static bool autostart_act(struct lxc_container *c)
+{
+	if (my_args.shutdown) {
+		if (!c->shutdown(c, shutdown_timeout_left()) && !c->stop(c)) {
+			fprintf(stderr, "Error shutting down container: %s\n", c->name);
+			return false;
+		}
+	} else if (my_args.hardstop) {
+		if (!c->stop(c)) {
+			fprintf(stderr, "Error killing container: %s\n", c->name);
+			return false;
+		}
+	} else if (my_args.reboot) {
+		if (!c->reboot(c)) {
+			fprintf(stderr, "Error rebooting container: %s\n", c->name);
+			return false;
+		}
+	} else {
+		if (!autostart_start(c)) {
+			fprintf(stderr, "Error starting container: %s\n", c->name);
+			return false;
+		}
+	}
+
+	return true;
+}
+
+/*
+ * Act on a batch with up to @jobs containers at once. Every container gets
+ * its own child, which keeps this process single threaded for the forks
+ * done by start() and lets the children block on the monitor independently.
+ */
+static void run_batch(struct autostart_entry *batch, int nr, unsigned int jobs)
+{
+	unsigned int running = 0;
+	int next = 0, status;
+	pid_t pid;
+
+	while (next < nr || running > 0) {
+		while (next < nr && running < jobs) {
+			struct lxc_container *c = batch[next++].c;
+
+			fflush(NULL);
+			pid = fork();
+			if (pid < 0) {
+				SYSERROR("Failed to fork for container %s", c->name);
+				autostart_act(c);
+				continue;
+			}
+
+			if (pid == 0) {
+				status = autostart_act(c) ? EXIT_SUCCESS : EXIT_FAILURE;
+				fflush(NULL);
+				_exit(status);
+			}
+			running++;
+		}
+
+		if (running == 0)
+			continue;
+
+		pid = waitpid(-1, &status, 0);
+		if (pid < 0) {
+			if (errno == EINTR)
+				continue;
+			SYSERROR("Failed to wait for autostart children");
+			return;
+		}
+		running--;
+	}
+}
+
+static void run_plan(struct autostart_entry *plan, int nr)
+{
+	unsigned int jobs = my_args.jobs;
+	int i, j, delay;
+
+	if (jobs == 0)
+		jobs = sysconf(_SC_NPROCESSORS_ONLN);
+	if (jobs == 0)
+		jobs = 1;
+
+	if (my_args.shutdown) {
+		clock_gettime(CLOCK_MONOTONIC, &shutdown_deadline);
+		shutdown_deadline.tv_sec += my_args.timeout;
+	}
+
+	for (i = 0; i < nr; i = j) {
+		delay = 0;
+		for (j = i; j < nr; j++) {
+			if (plan[j].pass != plan[i].pass ||
+			    plan[j].order != plan[i].order)
+				break;
+			if (plan[j].delay > delay)
+				delay = plan[j].delay;
+		}
+
+		run_batch(&plan[i], j - i, jobs);
+
+		/*
+		 * Each container of the batch reached RUNNING (or failed)
+		 * by now, lxc.start.delay only holds back the next batch.
+		 */
+		if (j < nr && delay > 0 && !my_args.shutdown && !my_args.hardstop)
+			sleep(delay);
+	}
+}
+
 int main(int argc, char *argv[])
 {
 	int count = 0;
 	int i = 0;
 	int ret = 0;
+	int nr_plan = 0, pass = 0;
 	struct lxc_container **containers = NULL;
 	struct lxc_list **c_groups_lists = NULL;
 	struct lxc_list *cmd_group;
+	struct autostart_entry *plan;
 
 	if (lxc_arguments_parse(&my_args, argc, argv))
 		exit(EXIT_FAILURE);
@@ -341,11 +516,16 @@ int main(int argc, char *argv[])
 		exit(EXIT_FAILURE);
 	lxc_log_options_no_override();
 
-	count = list_defined_containers(my_args.lxcpath[0], NULL, &containers);
+	count = list_defined_containers_parallel(my_args.lxcpath[0], NULL, &containers, 0);
 
 	if (count < 0)
 		exit(EXIT_FAILURE);
 
+	/* Every container is selected at most once */
+	plan = calloc(count ? count : 1, sizeof(*plan));
+	if (!plan)
+		exit(EXIT_FAILURE);
+
 	if (!my_args.all) {
 		/* Allocate an array for our container group lists */
 		c_groups_lists = calloc( count, sizeof( struct lxc_list * ) );
@@ -423,73 +603,36 @@ int main(int argc, char *argv[])
 			/* We have a candidate continer to process */
 			c->want_daemonize(c, 1);
 
-			if (my_args.shutdown) {
-				/* Shutdown the container */
-				if (c->is_running(c)) {
-					if (my_args.list) {
-						printf("%s\n", c->name);
-						fflush(stdout);
-					}
-					else {
-						if (!c->shutdown(c, my_args.timeout)) {
-							if (!c->stop(c)) {
-								fprintf(stderr, "Error shutting down container: %s\n", c->name);
-								fflush(stderr);
-							}
-						}
-					}
-				}
-			}
-			else if (my_args.hardstop) {
-				/* Kill the container */
-				if (c->is_running(c)) {
-					if (my_args.list) {
-						printf("%s\n", c->name);
-						fflush(stdout);
-					}
-					else {
-						if (!c->stop(c)) {
-							fprintf(stderr, "Error killing container: %s\n", c->name);
-							fflush(stderr);
-						}
-					}
-				}
+			if (my_args.shutdown || my_args.hardstop ||
+			    my_args.reboot) {
+				/* Shutdown, kill or reboot the container */
+				if (!c->is_running(c))
+					c = NULL;
+			} else {
+				/* Start the container */
+				if (c->is_running(c))
+					c = NULL;
 			}
-			else if (my_args.reboot) {
-				/* Reboot the container */
-				if (c->is_running(c)) {
-					if (my_args.list) {
-						printf("%s %d\n", c->name,
-						       get_config_integer(c, "lxc.start.delay"));
-						fflush(stdout);
-					}
-					else {
-						if (!c->reboot(c)) {
-							fprintf(stderr, "Error rebooting container: %s\n", c->name);
-							fflush(stderr);
-						}
-						else
-							sleep(get_config_integer(c, "lxc.start.delay"));
-					}
-				}
+
+			if (c && my_args.list) {
+				if (my_args.shutdown || my_args.hardstop)
+					printf("%s\n", c->name);
+				else
+					printf("%s %d\n", c->name,
+					       get_config_integer(c, "lxc.start.delay"));
+				fflush(stdout);
+				c = NULL;
 			}
-			else {
-				/* Start the container */
-				if (!c->is_running(c)) {
-					if (my_args.list) {
-						printf("%s %d\n", c->name,
-						       get_config_integer(c, "lxc.start.delay"));
-						fflush(stdout);
-					}
-					else {
-						if (!c->start(c, 0, NULL)) {
-							fprintf(stderr, "Error starting container: %s\n", c->name);
-							fflush(stderr);
-						}
-						else
-							sleep(get_config_integer(c, "lxc.start.delay"));
-					}
-				}
+
+			if (c) {
+				/* The plan takes over our reference */
+				plan[nr_plan].c = c;
+				plan[nr_plan].pass = pass;
+				plan[nr_plan].order = get_config_integer(c, "lxc.start.order");
+				plan[nr_plan].delay = get_config_integer(c, "lxc.start.delay");
+				nr_plan++;
+			} else {
+				lxc_container_put(containers[i]);
 			}
 
 			/*
@@ -497,17 +640,22 @@ int main(int argc, char *argv[])
 			 * then we're done with this container...  We can dump any
 			 * c_groups_list and the container itself.
 			 */
-			if ( lxc_container_put(c) > 0 ) {
-				containers[i] = NULL;
-			}
+			containers[i] = NULL;
 			if ( c_groups_lists ) {
 				toss_list(c_groups_lists[i]);
 				c_groups_lists[i] = NULL;
 			}
 		}
 
+		pass++;
 	}
 
+	run_plan(plan, nr_plan);
+
+	for (i = 0; i < nr_plan; i++)
+		lxc_container_put(plan[i].c);
+	free(plan);
+
 	/* clean up any lingering detritus */
 	for (i = 0; i < count; i++) {
 		if ( containers[i] ) {
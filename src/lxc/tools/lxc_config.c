@@ -36,8 +36,12 @@ static struct lxc_config_items items[] =
 	{ .name = "lxc.bdev.lvm.vg", },
 	{ .name = "lxc.bdev.lvm.thin_pool", },
 	{ .name = "lxc.bdev.zfs.root", },
+	{ .name = "lxc.bdev.loop.alloc", },
 	{ .name = "lxc.cgroup.use", },
 	{ .name = "lxc.cgroup.pattern", },
+	{ .name = "lxc.log.format", },
+	{ .name = "lxc.log.buffered", },
+	{ .name = "lxc.config.cache", },
 	{ .name = NULL, },
 };
 
@@ -199,6 +199,9 @@ int main(int argc, char *argv[])
 
 	if (my_args.task == SNAP || my_args.task == DESTROY)
 		flags |= LXC_CLONE_SNAPSHOT;
+	/* ephemeral copies mount a tmpfs over theirs, they need an overlay */
+	if (my_args.task == SNAP)
+		flags |= LXC_CLONE_REFLINK;
 	if (my_args.keepname)
 		flags |= LXC_CLONE_KEEPNAME;
 	if (my_args.keepmac)
@@ -82,6 +82,7 @@ static int my_parser(struct lxc_arguments* args, int c, char* arg)
 	case '6': args->dir = arg; break;
 	case '7': args->rbdname = arg; break;
 	case '8': args->rbdpool = arg; break;
+	case '9': args->prealloc = 1; break;
 	}
 	return 0;
 }
@@ -99,6 +100,7 @@ static const struct option my_longopts[] = {
 	{"dir", required_argument, 0, '6'},
 	{"rbdname", required_argument, 0, '7'},
 	{"rbdpool", required_argument, 0, '8'},
+	{"prealloc", no_argument, 0, '9'},
 	LXC_COMMON_OPTIONS
 };
 
@@ -165,7 +167,12 @@ Options :\n\
                                 (Default: ext3)\n\
       --fssize=SIZE[U]          Create filesystem of\n\
                                 size SIZE * unit U (bBkKmMgGtT)\n\
-                                (Default: 1G, default unit: M)\n",
+                                (Default: 1G, default unit: M)\n\
+\n\
+  BDEV option for Loop (with -B/--bdev loop) :\n\
+      --prealloc                Reserve the whole image instead\n\
+                                of leaving it sparse\n\
+                                (Default: lxc.bdev.loop.alloc)\n",
 	.options  = my_longopts,
 	.parser   = my_parser,
 	.checker  = NULL,
@@ -194,6 +201,12 @@ static bool validate_bdev_args(struct lxc_arguments *a)
 				return false;
 			}
 		}
+		if (strcmp(a->bdevtype, "loop") != 0) {
+			if (a->prealloc) {
+				fprintf(stderr, "--prealloc is only valid with -B loop\n");
+				return false;
+			}
+		}
 		if (strcmp(a->bdevtype, "zfs") != 0) {
 			if (a->zfsroot) {
 				fprintf(stderr, "zfsroot is only valid with -B zfs\n");
@@ -313,6 +326,8 @@ int main(int argc, char *argv[])
 
 	if (my_args.quiet)
 		flags = LXC_CREATE_QUIET;
+	if (my_args.prealloc)
+		flags |= LXC_CREATE_PREALLOC;
 
 	if (!c->create(c, my_args.template, my_args.bdevtype, &spec, flags, &argv[optind])) {
 		ERROR("Error creating container %s", c->name);
@@ -320,7 +335,7 @@ int main(int argc, char *argv[])
 		exit(EXIT_FAILURE);
 	}
 
-	lxc_container_put(c);
 	INFO("container %s created", c->name);
+	lxc_container_put(c);
 	exit(EXIT_SUCCESS);
 }
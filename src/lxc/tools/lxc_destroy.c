@@ -40,13 +40,14 @@ static bool quiet;
 static const struct option my_longopts[] = {
 	{"force", no_argument, 0, 'f'},
 	{"snapshots", no_argument, 0, 's'},
+	{"background", no_argument, 0, 'b'},
 	LXC_COMMON_OPTIONS
 };
 
 static struct lxc_arguments my_args = {
 	.progname = "lxc-destroy",
 	.help     = "\
---name=NAME [-f] [-P lxcpath]\n\
+--name=NAME [-f] [-b] [-P lxcpath]\n\
 \n\
 lxc-destroy destroys a container with the identifier NAME\n\
 \n\
@@ -54,6 +55,7 @@ Options :\n\
   -n, --name=NAME   NAME of the container\n\
   -s, --snapshots   destroy including all snapshots\n\
   -f, --force       wait for the container to shut down\n\
+  -b, --background  return before the container's files are removed\n\
   --rcfile=FILE     Load configuration file FILE\n",
 	.options  = my_longopts,
 	.parser   = my_parser,
@@ -140,6 +142,7 @@ static int my_parser(struct lxc_arguments *args, int c, char *arg)
 	switch (c) {
 	case 'f': args->force = 1; break;
 	case 's': args->task = SNAP; break;
+	case 'b': args->background = 1; break;
 	}
 	return 0;
 }
@@ -179,9 +182,13 @@ static bool do_destroy(struct lxc_container *c)
 		c->stop(c);
 	}
 
+	if (my_args.background)
+		c->want_background_destroy(c, true);
+
 	/* If the container was ephemeral we have already removed it when we
 	 * stopped it. */
-	if (c->is_defined(c) && !c->lxc_conf->ephemeral)
+	if (c->is_defined(c) && lxc_container_load_pending_config(c) &&
+	    !c->lxc_conf->ephemeral)
 		bret = c->destroy(c);
 
 	if (!bret) {
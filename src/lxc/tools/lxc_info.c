@@ -21,9 +21,11 @@
  * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
  */
 
+#include <errno.h>
 #include <stdio.h>
 #include <stdbool.h>
 #include <stdlib.h>
+#include <string.h>
 #include <unistd.h>
 #include <limits.h>
 #include <libgen.h>
@@ -148,27 +150,57 @@ static unsigned long long str_size_humanize(char *iobuf, size_t iobufsz)
 
 static void print_net_stats(struct lxc_container *c)
 {
-	int rc,netnr;
+	int rc, netnr, nr = 0;
 	unsigned long long rx_bytes = 0, tx_bytes = 0;
-	char *ifname, *type;
+	const char *netitems[] = { "lxc.network", NULL };
+	const char **items = NULL, **tmp;
+	struct lxc_cmd_session *session;
+	char *types = NULL, *type, *saveptr = NULL, *ifname;
+	char **links = NULL;
 	char path[PATH_MAX];
 	char buf[256];
 
-	for(netnr = 0; ;netnr++) {
-		sprintf(buf, "lxc.network.%d.type", netnr);
-		type = c->get_running_config_item(c, buf);
-		if (!type)
-			break;
+	/* ask for all links over one connection, one by one from old monitors */
+	session = lxc_cmd_session_open(c->name, c->config_path);
+	if (!session && errno != ENOSYS)
+		return;
+
+	if (lxc_cmd_get_config_items(c->name, c->config_path, session,
+				     netitems, &types) < 0 || !types)
+		goto out;
+
+	for (type = strtok_r(types, "\n", &saveptr); type;
+	     type = strtok_r(NULL, "\n", &saveptr)) {
+		tmp = realloc(items, (nr + 2) * sizeof(*items));
+		if (!tmp)
+			goto out;
+		items = tmp;
+		if (!strcmp(type, "veth"))
+			sprintf(buf, "lxc.network.%d.veth.pair", nr);
+		else
+			sprintf(buf, "lxc.network.%d.link", nr);
+		items[nr] = strdup(buf);
+		if (!items[nr])
+			goto out;
+		items[++nr] = NULL;
+	}
+	if (!nr)
+		goto out;
+
+	links = malloc(nr * sizeof(*links));
+	if (!links)
+		goto out;
+	if (lxc_cmd_get_config_items(c->name, c->config_path, session,
+				     items, links) < 0) {
+		free(links);
+		links = NULL;
+		goto out;
+	}
 
-		if (!strcmp(type, "veth")) {
-			sprintf(buf, "lxc.network.%d.veth.pair", netnr);
-		} else {
-			sprintf(buf, "lxc.network.%d.link", netnr);
-		}
-		free(type);
-		ifname = c->get_running_config_item(c, buf);
+	for (netnr = 0; netnr < nr; netnr++) {
+		ifname = links[netnr];
 		if (!ifname)
-			return;
+			break;
 		printf("%-15s %s\n", "Link:", ifname);
 		fflush(stdout);
 
@@ -197,8 +229,18 @@ static void print_net_stats(struct lxc_container *c)
 		str_size_humanize(buf, sizeof(buf));
 		printf("%-15s %s\n", " Total bytes:", buf);
 		fflush(stdout);
-		free(ifname);
 	}
+
+out:
+	for (netnr = 0; netnr < nr; netnr++) {
+		free((char *)items[netnr]);
+		if (links)
+			free(links[netnr]);
+	}
+	free(items);
+	free(links);
+	free(types);
+	lxc_cmd_session_close(session);
 }
 
 static void print_stats(struct lxc_container *c)
@@ -0,0 +1,69 @@
+/* lxc_log_decode
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2.1 of the License, or (at your option) any later version.
+
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "log.h"
+
+static void usage(char *me)
+{
+	printf("Usage: %s [FILE]...: print binary log files (lxc.log.format = binary) as text\n", me);
+	exit(EXIT_SUCCESS);
+}
+
+static int decode(const char *path)
+{
+	FILE *f = stdin;
+	int ret;
+
+	if (path && strcmp(path, "-") != 0) {
+		f = fopen(path, "r");
+		if (!f) {
+			fprintf(stderr, "%s: %s\n", path, strerror(errno));
+			return -1;
+		}
+	}
+
+	ret = lxc_log_decode(f, stdout);
+	if (ret < 0)
+		fprintf(stderr, "%s: not a binary lxc log or truncated\n",
+			path ? path : "stdin");
+
+	if (f != stdin)
+		fclose(f);
+	return ret;
+}
+
+int main(int argc, char *argv[])
+{
+	int i, ret = EXIT_SUCCESS;
+
+	if (argc > 1 && (!strcmp(argv[1], "-h") || !strcmp(argv[1], "--help")))
+		usage(argv[0]);
+
+	if (argc < 2)
+		return decode(NULL) < 0 ? EXIT_FAILURE : EXIT_SUCCESS;
+
+	for (i = 1; i < argc; i++)
+		if (decode(argv[i]) < 0)
+			ret = EXIT_FAILURE;
+
+	exit(ret);
+}
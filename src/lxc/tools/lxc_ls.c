@@ -19,6 +19,7 @@
 #include "config.h"
 
 #include <getopt.h>
+#include <pthread.h>
 #include <regex.h>
 #include <stdbool.h>
 #include <stdio.h>
@@ -35,6 +36,7 @@
 #include <lxc/lxccontainer.h>
 
 #include "arguments.h"
+#include "commands.h"
 #include "conf.h"
 #include "confile.h"
 #include "log.h"
@@ -54,6 +56,20 @@ lxc_log_define(lxc_ls, lxc);
 #define LS_RUNNING 4
 #define LS_NESTING 5
 #define LS_FILTER 6
+#define LS_THREADS 7
+#define LS_STREAM 8
+
+/* Columns of the fancy output, only what they show is collected. */
+#define LS_COL_NAME (1 << 0)
+#define LS_COL_STATE (1 << 1)
+#define LS_COL_PID (1 << 2)
+#define LS_COL_RAM (1 << 3)
+#define LS_COL_SWAP (1 << 4)
+#define LS_COL_AUTOSTART (1 << 5)
+#define LS_COL_GROUPS (1 << 6)
+#define LS_COL_INTERFACE (1 << 7)
+#define LS_COL_IPV4 (1 << 8)
+#define LS_COL_IPV6 (1 << 9)
 
 #ifndef SOCK_CLOEXEC
 #  define SOCK_CLOEXEC                02000000
@@ -89,10 +105,60 @@ struct lengths {
 	unsigned int autostart_length;
 };
 
+/* A container of the level being listed, filled in by one of the workers. */
+struct ls_item {
+	char *name;
+	struct lxc_container *c; /* kept when nested containers are wanted */
+	struct ls l;
+	bool keep;
+};
+
+struct ls_pool {
+	const struct lxc_arguments *args;
+	const char *path;
+	const char *parent;
+	unsigned int lvl;
+	char **grps_must;
+	size_t grps_must_len;
+	struct ls_item *items;
+	size_t nr;
+	size_t next; /* next item to collect, claimed atomically */
+	bool enomem;
+};
+
+static const struct ls_column {
+	const char *key;
+	unsigned int col;
+} ls_column_keys[] = {
+	{ "NAME",      LS_COL_NAME      },
+	{ "STATE",     LS_COL_STATE     },
+	{ "PID",       LS_COL_PID       },
+	{ "RAM",       LS_COL_RAM       },
+	{ "SWAP",      LS_COL_SWAP      },
+	{ "AUTOSTART", LS_COL_AUTOSTART },
+	{ "GROUPS",    LS_COL_GROUPS    },
+	{ "INTERFACE", LS_COL_INTERFACE },
+	{ "IPV4",      LS_COL_IPV4      },
+	{ "IPV6",      LS_COL_IPV6      },
+	{ NULL,        0                },
+};
+
+/* Columns to collect, keys of --fancy-format and the compiled --filter. */
+static unsigned int ls_columns;
+static char **ls_fancy_keys;
+static regex_t *ls_regex;
+
+/* Print rows as soon as they are complete instead of as a table. */
+static bool ls_stream;
+static struct lengths ls_stream_len;
+static pthread_mutex_t ls_stream_lock = PTHREAD_MUTEX_INITIALIZER;
+
 static int ls_deserialize(int rpipefd, struct ls **m, size_t *len);
 static void ls_field_width(const struct ls *l, const size_t size,
 		struct lengths *lht);
 static void ls_free(struct ls *l, size_t size);
+static void ls_free_entries(struct ls *l, size_t size);
+static void ls_free_entry(struct ls *l);
 static void ls_free_arr(char **arr, size_t size);
 static int ls_get(struct ls **m, size_t *size, const struct lxc_arguments *args,
 		const char *basepath, const char *parent, unsigned int lvl,
@@ -100,9 +166,14 @@ static int ls_get(struct ls **m, size_t *size, const struct lxc_arguments *args,
 		size_t grps_must_len);
 static char *ls_get_cgroup_item(struct lxc_container *c, const char *item);
 static char *ls_get_config_item(struct lxc_container *c, const char *item,
-		bool running);
-static char *ls_get_groups(struct lxc_container *c, bool running);
-static char *ls_get_ips(struct lxc_container *c, const char *inet);
+		bool running, struct lxc_cmd_status_bundle *bundle);
+static char *ls_get_groups(struct lxc_container *c, bool running,
+		struct lxc_cmd_status_bundle *bundle);
+static void ls_get_ips(struct lxc_container *c, char **ipv4, char **ipv6);
+static void ls_get_nested(struct ls **m, size_t *size,
+		const struct lxc_arguments *args, const char *basepath,
+		const char *path, struct ls_item *it, char **lockpath,
+		size_t *len_lockpath, char **grps_must, size_t grps_must_len);
 static int ls_recv_str(int fd, char **buf);
 static int ls_send_str(int fd, const char *buf);
 
@@ -138,7 +209,10 @@ static struct ls *ls_new(struct ls **ls, size_t *size);
  * Print user-specified fancy format.
  */
 static void ls_print_fancy_format(struct ls *l, struct lengths *lht,
-		size_t size, const char *fancy_fmt);
+		size_t size, char **keys);
+static void ls_print_fancy_header(struct lengths *lht, char **keys);
+static void ls_print_fancy_row(const struct ls *m, struct lengths *lht,
+		char **keys);
 
 /*
  * Only print names of containers.
@@ -151,6 +225,13 @@ static void ls_print_names(struct ls *l, struct lengths *lht,
  */
 static void ls_print_table(struct ls *l, struct lengths *lht,
 		size_t size);
+static void ls_print_table_header(struct lengths *lht);
+static void ls_print_table_row(const struct ls *m, struct lengths *lht);
+
+/*
+ * Print rows right away, widths are the ones of the header then.
+ */
+static void ls_stream_rows(const struct ls *l, size_t size);
 
 /*
  * id can only be 79 + \0 chars long.
@@ -171,6 +252,8 @@ static const struct option my_longopts[] = {
 	{"nesting", optional_argument, 0, LS_NESTING},
 	{"groups", required_argument, 0, 'g'},
 	{"filter", required_argument, 0, LS_FILTER},
+	{"threads", required_argument, 0, LS_THREADS},
+	{"stream", no_argument, 0, LS_STREAM},
 	LXC_COMMON_OPTIONS
 };
 
@@ -193,7 +276,9 @@ Options :\n\
   --stopped          list only stopped containers\n\
   --nesting=NUM      list nested containers up to NUM (default is 5) levels of nesting\n\
   --filter=REGEX     filter container names by regular expression\n\
-  -g --groups        comma separated list of groups a container must have to be displayed\n",
+  -g --groups        comma separated list of groups a container must have to be displayed\n\
+  --threads=NUM      query up to NUM containers at once (default is one per CPU)\n\
+  --stream           print each container as soon as it is known, unaligned and unsorted\n",
 	.options = my_longopts,
 	.parser = my_parser,
 	.ls_nesting = 0,
@@ -238,28 +323,75 @@ int main(int argc, char *argv[])
 
 	char **grps = NULL;
 	size_t ngrps = 0;
+	struct ls *ls_arr = NULL;
+	size_t ls_size = 0;
+	regex_t preg;
+
 	if (my_args.groups) {
 		grps = lxc_string_split_and_trim(my_args.groups, ',');
 		ngrps = lxc_array_len((void **)grps);
 	}
 
-	struct ls *ls_arr = NULL;
-	size_t ls_size = 0;
+	/* Work out the columns first, so nothing else gets collected. */
+	if (my_args.ls_fancy && my_args.ls_fancy_format) {
+		ls_fancy_keys = lxc_string_split_and_trim(my_args.ls_fancy_format, ',');
+		if (!ls_fancy_keys)
+			goto out;
+
+		char **s;
+		const struct ls_column *col;
+		for (s = ls_fancy_keys; *s; s++) {
+			for (col = ls_column_keys; col->key; col++)
+				if (strcasecmp(*s, col->key) == 0)
+					break;
+			if (!col->key) {
+				fprintf(stderr, "Invalid key: %s\n", *s);
+				goto out;
+			}
+			ls_columns |= col->col;
+		}
+	} else if (my_args.ls_fancy) {
+		ls_columns = LS_COL_NAME | LS_COL_STATE | LS_COL_AUTOSTART |
+			     LS_COL_GROUPS | LS_COL_IPV4 | LS_COL_IPV6;
+	} else {
+		ls_columns = LS_COL_NAME;
+	}
+
+	/* Filter container names by the regex the user gave us. */
+	if (my_args.ls_filter || my_args.argc == 1) {
+		int check = regcomp(&preg, my_args.ls_filter ? my_args.ls_filter : my_args.argv[0],
+				REG_NOSUB | REG_EXTENDED);
+		if (check == REG_ESPACE) /* we're out of memory */
+			goto out;
+		else if (check != 0) {
+			/* Nothing can match. */
+			ret = EXIT_SUCCESS;
+			goto out;
+		}
+		ls_regex = &preg;
+	}
+
+	if (my_args.ls_stream) {
+		ls_stream = true;
+		ls_stream_len = max_len;
+	}
+
 	/* &(char *){NULL} is no magic. It's just a compound literal which
 	 * avoids having a pointless variable in main() that serves no purpose
 	 * here. */
 	int status = ls_get(&ls_arr, &ls_size, &my_args, "", NULL, 0, &(char *){NULL}, 0, grps, ngrps);
-	if (!ls_arr && status == 0)
+	if (!ls_arr && status == 0) {
 		/* We did not fail. There was just nothing to do. */
-		exit(EXIT_SUCCESS);
-	else if (!ls_arr || status == -1)
+		ret = EXIT_SUCCESS;
+		goto out;
+	} else if (!ls_arr || status == -1)
 		goto out;
 
 	ls_field_width(ls_arr, ls_size, &max_len);
 	if (my_args.ls_fancy && !my_args.ls_fancy_format) {
 		ls_print_table(ls_arr, &max_len, ls_size);
 	} else if (my_args.ls_fancy && my_args.ls_fancy_format) {
-		ls_print_fancy_format(ls_arr, &max_len, ls_size, my_args.ls_fancy_format);
+		ls_print_fancy_format(ls_arr, &max_len, ls_size, ls_fancy_keys);
 	} else {
 		unsigned int cols = 0;
 		if (!my_args.ls_line)
@@ -272,28 +404,54 @@ int main(int argc, char *argv[])
 out:
 	ls_free(ls_arr, ls_size);
 	lxc_free_array((void **)grps, free);
+	lxc_free_array((void **)ls_fancy_keys, free);
+	if (ls_regex)
+		regfree(ls_regex);
 
 	exit(ret);
 }
 
-static void ls_free(struct ls *l, size_t size)
+static void ls_free_entry(struct ls *l)
+{
+	free(l->groups);
+	free(l->interface);
+	free(l->ipv4);
+	free(l->ipv6);
+	free(l->name);
+	free(l->state);
+}
+
+static void ls_free_entries(struct ls *l, size_t size)
 {
 	size_t i;
-	struct ls *m = NULL;
-	for (i = 0, m = l; i < size; i++, m++) {
-		free(m->groups);
-		free(m->interface);
-		free(m->ipv4);
-		free(m->ipv6);
-		free(m->name);
-		free(m->state);
-	}
+	for (i = 0; i < size; i++)
+		ls_free_entry(&l[i]);
+}
+
+static void ls_free(struct ls *l, size_t size)
+{
+	ls_free_entries(l, size);
 	free(l);
 }
 
+/*
+ * Config items the monitor of a running container returns together with its
+ * state in a single LXC_CMD_GET_STATUS_BUNDLE request.
+ */
+static const char *ls_bundle_keys[] = {
+	"lxc.group",
+	"lxc.start.auto",
+	NULL,
+};
+
 static char *ls_get_config_item(struct lxc_container *c, const char *item,
-		bool running)
+		bool running, struct lxc_cmd_status_bundle *bundle)
 {
+	if (running && bundle) {
+		const char *val = lxc_cmd_status_bundle_get(bundle, item);
+		return val ? strdup(val) : NULL;
+	}
+
 	if (running)
 		return c->get_running_config_item(c, item);
 
@@ -321,6 +479,287 @@ static void ls_free_arr(char **arr, size_t size)
 	free(arr);
 }
 
+static bool ls_collect_fancy(struct lxc_container *c, struct ls *l,
+		const char *state, bool running,
+		struct lxc_cmd_status_bundle *b)
+{
+	char *tmp;
+
+	/* Maybe we should even consider the name sensitive and hide it when
+	 * you're not allowed to control the container. */
+	if (!c->may_control(c))
+		return false;
+
+	l->state = strdup(state);
+	if (!l->state)
+		return false;
+
+	if (ls_columns & LS_COL_AUTOSTART) {
+		tmp = ls_get_config_item(c, "lxc.start.auto", running, b);
+		if (tmp)
+			l->autostart = atoi(tmp);
+		free(tmp);
+	}
+
+	if (!running)
+		return true;
+
+	if (ls_columns & LS_COL_PID)
+		l->init = b ? b->init_pid : c->init_pid(c);
+
+	if (ls_columns & LS_COL_INTERFACE)
+		l->interface = ls_get_interface(c);
+
+	if (ls_columns & (LS_COL_IPV4 | LS_COL_IPV6))
+		ls_get_ips(c, ls_columns & LS_COL_IPV4 ? &l->ipv4 : NULL,
+			   ls_columns & LS_COL_IPV6 ? &l->ipv6 : NULL);
+
+	if (ls_columns & LS_COL_RAM) {
+		tmp = ls_get_cgroup_item(c, "memory.usage_in_bytes");
+		if (tmp) {
+			l->ram = strtoull(tmp, NULL, 0);
+			l->ram = l->ram / 1024 /1024;
+			free(tmp);
+		}
+	}
+
+	if (ls_columns & LS_COL_SWAP)
+		l->swap = ls_get_swap(c);
+
+	return true;
+}
+
+/*
+ * Gather what is to be printed about one container. Called from the workers,
+ * so it must only touch its own item.
+ */
+static void ls_collect(struct ls_pool *pool, struct ls_item *it)
+{
+	const struct lxc_arguments *args = pool->args;
+	struct lxc_cmd_status_bundle bundle, *b = NULL;
+	struct lxc_container *c;
+	struct ls *l = &it->l;
+	const char *state_tmp;
+	bool running;
+
+	errno = 0;
+	c = lxc_container_new(it->name, pool->path);
+	if (!c) {
+		if (errno == ENOMEM)
+			pool->enomem = true;
+		return;
+	}
+
+	bundle.data = NULL;
+	if (!c->is_defined(c))
+		goto put;
+
+	/* Ask the monitor for state, init pid and running config items in
+	 * one go instead of one request each. */
+	if (lxc_cmd_get_status_bundle(it->name, pool->path, ls_bundle_keys, &bundle) == 0)
+		b = &bundle;
+
+	if (b && (b->state == STOPPED ||
+		  lxc_cmd_status_bundle_get(b, "freezer.state")))
+		state_tmp = lxc_state2str(b->state);
+	else
+		state_tmp = c->state(c);
+
+	running = state_tmp && strcmp(state_tmp, "STOPPED");
+	if (!state_tmp)
+		state_tmp = "UNKNOWN";
+
+	if (args->ls_running && !running)
+		goto put;
+
+	if (args->ls_frozen && !args->ls_active && strcmp(state_tmp, "FROZEN"))
+		goto put;
+
+	if (args->ls_stopped && strcmp(state_tmp, "STOPPED"))
+		goto put;
+
+	if ((ls_columns & LS_COL_GROUPS) || pool->grps_must) {
+		l->groups = ls_get_groups(c, running, b);
+		if (!ls_has_all_grps(l->groups, pool->grps_must, pool->grps_must_len))
+			goto put;
+	}
+
+	/* How deeply nested are we? */
+	l->nestlvl = pool->lvl;
+
+	l->running = running;
+
+	if (pool->parent && args->ls_nesting && (args->ls_line || !args->ls_fancy))
+		/* Prepend the name of the container with all its parents when
+		 * the user requests it. */
+		l->name = lxc_append_paths(pool->parent, it->name);
+	else
+		/* Otherwise simply record the name. */
+		l->name = strdup(it->name);
+	if (!l->name) {
+		pool->enomem = true;
+		goto put;
+	}
+
+	/* Do not record stuff the user did not explictly request. */
+	if (args->ls_fancy && !ls_collect_fancy(c, l, state_tmp, running, b))
+		goto keep;
+
+	/* Nested containers are looked for once the whole level is known, so
+	 * they can follow their parent in the output. */
+	if (args->ls_nesting) {
+		it->c = c;
+		c = NULL;
+	}
+
+keep:
+	it->keep = true;
+	if (ls_stream)
+		ls_stream_rows(l, 1);
+
+put:
+	if (!it->keep)
+		ls_free_entry(l);
+	lxc_cmd_status_bundle_free(&bundle);
+	lxc_container_put(c);
+}
+
+static void *ls_worker(void *arg)
+{
+	struct ls_pool *pool = arg;
+	size_t i;
+
+	while ((i = __sync_fetch_and_add(&pool->next, 1)) < pool->nr)
+		ls_collect(pool, &pool->items[i]);
+
+	return NULL;
+}
+
+/*
+ * Most of the time goes into waiting on the monitors and the kernel.  API
+ * calls set liblxc's current_config, which is only per thread with thread
+ * local storage, so without it everything is collected from this thread.
+ */
+static void ls_collect_all(struct ls_pool *pool, unsigned int threads)
+{
+	pthread_t *tids = NULL;
+	unsigned int i, started = 0;
+
+#ifdef HAVE_TLS
+	if (threads == 0)
+		threads = sysconf(_SC_NPROCESSORS_ONLN);
+#else
+	threads = 1;
+#endif
+	if (threads > pool->nr)
+		threads = pool->nr;
+
+	if (threads > 1)
+		tids = malloc((threads - 1) * sizeof(*tids));
+
+	for (i = 0; tids && i < threads - 1; i++) {
+		if (pthread_create(&tids[i], NULL, ls_worker, pool) != 0)
+			break;
+		started++;
+	}
+
+	ls_worker(pool);
+
+	for (i = 0; i < started; i++)
+		pthread_join(tids[i], NULL);
+	free(tids);
+}
+
+static void ls_get_nested(struct ls **m, size_t *size,
+		const struct lxc_arguments *args, const char *basepath,
+		const char *path, struct ls_item *it, char **lockpath,
+		size_t *len_lockpath, char **grps_must, size_t grps_must_len)
+{
+	struct lxc_container *c = it->c;
+	int check;
+
+	if (it->l.running) {
+		struct wrapargs wargs = (struct wrapargs){.args = NULL};
+		size_t old_size = *size;
+
+		/* Open a socket so that the child can communicate with us. */
+		check = socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, wargs.pipefd);
+		if (check == -1)
+			return;
+
+		/* Set the next nesting level. */
+		wargs.nestlvl = it->l.nestlvl + 1;
+		/* Send in the parent for the next nesting level. */
+		wargs.parent = it->l.name;
+		wargs.args = args;
+		wargs.grps_must = grps_must;
+		wargs.grps_must_len = grps_must_len;
+
+		pid_t out;
+
+		lxc_attach_options_t aopt = LXC_ATTACH_OPTIONS_DEFAULT;
+		aopt.env_policy = LXC_ATTACH_CLEAR_ENV;
+
+		/* fork(): Attach to the namespace of the container and
+		 * run ls_get() in it which is called in ls_get_wrapper(). */
+		check = c->attach(c, ls_get_wrapper, &wargs, &aopt, &out);
+		/* close the socket */
+		close(wargs.pipefd[1]);
+
+		/* Retrieve all information we want from the child. */
+		if (check == 0 && ls_deserialize(wargs.pipefd[0], m, size) == 0 &&
+		    ls_stream) {
+			ls_stream_rows(*m + old_size, *size - old_size);
+			ls_free_entries(*m + old_size, *size - old_size);
+			*size = old_size;
+		}
+
+		/* Wait for the child to finish. */
+		if (check == 0)
+			wait_for_pid(out);
+
+		/* We've done all the communication we need so shutdown
+		 * the socket and close it. */
+		shutdown(wargs.pipefd[0], SHUT_RDWR);
+		close(wargs.pipefd[0]);
+	} else {
+		/* This way of extracting the rootfs is not safe since
+		 * it will return very different things depending on the
+		 * storage backend that is used for the container. We
+		 * need a path-extractor function. We face the same
+		 * problem with the ovl_mkdir() function in
+		 * lxcoverlay.{c,h}. */
+		char *curr_path = ls_get_config_item(c, "lxc.rootfs", false, NULL);
+		if (!curr_path)
+			return;
+
+		/* Since the container is not running and we cannot
+		 * attach to it we need another strategy to retrieve
+		 * nested containers. What we do is simply create a
+		 * growing path which will lead us into the rootfs of
+		 * the next container where it stores its containers. */
+		char *newpath = lxc_append_paths(basepath, curr_path);
+		free(curr_path);
+		if (!newpath)
+			return;
+
+		/* We want to remove all locks we create under
+		 * /run/lxc/lock so we create a string pointing us to
+		 * the lock path for the current container. */
+		if (ls_remove_lock(path, it->name, lockpath, len_lockpath, true) == -1) {
+			free(newpath);
+			return;
+		}
+
+		ls_get(m, size, args, newpath, it->l.name, it->l.nestlvl + 1,
+		       lockpath, *len_lockpath, grps_must, grps_must_len);
+		free(newpath);
+
+		/* Remove the lock. No need to check for failure here. */
+		ls_remove_lock(path, it->name, lockpath, len_lockpath, false);
+	}
+}
+
 static int ls_get(struct ls **m, size_t *size, const struct lxc_arguments *args,
 		const char *basepath, const char *parent, unsigned int lvl,
 		char **lockpath, size_t len_lockpath, char **grps_must,
@@ -338,6 +777,7 @@ static int ls_get(struct ls **m, size_t *size, const struct lxc_arguments *args,
 
 	int num = 0, ret = -1;
 	char **containers = NULL;
+	struct ls_pool pool = (struct ls_pool){.items = NULL};
 	/* If we, at some level of nesting, encounter a stopped container but
 	 * want to retrieve nested containers we need to build an absolute path
 	 * beginning from it. Initially, at nesting level 0, basepath will
@@ -364,203 +804,66 @@ static int ls_get(struct ls **m, size_t *size, const struct lxc_arguments *args,
 		goto out;
 	}
 
-	char *tmp = NULL;
-	int check;
-	struct ls *l = NULL;
-	struct lxc_container *c = NULL;
+	pool.items = calloc(num ? num : 1, sizeof(*pool.items));
+	if (!pool.items)
+		goto out;
+
 	size_t i;
 	for (i = 0; i < (size_t)num; i++) {
-		char *name = containers[i];
-
 		/* Filter container names by regex the user gave us. */
-		if (args->ls_filter || args->argc == 1) {
-			regex_t preg;
-			tmp = args->ls_filter ? args->ls_filter : args->argv[0];
-			check = regcomp(&preg, tmp, REG_NOSUB | REG_EXTENDED);
-			if (check == REG_ESPACE) /* we're out of memory */
-				goto out;
-			else if (check != 0)
-				continue;
-			check = regexec(&preg, name, 0, NULL, 0);
-			regfree(&preg);
-			if (check != 0)
-				continue;
-		}
-
- 		errno = 0;
-		c = lxc_container_new(name, path);
- 		if ((errno == ENOMEM) && !c)
- 			goto out;
- 		else if (!c)
- 			continue;
-
-		if (!c->is_defined(c))
-			goto put_and_next;
-
-		/* This does not allocate memory so no worries about freeing it
-		 * when we goto next or out. */
-		const char *state_tmp = c->state(c);
-		if (!state_tmp)
-			state_tmp = "UNKNOWN";
-
-		if (args->ls_running && !c->is_running(c))
-			goto put_and_next;
-
-		if (args->ls_frozen && !args->ls_active && strcmp(state_tmp, "FROZEN"))
-			goto put_and_next;
-
-		if (args->ls_stopped && strcmp(state_tmp, "STOPPED"))
-			goto put_and_next;
+		if (ls_regex && regexec(ls_regex, containers[i], 0, NULL, 0) != 0)
+			continue;
 
-		bool running = c->is_running(c);
-
-		char *grp_tmp = ls_get_groups(c, running);
-		if (!ls_has_all_grps(grp_tmp, grps_must, grps_must_len)) {
-			free(grp_tmp);
-			goto put_and_next;
-		}
-
-		/* Now it makes sense to allocate memory. */
-		l = ls_new(m, size);
-		if (!l) {
-			free(grp_tmp);
-			goto put_and_next;
-		}
-
-		/* How deeply nested are we? */
-		l->nestlvl = lvl;
-
-		l->groups = grp_tmp;
-
-		l->running = running;
-
-		if (parent && args->ls_nesting && (args->ls_line || !args->ls_fancy))
-			/* Prepend the name of the container with all its parents when
-			 * the user requests it. */
-			l->name = lxc_append_paths(parent, name);
-		else
-			/* Otherwise simply record the name. */
-			l->name = strdup(name);
-		if (!l->name)
-			goto put_and_next;
-
-		/* Do not record stuff the user did not explictly request. */
-		if (args->ls_fancy) {
-			/* Maybe we should even consider the name sensitive and
-			 * hide it when you're not allowed to control the
-			 * container. */
-			if (!c->may_control(c))
-				goto put_and_next;
-
-			l->state = strdup(state_tmp);
-			if (!l->state)
-				goto put_and_next;
-
-			tmp = ls_get_config_item(c, "lxc.start.auto", running);
-			if (tmp)
-				l->autostart = atoi(tmp);
-			free(tmp);
-
-			if (running) {
-				l->init = c->init_pid(c);
-
-				l->interface = ls_get_interface(c);
-
-				l->ipv4 = ls_get_ips(c, "inet");
-
-				l->ipv6 = ls_get_ips(c, "inet6");
-
-				tmp = ls_get_cgroup_item(c, "memory.usage_in_bytes");
-				if (tmp) {
-					l->ram = strtoull(tmp, NULL, 0);
-					l->ram = l->ram / 1024 /1024;
-					free(tmp);
-				}
+		pool.items[pool.nr].name = containers[i];
+		pool.items[pool.nr].l = (struct ls){.name = NULL, .init = -1};
+		pool.nr++;
+	}
 
-				l->swap = ls_get_swap(c);
+	pool.args = args;
+	pool.path = path;
+	pool.parent = parent;
+	pool.lvl = lvl;
+	pool.grps_must = grps_must;
+	pool.grps_must_len = grps_must_len;
+	ls_collect_all(&pool, args->ls_threads);
+
+	/* Assemble the level in name order, each container followed by the
+	 * ones nested in it. */
+	struct ls *l;
+	for (i = 0; i < pool.nr; i++) {
+		struct ls_item *it = &pool.items[i];
+
+		if (!it->keep)
+			continue;
+
+		if (!ls_stream) {
+			l = ls_new(m, size);
+			if (!l) {
+				ls_free_entry(&it->l);
+				lxc_container_put(it->c);
+				continue;
 			}
+			*l = it->l;
 		}
 
 		/* Get nested containers: Only do this after we have gathered
 		 * all other information we need. */
-		if (args->ls_nesting && running) {
-			struct wrapargs wargs = (struct wrapargs){.args = NULL};
-			/* Open a socket so that the child can communicate with us. */
-			check = socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, wargs.pipefd);
-			if (check == -1)
-				goto put_and_next;
-
-			/* Set the next nesting level. */
-			wargs.nestlvl = lvl + 1;
-			/* Send in the parent for the next nesting level. */
-			wargs.parent = l->name;
-			wargs.args = args;
-			wargs.grps_must = grps_must;
-			wargs.grps_must_len = grps_must_len;
-
-			pid_t out;
-
-			lxc_attach_options_t aopt = LXC_ATTACH_OPTIONS_DEFAULT;
-			aopt.env_policy = LXC_ATTACH_CLEAR_ENV;
-
-			/* fork(): Attach to the namespace of the container and
-			 * run ls_get() in it which is called in ls_get_wrapper(). */
-			check = c->attach(c, ls_get_wrapper, &wargs, &aopt, &out);
-			/* close the socket */
-			close(wargs.pipefd[1]);
-
-			/* Retrieve all information we want from the child. */
-			if (check == 0)
-				if (ls_deserialize(wargs.pipefd[0], m, size) == -1)
-					goto put_and_next;
-
-			/* Wait for the child to finish. */
-			wait_for_pid(out);
-
-			/* We've done all the communication we need so shutdown
-			 * the socket and close it. */
-			shutdown(wargs.pipefd[0], SHUT_RDWR);
-			close(wargs.pipefd[0]);
-		} else if (args->ls_nesting && !running) {
-			/* This way of extracting the rootfs is not safe since
-			 * it will return very different things depending on the
-			 * storage backend that is used for the container. We
-			 * need a path-extractor function. We face the same
-			 * problem with the ovl_mkdir() function in
-			 * lxcoverlay.{c,h}. */
-			char *curr_path = ls_get_config_item(c, "lxc.rootfs", running);
-			if (!curr_path)
-				goto put_and_next;
-
-			/* Since the container is not running and we cannot
-			 * attach to it we need another strategy to retrieve
-			 * nested containers. What we do is simply create a
-			 * growing path which will lead us into the rootfs of
-			 * the next container where it stores its containers. */
-			char *newpath = lxc_append_paths(basepath, curr_path);
-			free(curr_path);
-			if (!newpath)
-				goto put_and_next;
-
-			/* We want to remove all locks we create under
-			 * /run/lxc/lock so we create a string pointing us to
-			 * the lock path for the current container. */
-			if (ls_remove_lock(path, name, lockpath, &len_lockpath, true) == -1)
-				goto put_and_next;
-
-			ls_get(m, size, args, newpath, l->name, lvl + 1, lockpath, len_lockpath, grps_must, grps_must_len);
-			free(newpath);
-
-			/* Remove the lock. No need to check for failure here. */
-			ls_remove_lock(path, name, lockpath, &len_lockpath, false);
+		if (it->c) {
+			ls_get_nested(m, size, args, basepath, path, it,
+				      lockpath, &len_lockpath, grps_must,
+				      grps_must_len);
+			lxc_container_put(it->c);
 		}
 
-put_and_next:
-		lxc_container_put(c);
+		if (ls_stream)
+			ls_free_entry(&it->l);
 	}
-	ret = 0;
+
+	if (!pool.enomem)
+		ret = 0;
 
 out:
+	free(pool.items);
 	ls_free_arr(containers, num);
 	free(path);
 	/* lockpath is shared amongst all non-fork()ing recursive calls to
@@ -589,13 +892,14 @@ static char *ls_get_cgroup_item(struct lxc_container *c, const char *item)
 	return val;
 }
 
-static char *ls_get_groups(struct lxc_container *c, bool running)
+static char *ls_get_groups(struct lxc_container *c, bool running,
+		struct lxc_cmd_status_bundle *bundle)
 {
 	size_t len = 0;
 	char *val = NULL;
 
 	if (running)
-		val = c->get_running_config_item(c, "lxc.group");
+		val = ls_get_config_item(c, "lxc.group", running, bundle);
 	else
 		len = c->get_config_item(c, "lxc.group", NULL, 0);
 
@@ -620,16 +924,42 @@ static char *ls_get_groups(struct lxc_container *c, bool running)
 	return val;
 }
 
-static char *ls_get_ips(struct lxc_container *c, const char *inet)
+/* Both families come from a single address dump when both are wanted. */
+static void ls_get_ips(struct lxc_container *c, char **ipv4, char **ipv6)
 {
-	char *ips = NULL;
-	char **iptmp = c->get_ips(c, NULL, inet, 0);
-	if (iptmp)
-		ips = lxc_string_join(", ", (const char **)iptmp, false);
+	const char *family = NULL, **v4, **v6;
+	char **iptmp;
+	size_t i, n4 = 0, n6 = 0;
 
-	lxc_free_array((void **)iptmp, free);
+	if (!ipv4)
+		family = "inet6";
+	else if (!ipv6)
+		family = "inet";
+
+	iptmp = c->get_ips(c, NULL, family, 0);
+	if (!iptmp)
+		return;
 
-	return ips;
+	for (i = 0; iptmp[i]; i++)
+		;
+	v4 = calloc(i + 1, sizeof(*v4));
+	v6 = calloc(i + 1, sizeof(*v6));
+	if (v4 && v6) {
+		for (i = 0; iptmp[i]; i++) {
+			if (strchr(iptmp[i], ':'))
+				v6[n6++] = iptmp[i];
+			else
+				v4[n4++] = iptmp[i];
+		}
+		if (ipv4)
+			*ipv4 = lxc_string_join(", ", v4, false);
+		if (ipv6)
+			*ipv6 = lxc_string_join(", ", v6, false);
+	}
+
+	free(v4);
+	free(v6);
+	lxc_free_array((void **)iptmp, free);
 }
 
 static char *ls_get_interface(struct lxc_container *c)
@@ -770,32 +1100,11 @@ static void ls_print_names(struct ls *l, struct lengths *lht,
 		printf("\n");
 }
 
-static void ls_print_fancy_format(struct ls *l, struct lengths *lht,
-		size_t size, const char *fancy_fmt)
+static void ls_print_fancy_header(struct lengths *lht, char **keys)
 {
-	/* If list is empty do nothing. */
-	if (size == 0)
-		return;
-
-	char **tmp = lxc_string_split_and_trim(fancy_fmt, ',');
-	if (!tmp)
-		return;
-
 	char **s;
-	/* Check for invalid keys. */
-	for (s = tmp; s && *s; s++) {
-		if (strcasecmp(*s, "NAME") && strcasecmp(*s, "STATE") &&
-				strcasecmp(*s, "PID") && strcasecmp(*s, "RAM") &&
-				strcasecmp(*s, "SWAP") && strcasecmp(*s, "AUTOSTART") &&
-				strcasecmp(*s, "GROUPS") && strcasecmp(*s, "INTERFACE") &&
-				strcasecmp(*s, "IPV4") && strcasecmp(*s, "IPV6")) {
-			fprintf(stderr, "Invalid key: %s\n", *s);
-			return;
-		}
-	}
 
-	/* print header */
-	for (s = tmp; s && *s; s++) {
+	for (s = keys; s && *s; s++) {
 		if (strcasecmp(*s, "NAME") == 0)
 			printf("%-*s ", lht->name_length, "NAME");
 		else if (strcasecmp(*s, "STATE") == 0)
@@ -818,61 +1127,69 @@ static void ls_print_fancy_format(struct ls *l, struct lengths *lht,
 			printf("%-*s ", lht->ipv6_length, "IPV6");
 	}
 	printf("\n");
+}
 
-	struct ls *m = NULL;
-	size_t i;
-	for (i = 0, m = l; i < size; i++, m++) {
-		for (s = tmp; s && *s; s++) {
-			if (strcasecmp(*s, "NAME") == 0) {
-				if (m->nestlvl > 0) {
-					printf("%*s", m->nestlvl, "\\");
-					printf("%-*s ", lht->name_length - m->nestlvl, m->name ? m->name : "-");
-				} else {
-					printf("%-*s ", lht->name_length, m->name ? m->name : "-");
-				}
-			} else if (strcasecmp(*s, "STATE") == 0) {
-				printf("%-*s ", lht->state_length, m->state ? m->state : "-");
-			} else if (strcasecmp(*s, "PID") == 0) {
-				if (m->init > 0)
-					printf("%-*d ", lht->init_length, m->init);
-				else
-					printf("%-*s ", lht->init_length, "-");
-			} else if (strcasecmp(*s, "RAM") == 0) {
-				if ((m->ram >= 0) && m->running)
-					printf("%*.2fMB ", lht->ram_length, m->ram);
-				else
-					printf("%-*s   ", lht->ram_length, "-");
-			} else if (strcasecmp(*s, "SWAP") == 0) {
-				if ((m->swap >= 0) && m->running)
-					printf("%*.2fMB ", lht->swap_length, m->swap);
-				else
-					printf("%-*s   ", lht->swap_length, "-");
-			} else if (strcasecmp(*s, "AUTOSTART") == 0) {
-				printf("%-*d ", lht->autostart_length, m->autostart);
-			} else if (strcasecmp(*s, "GROUPS") == 0) {
-				printf("%-*s ", lht->groups_length, m->groups ? m->groups : "-");
-			} else if (strcasecmp(*s, "INTERFACE") == 0) {
-				printf("%-*s ", lht->interface_length, m->interface ? m->interface : "-");
-			} else if (strcasecmp(*s, "IPV4") == 0) {
-				printf("%-*s ", lht->ipv4_length, m->ipv4 ? m->ipv4 : "-");
-			} else if (strcasecmp(*s, "IPV6") == 0) {
-				printf("%-*s ", lht->ipv6_length, m->ipv6 ? m->ipv6 : "-");
+static void ls_print_fancy_row(const struct ls *m, struct lengths *lht,
+		char **keys)
+{
+	char **s;
+
+	for (s = keys; s && *s; s++) {
+		if (strcasecmp(*s, "NAME") == 0) {
+			if (m->nestlvl > 0) {
+				printf("%*s", m->nestlvl, "\\");
+				printf("%-*s ", lht->name_length - m->nestlvl, m->name ? m->name : "-");
+			} else {
+				printf("%-*s ", lht->name_length, m->name ? m->name : "-");
 			}
+		} else if (strcasecmp(*s, "STATE") == 0) {
+			printf("%-*s ", lht->state_length, m->state ? m->state : "-");
+		} else if (strcasecmp(*s, "PID") == 0) {
+			if (m->init > 0)
+				printf("%-*d ", lht->init_length, m->init);
+			else
+				printf("%-*s ", lht->init_length, "-");
+		} else if (strcasecmp(*s, "RAM") == 0) {
+			if ((m->ram >= 0) && m->running)
+				printf("%*.2fMB ", lht->ram_length, m->ram);
+			else
+				printf("%-*s   ", lht->ram_length, "-");
+		} else if (strcasecmp(*s, "SWAP") == 0) {
+			if ((m->swap >= 0) && m->running)
+				printf("%*.2fMB ", lht->swap_length, m->swap);
+			else
+				printf("%-*s   ", lht->swap_length, "-");
+		} else if (strcasecmp(*s, "AUTOSTART") == 0) {
+			printf("%-*d ", lht->autostart_length, m->autostart);
+		} else if (strcasecmp(*s, "GROUPS") == 0) {
+			printf("%-*s ", lht->groups_length, m->groups ? m->groups : "-");
+		} else if (strcasecmp(*s, "INTERFACE") == 0) {
+			printf("%-*s ", lht->interface_length, m->interface ? m->interface : "-");
+		} else if (strcasecmp(*s, "IPV4") == 0) {
+			printf("%-*s ", lht->ipv4_length, m->ipv4 ? m->ipv4 : "-");
+		} else if (strcasecmp(*s, "IPV6") == 0) {
+			printf("%-*s ", lht->ipv6_length, m->ipv6 ? m->ipv6 : "-");
 		}
-		printf("\n");
 	}
+	printf("\n");
 }
 
-static void ls_print_table(struct ls *l, struct lengths *lht,
-		size_t size)
+static void ls_print_fancy_format(struct ls *l, struct lengths *lht,
+		size_t size, char **keys)
 {
 	/* If list is empty do nothing. */
 	if (size == 0)
 		return;
 
-	struct ls *m = NULL;
+	ls_print_fancy_header(lht, keys);
+
+	size_t i;
+	for (i = 0; i < size; i++)
+		ls_print_fancy_row(&l[i], lht, keys);
+}
 
-	/* print header */
+static void ls_print_table_header(struct lengths *lht)
+{
 	printf("%-*s ", lht->name_length, "NAME");
 	printf("%-*s ", lht->state_length, "STATE");
 	printf("%-*s ", lht->autostart_length, "AUTOSTART");
@@ -880,22 +1197,65 @@ static void ls_print_table(struct ls *l, struct lengths *lht,
 	printf("%-*s ", lht->ipv4_length, "IPV4");
 	printf("%-*s ", lht->ipv6_length, "IPV6");
 	printf("\n");
+}
+
+static void ls_print_table_row(const struct ls *m, struct lengths *lht)
+{
+	if (m->nestlvl > 0) {
+		printf("%*s", m->nestlvl, "\\");
+		printf("%-*s ", lht->name_length - m->nestlvl, m->name ? m->name : "-");
+	} else {
+	     printf("%-*s ", lht->name_length, m->name ? m->name : "-");
+	}
+	printf("%-*s ", lht->state_length, m->state ? m->state : "-");
+	printf("%-*d ", lht->autostart_length, m->autostart);
+	printf("%-*s ", lht->groups_length, m->groups ? m->groups : "-");
+	printf("%-*s ", lht->ipv4_length, m->ipv4 ? m->ipv4 : "-");
+	printf("%-*s ", lht->ipv6_length, m->ipv6 ? m->ipv6 : "-");
+	printf("\n");
+}
+
+static void ls_print_table(struct ls *l, struct lengths *lht,
+		size_t size)
+{
+	/* If list is empty do nothing. */
+	if (size == 0)
+		return;
+
+	ls_print_table_header(lht);
 
 	size_t i;
-	for (i = 0, m = l; i < size; i++, m++) {
-		if (m->nestlvl > 0) {
-			printf("%*s", m->nestlvl, "\\");
-			printf("%-*s ", lht->name_length - m->nestlvl, m->name ? m->name : "-");
-		} else {
-		     printf("%-*s ", lht->name_length, m->name ? m->name : "-");
+	for (i = 0; i < size; i++)
+		ls_print_table_row(&l[i], lht);
+}
+
+static void ls_stream_rows(const struct ls *l, size_t size)
+{
+	static bool header_printed = false;
+	size_t i;
+
+	pthread_mutex_lock(&ls_stream_lock);
+	for (i = 0; i < size; i++) {
+		if (!my_args.ls_fancy) {
+			printf("%s\n", l[i].name ? l[i].name : "-");
+			continue;
 		}
-		printf("%-*s ", lht->state_length, m->state ? m->state : "-");
-		printf("%-*d ", lht->autostart_length, m->autostart);
-		printf("%-*s ", lht->groups_length, m->groups ? m->groups : "-");
-		printf("%-*s ", lht->ipv4_length, m->ipv4 ? m->ipv4 : "-");
-		printf("%-*s ", lht->ipv6_length, m->ipv6 ? m->ipv6 : "-");
-		printf("\n");
+
+		if (!header_printed) {
+			if (ls_fancy_keys)
+				ls_print_fancy_header(&ls_stream_len, ls_fancy_keys);
+			else
+				ls_print_table_header(&ls_stream_len);
+			header_printed = true;
+		}
+
+		if (ls_fancy_keys)
+			ls_print_fancy_row(&l[i], &ls_stream_len, ls_fancy_keys);
+		else
+			ls_print_table_row(&l[i], &ls_stream_len);
 	}
+	fflush(stdout);
+	pthread_mutex_unlock(&ls_stream_lock);
 }
 
 static int my_parser(struct lxc_arguments *args, int c, char *arg)
@@ -947,6 +1307,18 @@ static int my_parser(struct lxc_arguments *args, int c, char *arg)
 	case 'F':
 		args->ls_fancy_format = arg;
 		break;
+	case LS_THREADS:
+		errno = 0;
+		m = strtoul(arg, &invalid, 0);
+		if (errno || (*invalid != '\0') || (*arg == '-') || (m > UINT_MAX)) {
+			fprintf(stderr, "Invalid number of threads: %s\n", arg);
+			return -1;
+		}
+		args->ls_threads = m;
+		break;
+	case LS_STREAM:
+		args->ls_stream = true;
+		break;
 	}
 
 	return 0;
@@ -962,6 +1334,9 @@ static int ls_get_wrapper(void *wrap)
 	/* close pipe */
 	close(wargs->pipefd[0]);
 
+	/* Rows go to the parent, which prints them. */
+	ls_stream = false;
+
 	/* &(char *){NULL} is no magic. It's just a compound literal which
 	 * allows us to avoid keeping a pointless variable around. */
 	ls_get(&m, &len, wargs->args, "", wargs->parent, wargs->nestlvl, &(char *){NULL}, 0, wargs->grps_must, wargs->grps_must_len);
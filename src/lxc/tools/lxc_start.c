@@ -280,6 +280,11 @@ int main(int argc, char *argv[])
 		err = 0;
 		goto out;
 	}
+	if (!lxc_container_load_pending_config(c)) {
+		ERROR("Failed to load the container configuration");
+		goto out;
+	}
+
 	/*
 	 * We should use set_config_item() over &defines, which would handle
 	 * unset c->lxc_conf for us and let us not use lxc_config_define_load()
@@ -21,12 +21,17 @@
  * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
  */
 
+#include "config.h"
+
 #include <errno.h>
+#include <pthread.h>
 #include <signal.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <termios.h>
+#include <time.h>
 #include <unistd.h>
 #include <sys/epoll.h>
 #include <sys/ioctl.h>
@@ -46,6 +51,11 @@ lxc_log_define(lxc_top_ui, lxc);
 #define TERMNORM  ESC "[0m"
 #define TERMBOLD  ESC "[1m"
 #define TERMRVRS  ESC "[7m"
+#define TERMEOL   ESC "[K"
+
+/* containers sampled per thread before another one is started */
+#define CTS_PER_THREAD 32
+#define MAX_THREADS    16
 
 struct stats {
 	uint64_t mem_used;
@@ -56,20 +66,41 @@ struct stats {
 	uint64_t cpu_use_user;
 	uint64_t cpu_use_sys;
 	uint64_t blkio;
+
+	/* over the last interval, valid once there were two samples */
+	double cpu_pct;
+	uint64_t blkio_rate;
+	int64_t mem_delta;
 };
 
+/*
+ * A container is kept from one refresh to the next as long as it is
+ * running, along with its previous sample and its cached cgroup handle.
+ */
 struct ct {
 	struct lxc_container *c;
 	struct stats *stats;
+	struct lxc_cgroup_stats cur;
+	struct lxc_cgroup_stats prev;
+	double cur_time;
+	double prev_time;
+	bool sampled;
+	bool have_prev;
 };
 
 static int delay = 3;
 static char sort_by = 'n';
 static int sort_reverse = 0;
+static bool batch = false;
 
 static struct termios oldtios;
-static struct ct *ct = NULL;
-static int ct_alloc_cnt = 0;
+static struct ct **ct = NULL;	/* sorted by name */
+static struct ct **view = NULL;	/* sorted for display */
+static int ct_cnt = 0;
+
+/* what is on the terminal, to only redraw lines that changed */
+static char **screen = NULL;
+static int screen_rows = 0;
 
 static int my_parser(struct lxc_arguments* args, int c, char* arg)
 {
@@ -77,6 +108,7 @@ static int my_parser(struct lxc_arguments* args, int c, char* arg)
 	case 'd': delay = atoi(arg); break;
 	case 's': sort_by = arg[0]; break;
 	case 'r': sort_reverse = 1; break;
+	case 'b': batch = true; break;
 	}
 	return 0;
 }
@@ -85,6 +117,7 @@ static const struct option my_longopts[] = {
 	{"delay",   required_argument, 0, 'd'},
 	{"sort",    required_argument, 0, 's'},
 	{"reverse", no_argument,       0, 'r'},
+	{"batch",   no_argument,       0, 'b'},
 	LXC_COMMON_OPTIONS
 };
 
@@ -103,7 +136,9 @@ Options :\n\
                   b = Block I/O use\n\
                   m = Memory use\n\
                   k = Kernel memory use\n\
-  -r, --reverse   sort in reverse (descending) order\n",
+  -r, --reverse   sort in reverse (descending) order\n\
+  -b, --batch     print one record per container and interval instead\n\
+                  of the interactive display\n",
 	.name     = ".*",
 	.options  = my_longopts,
 	.parser   = my_parser,
@@ -179,6 +214,14 @@ static void sig_handler(int sig)
 	exit(EXIT_SUCCESS);
 }
 
+static double now(clockid_t clock)
+{
+	struct timespec ts;
+
+	clock_gettime(clock, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
 static void size_humanize(unsigned long long val, char *buf, size_t bufsz)
 {
 	if (val > 1 << 30) {
@@ -198,176 +241,248 @@ static void size_humanize(unsigned long long val, char *buf, size_t bufsz)
 	}
 }
 
-static uint64_t stat_get_int(struct lxc_container *c, const char *item)
+static void delta_humanize(long long val, char *buf, size_t bufsz)
 {
-	char buf[80];
-	int len;
-	uint64_t val;
+	if (bufsz < 2)
+		return;
 
-	len = c->get_cgroup_item(c, item, buf, sizeof(buf));
-	if (len <= 0) {
-		ERROR("unable to read cgroup item %s", item);
-		return 0;
+	buf[0] = val < 0 ? '-' : '+';
+	size_humanize(val < 0 ? -val : val, buf + 1, bufsz - 1);
+}
+
+static void stats_sample(struct ct *ct)
+{
+	struct lxc_cgroup_stats *cur = &ct->cur, *prev = &ct->prev;
+	struct stats *stats = ct->stats;
+	double elapsed;
+
+	ct->prev = ct->cur;
+	ct->prev_time = ct->cur_time;
+	ct->have_prev = ct->sampled;
+
+	ct->cur_time = now(CLOCK_MONOTONIC);
+	ct->sampled = ct->c->get_cgroup_stats(ct->c, cur, sizeof(*cur)) == 0;
+	if (!ct->sampled) {
+		memset(cur, 0, sizeof(*cur));
+		ct->have_prev = false;
 	}
 
-	val = strtoull(buf, NULL, 0);
-	return val;
+	stats->mem_used      = cur->mem_used;
+	stats->mem_limit     = cur->mem_limit;
+	stats->kmem_used     = cur->kmem_used;
+	stats->kmem_limit    = cur->kmem_limit;
+	stats->cpu_use_nanos = cur->cpu_use_nanos;
+	stats->cpu_use_user  = cur->cpu_use_user;
+	stats->cpu_use_sys   = cur->cpu_use_sys;
+	stats->blkio         = cur->blkio;
+
+	stats->cpu_pct = 0;
+	stats->blkio_rate = 0;
+	stats->mem_delta = 0;
+	elapsed = ct->cur_time - ct->prev_time;
+	if (!ct->have_prev || elapsed <= 0)
+		return;
+
+	/* counters go backwards when the container restarted */
+	if (cur->cpu_use_nanos >= prev->cpu_use_nanos)
+		stats->cpu_pct = (cur->cpu_use_nanos - prev->cpu_use_nanos) /
+				 (elapsed * 1e7);
+	if (cur->blkio >= prev->blkio)
+		stats->blkio_rate = (cur->blkio - prev->blkio) / elapsed;
+	stats->mem_delta = (int64_t)(cur->mem_used - prev->mem_used);
 }
 
-static uint64_t stat_match_get_int(struct lxc_container *c, const char *item,
-				   const char *match, int column)
+struct sample_pool {
+	struct ct **ct;
+	int nr;
+	int next;	/* next container to sample, claimed atomically */
+};
+
+static void *sample_worker(void *arg)
 {
-	char buf[4096];
-	int i,j,len;
-	uint64_t val = 0;
-	char **lines, **cols;
-	size_t matchlen;
-
-	len = c->get_cgroup_item(c, item, buf, sizeof(buf));
-	if (len <= 0) {
-		ERROR("unable to read cgroup item %s", item);
-		goto out;
-	}
+	struct sample_pool *pool = arg;
+	int i;
 
-	lines = lxc_string_split_and_trim(buf, '\n');
-	if (!lines)
-		goto out;
+	while ((i = __sync_fetch_and_add(&pool->next, 1)) < pool->nr)
+		stats_sample(pool->ct[i]);
 
-	matchlen = strlen(match);
-	for (i = 0; lines[i]; i++) {
-		if (strncmp(lines[i], match, matchlen) == 0) {
-			cols = lxc_string_split_and_trim(lines[i], ' ');
-			if (!cols)
-				goto err1;
-			for (j = 0; cols[j]; j++) {
-				if (j == column) {
-					val = strtoull(cols[j], NULL, 0);
-					break;
-				}
-			}
-			lxc_free_array((void **)cols, free);
+	return NULL;
+}
+
+/*
+ * Most of the time goes into waiting on the kernel, so sample big lists
+ * from a few threads at once.  The samples are API calls, which set
+ * liblxc's current_config, so that needs thread local storage.
+ */
+static void stats_sample_all(void)
+{
+	struct sample_pool pool = { ct, ct_cnt, 0 };
+	pthread_t threads[MAX_THREADS];
+	int i, nr_threads;
+
+#ifdef HAVE_TLS
+	nr_threads = (ct_cnt + CTS_PER_THREAD - 1) / CTS_PER_THREAD;
+	if (nr_threads > MAX_THREADS)
+		nr_threads = MAX_THREADS;
+#else
+	nr_threads = 1;
+#endif
+
+	for (i = 1; i < nr_threads; i++)
+		if (pthread_create(&threads[i], NULL, sample_worker, &pool) != 0)
 			break;
-		}
-	}
-err1:
-	lxc_free_array((void **)lines, free);
-out:
-	return val;
+	nr_threads = i;
+
+	sample_worker(&pool);
+
+	for (i = 1; i < nr_threads; i++)
+		pthread_join(threads[i], NULL);
 }
 
-static void stats_get(struct lxc_container *c, struct ct *ct, struct stats *total)
+static void stats_total(struct stats *total)
 {
-	ct->c = c;
-	ct->stats->mem_used      = stat_get_int(c, "memory.usage_in_bytes");
-	ct->stats->mem_limit     = stat_get_int(c, "memory.limit_in_bytes");
-	ct->stats->kmem_used     = stat_get_int(c, "memory.kmem.usage_in_bytes");
-	ct->stats->kmem_limit    = stat_get_int(c, "memory.kmem.limit_in_bytes");
-	ct->stats->cpu_use_nanos = stat_get_int(c, "cpuacct.usage");
-	ct->stats->cpu_use_user  = stat_match_get_int(c, "cpuacct.stat", "user", 1);
-	ct->stats->cpu_use_sys   = stat_match_get_int(c, "cpuacct.stat", "system", 1);
-	ct->stats->blkio         = stat_match_get_int(c, "blkio.throttle.io_service_bytes", "Total", 1);
-
-	if (total) {
-		total->mem_used      = total->mem_used      + ct->stats->mem_used;
-		total->mem_limit     = total->mem_limit     + ct->stats->mem_limit;
-		total->kmem_used     = total->kmem_used     + ct->stats->kmem_used;
-		total->kmem_limit    = total->kmem_limit    + ct->stats->kmem_limit;
-		total->cpu_use_nanos = total->cpu_use_nanos + ct->stats->cpu_use_nanos;
-		total->cpu_use_user  = total->cpu_use_user  + ct->stats->cpu_use_user;
-		total->cpu_use_sys   = total->cpu_use_sys   + ct->stats->cpu_use_sys;
-		total->blkio         = total->blkio         + ct->stats->blkio;
+	int i;
+
+	memset(total, 0, sizeof(*total));
+	for (i = 0; i < ct_cnt; i++) {
+		struct stats *stats = ct[i]->stats;
+
+		total->mem_used      += stats->mem_used;
+		total->mem_limit     += stats->mem_limit;
+		total->kmem_used     += stats->kmem_used;
+		total->kmem_limit    += stats->kmem_limit;
+		total->cpu_use_nanos += stats->cpu_use_nanos;
+		total->cpu_use_user  += stats->cpu_use_user;
+		total->cpu_use_sys   += stats->cpu_use_sys;
+		total->blkio         += stats->blkio;
+		total->cpu_pct       += stats->cpu_pct;
+		total->blkio_rate    += stats->blkio_rate;
+		total->mem_delta     += stats->mem_delta;
 	}
 }
 
-static void stats_print_header(struct stats *stats)
+static void stats_format_header(char *line1, char *line2, size_t size,
+				const struct stats *total)
 {
-	printf(TERMRVRS TERMBOLD);
-	printf("%-18s %12s %12s %12s %14s %10s", "Container", "CPU",  "CPU",  "CPU",  "BlkIO", "Mem");
-	if (stats->kmem_used > 0)
-		printf(" %10s", "KMem");
-	printf("\n");
-
-	printf("%-18s %12s %12s %12s %14s %10s", "Name",      "Used", "Sys",  "User", "Total", "Used");
-	if (stats->kmem_used > 0)
-		printf(" %10s", "Used");
-	printf("\n");
-	printf(TERMNORM);
+	snprintf(line1, size, TERMRVRS TERMBOLD
+		 "%-18s %7s %12s %12s %12s %10s %10s %10s %11s%s" TERMNORM,
+		 "Container", "CPU", "CPU", "CPU", "CPU", "BlkIO", "BlkIO",
+		 "Mem", "Mem", total->kmem_used > 0 ? "       KMem" : "");
+	snprintf(line2, size, TERMRVRS TERMBOLD
+		 "%-18s %7s %12s %12s %12s %10s %10s %10s %11s%s" TERMNORM,
+		 "Name", "%", "Used", "Sys", "User", "Total", "per sec",
+		 "Used", "Delta", total->kmem_used > 0 ? "       Used" : "");
 }
 
-static void stats_print(const char *name, const struct stats *stats,
-			const struct stats *total)
+static void stats_format(char *line, size_t size, const char *name,
+			 const struct stats *stats, const struct stats *total)
 {
 	char blkio_str[20];
+	char blkio_rate_str[20];
 	char mem_used_str[20];
-	char kmem_used_str[20];
+	char mem_delta_str[20];
+	char kmem_used_str[20] = "";
+	int len;
 
 	size_humanize(stats->blkio, blkio_str, sizeof(blkio_str));
+	size_humanize(stats->blkio_rate, blkio_rate_str, sizeof(blkio_rate_str));
 	size_humanize(stats->mem_used, mem_used_str, sizeof(mem_used_str));
-
-	printf("%-18.18s %12.2f %12.2f %12.2f %14s %10s",
-	       name,
-	       (float)stats->cpu_use_nanos / 1000000000,
-	       (float)stats->cpu_use_sys  / USER_HZ,
-	       (float)stats->cpu_use_user / USER_HZ,
-	       blkio_str,
-	       mem_used_str);
-	if (total->kmem_used > 0) {
+	delta_humanize(stats->mem_delta, mem_delta_str, sizeof(mem_delta_str));
+
+	len = snprintf(line, size,
+		       "%-18.18s %7.1f %12.2f %12.2f %12.2f %10s %10s %10s %11s",
+		       name,
+		       stats->cpu_pct,
+		       (float)stats->cpu_use_nanos / 1000000000,
+		       (float)stats->cpu_use_sys  / USER_HZ,
+		       (float)stats->cpu_use_user / USER_HZ,
+		       blkio_str,
+		       blkio_rate_str,
+		       mem_used_str,
+		       mem_delta_str);
+	if (total->kmem_used > 0 && len > 0 && (size_t)len < size) {
 		size_humanize(stats->kmem_used, kmem_used_str, sizeof(kmem_used_str));
-		printf(" %10s", kmem_used_str);
+		snprintf(line + len, size - len, " %10s", kmem_used_str);
 	}
 }
 
-static int cmp_name(const void *sct1, const void *sct2)
+/* print @text at @row unless that is what the terminal shows already */
+static void screen_put(int row, const char *text)
 {
-	const struct ct *ct1 = sct1;
-	const struct ct *ct2 = sct2;
+	if (row >= screen_rows)
+		return;
 
-	if (sort_reverse)
-		return strcmp(ct2->c->name, ct1->c->name);
-	return strcmp(ct1->c->name, ct2->c->name);
+	if (screen[row] && strcmp(screen[row], text) == 0)
+		return;
+
+	printf(ESC "[%d;1H%s" TERMEOL, row + 1, text);
+	free(screen[row]);
+	screen[row] = strdup(text);
 }
 
-static int cmp_cpuuse(const void *sct1, const void *sct2)
+static void screen_clear_from(int row)
 {
-	const struct ct *ct1 = sct1;
-	const struct ct *ct2 = sct2;
-
-	if (sort_reverse)
-		return ct2->stats->cpu_use_nanos < ct1->stats->cpu_use_nanos;
-	return ct1->stats->cpu_use_nanos < ct2->stats->cpu_use_nanos;
+	for (; row < screen_rows; row++) {
+		if (!screen[row])
+			continue;
+		printf(ESC "[%d;1H" TERMEOL, row + 1);
+		free(screen[row]);
+		screen[row] = NULL;
+	}
 }
 
-static int cmp_blkio(const void *sct1, const void *sct2)
+static void screen_reset(int rows)
 {
-	const struct ct *ct1 = sct1;
-	const struct ct *ct2 = sct2;
+	int i;
 
-	if (sort_reverse)
-		return ct2->stats->blkio < ct1->stats->blkio;
-	return ct1->stats->blkio < ct2->stats->blkio;
+	for (i = 0; i < screen_rows; i++)
+		free(screen[i]);
+	free(screen);
+
+	screen = calloc(rows, sizeof(*screen));
+	if (!screen) {
+		ERROR("cannot alloc mem");
+		exit(EXIT_FAILURE);
+	}
+	screen_rows = rows;
+	printf(TERMCLEAR);
 }
 
-static int cmp_memory(const void *sct1, const void *sct2)
+static int cmp_u64(uint64_t a, uint64_t b)
 {
-	const struct ct *ct1 = sct1;
-	const struct ct *ct2 = sct2;
-
-	if (sort_reverse)
-		return ct2->stats->mem_used < ct1->stats->mem_used;
-	return ct1->stats->mem_used < ct2->stats->mem_used;
+	return a < b ? -1 : a > b;
 }
 
-static int cmp_kmemory(const void *sct1, const void *sct2)
+static int cmp_name(const void *sct1, const void *sct2)
 {
-	const struct ct *ct1 = sct1;
-	const struct ct *ct2 = sct2;
+	const struct ct *ct1 = *(struct ct * const *)sct1;
+	const struct ct *ct2 = *(struct ct * const *)sct2;
 
 	if (sort_reverse)
-		return ct2->stats->kmem_used < ct1->stats->kmem_used;
-	return ct1->stats->kmem_used < ct2->stats->kmem_used;
+		return strcmp(ct2->c->name, ct1->c->name);
+	return strcmp(ct1->c->name, ct2->c->name);
+}
+
+/* values sort largest first unless reversed */
+#define CMP_STAT(fn, expr)						\
+static int fn(const void *sct1, const void *sct2)			\
+{									\
+	const struct stats *s1 = (*(struct ct * const *)sct1)->stats;	\
+	const struct stats *s2 = (*(struct ct * const *)sct2)->stats;	\
+	int ret;							\
+									\
+	ret = expr;							\
+	if (ret == 0)							\
+		return cmp_name(sct1, sct2);				\
+	return sort_reverse ? ret : -ret;				\
 }
 
-static void ct_sort(int active)
+CMP_STAT(cmp_cpuuse, s1->cpu_pct < s2->cpu_pct ? -1 : s1->cpu_pct > s2->cpu_pct)
+CMP_STAT(cmp_blkio, cmp_u64(s1->blkio_rate, s2->blkio_rate))
+CMP_STAT(cmp_memory, cmp_u64(s1->mem_used, s2->mem_used))
+CMP_STAT(cmp_kmemory, cmp_u64(s1->kmem_used, s2->kmem_used))
+
+static void ct_sort(void)
 {
 	int (*cmp_func)(const void *, const void *);
 
@@ -379,56 +494,216 @@ static void ct_sort(int active)
 	case 'm': cmp_func = cmp_memory; break;
 	case 'k': cmp_func = cmp_kmemory; break;
 	}
-	qsort(ct, active, sizeof(*ct), (int (*)(const void *,const void *))cmp_func);
+
+	memcpy(view, ct, ct_cnt * sizeof(*view));
+	qsort(view, ct_cnt, sizeof(*view), cmp_func);
 }
 
-static void ct_free(void)
+static void ct_free(struct ct *ct)
 {
-	int i;
+	lxc_container_put(ct->c);
+	free(ct->stats);
+	free(ct);
+}
+
+static struct ct *ct_new(const char *name)
+{
+	struct ct *ct;
+
+	ct = malloc(sizeof(*ct));
+	if (!ct)
+		return NULL;
+	memset(ct, 0, sizeof(*ct));
+
+	ct->stats = malloc(sizeof(*ct->stats));
+	ct->c = lxc_container_new(name, my_args.lxcpath[0]);
+	if (!ct->stats || !ct->c) {
+		free(ct->stats);
+		if (ct->c)
+			lxc_container_put(ct->c);
+		free(ct);
+		return NULL;
+	}
+	memset(ct->stats, 0, sizeof(*ct->stats));
+
+	/* keep the cgroup directories open for the next refreshes */
+	ct->c->want_cgroup_cache(ct->c, true);
+	return ct;
+}
 
-	for (i = 0; i < ct_alloc_cnt; i++) {
-		if (ct[i].c) {
-			lxc_container_put(ct[i].c);
-			ct[i].c = NULL;
+static int string_cmp(const void *a, const void *b)
+{
+	return strcmp(*(char * const *)a, *(char * const *)b);
+}
+
+/*
+ * Merge the running containers into the list kept from the last refresh,
+ * only containers that started since get a new lxc_container.
+ */
+static void ct_update(void)
+{
+	struct ct **newct;
+	char **names = NULL;
+	int i = 0, j = 0, n = 0, cmp, nr;
+
+	nr = list_active_containers(my_args.lxcpath[0], &names, NULL);
+	if (nr < 0) {
+		ERROR("failed to list active containers");
+		nr = 0;
+	}
+	qsort(names, nr, sizeof(*names), string_cmp);
+
+	newct = malloc((nr + 1) * sizeof(*newct));
+	if (!newct) {
+		ERROR("cannot alloc mem");
+		exit(EXIT_FAILURE);
+	}
+
+	while (i < nr || j < ct_cnt) {
+		if (i == nr)
+			cmp = 1;
+		else if (j == ct_cnt)
+			cmp = -1;
+		else
+			cmp = strcmp(names[i], ct[j]->c->name);
+
+		if (cmp == 0) {
+			newct[n++] = ct[j++];
+			i++;
+		} else if (cmp < 0) {
+			newct[n] = ct_new(names[i++]);
+			if (newct[n])
+				n++;
+		} else {
+			ct_free(ct[j++]);
 		}
-		free(ct[i].stats);
-		ct[i].stats = NULL;
+	}
+
+	for (i = 0; i < nr; i++)
+		free(names[i]);
+	free(names);
+
+	free(ct);
+	ct = newct;
+	ct_cnt = n;
+
+	free(view);
+	view = malloc((ct_cnt + 1) * sizeof(*view));
+	if (!view) {
+		ERROR("cannot alloc mem");
+		exit(EXIT_FAILURE);
 	}
 }
 
-static void ct_realloc(int active_cnt)
+static void json_print_string(const char *s)
 {
+	putchar('"');
+	for (; *s; s++) {
+		if (*s == '"' || *s == '\\')
+			putchar('\\');
+		if ((unsigned char)*s < 0x20)
+			printf("\\u%04x", *s);
+		else
+			putchar(*s);
+	}
+	putchar('"');
+}
+
+/* one newline delimited JSON record per container, for collectors */
+static void stats_print_records(void)
+{
+	double stamp = now(CLOCK_REALTIME);
+	struct lxc_cgroup_stats *cur;
+	struct stats *stats;
 	int i;
 
-	if (active_cnt > ct_alloc_cnt) {
-		ct_free();
-		ct = realloc(ct, sizeof(*ct) * active_cnt);
-		if (!ct) {
-			ERROR("cannot alloc mem");
-			exit(EXIT_FAILURE);
-		}
-		for (i = 0; i < active_cnt; i++) {
-			ct[i].stats = malloc(sizeof(*ct[0].stats));
-			if (!ct[i].stats) {
-				ERROR("cannot alloc mem");
-				exit(EXIT_FAILURE);
-			}
-		}
-		ct_alloc_cnt = active_cnt;
+	for (i = 0; i < ct_cnt; i++) {
+		if (!ct[i]->sampled)
+			continue;
+		cur = &ct[i]->cur;
+		stats = ct[i]->stats;
+
+		printf("{\"time\":%.3f,\"name\":", stamp);
+		json_print_string(ct[i]->c->name);
+		printf(",\"mem_used\":%llu,\"mem_limit\":%llu,\"kmem_used\":%llu"
+		       ",\"cpu_use_nanos\":%llu,\"cpu_use_user\":%llu"
+		       ",\"cpu_use_sys\":%llu,\"blkio\":%llu,\"pids\":%llu",
+		       (unsigned long long)cur->mem_used,
+		       (unsigned long long)cur->mem_limit,
+		       (unsigned long long)cur->kmem_used,
+		       (unsigned long long)cur->cpu_use_nanos,
+		       (unsigned long long)cur->cpu_use_user,
+		       (unsigned long long)cur->cpu_use_sys,
+		       (unsigned long long)cur->blkio,
+		       (unsigned long long)cur->pids_current);
+		if (ct[i]->have_prev)
+			printf(",\"interval\":%.3f,\"cpu_pct\":%.2f"
+			       ",\"blkio_rate\":%llu,\"mem_delta\":%lld",
+			       ct[i]->cur_time - ct[i]->prev_time,
+			       stats->cpu_pct,
+			       (unsigned long long)stats->blkio_rate,
+			       (long long)stats->mem_delta);
+		printf("}\n");
 	}
+	fflush(stdout);
+}
+
+static void stats_display(int rows)
+{
+	char line1[256], line2[256], total_name[30];
+	struct stats total;
+	int i, ct_print_cnt;
+
+	if (rows != screen_rows)
+		screen_reset(rows);
+	ct_print_cnt = rows - 3; /* 3 -> header and total */
+
+	stats_total(&total);
+	ct_sort();
+
+	stats_format_header(line1, line2, sizeof(line1), &total);
+	screen_put(0, line1);
+	screen_put(1, line2);
+	for (i = 0; i < ct_cnt && i < ct_print_cnt; i++) {
+		stats_format(line1, sizeof(line1), view[i]->c->name,
+			     view[i]->stats, &total);
+		screen_put(i + 2, line1);
+	}
+	sprintf(total_name, "TOTAL %d of %d", i, ct_cnt);
+	stats_format(line1, sizeof(line1), total_name, &total, &total);
+	screen_put(i + 2, line1);
+	screen_clear_from(i + 3);
+	fflush(stdout);
+}
+
+static int batch_loop(void)
+{
+	for (;;) {
+		ct_update();
+		stats_sample_all();
+		stats_print_records();
+		sleep(delay);
+	}
+
+	return EXIT_SUCCESS;
 }
 
 int main(int argc, char *argv[])
 {
 	struct lxc_epoll_descr descr;
-	int ret, ct_print_cnt;
+	int ret;
 	char in_char;
 
 	ret = EXIT_FAILURE;
 	if (lxc_arguments_parse(&my_args, argc, argv))
 		goto out;
 
-	ct_print_cnt = stdin_tios_rows() - 3; /* 3 -> header and total */
+	signal(SIGINT, sig_handler);
+	signal(SIGQUIT, sig_handler);
+
+	if (batch)
+		exit(batch_loop());
+
 	if (stdin_tios_setup() < 0) {
 		ERROR("failed to setup terminal");
 		goto out;
@@ -436,8 +711,6 @@ int main(int argc, char *argv[])
 
 	/* ensure the terminal gets restored */
 	atexit(stdin_tios_restore);
-	signal(SIGINT, sig_handler);
-	signal(SIGQUIT, sig_handler);
 
 	if (lxc_mainloop_open(&descr)) {
 		ERROR("failed to create mainloop");
@@ -452,34 +725,9 @@ int main(int argc, char *argv[])
 	}
 
 	for(;;) {
-		struct lxc_container **active;
-		int i, active_cnt;
-		struct stats total;
-		char total_name[30];
-
-		active_cnt = list_active_containers(my_args.lxcpath[0], NULL, &active);
-		ct_realloc(active_cnt);
-
-		memset(&total, 0, sizeof(total));
-		for (i = 0; i < active_cnt; i++)
-			stats_get(active[i], &ct[i], &total);
-
-		ct_sort(active_cnt);
-
-		printf(TERMCLEAR);
-		stats_print_header(&total);
-		for (i = 0; i < active_cnt && i < ct_print_cnt; i++) {
-			stats_print(ct[i].c->name, ct[i].stats, &total);
-			printf("\n");
-		}
-		sprintf(total_name, "TOTAL %d of %d", i, active_cnt);
-		stats_print(total_name, &total, &total);
-		fflush(stdout);
-
-		for (i = 0; i < active_cnt; i++) {
-			lxc_container_put(ct[i].c);
-			ct[i].c = NULL;
-		}
+		ct_update();
+		stats_sample_all();
+		stats_display(stdin_tios_rows());
 
 		in_char = '\0';
 		ret = lxc_mainloop(&descr, 1000 * delay);
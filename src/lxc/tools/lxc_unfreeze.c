@@ -33,25 +33,76 @@
 
 lxc_log_define(lxc_unfreeze_ui, lxc);
 
+static int my_parser(struct lxc_arguments *args, int c, char *arg)
+{
+	switch (c) {
+	case 'a': args->all = 1; break;
+	}
+	return 0;
+}
+
+static int my_checker(const struct lxc_arguments *args)
+{
+	if (args->all && args->name) {
+		lxc_error(args, "specifying --name with --all doesn't make sense");
+		return -1;
+	}
+	return 0;
+}
+
 static const struct option my_longopts[] = {
+	{"all", no_argument, 0, 'a'},
 	LXC_COMMON_OPTIONS
 };
 
 static struct lxc_arguments my_args = {
 	.progname = "lxc-unfreeze",
 	.help     = "\
---name=NAME\n\
+--name=NAME | --all\n\
 \n\
 lxc-unfreeze unfreezes a container with the identifier NAME\n\
 \n\
 Options :\n\
   -n, --name=NAME   NAME of the container\n\
+  -a, --all         Unfreeze all running containers at once\n\
   --rcfile=FILE     Load configuration file FILE\n",
 	.options  = my_longopts,
-	.parser   = NULL,
-	.checker  = NULL,
+	.parser   = my_parser,
+	.checker  = my_checker,
 };
 
+/* all running containers of the lxcpath are thawed at once */
+static bool unfreeze_all(void)
+{
+	struct lxc_container **cts;
+	int i, nr, count, ret;
+
+	count = list_active_containers(my_args.lxcpath[0], NULL, &cts);
+	if (count < 0) {
+		ERROR("Failed to list the containers in %s", my_args.lxcpath[0]);
+		return false;
+	}
+
+	for (i = nr = 0; i < count; i++) {
+		if (!cts[i]->may_control(cts[i])) {
+			ERROR("Insufficent privileges to control %s:%s", my_args.lxcpath[0], cts[i]->name);
+			lxc_container_put(cts[i]);
+			continue;
+		}
+		cts[nr++] = cts[i];
+	}
+
+	ret = lxc_unfreeze_containers(cts, nr);
+	if (ret != nr)
+		ERROR("Failed to unfreeze %d of %d containers in %s",
+		      ret < 0 ? nr : nr - ret, nr, my_args.lxcpath[0]);
+
+	for (i = 0; i < nr; i++)
+		lxc_container_put(cts[i]);
+	free(cts);
+	return ret == nr && nr == count;
+}
+
 int main(int argc, char *argv[])
 {
 	struct lxc_container *c;
@@ -67,6 +118,9 @@ int main(int argc, char *argv[])
 		exit(EXIT_FAILURE);
 	lxc_log_options_no_override();
 
+	if (my_args.all)
+		exit(unfreeze_all() ? EXIT_SUCCESS : EXIT_FAILURE);
+
 	c = lxc_container_new(my_args.name, my_args.lxcpath[0]);
 	if (!c) {
 		ERROR("No such container: %s:%s", my_args.lxcpath[0], my_args.name);
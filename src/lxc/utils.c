@@ -28,6 +28,7 @@
 #include <errno.h>
 #include <fcntl.h>
 #include <libgen.h>
+#include <pthread.h>
 #include <stddef.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -37,6 +38,7 @@
 #include <sys/mount.h>
 #include <sys/param.h>
 #include <sys/prctl.h>
+#include <sys/sendfile.h>
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <sys/vfs.h>
@@ -87,97 +89,230 @@ lxc_log_define(lxc_utils, lxc);
  */
 extern bool btrfs_try_remove_subvol(const char *path);
 
-static int _recursive_rmdir(char *dirname, dev_t pdev,
-			    const char *exclude, int level, bool onedev)
+#define RMDIR_MAX_WORKERS 16
+
+/*
+ * A directory being emptied, relative to the root of the removal. It goes
+ * away once it was scanned and all its subdirectories are gone.
+ */
+struct rmdir_node {
+	struct rmdir_node *parent;
+	struct rmdir_node *next;
+	int pending; /* subdirectories left, plus one while being scanned */
+	char path[];
+};
+
+struct rmdir_pool {
+	const char *root;
+	int rootfd;
+	dev_t dev;
+	bool onedev;
+	const char *exclude;
+	bool hadexclude;
+
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	struct rmdir_node *queue;
+	unsigned int busy;
+	bool failed;
+};
+
+static void rmdir_fail(struct rmdir_pool *pool)
+{
+	pthread_mutex_lock(&pool->lock);
+	pool->failed = true;
+	pthread_mutex_unlock(&pool->lock);
+}
+
+/* btrfs subvolumes are only removed by path */
+static bool rmdir_try_subvol(struct rmdir_pool *pool, const char *path,
+			     const char *name)
+{
+	char *full;
+	bool ret;
+
+	if (asprintf(&full, "%s/%s%s%s", pool->root, path, *path ? "/" : "",
+		     name) < 0)
+		return false;
+	ret = btrfs_try_remove_subvol(full);
+	if (ret)
+		INFO("Removed btrfs subvolume at %s", full);
+	free(full);
+	return ret;
+}
+
+static int rmdir_queue(struct rmdir_pool *pool, struct rmdir_node *parent,
+		       const char *name)
+{
+	struct rmdir_node *n;
+	size_t plen = strlen(parent->path), nlen = strlen(name);
+
+	n = malloc(sizeof(*n) + plen + nlen + 2);
+	if (!n)
+		return -1;
+
+	n->parent = parent;
+	n->pending = 1;
+	if (plen) {
+		memcpy(n->path, parent->path, plen);
+		n->path[plen++] = '/';
+	}
+	memcpy(n->path + plen, name, nlen + 1);
+	__sync_fetch_and_add(&parent->pending, 1);
+
+	/* LIFO: depth first keeps the number of pending directories low */
+	pthread_mutex_lock(&pool->lock);
+	n->next = pool->queue;
+	pool->queue = n;
+	pthread_cond_signal(&pool->cond);
+	pthread_mutex_unlock(&pool->lock);
+
+	return 0;
+}
+
+/*
+ * Drop a reference to @n. The last one removes the directory and drops the
+ * reference it held on its parent, the root is left to the caller.
+ */
+static void rmdir_put(struct rmdir_pool *pool, struct rmdir_node *n)
+{
+	struct rmdir_node *parent;
+
+	while (n->parent && __sync_sub_and_fetch(&n->pending, 1) == 0) {
+		parent = n->parent;
+		if (unlinkat(pool->rootfd, n->path, AT_REMOVEDIR) < 0 &&
+		    !rmdir_try_subvol(pool, n->path, "")) {
+			SYSERROR("%s: failed to delete %s/%s", __func__,
+				 pool->root, n->path);
+			rmdir_fail(pool);
+		}
+		free(n);
+		n = parent;
+	}
+	if (!n->parent)
+		__sync_sub_and_fetch(&n->pending, 1);
+}
+
+static void rmdir_exclude(struct rmdir_pool *pool, int fd, const char *name)
+{
+	if (unlinkat(fd, name, AT_REMOVEDIR) == 0)
+		return;
+
+	switch (errno) {
+	case ENOTEMPTY:
+		INFO("Not deleting snapshot %s/%s", pool->root, name);
+		pool->hadexclude = true;
+		break;
+	case ENOTDIR:
+		if (unlinkat(fd, name, 0) < 0)
+			INFO("%s: failed to remove %s/%s", __func__, pool->root, name);
+		break;
+	default:
+		SYSERROR("%s: failed to rmdir %s/%s", __func__, pool->root, name);
+		rmdir_fail(pool);
+		break;
+	}
+}
+
+/*
+ * Unlink everything in one directory but its subdirectories, which are
+ * handed back to the pool. Everything is relative to the directory's fd.
+ * Every entry is checked for its device before it is touched, as files can
+ * be bind mounted too.
+ */
+static void rmdir_scan(struct rmdir_pool *pool, struct rmdir_node *n)
 {
 	struct dirent *direntp;
+	struct stat st;
 	DIR *dir;
-	int ret, failed=0;
-	char pathname[MAXPATHLEN];
-	bool hadexclude = false;
+	int fd;
 
-	dir = opendir(dirname);
-	if (!dir) {
-		ERROR("%s: failed to open %s", __func__, dirname);
-		return -1;
+	fd = openat(pool->rootfd, *n->path ? n->path : ".",
+		    O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+	if (fd < 0 || !(dir = fdopendir(fd))) {
+		SYSERROR("%s: failed to open %s/%s", __func__, pool->root, n->path);
+		if (fd >= 0)
+			close(fd);
+		rmdir_fail(pool);
+		return;
 	}
 
 	while ((direntp = readdir(dir))) {
-		struct stat mystat;
-		int rc;
-
-		if (!direntp)
-			break;
+		const char *name = direntp->d_name;
 
-		if (!strcmp(direntp->d_name, ".") ||
-		    !strcmp(direntp->d_name, ".."))
+		if (!strcmp(name, ".") || !strcmp(name, ".."))
 			continue;
 
-		rc = snprintf(pathname, MAXPATHLEN, "%s/%s", dirname, direntp->d_name);
-		if (rc < 0 || rc >= MAXPATHLEN) {
-			ERROR("pathname too long");
-			failed=1;
+		if (!n->parent && pool->exclude && !strcmp(name, pool->exclude)) {
+			rmdir_exclude(pool, fd, name);
 			continue;
 		}
 
-		if (!level && exclude && !strcmp(direntp->d_name, exclude)) {
-			ret = rmdir(pathname);
-			if (ret < 0) {
-				switch(errno) {
-				case ENOTEMPTY:
-					INFO("Not deleting snapshot %s", pathname);
-					hadexclude = true;
-					break;
-				case ENOTDIR:
-					ret = unlink(pathname);
-					if (ret)
-						INFO("%s: failed to remove %s", __func__, pathname);
-					break;
-				default:
-					SYSERROR("%s: failed to rmdir %s", __func__, pathname);
-					failed = 1;
-					break;
-				}
+		/* without a device to stay on, only directories need a stat */
+		if (!pool->onedev && direntp->d_type != DT_DIR &&
+		    direntp->d_type != DT_UNKNOWN) {
+			if (unlinkat(fd, name, 0) < 0) {
+				SYSERROR("%s: failed to delete %s/%s/%s", __func__,
+					 pool->root, n->path, name);
+				rmdir_fail(pool);
 			}
 			continue;
 		}
 
-		ret = lstat(pathname, &mystat);
-		if (ret) {
-			ERROR("%s: failed to stat %s", __func__, pathname);
-			failed = 1;
+		if (fstatat(fd, name, &st, AT_SYMLINK_NOFOLLOW) < 0) {
+			SYSERROR("%s: failed to stat %s/%s/%s", __func__,
+				 pool->root, n->path, name);
+			rmdir_fail(pool);
 			continue;
 		}
-		if (onedev && mystat.st_dev != pdev) {
+
+		if (pool->onedev && st.st_dev != pool->dev) {
 			/* TODO should we be checking /proc/self/mountinfo for
 			 * pathname and not doing this if found? */
-			if (btrfs_try_remove_subvol(pathname))
-				INFO("Removed btrfs subvolume at %s\n", pathname);
+			rmdir_try_subvol(pool, n->path, name);
 			continue;
 		}
-		if (S_ISDIR(mystat.st_mode)) {
-			if (_recursive_rmdir(pathname, pdev, exclude, level+1, onedev) < 0)
-				failed=1;
-		} else {
-			if (unlink(pathname) < 0) {
-				SYSERROR("%s: failed to delete %s", __func__, pathname);
-				failed=1;
-			}
+
+		if (S_ISDIR(st.st_mode)) {
+			if (rmdir_queue(pool, n, name) < 0)
+				rmdir_fail(pool);
+		} else if (unlinkat(fd, name, 0) < 0) {
+			SYSERROR("%s: failed to delete %s/%s/%s", __func__,
+				 pool->root, n->path, name);
+			rmdir_fail(pool);
 		}
 	}
 
-	if (rmdir(dirname) < 0 && !btrfs_try_remove_subvol(dirname) && !hadexclude) {
-		ERROR("%s: failed to delete %s", __func__, dirname);
-		failed=1;
-	}
+	closedir(dir);
+}
 
-	ret = closedir(dir);
-	if (ret) {
-		ERROR("%s: failed to close directory %s", __func__, dirname);
-		failed=1;
-	}
+static void *rmdir_worker(void *arg)
+{
+	struct rmdir_pool *pool = arg;
+	struct rmdir_node *n;
+
+	for (;;) {
+		pthread_mutex_lock(&pool->lock);
+		while (!pool->queue && pool->busy > 0)
+			pthread_cond_wait(&pool->cond, &pool->lock);
+		if (!pool->queue) {
+			pthread_cond_broadcast(&pool->cond);
+			pthread_mutex_unlock(&pool->lock);
+			return NULL;
+		}
+		n = pool->queue;
+		pool->queue = n->next;
+		pool->busy++;
+		pthread_mutex_unlock(&pool->lock);
 
-	return failed ? -1 : 0;
+		rmdir_scan(pool, n);
+		rmdir_put(pool, n);
+
+		pthread_mutex_lock(&pool->lock);
+		if (--pool->busy == 0)
+			pthread_cond_broadcast(&pool->cond);
+		pthread_mutex_unlock(&pool->lock);
+	}
 }
 
 /* we have two different magic values for overlayfs, yay */
@@ -203,10 +338,20 @@ static bool is_native_overlayfs(const char *path)
 extern int lxc_rmdir_onedev(char *path, const char *exclude)
 {
 	struct stat mystat;
-	bool onedev = true;
+	struct rmdir_node root = { .pending = 1 };
+	struct rmdir_pool pool = {
+		.root = path,
+		.onedev = true,
+		.exclude = exclude,
+		.lock = PTHREAD_MUTEX_INITIALIZER,
+		.cond = PTHREAD_COND_INITIALIZER,
+		.queue = &root,
+	};
+	pthread_t tids[RMDIR_MAX_WORKERS];
+	long i, nr;
 
 	if (is_native_overlayfs(path)) {
-		onedev = false;
+		pool.onedev = false;
 	}
 
 	if (lstat(path, &mystat) < 0) {
@@ -215,8 +360,33 @@ extern int lxc_rmdir_onedev(char *path, const char *exclude)
 		ERROR("%s: failed to stat %s", __func__, path);
 		return -1;
 	}
+	pool.dev = mystat.st_dev;
+
+	pool.rootfd = open(path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+	if (pool.rootfd < 0) {
+		ERROR("%s: failed to open %s", __func__, path);
+		return -1;
+	}
 
-	return _recursive_rmdir(path, mystat.st_dev, exclude, 0, onedev);
+	/* the calling thread is one of the workers */
+	nr = sysconf(_SC_NPROCESSORS_ONLN);
+	if (nr > RMDIR_MAX_WORKERS)
+		nr = RMDIR_MAX_WORKERS;
+	for (i = 1; i < nr; i++)
+		if (pthread_create(&tids[i], NULL, rmdir_worker, &pool) != 0)
+			break;
+	nr = i;
+	rmdir_worker(&pool);
+	for (i = 1; i < nr; i++)
+		pthread_join(tids[i], NULL);
+	close(pool.rootfd);
+
+	if (rmdir(path) < 0 && !btrfs_try_remove_subvol(path) && !pool.hadexclude) {
+		ERROR("%s: failed to delete %s", __func__, path);
+		pool.failed = true;
+	}
+
+	return pool.failed ? -1 : 0;
 }
 
 /* borrowed from iproute2 */
@@ -359,6 +529,209 @@ ssize_t lxc_read_nointr_expect(int fd, void* buf, size_t count, const void* expe
 	return ret;
 }
 
+#define COPY_CHUNK (1 << 30)
+#define COPY_BUF_SIZE (1 << 20)
+
+/* the bounce buffer of @s, allocated on first use */
+static char *copy_buf(struct lxc_copy_state *s)
+{
+	if (!s->buf)
+		s->buf = malloc(COPY_BUF_SIZE);
+	return s->buf;
+}
+
+void lxc_copy_state_free(struct lxc_copy_state *s)
+{
+	free(s->buf);
+	s->buf = NULL;
+}
+
+/*
+ * Copy @len bytes of @in at @off to the same offset of @out. The data is
+ * moved with copy_file_range(), which can share extents or copy on the
+ * server, then sendfile(), and through the buffer of @s only if neither
+ * works for these files. A method that failed is not tried again with the
+ * same @s. Stops early, without error, at the end of @in. Returns the
+ * number of bytes copied.
+ */
+off_t lxc_copy_range(struct lxc_copy_state *s, int in, int out, off_t off,
+		     off_t len)
+{
+	char *buf;
+	ssize_t nr = 0, nw, done;
+	off_t start = off;
+
+	while (len > 0 && !s->no_range) {
+		loff_t ioff = off, ooff = off;
+
+		nr = copy_file_range(in, &ioff, out, &ooff,
+				     len > COPY_CHUNK ? COPY_CHUNK : len, 0);
+		if (nr < 0 && errno == EINTR)
+			continue;
+		if (nr < 0 && errno != ENOSYS && errno != EXDEV &&
+		    errno != EINVAL && errno != EOPNOTSUPP)
+			return -1;
+		if (nr < 0)
+			s->no_range = true;
+		/* some filesystems wrongly report nothing to copy, retry below */
+		if (nr <= 0)
+			break;
+		off += nr;
+		len -= nr;
+	}
+
+	if (len > 0 && !s->no_sendfile && lseek(out, off, SEEK_SET) == off) {
+		while (len > 0) {
+			off_t ioff = off;
+
+			nr = sendfile(out, in, &ioff,
+				      len > COPY_CHUNK ? COPY_CHUNK : len);
+			if (nr < 0 && errno == EINTR)
+				continue;
+			if (nr < 0 && errno != EINVAL && errno != ENOSYS)
+				return -1;
+			if (nr < 0)
+				s->no_sendfile = true;
+			if (nr <= 0)
+				break;
+			off += nr;
+			len -= nr;
+		}
+	}
+
+	if (len <= 0)
+		return off - start;
+
+	buf = copy_buf(s);
+	if (!buf)
+		return -1;
+
+	while (len > 0) {
+		nr = pread(in, buf, len > COPY_BUF_SIZE ? COPY_BUF_SIZE : len, off);
+		if (nr < 0 && errno == EINTR)
+			continue;
+		if (nr <= 0)
+			break;
+
+		for (done = 0; done < nr; done += nw) {
+			nw = pwrite(out, buf + done, nr - done, off + done);
+			if (nw < 0 && errno == EINTR) {
+				nw = 0;
+				continue;
+			}
+			if (nw < 0)
+				return -1;
+		}
+		off += nr;
+		len -= nr;
+	}
+
+	return nr < 0 ? -1 : off - start;
+}
+
+/* Append everything left in @in to @out, for files without a usable size. */
+static int copy_until_eof(struct lxc_copy_state *s, int in, int out)
+{
+	char *buf;
+	ssize_t nr;
+
+	buf = copy_buf(s);
+	if (!buf)
+		return -1;
+
+	while ((nr = lxc_read_nointr(in, buf, COPY_BUF_SIZE)) > 0)
+		if (lxc_write_nointr(out, buf, nr) != nr)
+			return -1;
+
+	return nr < 0 ? -1 : 0;
+}
+
+/*
+ * Copy the file @src to @dest, which must not exist yet, keeping its mode
+ * and, as far as we are allowed to, its owner. @src may also be a pipe, a
+ * character device or a procfs file, those are read until their end.
+ */
+int lxc_copy_file(const char *src, const char *dest)
+{
+	struct lxc_copy_state state = { NULL };
+	int in, out;
+	off_t copied = 0;
+	struct stat st;
+
+	in = open(src, O_RDONLY | O_CLOEXEC);
+	if (in < 0) {
+		/* optional files like lxc_rdepends, the caller decides */
+		if (errno == ENOENT)
+			INFO("Error stat'ing %s", src);
+		else
+			SYSERROR("Error opening original file %s", src);
+		return -1;
+	}
+	if (fstat(in, &st) < 0) {
+		SYSERROR("Error stat'ing %s", src);
+		close(in);
+		return -1;
+	}
+
+	/* only regular files have an owner and mode worth keeping */
+	out = open(dest, O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC,
+		   S_ISREG(st.st_mode) ? 0600 : 0644);
+	if (out < 0) {
+		if (errno == EEXIST)
+			ERROR("copy destination %s exists", dest);
+		else
+			SYSERROR("Error opening new file %s", dest);
+		close(in);
+		return -1;
+	}
+
+	if (S_ISREG(st.st_mode) && st.st_size > 0)
+		copied = lxc_copy_range(&state, in, out, 0, st.st_size);
+	/* pipes and pseudo files have no size, or not the one they report */
+	if (copied >= 0 && (!S_ISREG(st.st_mode) || copied < st.st_size ||
+			    st.st_size == 0)) {
+		if (copied > 0 && (lseek(in, copied, SEEK_SET) != copied ||
+				   lseek(out, copied, SEEK_SET) != copied))
+			copied = -1;
+		else if (copy_until_eof(&state, in, out) < 0)
+			copied = -1;
+	}
+	lxc_copy_state_free(&state);
+	if (copied < 0) {
+		SYSERROR("Error copying %s to %s", src, dest);
+		goto err;
+	}
+
+	if (S_ISREG(st.st_mode)) {
+		/* chown() drops setuid bits, so it has to come first */
+		if (fchown(out, st.st_uid, st.st_gid) < 0) {
+			if (errno != EPERM) {
+				SYSERROR("Error setting owner on %s", dest);
+				goto err;
+			}
+			INFO("Not allowed to keep the owner of %s", src);
+		}
+		if (fchmod(out, st.st_mode & 07777) < 0) {
+			SYSERROR("Error setting mode on %s", dest);
+			goto err;
+		}
+	}
+
+	close(in);
+	if (close(out) < 0) {
+		SYSERROR("Error writing %s", dest);
+		unlink(dest);
+		return -1;
+	}
+	return 0;
+
+err:
+	close(in);
+	close(out);
+	unlink(dest);
+	return -1;
+}
+
 #if HAVE_LIBGNUTLS
 #include <gnutls/gnutls.h>
 #include <gnutls/crypto.h>
@@ -78,6 +78,22 @@ static inline int unshare(int flags)
 int unshare(int);
 #endif
 
+/* Define copy_file_range() if missing from the C library */
+#ifndef HAVE_COPY_FILE_RANGE
+static inline ssize_t copy_file_range(int fd_in, loff_t *off_in, int fd_out,
+				      loff_t *off_out, size_t len,
+				      unsigned int flags)
+{
+#ifdef __NR_copy_file_range
+	return syscall(__NR_copy_file_range, fd_in, off_in, fd_out, off_out,
+		       len, flags);
+#else
+	errno = ENOSYS;
+	return -1;
+#endif
+}
+#endif
+
 /* Define signalfd() if missing from the C library */
 #ifdef HAVE_SYS_SIGNALFD_H
 #  include <sys/signalfd.h>
@@ -220,6 +236,17 @@ extern int lxc_wait_for_pid_status(pid_t pid);
 extern ssize_t lxc_write_nointr(int fd, const void* buf, size_t count);
 extern ssize_t lxc_read_nointr(int fd, void* buf, size_t count);
 extern ssize_t lxc_read_nointr_expect(int fd, void* buf, size_t count, const void* expected_buf);
+
+/* copy file contents, in the kernel when the filesystems allow it */
+struct lxc_copy_state {
+	char *buf;		/* bounce buffer, allocated on first use */
+	bool no_range;		/* copy_file_range() failed, do not retry */
+	bool no_sendfile;	/* sendfile() failed, do not retry */
+};
+extern off_t lxc_copy_range(struct lxc_copy_state *s, int in, int out,
+			    off_t off, off_t len);
+extern void lxc_copy_state_free(struct lxc_copy_state *s);
+extern int lxc_copy_file(const char *src, const char *dest);
 #if HAVE_LIBGNUTLS
 #define SHA_DIGEST_LENGTH 20
 extern int sha1sum_file(char *fnam, unsigned char *md_value);
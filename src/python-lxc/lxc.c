@@ -980,6 +980,67 @@ Container_get_cgroup_item(Container *self, PyObject *args, PyObject *kwds)
     return ret;
 }
 
+static PyObject *
+Container_get_cgroup_stats(Container *self, PyObject *unused)
+{
+    static const struct {
+        const char *name;
+        unsigned int valid;
+        size_t offset;
+    } counters[] = {
+        #define STAT(group, member) \
+            {#member, LXC_CGROUP_STATS_##group, \
+             offsetof(struct lxc_cgroup_stats, member)}
+        STAT(MEMORY, mem_used),
+        STAT(MEMORY, mem_limit),
+        STAT(MEMORY, mem_cache),
+        STAT(MEMORY, mem_rss),
+        STAT(KMEM, kmem_used),
+        STAT(KMEM, kmem_limit),
+        STAT(MEMSW, memsw_used),
+        STAT(MEMSW, memsw_limit),
+        STAT(CPUACCT, cpu_use_nanos),
+        STAT(CPUACCT, cpu_use_user),
+        STAT(CPUACCT, cpu_use_sys),
+        STAT(BLKIO, blkio_read),
+        STAT(BLKIO, blkio_write),
+        STAT(BLKIO, blkio),
+        STAT(BLKIO, blkio_ios),
+        STAT(PIDS, pids_current),
+        STAT(PIDS, pids_max),
+        #undef STAT
+    };
+    struct lxc_cgroup_stats stats;
+    PyObject *ret, *value;
+    size_t i;
+
+    if (self->container->get_cgroup_stats(self->container, &stats,
+                                          sizeof(stats)) < 0)
+        Py_RETURN_FALSE;
+
+    ret = PyDict_New();
+    if (ret == NULL)
+        return NULL;
+
+    /* only the counters which could be read */
+    for (i = 0; i < sizeof(counters) / sizeof(counters[0]); i++) {
+        if (!(stats.valid & counters[i].valid))
+            continue;
+
+        value = PyLong_FromUnsignedLongLong(
+            *(uint64_t *)((char *)&stats + counters[i].offset));
+        if (value == NULL || PyDict_SetItemString(ret, counters[i].name,
+                                                  value) < 0) {
+            Py_XDECREF(value);
+            Py_DECREF(ret);
+            return NULL;
+        }
+        Py_DECREF(value);
+    }
+
+    return ret;
+}
+
 static PyObject *
 Container_get_config_item(Container *self, PyObject *args, PyObject *kwds)
 {
@@ -1701,6 +1762,13 @@ static PyMethodDef Container_methods[] = {
      "\n"
      "Get the current value of a cgroup entry."
     },
+    {"get_cgroup_stats", (PyCFunction)Container_get_cgroup_stats,
+     METH_NOARGS,
+     "get_cgroup_stats() -> dict\n"
+     "\n"
+     "Get the memory, cpuacct, blkio and pids counters of a running "
+     "container in one call, False if it isn't running."
+    },
     {"get_config_item", (PyCFunction)Container_get_config_item,
      METH_VARARGS|METH_KEYWORDS,
      "get_config_item(key) -> string\n"
@@ -1970,10 +2038,12 @@ PyInit__lxc(void)
     PYLXC_EXPORT_CONST(LXC_CLONE_KEEPMACADDR);
     PYLXC_EXPORT_CONST(LXC_CLONE_KEEPNAME);
     PYLXC_EXPORT_CONST(LXC_CLONE_MAYBE_SNAPSHOT);
+    PYLXC_EXPORT_CONST(LXC_CLONE_REFLINK);
     PYLXC_EXPORT_CONST(LXC_CLONE_SNAPSHOT);
 
     /* create: create flags */
     PYLXC_EXPORT_CONST(LXC_CREATE_QUIET);
+    PYLXC_EXPORT_CONST(LXC_CREATE_PREALLOC);
 
     #undef PYLXC_EXPORT_CONST
 
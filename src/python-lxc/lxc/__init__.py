@@ -504,7 +504,9 @@ LXC_CLONE_KEEPBDEVTYPE = _lxc.LXC_CLONE_KEEPBDEVTYPE
 LXC_CLONE_KEEPMACADDR = _lxc.LXC_CLONE_KEEPMACADDR
 LXC_CLONE_KEEPNAME = _lxc.LXC_CLONE_KEEPNAME
 LXC_CLONE_MAYBE_SNAPSHOT = _lxc.LXC_CLONE_MAYBE_SNAPSHOT
+LXC_CLONE_REFLINK = _lxc.LXC_CLONE_REFLINK
 LXC_CLONE_SNAPSHOT = _lxc.LXC_CLONE_SNAPSHOT
 
 # create: create flags
 LXC_CREATE_QUIET = _lxc.LXC_CREATE_QUIET
+LXC_CREATE_PREALLOC = _lxc.LXC_CREATE_PREALLOC
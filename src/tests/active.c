@@ -0,0 +1,163 @@
+/*
+ * lxc: linux Container library
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#define _GNU_SOURCE
+#include <fcntl.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/param.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+
+#include <lxc/lxccontainer.h>
+
+#include "lxctest.h"
+#include "state.h"
+#include "utils.h"
+
+static char lxcpath[] = "/tmp/lxc-test-active-XXXXXX";
+
+static int list_count(void)
+{
+	char **names = NULL;
+	int i, nr;
+
+	nr = lxc_active_list(lxcpath, &names);
+	for (i = 0; i < nr; i++)
+		free(names[i]);
+	free(names);
+	return nr;
+}
+
+static void record_path(char *path, const char *name)
+{
+	char *rundir;
+	int ret;
+
+	rundir = get_rundir();
+	lxc_test_assert_abort(rundir);
+	ret = snprintf(path, MAXPATHLEN, "%s/lxc/active/%s%s%s", rundir,
+		       lxcpath, name ? "/." : "", name ? name : "");
+	free(rundir);
+	lxc_test_assert_abort(ret > 0 && ret < MAXPATHLEN);
+}
+
+/* a record whose monitor exited without lxc_active_del() is pruned */
+static void test_exited(void)
+{
+	char path[MAXPATHLEN];
+	pid_t pid;
+
+	pid = fork();
+	lxc_test_assert_abort(pid >= 0);
+	if (pid == 0)
+		_exit(lxc_active_add("exited", lxcpath) == 0 ? 0 : 1);
+	lxc_test_assert_abort(wait_for_pid(pid) == 0);
+
+	record_path(path, "exited");
+	lxc_test_assert_abort(file_exists(path));
+	lxc_test_assert_abort(list_count() == 1);
+	lxc_test_assert_abort(!file_exists(path));
+}
+
+/* a live pid with the wrong start time is a reused pid, not the monitor */
+static void test_reused(void)
+{
+	char path[MAXPATHLEN], buf[64];
+	int fd, len;
+
+	record_path(path, "reused");
+	fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	lxc_test_assert_abort(fd >= 0);
+	len = snprintf(buf, sizeof(buf), "%d 1\n", getpid());
+	lxc_test_assert_abort(write(fd, buf, len) == len);
+	close(fd);
+
+	lxc_test_assert_abort(list_count() == 1);
+	lxc_test_assert_abort(!file_exists(path));
+}
+
+/* a monitor of an older liblxc keeps no record but is still listed */
+static void test_unrecorded(void)
+{
+	struct sockaddr_un addr;
+	char **names = NULL;
+	int fd, i, len, nr;
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	len = snprintf(addr.sun_path + 1, sizeof(addr.sun_path) - 1,
+		       "%s/unrecorded/command", lxcpath);
+	lxc_test_assert_abort(len > 0 && len < sizeof(addr.sun_path) - 1);
+
+	fd = socket(PF_UNIX, SOCK_STREAM, 0);
+	lxc_test_assert_abort(fd >= 0);
+	lxc_test_assert_abort(bind(fd, (struct sockaddr *)&addr,
+				   offsetof(struct sockaddr_un, sun_path) + len + 1) == 0);
+	lxc_test_assert_abort(listen(fd, 1) == 0);
+
+	nr = list_active_containers(lxcpath, &names, NULL);
+	lxc_test_assert_abort(nr == 2);
+	lxc_test_assert_abort(strcmp(names[0], "live") == 0);
+	lxc_test_assert_abort(strcmp(names[1], "unrecorded") == 0);
+	for (i = 0; i < nr; i++)
+		free(names[i]);
+	free(names);
+	close(fd);
+}
+
+int main(int argc, char *argv[])
+{
+	char path[MAXPATHLEN], **names = NULL;
+
+	lxc_test_assert_abort(mkdtemp(lxcpath));
+
+	/* no monitor has used this lxcpath yet */
+	lxc_test_assert_abort(lxc_active_list(lxcpath, &names) < 0);
+
+	lxc_test_assert_abort(lxc_active_add("live", lxcpath) == 0);
+	lxc_test_assert_abort(lxc_active_list(lxcpath, &names) == 1);
+	lxc_test_assert_abort(strcmp(names[0], "live") == 0);
+	free(names[0]);
+	free(names);
+
+	test_exited();
+	test_reused();
+	test_unrecorded();
+
+	/* the last record takes the directory of the lxcpath with it */
+	lxc_active_del("live", lxcpath);
+	record_path(path, NULL);
+	lxc_test_assert_abort(!file_exists(path));
+	lxc_test_assert_abort(list_count() < 0);
+
+	/* lxc_active_add() created <rundir>/lxc/active/tmp as well, keep
+	 * whatever other lxcpaths still use
+	 */
+	*strrchr(path, '/') = '\0';
+	rmdir(path);
+	*strrchr(path, '/') = '\0';
+	rmdir(path);
+	rmdir(lxcpath);
+	exit(EXIT_SUCCESS);
+}
@@ -0,0 +1,147 @@
+/*
+ * lxc: linux Container library
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#define _GNU_SOURCE
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/param.h>
+#include <sys/stat.h>
+
+#include <lxc/lxccontainer.h>
+
+#include "lxctest.h"
+#include "utils.h"
+
+#define MYNAME "lxctest-cgroup-handle"
+#define NR_THREADS 4
+#define NR_LOOPS 500
+
+static char lxcpath[] = "/tmp/lxc-test-cgroup-handle-XXXXXX";
+static volatile int stop;
+
+static struct lxc_container *create_container(void)
+{
+	struct lxc_container *c;
+	char path[MAXPATHLEN];
+	FILE *f;
+
+	snprintf(path, sizeof(path), "%s/%s", lxcpath, MYNAME);
+	lxc_test_assert_abort(mkdir(path, 0755) == 0);
+
+	/* the host's root is enough to run sleep in fresh cgroups */
+	snprintf(path, sizeof(path), "%s/%s/config", lxcpath, MYNAME);
+	f = fopen(path, "w");
+	lxc_test_assert_abort(f);
+	fprintf(f, "lxc.utsname = %s\n", MYNAME);
+	fprintf(f, "lxc.rootfs = /\n");
+	fprintf(f, "lxc.rootfs.backend = dir\n");
+	fprintf(f, "lxc.network.type = empty\n");
+	fclose(f);
+
+	c = lxc_container_new(MYNAME, lxcpath);
+	lxc_test_assert_abort(c);
+	return c;
+}
+
+/* subsystems nobody mounts take up a cache slot each, real ones must still resolve */
+static void test_many_subsystems(struct lxc_container *c)
+{
+	char key[64], value[64];
+	int i;
+
+	lxc_test_assert_abort(c->want_cgroup_cache(c, true));
+	for (i = 0; i < 40; i++) {
+		snprintf(key, sizeof(key), "nosuch%d.value", i);
+		lxc_test_assert_abort(c->get_cgroup_item(c, key, value, sizeof(value)) < 0);
+	}
+	lxc_test_assert_abort(c->get_cgroup_item(c, "pids.current", value, sizeof(value)) > 0);
+	lxc_test_assert_abort(c->set_cgroup_item(c, "pids.max", "100"));
+	lxc_test_assert_abort(c->get_cgroup_item(c, "pids.max", value, sizeof(value)) > 0);
+	lxc_test_assert_abort(strncmp(value, "100", 3) == 0);
+	lxc_test_assert_abort(c->want_cgroup_cache(c, false));
+}
+
+static void *reader(void *arg)
+{
+	struct lxc_container *c = arg;
+	struct lxc_cgroup_stats stats;
+	char value[64];
+
+	while (!stop) {
+		if (c->get_cgroup_stats(c, &stats, sizeof(stats)) < 0 ||
+		    !(stats.valid & LXC_CGROUP_STATS_PIDS))
+			return (void *)1;
+		if (c->get_cgroup_item(c, "pids.current", value, sizeof(value)) <= 0)
+			return (void *)1;
+		if (!c->set_cgroup_item(c, "pids.max", "100"))
+			return (void *)1;
+	}
+
+	return NULL;
+}
+
+/* the handle is freed and recreated under the feet of the readers */
+static void test_toggle(struct lxc_container *c)
+{
+	pthread_t tids[NR_THREADS];
+	void *ret;
+	int i, failed = 0;
+
+	for (i = 0; i < NR_THREADS; i++)
+		lxc_test_assert_abort(pthread_create(&tids[i], NULL, reader, c) == 0);
+
+	for (i = 0; i < NR_LOOPS; i++)
+		lxc_test_assert_abort(c->want_cgroup_cache(c, i % 2 == 0));
+
+	stop = 1;
+	for (i = 0; i < NR_THREADS; i++) {
+		lxc_test_assert_abort(pthread_join(tids[i], &ret) == 0);
+		if (ret)
+			failed++;
+	}
+	lxc_test_assert_abort(failed == 0);
+}
+
+int main(int argc, char *argv[])
+{
+	struct lxc_container *c;
+	char *const args[] = { "/bin/sleep", "600", NULL };
+
+	if (geteuid() != 0) {
+		fprintf(stderr, "%s: needs root to create cgroups, skipped\n", argv[0]);
+		exit(EXIT_SUCCESS);
+	}
+
+	lxc_test_assert_abort(mkdtemp(lxcpath));
+	c = create_container();
+
+	c->want_daemonize(c, true);
+	lxc_test_assert_abort(c->start(c, 0, args));
+	lxc_test_assert_abort(c->wait(c, "RUNNING", 30));
+
+	test_many_subsystems(c);
+	test_toggle(c);
+
+	lxc_test_assert_abort(c->stop(c));
+	lxc_container_put(c);
+	lxc_rmdir_onedev(lxcpath, NULL);
+	exit(EXIT_SUCCESS);
+}
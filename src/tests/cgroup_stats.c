@@ -0,0 +1,115 @@
+/*
+ * lxc: linux Container library
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#define _GNU_SOURCE
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/param.h>
+
+#include <lxc/lxccontainer.h>
+
+#include "cgroup.h"
+#include "lxctest.h"
+#include "utils.h"
+
+/* more than the 4096 bytes the parser reads at once */
+#define NR_DEVICES 300
+
+static char dir[] = "/tmp/lxc-test-cgroup-stats-XXXXXX";
+static int dirfd;
+
+static FILE *stat_file(const char *filename)
+{
+	char path[MAXPATHLEN];
+	FILE *f;
+
+	snprintf(path, sizeof(path), "%s/%s", dir, filename);
+	f = fopen(path, "w");
+	lxc_test_assert_abort(f);
+	return f;
+}
+
+/* per device lines are summed, the per device totals are not the total */
+static void test_blkio_devices(void)
+{
+	struct lxc_cgroup_stats stats;
+	FILE *f;
+	int i;
+
+	f = stat_file("blkio.throttle.io_service_bytes");
+	for (i = 0; i < NR_DEVICES; i++) {
+		fprintf(f, "8:%d Read %d\n", i, i);
+		fprintf(f, "8:%d Write %d\n", i, 2 * i);
+		fprintf(f, "8:%d Sync 7\n", i);
+		fprintf(f, "8:%d Total %d\n", i, 3 * i);
+	}
+	fprintf(f, "Total 12345\n");
+	fclose(f);
+
+	memset(&stats, 0, sizeof(stats));
+	lxc_test_assert_abort(cgroup_read_stat_file(dirfd,
+			"blkio.throttle.io_service_bytes", &stats) == 0);
+	lxc_test_assert_abort(stats.blkio_read == NR_DEVICES * (NR_DEVICES - 1) / 2);
+	lxc_test_assert_abort(stats.blkio_write == NR_DEVICES * (NR_DEVICES - 1));
+	lxc_test_assert_abort(stats.blkio == 12345);
+}
+
+/* a line which does not fit the buffer is dropped as a whole */
+static void test_long_line(void)
+{
+	struct lxc_cgroup_stats stats;
+	FILE *f;
+	int i;
+
+	f = stat_file("memory.stat");
+	fprintf(f, "total_rss 42\n");
+	/* the tail after the first 4095 bytes looks like a line of its own */
+	for (i = 0; i < 4095; i++)
+		fputc('x', f);
+	fprintf(f, "total_rss 999\n");
+	fprintf(f, "total_cache 7");
+	fclose(f);
+
+	memset(&stats, 0, sizeof(stats));
+	lxc_test_assert_abort(cgroup_read_stat_file(dirfd, "memory.stat",
+						    &stats) == 0);
+	lxc_test_assert_abort(stats.mem_rss == 42);
+	lxc_test_assert_abort(stats.mem_cache == 7);
+}
+
+int main(int argc, char *argv[])
+{
+	struct lxc_cgroup_stats stats;
+
+	lxc_test_assert_abort(mkdtemp(dir));
+	dirfd = open(dir, O_RDONLY | O_DIRECTORY);
+	lxc_test_assert_abort(dirfd >= 0);
+
+	test_blkio_devices();
+	test_long_line();
+
+	/* only the files lxc_cgroup_get_stats() reads */
+	lxc_test_assert_abort(cgroup_read_stat_file(dirfd, "tasks", &stats) < 0);
+
+	close(dirfd);
+	lxc_rmdir_onedev(dir, NULL);
+	exit(EXIT_SUCCESS);
+}
@@ -0,0 +1,189 @@
+/*
+ * lxc: linux Container library
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/param.h>
+#include <sys/stat.h>
+
+#include <lxc/lxccontainer.h>
+
+#include "commands.h"
+#include "lxctest.h"
+#include "utils.h"
+
+#define MYNAME "lxctest-cmd-session"
+#define NR_ITEMS (3 * LXC_CMD_SESSION_MAX_INFLIGHT)
+
+static char lxcpath[] = "/tmp/lxc-test-cmd-session-XXXXXX";
+
+static struct lxc_container *create_container(void)
+{
+	struct lxc_container *c;
+	char path[MAXPATHLEN];
+	FILE *f;
+
+	snprintf(path, sizeof(path), "%s/%s", lxcpath, MYNAME);
+	lxc_test_assert_abort(mkdir(path, 0755) == 0);
+
+	snprintf(path, sizeof(path), "%s/%s/config", lxcpath, MYNAME);
+	f = fopen(path, "w");
+	lxc_test_assert_abort(f);
+	fprintf(f, "lxc.utsname = %s\n", MYNAME);
+	fprintf(f, "lxc.rootfs = /\n");
+	fprintf(f, "lxc.rootfs.backend = dir\n");
+	fprintf(f, "lxc.network.type = empty\n");
+	fprintf(f, "lxc.network.type = empty\n");
+	fclose(f);
+
+	c = lxc_container_new(MYNAME, lxcpath);
+	lxc_test_assert_abort(c);
+	return c;
+}
+
+/* several requests in flight, answered in order on the same connection */
+static void test_pipeline(struct lxc_container *c, struct lxc_cmd_session *s)
+{
+	struct lxc_cmd_rr cmds[5];
+	int i;
+
+	memset(cmds, 0, sizeof(cmds));
+	cmds[0].req.cmd = LXC_CMD_GET_STATE;
+	cmds[1].req.cmd = LXC_CMD_GET_INIT_PID;
+	cmds[2].req.cmd = LXC_CMD_GET_CONFIG_ITEM;
+	cmds[2].req.data = "lxc.utsname";
+	cmds[2].req.datalen = strlen("lxc.utsname") + 1;
+	cmds[3].req.cmd = LXC_CMD_STOP;
+	cmds[4].req.cmd = LXC_CMD_GET_CONFIG_ITEM;
+	cmds[4].req.data = "lxc.nosuchkey";
+	cmds[4].req.datalen = strlen("lxc.nosuchkey") + 1;
+
+	for (i = 0; i < 5; i++)
+		lxc_test_assert_abort(lxc_cmd_session_send(s, &cmds[i]) == 0);
+	lxc_test_assert_abort(s->inflight == 5);
+	for (i = 0; i < 5; i++)
+		lxc_test_assert_abort(lxc_cmd_session_recv(s, &cmds[i]) > 0);
+	lxc_test_assert_abort(s->inflight == 0);
+
+	lxc_test_assert_abort(PTR_TO_INT(cmds[0].rsp.data) == RUNNING);
+	lxc_test_assert_abort(PTR_TO_INT(cmds[1].rsp.data) == c->init_pid(c));
+	lxc_test_assert_abort(cmds[2].rsp.ret == 0);
+	lxc_test_assert_abort(strcmp(cmds[2].rsp.data, MYNAME) == 0);
+	free(cmds[2].rsp.data);
+	/* stop needs a connection of its own and leaves the session alone */
+	lxc_test_assert_abort(cmds[3].rsp.ret == -EINVAL);
+	lxc_test_assert_abort(c->is_running(c));
+	lxc_test_assert_abort(cmds[4].rsp.ret < 0);
+}
+
+/* the window is bounded, the oldest response has to be collected first */
+static void test_window(struct lxc_cmd_session *s)
+{
+	struct lxc_cmd_rr cmds[LXC_CMD_SESSION_MAX_INFLIGHT + 1];
+	int i;
+
+	memset(cmds, 0, sizeof(cmds));
+	for (i = 0; i <= LXC_CMD_SESSION_MAX_INFLIGHT; i++)
+		cmds[i].req.cmd = LXC_CMD_GET_STATE;
+
+	for (i = 0; i < LXC_CMD_SESSION_MAX_INFLIGHT; i++)
+		lxc_test_assert_abort(lxc_cmd_session_send(s, &cmds[i]) == 0);
+	errno = 0;
+	lxc_test_assert_abort(lxc_cmd_session_send(s, &cmds[i]) < 0);
+	lxc_test_assert_abort(errno == EAGAIN);
+
+	lxc_test_assert_abort(lxc_cmd_session_recv(s, &cmds[0]) > 0);
+	lxc_test_assert_abort(lxc_cmd_session_send(s, &cmds[i]) == 0);
+	for (i = 1; i <= LXC_CMD_SESSION_MAX_INFLIGHT; i++) {
+		lxc_test_assert_abort(lxc_cmd_session_recv(s, &cmds[i]) > 0);
+		lxc_test_assert_abort(PTR_TO_INT(cmds[i].rsp.data) == RUNNING);
+	}
+}
+
+/* more items than fit in the window give what one shot commands give */
+static void test_config_items(struct lxc_cmd_session *s)
+{
+	const char *keys[] = { "lxc.utsname", "lxc.network", "lxc.rootfs",
+			       "lxc.network.1.type", "lxc.nosuchkey" };
+	const char *items[NR_ITEMS + 1];
+	char *values[NR_ITEMS], *oneshot[NR_ITEMS];
+	int i;
+
+	for (i = 0; i < NR_ITEMS; i++)
+		items[i] = keys[i % 5];
+	items[NR_ITEMS] = NULL;
+
+	lxc_test_assert_abort(lxc_cmd_get_config_items(MYNAME, lxcpath, s, items, values) == 0);
+	lxc_test_assert_abort(s->inflight == 0);
+	lxc_test_assert_abort(lxc_cmd_get_config_items(MYNAME, lxcpath, NULL, items, oneshot) == 0);
+	lxc_test_assert_abort(values[0] && strcmp(values[0], MYNAME) == 0);
+	lxc_test_assert_abort(values[1] && strcmp(values[1], "empty\nempty\n") == 0);
+
+	for (i = 0; i < NR_ITEMS; i++) {
+		if (i % 5 == 4) {
+			lxc_test_assert_abort(!values[i] && !oneshot[i]);
+			continue;
+		}
+		lxc_test_assert_abort(values[i] && oneshot[i]);
+		lxc_test_assert_abort(strcmp(values[i], oneshot[i]) == 0);
+		free(values[i]);
+		free(oneshot[i]);
+	}
+}
+
+int main(int argc, char *argv[])
+{
+	struct lxc_container *c;
+	struct lxc_cmd_session *s;
+	char *const args[] = { "/bin/sleep", "600", NULL };
+
+	if (geteuid() != 0) {
+		fprintf(stderr, "%s: needs root to start a container, skipped\n", argv[0]);
+		exit(EXIT_SUCCESS);
+	}
+
+	lxc_test_assert_abort(mkdtemp(lxcpath));
+	c = create_container();
+
+	/* nothing to connect to yet */
+	errno = 0;
+	lxc_test_assert_abort(!lxc_cmd_session_open(MYNAME, lxcpath));
+	lxc_test_assert_abort(errno == ECONNREFUSED);
+
+	c->want_daemonize(c, true);
+	lxc_test_assert_abort(c->start(c, 0, args));
+	lxc_test_assert_abort(c->wait(c, "RUNNING", 30));
+
+	s = lxc_cmd_session_open(MYNAME, lxcpath);
+	lxc_test_assert_abort(s);
+	lxc_test_assert_abort(s->version == LXC_CMD_SESSION_VERSION);
+
+	test_pipeline(c, s);
+	test_window(s);
+	test_config_items(s);
+	lxc_cmd_session_close(s);
+
+	lxc_test_assert_abort(c->stop(c));
+	lxc_container_put(c);
+	lxc_rmdir_onedev(lxcpath, NULL);
+	exit(EXIT_SUCCESS);
+}
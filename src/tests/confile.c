@@ -0,0 +1,382 @@
+/*
+ * lxc: linux Container library
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#define _GNU_SOURCE
+#include <fcntl.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mount.h>
+#include <sys/param.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+#include "conf.h"
+#include "confile.h"
+#include "lxctest.h"
+#include "utils.h"
+
+#define NR_LINES 10000
+#define NR_ROUNDS 5
+
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void check_key(const char *key, const char *expected)
+{
+	struct lxc_config_t *config;
+
+	config = lxc_getconfig(key);
+	if (!expected) {
+		lxc_test_assert_abort(!config);
+		return;
+	}
+	lxc_test_assert_abort(config);
+	lxc_test_assert_abort(strcmp(config->name, expected) == 0);
+}
+
+static void test_lookup(void)
+{
+	char *keys, *key, *saveptr = NULL;
+	int len;
+
+	/* every listed key finds its own entry */
+	len = lxc_listconfigs(NULL, 0);
+	keys = malloc(len + 1);
+	lxc_test_assert_abort(keys);
+	lxc_test_assert_abort(lxc_listconfigs(keys, len + 1) == len);
+	for (key = strtok_r(keys, "\n", &saveptr); key;
+	     key = strtok_r(NULL, "\n", &saveptr))
+		check_key(key, key);
+	free(keys);
+
+	/* prefixes resolve to the longest entry */
+	check_key("lxc.cgroup.memory.limit_in_bytes", "lxc.cgroup");
+	check_key("lxc.network.0.type", "lxc.network.");
+	check_key("lxc.network.ipv4.gateway", "lxc.network.ipv4.gateway");
+	check_key("lxc.network.ipv4.foo", "lxc.network.ipv4");
+	check_key("lxc.hook.pre-start", "lxc.hook.pre-start");
+	check_key("lxc.rootfs.backend", "lxc.rootfs.backend");
+	check_key("lxc.console.logfile.old", "lxc.console.logfile");
+	check_key("lxc.ttyfoo", "lxc.tty");
+	check_key("lxc.mount.entryxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxx", "lxc.mount.entry");
+	check_key("lxc.foo", NULL);
+	check_key("lxc", NULL);
+	check_key("", NULL);
+}
+
+static char *write_bench_config(void)
+{
+	static char path[] = "/tmp/lxc-test-confile-XXXXXX";
+	FILE *f;
+	int fd, i;
+
+	fd = mkstemp(path);
+	lxc_test_assert_abort(fd >= 0);
+	f = fdopen(fd, "w");
+	lxc_test_assert_abort(f);
+
+	/* roughly what generated configs of big containers look like */
+	fprintf(f, "lxc.utsname = bench\nlxc.rootfs = /var/lib/lxc/bench/rootfs\n");
+	for (i = 2; i < NR_LINES; i++) {
+		switch (i % 4) {
+		case 0:
+			fprintf(f, "lxc.mount.entry = /srv/%d srv/%d none bind,create=dir 0 0\n", i, i);
+			break;
+		case 1:
+			fprintf(f, "lxc.cgroup.devices.allow = c %d:%d rwm\n", i / 256, i % 256);
+			break;
+		case 2:
+			fprintf(f, "# comment %d\n", i);
+			break;
+		case 3:
+			fprintf(f, "lxc.environment = VAR%d=%d\n", i, i);
+			break;
+		}
+	}
+	fclose(f);
+
+	return path;
+}
+
+static void test_parse(const char *path)
+{
+	struct lxc_conf *conf;
+	double start, elapsed = 0;
+	char buf[256];
+	int i;
+
+	for (i = 0; i < NR_ROUNDS; i++) {
+		conf = lxc_conf_init();
+		lxc_test_assert_abort(conf);
+
+		start = now();
+		lxc_test_assert_abort(lxc_config_read(path, conf, false) == 0);
+		elapsed += now() - start;
+
+		lxc_test_assert_abort(lxc_get_config_item(conf, "lxc.utsname", buf, sizeof(buf)) == 5);
+		lxc_test_assert_abort(strcmp(buf, "bench") == 0);
+		lxc_test_assert_abort(lxc_get_config_item(conf, "lxc.mount.entry", NULL, 0) > 0);
+		lxc_test_assert_abort(lxc_get_config_item(conf, "lxc.cgroup.devices.allow", NULL, 0) > 0);
+		lxc_test_assert_abort(lxc_get_config_item(conf, "lxc.utsnamex", NULL, 0) < 0);
+		lxc_test_assert_abort(lxc_clear_config_item(conf, "lxc.mount.entry") == 0);
+		lxc_test_assert_abort(lxc_get_config_item(conf, "lxc.mount.entry", NULL, 0) == 0);
+		lxc_test_assert_abort(lxc_clear_config_item(conf, "lxc.utsname") < 0);
+
+		lxc_conf_free(conf);
+	}
+
+	printf("parsed %d lines in %.3f ms (%.0f lines/s)\n", NR_LINES,
+	       elapsed / NR_ROUNDS * 1e3, NR_LINES * NR_ROUNDS / elapsed);
+}
+
+/* bulk edits of the unexpanded config, as done through set_config_item */
+static void test_unexp(void)
+{
+	struct lxc_conf *conf;
+	double start, elapsed;
+	char value[64], *buf;
+	size_t size;
+	FILE *f;
+	int i;
+
+	conf = lxc_conf_init();
+	lxc_test_assert_abort(conf);
+
+	start = now();
+	for (i = 0; i < NR_LINES; i++) {
+		snprintf(value, sizeof(value), "/srv/%d srv/%d none bind 0 0", i, i);
+		lxc_test_assert_abort(do_append_unexp_config_line(conf,
+					i % 2 ? "lxc.mount.entry" : "lxc.mount", value));
+	}
+	clear_unexp_config_line(conf, "lxc.mount.entry", false);
+	elapsed = now() - start;
+	printf("appended %d lines and cleared half in %.3f ms\n", NR_LINES,
+	       elapsed * 1e3);
+
+	f = open_memstream(&buf, &size);
+	lxc_test_assert_abort(f);
+	write_config(f, conf);
+	fclose(f);
+
+	/* only the lxc.mount lines are left, in order */
+	lxc_test_assert_abort(size == conf->unexpanded_len);
+	lxc_test_assert_abort(strlen(conf->unexpanded_config) == size);
+	lxc_test_assert_abort(strncmp(buf, "lxc.mount = /srv/0 ", 19) == 0);
+	lxc_test_assert_abort(!strstr(buf, "lxc.mount.entry"));
+	lxc_test_assert_abort(strstr(buf, "lxc.mount = /srv/9998 "));
+
+	clear_unexp_config_line(conf, "lxc.mount", true);
+	lxc_test_assert_abort(conf->unexpanded_len == 0);
+
+	free(buf);
+	lxc_conf_free(conf);
+}
+
+static char cachedir[] = "/tmp/lxc-test-confile-cache-XXXXXX";
+
+static void write_file(const char *name, const char *mode, const char *content)
+{
+	char path[MAXPATHLEN];
+	FILE *f;
+
+	snprintf(path, sizeof(path), "%s/%s", cachedir, name);
+	f = fopen(path, mode);
+	lxc_test_assert_abort(f);
+	fprintf(f, "%s", content);
+	fclose(f);
+}
+
+/* inode of the cache, a new one each time the cache is written */
+static ino_t cache_ino(const char *config)
+{
+	char path[MAXPATHLEN];
+	struct stat st;
+
+	snprintf(path, sizeof(path), "%s.cache", config);
+	if (stat(path, &st) < 0)
+		return 0;
+	return st.st_ino;
+}
+
+/* load @config, keep what it expands to and its unexpanded form */
+static void load(const char *config, char *env, size_t len, char **unexp)
+{
+	struct lxc_conf *conf;
+
+	conf = lxc_conf_init();
+	lxc_test_assert_abort(conf);
+	lxc_test_assert_abort(lxc_config_read(config, conf, false) == 0);
+	lxc_test_assert_abort(lxc_get_config_item(conf, "lxc.environment", env, len) > 0);
+	if (unexp) {
+		*unexp = strdup(conf->unexpanded_config);
+		lxc_test_assert_abort(*unexp);
+	}
+	lxc_conf_free(conf);
+}
+
+static void test_cache(void)
+{
+	char config[MAXPATHLEN], cache[MAXPATHLEN], content[MAXPATHLEN * 3];
+	char env[256], env2[256], *unexp, *unexp2;
+	struct timespec times[2];
+	struct stat st;
+	ino_t ino;
+
+	lxc_test_assert_abort(mkdtemp(cachedir));
+	snprintf(config, sizeof(config), "%s/config", cachedir);
+	snprintf(cache, sizeof(cache), "%s/config.cache", cachedir);
+	snprintf(content, sizeof(content),
+		 "lxc.utsname = cached\n"
+		 "lxc.include = %s/inc.conf\n"
+		 "lxc.include = %s/inc.d\n"
+		 "lxc.environment = TOP=1\n", cachedir, cachedir);
+	write_file("config", "w", content);
+	write_file("inc.conf", "w", "lxc.environment = INC=1\n");
+	snprintf(content, sizeof(content), "%s/inc.d", cachedir);
+	lxc_test_assert_abort(mkdir(content, 0755) == 0);
+	write_file("inc.d/a.conf", "w", "lxc.environment = DIRA=1\n");
+
+	/* the first load parses and writes the cache */
+	lxc_test_assert_abort(cache_ino(config) == 0);
+	load(config, env, sizeof(env), &unexp);
+	ino = cache_ino(config);
+	lxc_test_assert_abort(ino != 0);
+	lxc_test_assert_abort(strcmp(env, "INC=1\nDIRA=1\nTOP=1\n") == 0);
+
+	/* replaying it gives the same config and leaves the cache alone */
+	load(config, env2, sizeof(env2), &unexp2);
+	lxc_test_assert_abort(cache_ino(config) == ino);
+	lxc_test_assert_abort(strcmp(env, env2) == 0);
+	lxc_test_assert_abort(strcmp(unexp, unexp2) == 0);
+	free(unexp);
+	free(unexp2);
+
+	/* editing an include or adding to an include dir invalidates it */
+	write_file("inc.conf", "a", "lxc.environment = INC=2\n");
+	load(config, env, sizeof(env), NULL);
+	lxc_test_assert_abort(strcmp(env, "INC=1\nINC=2\nDIRA=1\nTOP=1\n") == 0);
+	lxc_test_assert_abort(cache_ino(config) != ino);
+	ino = cache_ino(config);
+
+	write_file("inc.d/b.conf", "w", "lxc.environment = DIRB=1\n");
+	load(config, env, sizeof(env), NULL);
+	lxc_test_assert_abort(strstr(env, "DIRB=1\n"));
+	lxc_test_assert_abort(cache_ino(config) != ino);
+	ino = cache_ino(config);
+
+	/* same size and mtime, only the ctime tells the cache is stale */
+	lxc_test_assert_abort(stat(config, &st) == 0);
+	snprintf(content, sizeof(content),
+		 "lxc.utsname = cached\n"
+		 "lxc.include = %s/inc.conf\n"
+		 "lxc.include = %s/inc.d\n"
+		 "lxc.environment = TOP=2\n", cachedir, cachedir);
+	write_file("config", "w", content);
+	times[0] = st.st_atim;
+	times[1] = st.st_mtim;
+	lxc_test_assert_abort(utimensat(AT_FDCWD, config, times, 0) == 0);
+	load(config, env, sizeof(env), NULL);
+	lxc_test_assert_abort(strstr(env, "TOP=2\n"));
+	lxc_test_assert_abort(cache_ino(config) != ino);
+	ino = cache_ino(config);
+
+	/* a valid cache owned by someone else than the config's owner or us */
+	lxc_test_assert_abort(chown(cache, 12345, 12345) == 0);
+	load(config, env, sizeof(env), NULL);
+	lxc_test_assert_abort(cache_ino(config) != ino);
+	lxc_test_assert_abort(stat(cache, &st) == 0 && st.st_uid == geteuid());
+	ino = cache_ino(config);
+
+	/* a cut off cache */
+	lxc_test_assert_abort(stat(cache, &st) == 0);
+	lxc_test_assert_abort(truncate(cache, st.st_size / 2) == 0);
+	load(config, env, sizeof(env), NULL);
+	lxc_test_assert_abort(strstr(env, "TOP=2\n"));
+	lxc_test_assert_abort(cache_ino(config) != ino);
+	lxc_test_assert_abort(stat(cache, &st) == 0 && st.st_size > 0);
+
+	lxc_rmdir_onedev(cachedir, NULL);
+}
+
+/*
+ * lxc.config.cache is only read from the global lxc.conf, so the cache
+ * tests get one of their own in a private mount namespace.
+ */
+static void run_cache_tests(void)
+{
+	char dir[MAXPATHLEN], *p;
+	int status;
+	pid_t pid;
+	FILE *f;
+
+	if (geteuid() != 0) {
+		fprintf(stderr, "needs root to enable lxc.config.cache, skipped cache tests\n");
+		return;
+	}
+
+	snprintf(dir, sizeof(dir), "%s", LXC_GLOBAL_CONF);
+	p = strrchr(dir, '/');
+	lxc_test_assert_abort(p);
+	*p = '\0';
+	if (!dir_exists(dir)) {
+		fprintf(stderr, "%s does not exist, skipped cache tests\n", dir);
+		return;
+	}
+
+	pid = fork();
+	lxc_test_assert_abort(pid >= 0);
+	if (pid == 0) {
+		lxc_test_assert_abort(unshare(CLONE_NEWNS) == 0);
+		lxc_test_assert_abort(mount(NULL, "/", NULL, MS_REC | MS_PRIVATE, NULL) == 0);
+		lxc_test_assert_abort(mount("tmpfs", dir, "tmpfs", 0, NULL) == 0);
+		f = fopen(LXC_GLOBAL_CONF, "w");
+		lxc_test_assert_abort(f);
+		fprintf(f, "lxc.config.cache = 1\n");
+		fclose(f);
+
+		test_cache();
+		exit(EXIT_SUCCESS);
+	}
+
+	lxc_test_assert_abort(waitpid(pid, &status, 0) == pid);
+	lxc_test_assert_abort(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+}
+
+int main(int argc, char *argv[])
+{
+	char *path;
+
+	run_cache_tests();
+	test_lookup();
+	test_unexp();
+
+	path = write_bench_config();
+	test_parse(path);
+	unlink(path);
+
+	exit(EXIT_SUCCESS);
+}
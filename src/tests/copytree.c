@@ -0,0 +1,343 @@
+/*
+ * lxc: linux Container library
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/sysmacros.h>
+#include <sys/xattr.h>
+
+#include <lxc/lxccontainer.h>
+
+#include "lxccopy.h"
+#include "lxctest.h"
+#include "utils.h"
+
+#define NR_DIRS 50
+#define NR_FILES 40
+
+/* vfs_cap_data, revision 2, effective: cap_net_raw=ep */
+static const unsigned char net_raw_cap[20] = {
+	0x01, 0x00, 0x00, 0x02, 0x00, 0x20, 0x00, 0x00,
+};
+static bool have_caps;
+
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void write_file(const char *path, const char *data, off_t hole)
+{
+	int fd;
+
+	fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	lxc_test_assert_abort(fd >= 0);
+	lxc_test_assert_abort(pwrite(fd, data, strlen(data), hole) == (ssize_t)strlen(data));
+	close(fd);
+}
+
+static void read_file(const char *path, char *buf, size_t size, off_t off)
+{
+	int fd;
+	ssize_t ret;
+
+	fd = open(path, O_RDONLY);
+	lxc_test_assert_abort(fd >= 0);
+	ret = pread(fd, buf, size - 1, off);
+	lxc_test_assert_abort(ret >= 0);
+	buf[ret] = '\0';
+	close(fd);
+}
+
+static void build_tree(const char *src)
+{
+	char path[PATH_MAX];
+	struct timespec times[2] = { { 1000000000, 0 }, { 1234567890, 0 } };
+
+	lxc_test_assert_abort(mkdir(src, 0755) == 0);
+	snprintf(path, sizeof(path), "%s/etc", src);
+	lxc_test_assert_abort(mkdir(path, 0750) == 0);
+	snprintf(path, sizeof(path), "%s/etc/passwd", src);
+	write_file(path, "root:x:0:0::/root:/bin/sh\n", 0);
+	lxc_test_assert_abort(chown(path, 1234, 5678) == 0);
+	lxc_test_assert_abort(chmod(path, 04711) == 0);
+	lxc_test_assert_abort(utimensat(AT_FDCWD, path, times, 0) == 0);
+	/* ENOTSUP is fine, the copy skips them just the same */
+	setxattr(path, "user.lxc", "value", 5, 0);
+
+	/* hardlinks, also across directories */
+	snprintf(path, sizeof(path), "%s/bin", src);
+	lxc_test_assert_abort(mkdir(path, 0755) == 0);
+	snprintf(path, sizeof(path), "%s/bin/busybox", src);
+	write_file(path, "#!busybox", 0);
+	lxc_test_assert_abort(chdir(src) == 0);
+	lxc_test_assert_abort(link("bin/busybox", "bin/sh") == 0);
+	lxc_test_assert_abort(link("bin/busybox", "etc/sh") == 0);
+
+	/* file capabilities, which chown() on the copy would drop */
+	write_file("bin/ping", "#!ping", 0);
+	lxc_test_assert_abort(chown("bin/ping", 0, 1234) == 0);
+	lxc_test_assert_abort(chmod("bin/ping", 0755) == 0);
+	have_caps = setxattr("bin/ping", "security.capability", net_raw_cap,
+			     sizeof(net_raw_cap), 0) == 0;
+
+	/* a file that is mostly a hole */
+	write_file("sparse", "tail", 64 << 20);
+
+	lxc_test_assert_abort(symlink("bin/busybox", "link") == 0);
+	lxc_test_assert_abort(mkfifo("fifo", 0600) == 0);
+	lxc_test_assert_abort(mknod("null", S_IFCHR | 0666, makedev(1, 3)) == 0);
+
+	/* the root itself carries attributes too */
+	lxc_test_assert_abort(chmod(src, 0711) == 0);
+	lxc_test_assert_abort(chdir("/") == 0);
+}
+
+static void check_same(const char *src, const char *dest, const char *name)
+{
+	char spath[PATH_MAX], dpath[PATH_MAX];
+	struct stat sst, dst;
+
+	snprintf(spath, sizeof(spath), "%s/%s", src, name);
+	snprintf(dpath, sizeof(dpath), "%s/%s", dest, name);
+	lxc_test_assert_abort(lstat(spath, &sst) == 0);
+	lxc_test_assert_abort(lstat(dpath, &dst) == 0);
+
+	lxc_test_assert_abort(sst.st_mode == dst.st_mode);
+	lxc_test_assert_abort(sst.st_uid == dst.st_uid);
+	lxc_test_assert_abort(sst.st_gid == dst.st_gid);
+	lxc_test_assert_abort(sst.st_rdev == dst.st_rdev);
+	lxc_test_assert_abort(sst.st_nlink == dst.st_nlink);
+	if (!S_ISDIR(sst.st_mode)) {
+		lxc_test_assert_abort(sst.st_size == dst.st_size);
+		lxc_test_assert_abort(sst.st_mtim.tv_sec == dst.st_mtim.tv_sec);
+	}
+}
+
+static void test_copy(const char *base)
+{
+	char src[PATH_MAX], dest[PATH_MAX], path[PATH_MAX], buf[64];
+	struct stat st1, st2;
+	ssize_t len;
+
+	snprintf(src, sizeof(src), "%s/src", base);
+	snprintf(dest, sizeof(dest), "%s/dest", base);
+	build_tree(src);
+
+	/* stale entries, and a directory where a file belongs */
+	lxc_test_assert_abort(mkdir(dest, 0755) == 0);
+	snprintf(path, sizeof(path), "%s/stale/deeper", dest);
+	lxc_test_assert_abort(mkdir_p(path, 0755) == 0);
+	snprintf(path, sizeof(path), "%s/stale/deeper/file", dest);
+	write_file(path, "stale", 0);
+	snprintf(path, sizeof(path), "%s/sparse/in-the-way", dest);
+	lxc_test_assert_abort(mkdir_p(path, 0755) == 0);
+	snprintf(path, sizeof(path), "%s/etc", dest);
+	lxc_test_assert_abort(mkdir(path, 0700) == 0);
+	snprintf(path, sizeof(path), "%s/etc/old", dest);
+	write_file(path, "old", 0);
+
+	lxc_test_assert_abort(lxc_copy_tree(src, dest) == 0);
+	printf("reflinks %ssupported in %s\n",
+	       lxc_can_reflink(src, base) ? "" : "not ", base);
+	lxc_test_assert_abort(!lxc_can_reflink(src, "/proc"));
+
+	check_same(src, dest, ".");
+	check_same(src, dest, "etc");
+	check_same(src, dest, "etc/passwd");
+	check_same(src, dest, "bin/busybox");
+	check_same(src, dest, "link");
+	check_same(src, dest, "fifo");
+	check_same(src, dest, "null");
+	check_same(src, dest, "sparse");
+
+	snprintf(path, sizeof(path), "%s/etc/passwd", dest);
+	read_file(path, buf, sizeof(buf), 0);
+	lxc_test_assert_abort(strcmp(buf, "root:x:0:0::/root:/bin/sh\n") == 0);
+	len = getxattr(path, "user.lxc", buf, sizeof(buf));
+	lxc_test_assert_abort(len == 5 || (len < 0 && errno == ENODATA));
+
+	check_same(src, dest, "bin/ping");
+	if (have_caps) {
+		char cap[sizeof(net_raw_cap)];
+
+		snprintf(path, sizeof(path), "%s/bin/ping", dest);
+		len = getxattr(path, "security.capability", cap, sizeof(cap));
+		lxc_test_assert_abort(len == sizeof(net_raw_cap));
+		lxc_test_assert_abort(memcmp(cap, net_raw_cap, len) == 0);
+	} else {
+		printf("file capabilities not supported, not checked\n");
+	}
+
+	/* all three links share the inode */
+	snprintf(path, sizeof(path), "%s/bin/busybox", dest);
+	lxc_test_assert_abort(stat(path, &st1) == 0);
+	snprintf(path, sizeof(path), "%s/etc/sh", dest);
+	lxc_test_assert_abort(stat(path, &st2) == 0);
+	lxc_test_assert_abort(st1.st_ino == st2.st_ino && st1.st_nlink == 3);
+
+	snprintf(path, sizeof(path), "%s/sparse", dest);
+	read_file(path, buf, sizeof(buf), 64 << 20);
+	lxc_test_assert_abort(strcmp(buf, "tail") == 0);
+	lxc_test_assert_abort(stat(path, &st1) == 0);
+	lxc_test_assert_abort(st1.st_blocks * 512 < (1 << 20));
+
+	snprintf(path, sizeof(path), "%s/link", dest);
+	len = readlink(path, buf, sizeof(buf));
+	lxc_test_assert_abort(len == 11 && strncmp(buf, "bin/busybox", 11) == 0);
+
+	snprintf(path, sizeof(path), "%s/stale", dest);
+	lxc_test_assert_abort(access(path, F_OK) < 0 && errno == ENOENT);
+	snprintf(path, sizeof(path), "%s/etc/old", dest);
+	lxc_test_assert_abort(access(path, F_OK) < 0 && errno == ENOENT);
+}
+
+static void test_bench(const char *base)
+{
+	char src[PATH_MAX], dest[PATH_MAX], path[PATH_MAX];
+	double start, elapsed;
+	int i, j;
+
+	snprintf(src, sizeof(src), "%s/bench", base);
+	snprintf(dest, sizeof(dest), "%s/bench-copy", base);
+	for (i = 0; i < NR_DIRS; i++) {
+		snprintf(path, sizeof(path), "%s/%d", src, i);
+		lxc_test_assert_abort(mkdir_p(path, 0755) == 0);
+		for (j = 0; j < NR_FILES; j++) {
+			snprintf(path, sizeof(path), "%s/%d/%d", src, i, j);
+			write_file(path, "some file content\n", 0);
+		}
+	}
+	lxc_test_assert_abort(mkdir(dest, 0755) == 0);
+
+	start = now();
+	lxc_test_assert_abort(lxc_copy_tree(src, dest) == 0);
+	elapsed = now() - start;
+	printf("copied %d files in %.3f ms (%.0f files/s)\n", NR_DIRS * NR_FILES,
+	       elapsed * 1e3, NR_DIRS * NR_FILES / elapsed);
+
+	snprintf(path, sizeof(path), "%s/%d/%d", dest, NR_DIRS - 1, NR_FILES - 1);
+	lxc_test_assert_abort(access(path, F_OK) == 0);
+}
+
+static struct lxc_container *clone_dir(struct lxc_container *c,
+				       const char *name, int flags,
+				       char *rootfs, size_t len)
+{
+	struct lxc_container *c2;
+
+	c2 = c->clone(c, name, NULL, flags, NULL, NULL, 0, NULL);
+	lxc_test_assert_abort(c2);
+	lxc_test_assert_abort(c2->get_config_item(c2, "lxc.rootfs", rootfs, len) > 0);
+	return c2;
+}
+
+static void test_clone(const char *base)
+{
+	char lxcpath[PATH_MAX], path[PATH_MAX], rootfs[PATH_MAX], buf[64];
+	struct lxc_container *c, *c2;
+	struct stat st1, st2;
+	bool reflink;
+	FILE *f;
+
+	snprintf(lxcpath, sizeof(lxcpath), "%s/lxcpath", base);
+	snprintf(path, sizeof(path), "%s/orig/rootfs/etc", lxcpath);
+	lxc_test_assert_abort(mkdir_p(path, 0755) == 0);
+	snprintf(path, sizeof(path), "%s/orig/rootfs/etc/hostname", lxcpath);
+	write_file(path, "orig", 0);
+	snprintf(path, sizeof(path), "%s/orig/config", lxcpath);
+	f = fopen(path, "w");
+	lxc_test_assert_abort(f);
+	fprintf(f, "lxc.utsname = orig\nlxc.rootfs = %s/orig/rootfs\n", lxcpath);
+	fclose(f);
+
+	c = lxc_container_new("orig", lxcpath);
+	lxc_test_assert_abort(c && c->is_defined(c));
+
+	/* a plain copy is a directory of its own */
+	c2 = clone_dir(c, "copy", 0, rootfs, sizeof(rootfs));
+	snprintf(path, sizeof(path), "%s/copy/rootfs", lxcpath);
+	lxc_test_assert_abort(strcmp(rootfs, path) == 0);
+	snprintf(path, sizeof(path), "%s/copy/rootfs/etc/hostname", lxcpath);
+	read_file(path, buf, sizeof(buf), 0);
+	lxc_test_assert_abort(strcmp(buf, "copy") == 0);
+	snprintf(path, sizeof(path), "%s/orig/rootfs/etc/hostname", lxcpath);
+	read_file(path, buf, sizeof(buf), 0);
+	lxc_test_assert_abort(strcmp(buf, "orig") == 0);
+	lxc_test_assert_abort(c2->destroy(c2));
+	lxc_container_put(c2);
+
+	/* snapshots are overlays unless reflinks are asked for and work */
+	snprintf(path, sizeof(path), "%s/orig/rootfs", lxcpath);
+	reflink = lxc_can_reflink(path, lxcpath);
+	if (access("/proc/filesystems", F_OK) == 0 &&
+	    system("grep -qw overlay /proc/filesystems") == 0) {
+		c2 = clone_dir(c, "snap", LXC_CLONE_SNAPSHOT, rootfs, sizeof(rootfs));
+		lxc_test_assert_abort(strncmp(rootfs, "overlayfs:", 10) == 0);
+		lxc_test_assert_abort(c2->destroy(c2));
+		lxc_container_put(c2);
+	}
+
+	if (reflink) {
+		c2 = clone_dir(c, "reflink", LXC_CLONE_SNAPSHOT | LXC_CLONE_REFLINK,
+			       rootfs, sizeof(rootfs));
+		snprintf(path, sizeof(path), "%s/reflink/rootfs", lxcpath);
+		lxc_test_assert_abort(strcmp(rootfs, path) == 0);
+		snprintf(path, sizeof(path), "%s/reflink/rootfs/etc/hostname", lxcpath);
+		lxc_test_assert_abort(stat(path, &st1) == 0);
+		snprintf(path, sizeof(path), "%s/orig/rootfs/etc/hostname", lxcpath);
+		lxc_test_assert_abort(stat(path, &st2) == 0);
+		lxc_test_assert_abort(st1.st_ino != st2.st_ino);
+		lxc_test_assert_abort(c2->destroy(c2));
+		lxc_container_put(c2);
+	}
+
+	lxc_test_assert_abort(c->destroy(c));
+	lxc_container_put(c);
+}
+
+int main(int argc, char *argv[])
+{
+	char base[] = "/tmp/lxc-test-copytree-XXXXXX";
+
+	if (geteuid() != 0) {
+		printf("Test requires root, skipping\n");
+		exit(EXIT_SUCCESS);
+	}
+
+	lxc_test_assert_abort(mkdtemp(base));
+
+	test_copy(base);
+	test_bench(base);
+	test_clone(base);
+
+	lxc_test_assert_abort(lxc_rmdir_onedev(base, NULL) == 0);
+	exit(EXIT_SUCCESS);
+}
@@ -0,0 +1,113 @@
+/*
+ * lxc: linux Container library
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/param.h>
+#include <sys/stat.h>
+
+#include <lxc/lxccontainer.h>
+
+#include "lxctest.h"
+#include "utils.h"
+
+#define NR_RUNNING 3
+
+static char lxcpath[] = "/tmp/lxc-test-freeze-XXXXXX";
+
+static struct lxc_container *create_container(int i)
+{
+	struct lxc_container *c;
+	char path[MAXPATHLEN], name[32];
+	FILE *f;
+
+	snprintf(name, sizeof(name), "lxctest-freeze%d", i);
+	snprintf(path, sizeof(path), "%s/%s", lxcpath, name);
+	lxc_test_assert_abort(mkdir(path, 0755) == 0);
+
+	snprintf(path, sizeof(path), "%s/%s/config", lxcpath, name);
+	f = fopen(path, "w");
+	lxc_test_assert_abort(f);
+	fprintf(f, "lxc.utsname = %s\n", name);
+	fprintf(f, "lxc.rootfs = /\n");
+	fprintf(f, "lxc.rootfs.backend = dir\n");
+	fprintf(f, "lxc.network.type = empty\n");
+	fclose(f);
+
+	c = lxc_container_new(name, lxcpath);
+	lxc_test_assert_abort(c);
+	return c;
+}
+
+static void check_states(struct lxc_container **cts, const char *state)
+{
+	int i;
+
+	for (i = 0; i < NR_RUNNING; i++)
+		lxc_test_assert_abort(strcmp(cts[i]->state(cts[i]), state) == 0);
+}
+
+int main(int argc, char *argv[])
+{
+	struct lxc_container *cts[NR_RUNNING + 1];
+	char *const args[] = { "/bin/sleep", "600", NULL };
+	int i;
+
+	lxc_test_assert_abort(lxc_freeze_containers(NULL, -1) == -1);
+	lxc_test_assert_abort(lxc_freeze_containers(NULL, 0) == 0);
+	lxc_test_assert_abort(lxc_unfreeze_containers(NULL, 0) == 0);
+
+	if (geteuid() != 0) {
+		fprintf(stderr, "%s: needs root to start containers, skipped the rest\n", argv[0]);
+		exit(EXIT_SUCCESS);
+	}
+
+	lxc_test_assert_abort(mkdtemp(lxcpath));
+	for (i = 0; i <= NR_RUNNING; i++)
+		cts[i] = create_container(i);
+	for (i = 0; i < NR_RUNNING; i++) {
+		cts[i]->want_daemonize(cts[i], true);
+		lxc_test_assert_abort(cts[i]->start(cts[i], 0, args));
+		lxc_test_assert_abort(cts[i]->wait(cts[i], "RUNNING", 30));
+	}
+
+	lxc_test_assert_abort(lxc_freeze_containers(cts, NR_RUNNING) == NR_RUNNING);
+	check_states(cts, "FROZEN");
+	/* already frozen ones count as done */
+	lxc_test_assert_abort(lxc_freeze_containers(cts, NR_RUNNING) == NR_RUNNING);
+	lxc_test_assert_abort(lxc_unfreeze_containers(cts, NR_RUNNING) == NR_RUNNING);
+	check_states(cts, "RUNNING");
+
+	/* a stopped container fails alone, the others still change */
+	lxc_test_assert_abort(lxc_freeze_containers(cts, NR_RUNNING + 1) == NR_RUNNING);
+	check_states(cts, "FROZEN");
+	lxc_test_assert_abort(strcmp(cts[NR_RUNNING]->state(cts[NR_RUNNING]), "STOPPED") == 0);
+	lxc_test_assert_abort(lxc_unfreeze_containers(cts, NR_RUNNING + 1) == NR_RUNNING);
+	check_states(cts, "RUNNING");
+
+	for (i = 0; i <= NR_RUNNING; i++) {
+		if (i < NR_RUNNING)
+			lxc_test_assert_abort(cts[i]->stop(cts[i]));
+		lxc_container_put(cts[i]);
+	}
+	lxc_rmdir_onedev(lxcpath, NULL);
+	exit(EXIT_SUCCESS);
+}
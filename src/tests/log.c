@@ -0,0 +1,120 @@
+/*
+ * lxc: linux Container library
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "log.h"
+#include "lxccontainer.h"
+#include "lxctest.h"
+
+lxc_log_define(lxc_test_log, lxc);
+
+#define NR_RECORDS 1000
+
+static off_t file_size(const char *path)
+{
+	struct stat st;
+
+	lxc_test_assert_abort(stat(path, &st) == 0);
+	return st.st_size;
+}
+
+static int count_lines(FILE *f, const char *needle)
+{
+	char line[LXC_LOG_BUFFER_SIZE];
+	int n = 0;
+
+	rewind(f);
+	while (fgets(line, sizeof(line), f))
+		if (strstr(line, needle))
+			n++;
+	return n;
+}
+
+/* buffered records only reach the file on flush or on an error */
+static void test_buffered(const char *path)
+{
+	off_t size;
+
+	lxc_log_set_buffered(true);
+	INFO("buffered record");
+	size = file_size(path);
+	ERROR("error record");
+	lxc_test_assert_abort(file_size(path) > size);
+
+	INFO("held back");
+	size = file_size(path);
+	lxc_log_flush();
+	lxc_test_assert_abort(file_size(path) > size);
+	lxc_log_set_buffered(false);
+
+	lxc_test_assert_abort(lxc_log_set_format("bogus") < 0);
+}
+
+/* binary records decode to the same text the logfile appender writes */
+static void test_binary(const char *path)
+{
+	FILE *in, *out;
+	int i;
+
+	lxc_test_assert_abort(lxc_log_set_format("binary") == 0);
+	lxc_log_set_buffered(true);
+	for (i = 0; i < NR_RECORDS; i++)
+		INFO("binary record %d", i);
+	lxc_log_set_buffered(false);
+	lxc_test_assert_abort(lxc_log_set_format("text") == 0);
+
+	in = fopen(path, "r");
+	lxc_test_assert_abort(in);
+	out = tmpfile();
+	lxc_test_assert_abort(out);
+
+	lxc_test_assert_abort(lxc_log_decode(in, out) == 0);
+	lxc_test_assert_abort(count_lines(out, "INFO     lxc_test_log - log.c:test_binary") == NR_RECORDS);
+	lxc_test_assert_abort(count_lines(out, "binary record 999") == 1);
+
+	fclose(in);
+	fclose(out);
+}
+
+int main(int argc, char *argv[])
+{
+	char path[] = "/tmp/lxc-test-log-XXXXXX";
+	int fd;
+
+	fd = mkstemp(path);
+	lxc_test_assert_abort(fd >= 0);
+	close(fd);
+
+	lxc_test_assert_abort(lxc_log_init(NULL, path, "INFO", "lxc-test", 1, NULL) == 0);
+	test_buffered(path);
+	lxc_log_close();
+
+	lxc_test_assert_abort(truncate(path, 0) == 0);
+	lxc_test_assert_abort(lxc_log_init(NULL, path, "INFO", "lxc-test", 1, NULL) == 0);
+	test_binary(path);
+	lxc_log_close();
+
+	unlink(path);
+	exit(EXIT_SUCCESS);
+}
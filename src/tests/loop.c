@@ -0,0 +1,159 @@
+/*
+ * lxc: linux Container library
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#define _GNU_SOURCE
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/param.h>
+#include <sys/stat.h>
+
+#include <lxc/lxccontainer.h>
+
+#include "lxcloop.h"
+#include "lxctest.h"
+#include "utils.h"
+
+#define IMAGE_SIZE (64 << 20)
+
+static char lxcpath[] = "/tmp/lxc-test-loop-XXXXXX";
+static char template[MAXPATHLEN];
+
+static struct lxc_container *create(const char *name, const char *bdevtype,
+				    int flags)
+{
+	struct bdev_specs specs;
+	struct lxc_container *c;
+
+	memset(&specs, 0, sizeof(specs));
+	specs.fstype = "ext4";
+	specs.fssize = IMAGE_SIZE;
+
+	c = lxc_container_new(name, lxcpath);
+	lxc_test_assert_abort(c);
+	/* start from this rather than from whatever default.conf holds */
+	lxc_test_assert_abort(c->set_config_item(c, "lxc.network.type", "empty"));
+	if (!c->create(c, template, bdevtype, &specs, flags, NULL)) {
+		lxc_container_put(c);
+		return NULL;
+	}
+	return c;
+}
+
+/* bytes the image of @name takes on disk */
+static off_t image_usage(const char *name)
+{
+	char path[MAXPATHLEN];
+	struct stat st;
+
+	snprintf(path, sizeof(path), "%s/%s/rootdev", lxcpath, name);
+	lxc_test_assert_abort(stat(path, &st) == 0);
+	lxc_test_assert_abort(st.st_size == IMAGE_SIZE);
+	return st.st_blocks * 512;
+}
+
+static void test_parse(void)
+{
+	lxc_test_assert_abort(loop_prealloc("full") == 1);
+	lxc_test_assert_abort(loop_prealloc("sparse") == 0);
+	lxc_test_assert_abort(loop_prealloc("fully") < 0);
+	lxc_test_assert_abort(loop_prealloc("") < 0);
+	/* lxc.bdev.loop.alloc, sparse unless lxc.conf says otherwise */
+	lxc_test_assert_abort(loop_prealloc(NULL) >= 0);
+}
+
+static void test_loop(void)
+{
+	struct lxc_container *c;
+	uint64_t trimmed = 0;
+	off_t before;
+
+	c = create("sparse", "loop", 0);
+	if (!c) {
+		fprintf(stderr, "no loop devices or mkfs.ext4, skipped loop containers\n");
+		return;
+	}
+	if (loop_prealloc(NULL) == 0)
+		lxc_test_assert_abort(image_usage("sparse") < IMAGE_SIZE / 2);
+	lxc_test_assert_abort(c->destroy(c));
+	lxc_container_put(c);
+
+	c = create("full", "loop", LXC_CREATE_PREALLOC);
+	lxc_test_assert_abort(c);
+	before = image_usage("full");
+	lxc_test_assert_abort(before >= IMAGE_SIZE);
+
+	/* the free blocks of the filesystem become holes in the image */
+	lxc_test_assert_abort(c->trim(c, &trimmed));
+	lxc_test_assert_abort(trimmed > 0);
+	lxc_test_assert_abort(image_usage("full") < before);
+	lxc_test_assert_abort(c->destroy(c));
+	lxc_container_put(c);
+}
+
+/* rootfs on the host's filesystem must never be trimmed */
+static void test_shared(void)
+{
+	struct lxc_container *c, *snap;
+	uint64_t trimmed = 0;
+
+	c = create("dir", "dir", 0);
+	lxc_test_assert_abort(c);
+	lxc_test_assert_abort(!c->trim(c, &trimmed));
+
+	if (system("grep -qw overlay /proc/filesystems") == 0) {
+		snap = c->clone(c, "overlay", lxcpath, LXC_CLONE_SNAPSHOT,
+				"overlayfs", NULL, 0, NULL);
+		lxc_test_assert_abort(snap);
+		lxc_test_assert_abort(!snap->trim(snap, &trimmed));
+		lxc_test_assert_abort(snap->destroy(snap));
+		lxc_container_put(snap);
+	}
+
+	lxc_test_assert_abort(trimmed == 0);
+	lxc_test_assert_abort(c->destroy(c));
+	lxc_container_put(c);
+}
+
+int main(int argc, char *argv[])
+{
+	FILE *f;
+
+	test_parse();
+
+	if (geteuid() != 0) {
+		fprintf(stderr, "%s: needs root for loop devices, skipped the rest\n", argv[0]);
+		exit(EXIT_SUCCESS);
+	}
+
+	/* only the backing store matters, the rootfs stays empty */
+	lxc_test_assert_abort(mkdtemp(lxcpath));
+	snprintf(template, sizeof(template), "%s/template", lxcpath);
+	f = fopen(template, "w");
+	lxc_test_assert_abort(f);
+	fprintf(f, "#!/bin/sh\nexit 0\n");
+	fclose(f);
+	lxc_test_assert_abort(chmod(template, 0755) == 0);
+
+	test_loop();
+	test_shared();
+	lxc_rmdir_onedev(lxcpath, NULL);
+	exit(EXIT_SUCCESS);
+}
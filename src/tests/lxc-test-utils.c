@@ -24,10 +24,12 @@
 #define _GNU_SOURCE
 #include <errno.h>
 #include <fcntl.h>
+#include <limits.h>
 #include <sched.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 #include <unistd.h>
 #include <sys/mount.h>
 #include <sys/stat.h>
@@ -274,12 +276,221 @@ void test_lxc_string_in_array(void)
 	lxc_test_assert_abort(lxc_string_in_array("XYZ", (const char *[]){"BERTA", "ARQWE(9", "C8Zhkd", "7U", "XYZ", "UOIZ9", "=)()", NULL}));
 }
 
+static void rmdir_mkfile(const char *dir, const char *name)
+{
+	char path[PATH_MAX];
+	int fd;
+
+	snprintf(path, sizeof(path), "%s/%s", dir, name);
+	fd = open(path, O_CREAT | O_WRONLY, 0600);
+	lxc_test_assert_abort(fd >= 0);
+	close(fd);
+}
+
+void test_lxc_rmdir_onedev(void)
+{
+	char base[] = "/tmp/lxc-test-utils-rmdir-XXXXXX";
+	char path[PATH_MAX], keep[PATH_MAX];
+	int i;
+
+	lxc_test_assert_abort(mkdtemp(base));
+
+	/* a wide and deep tree, so that several workers get busy */
+	for (i = 0; i < 64; i++) {
+		snprintf(path, sizeof(path), "%s/%d/a/b/c", base, i);
+		lxc_test_assert_abort(mkdir_p(path, 0755) == 0);
+		rmdir_mkfile(path, "file");
+		snprintf(path, sizeof(path), "%s/%d", base, i);
+		rmdir_mkfile(path, "file");
+	}
+
+	/* symlinks are removed, never followed */
+	snprintf(keep, sizeof(keep), "%s-keep", base);
+	lxc_test_assert_abort(mkdir(keep, 0755) == 0);
+	rmdir_mkfile(keep, "file");
+	snprintf(path, sizeof(path), "%s/0/a/link", base);
+	lxc_test_assert_abort(symlink(keep, path) == 0);
+	snprintf(path, sizeof(path), "%s/fifo", base);
+	lxc_test_assert_abort(mkfifo(path, 0600) == 0);
+
+	/* a non-empty exclude is kept along with the top directory */
+	snprintf(path, sizeof(path), "%s/snaps/snap0", base);
+	lxc_test_assert_abort(mkdir_p(path, 0755) == 0);
+	lxc_test_assert_abort(lxc_rmdir_onedev(base, "snaps") == 0);
+	lxc_test_assert_abort(access(path, F_OK) == 0);
+	snprintf(path, sizeof(path), "%s/0", base);
+	lxc_test_assert_abort(access(path, F_OK) < 0 && errno == ENOENT);
+
+	/* an empty one goes */
+	snprintf(path, sizeof(path), "%s/snaps/snap0", base);
+	lxc_test_assert_abort(rmdir(path) == 0);
+	lxc_test_assert_abort(lxc_rmdir_onedev(base, "snaps") == 0);
+	lxc_test_assert_abort(access(base, F_OK) < 0 && errno == ENOENT);
+
+	snprintf(path, sizeof(path), "%s/file", keep);
+	lxc_test_assert_abort(access(path, F_OK) == 0);
+	lxc_test_assert_abort(lxc_rmdir_onedev(keep, NULL) == 0);
+	/* nothing left to remove is not an error */
+	lxc_test_assert_abort(lxc_rmdir_onedev(keep, NULL) == 0);
+}
+
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* what copies used to look like, for comparison */
+static void copy_by_read_write(const char *src, const char *dest)
+{
+	char buf[8096];
+	ssize_t len;
+	int in, out;
+
+	in = open(src, O_RDONLY);
+	out = open(dest, O_CREAT | O_EXCL | O_WRONLY, 0644);
+	lxc_test_assert_abort(in >= 0 && out >= 0);
+	while ((len = read(in, buf, sizeof(buf))) > 0)
+		lxc_test_assert_abort(write(out, buf, len) == len);
+	close(in);
+	close(out);
+}
+
+static void check_same_data(const char *a, const char *b, size_t size)
+{
+	char *buf1, *buf2;
+	int fd1, fd2;
+
+	buf1 = malloc(size);
+	buf2 = malloc(size);
+	lxc_test_assert_abort(buf1 && buf2);
+	fd1 = open(a, O_RDONLY);
+	fd2 = open(b, O_RDONLY);
+	lxc_test_assert_abort(fd1 >= 0 && fd2 >= 0);
+	lxc_test_assert_abort(lxc_read_nointr(fd1, buf1, size) == (ssize_t)size);
+	lxc_test_assert_abort(lxc_read_nointr(fd2, buf2, size) == (ssize_t)size);
+	lxc_test_assert_abort(memcmp(buf1, buf2, size) == 0);
+	close(fd1);
+	close(fd2);
+	free(buf1);
+	free(buf2);
+}
+
+/* files without a usable size are read until their end */
+static void test_copy_pseudo_files(const char *base)
+{
+	struct lxc_copy_state state = { NULL };
+	char src[PATH_MAX], dest[PATH_MAX], buf[64];
+	struct stat st;
+	pid_t pid;
+	int fd, in, out;
+
+	/* procfs files claim to be empty */
+	snprintf(dest, sizeof(dest), "%s/status", base);
+	lxc_test_assert_abort(lxc_copy_file("/proc/self/status", dest) == 0);
+	lxc_test_assert_abort(stat(dest, &st) == 0 && st.st_size > 0);
+
+	/* a fifo has no size at all */
+	snprintf(src, sizeof(src), "%s/fifo", base);
+	lxc_test_assert_abort(mkfifo(src, 0600) == 0);
+	pid = fork();
+	lxc_test_assert_abort(pid >= 0);
+	if (pid == 0) {
+		fd = open(src, O_WRONLY);
+		if (fd < 0 || write(fd, "from a fifo\n", 12) != 12)
+			_exit(EXIT_FAILURE);
+		_exit(EXIT_SUCCESS);
+	}
+	snprintf(dest, sizeof(dest), "%s/fifo-copy", base);
+	lxc_test_assert_abort(lxc_copy_file(src, dest) == 0);
+	lxc_test_assert_abort(wait_for_pid(pid) == 0);
+	fd = open(dest, O_RDONLY);
+	lxc_test_assert_abort(fd >= 0);
+	lxc_test_assert_abort(read(fd, buf, sizeof(buf)) == 12);
+	lxc_test_assert_abort(memcmp(buf, "from a fifo\n", 12) == 0);
+	close(fd);
+
+	/* a range copy ends early at the end of the source */
+	in = open(dest, O_RDONLY);
+	snprintf(dest, sizeof(dest), "%s/range", base);
+	out = open(dest, O_CREAT | O_EXCL | O_WRONLY, 0600);
+	lxc_test_assert_abort(in >= 0 && out >= 0);
+	lxc_test_assert_abort(lxc_copy_range(&state, in, out, 5, 100) == 7);
+	lxc_test_assert_abort(lxc_copy_range(&state, in, out, 0, 5) == 5);
+	lxc_copy_state_free(&state);
+	close(in);
+	close(out);
+	lxc_test_assert_abort(stat(dest, &st) == 0 && st.st_size == 12);
+}
+
+void test_lxc_copy_file(void)
+{
+	char base[] = "/tmp/lxc-test-utils-copy-XXXXXX";
+	char src[PATH_MAX], dest[PATH_MAX], old[PATH_MAX];
+	size_t i, size = 32 << 20;
+	unsigned int *data;
+	struct stat st;
+	double start, t_copy, t_old;
+	int fd;
+
+	lxc_test_assert_abort(mkdtemp(base));
+	snprintf(src, sizeof(src), "%s/src", base);
+	snprintf(dest, sizeof(dest), "%s/dest", base);
+	snprintf(old, sizeof(old), "%s/old", base);
+
+	data = malloc(size);
+	lxc_test_assert_abort(data);
+	for (i = 0; i < size / sizeof(*data); i++)
+		data[i] = i * 2654435761U;
+	fd = open(src, O_CREAT | O_WRONLY, 0750);
+	lxc_test_assert_abort(fd >= 0);
+	lxc_test_assert_abort(lxc_write_nointr(fd, data, size) == (ssize_t)size);
+	close(fd);
+	free(data);
+
+	start = now();
+	lxc_test_assert_abort(lxc_copy_file(src, dest) == 0);
+	t_copy = now() - start;
+	start = now();
+	copy_by_read_write(src, old);
+	t_old = now() - start;
+	printf("copied %zu MiB in %.3f ms, %.3f ms with read/write\n",
+	       size >> 20, t_copy * 1e3, t_old * 1e3);
+
+	check_same_data(src, dest, size);
+	lxc_test_assert_abort(stat(dest, &st) == 0);
+	lxc_test_assert_abort((st.st_mode & 07777) == 0750);
+	lxc_test_assert_abort(st.st_size == (off_t)size);
+
+	/* the destination is never overwritten */
+	lxc_test_assert_abort(lxc_copy_file(src, dest) < 0);
+	lxc_test_assert_abort(stat(dest, &st) == 0 && st.st_size == (off_t)size);
+	snprintf(dest, sizeof(dest), "%s/missing", base);
+	lxc_test_assert_abort(lxc_copy_file(dest, old) < 0);
+
+	/* empty files have nothing to copy */
+	snprintf(src, sizeof(src), "%s/empty", base);
+	fd = open(src, O_CREAT | O_WRONLY, 0600);
+	lxc_test_assert_abort(fd >= 0);
+	close(fd);
+	snprintf(dest, sizeof(dest), "%s/empty-copy", base);
+	lxc_test_assert_abort(lxc_copy_file(src, dest) == 0);
+	lxc_test_assert_abort(stat(dest, &st) == 0 && st.st_size == 0);
+
+	test_copy_pseudo_files(base);
+	lxc_test_assert_abort(lxc_rmdir_onedev(base, NULL) == 0);
+}
+
 int main(int argc, char *argv[])
 {
 	test_lxc_string_replace();
 	test_lxc_string_in_array();
 	test_lxc_deslashify();
 	test_detect_ramfs_rootfs();
+	test_lxc_rmdir_onedev();
+	test_lxc_copy_file();
 
 	exit(EXIT_SUCCESS);
 }
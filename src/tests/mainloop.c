@@ -0,0 +1,186 @@
+/*
+ * lxc: linux Container library
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+#include <sys/resource.h>
+
+#include "lxctest.h"
+#include "mainloop.h"
+
+#define NR_FDS 10000
+#define NR_DISPATCH 2000000
+
+struct bench {
+	int *fds;
+	int nr_fds;
+	unsigned long *hits;
+	unsigned long dispatched;
+	unsigned long limit;
+};
+
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int count_cb(int fd, uint32_t events, void *data,
+		    struct lxc_epoll_descr *descr)
+{
+	struct bench *b = data;
+
+	b->hits[fd]++;
+	if (++b->dispatched >= b->limit)
+		return 1;
+
+	return 0;
+}
+
+/* Deletes its own handler and closes the fd, the next one registered gets
+ * the same fd number; a stale event must not reach the new handler. */
+static int close_cb(int fd, uint32_t events, void *data,
+		    struct lxc_epoll_descr *descr)
+{
+	struct bench *b = data;
+
+	lxc_test_assert_abort(lxc_mainloop_del_handler(descr, fd) == 0);
+	close(fd);
+	b->dispatched++;
+	return 0;
+}
+
+static int max_fds(void)
+{
+	struct rlimit rl;
+
+	if (getrlimit(RLIMIT_NOFILE, &rl) < 0)
+		return 1000;
+
+	if (rl.rlim_cur < NR_FDS + 64) {
+		rl.rlim_cur = rl.rlim_max < NR_FDS + 64 ? rl.rlim_max : NR_FDS + 64;
+		setrlimit(RLIMIT_NOFILE, &rl);
+		getrlimit(RLIMIT_NOFILE, &rl);
+	}
+
+	if (rl.rlim_cur < NR_FDS + 64)
+		return rl.rlim_cur - 64;
+
+	return NR_FDS;
+}
+
+static void test_dispatch(struct bench *b)
+{
+	int i;
+	double start, elapsed;
+	struct lxc_epoll_descr descr;
+
+	lxc_test_assert_abort(lxc_mainloop_open(&descr) == 0);
+
+	start = now();
+	for (i = 0; i < b->nr_fds; i++)
+		lxc_test_assert_abort(lxc_mainloop_add_handler(&descr, b->fds[i], count_cb, b) == 0);
+	elapsed = now() - start;
+	printf("registered %d fds in %.3f ms\n", b->nr_fds, elapsed * 1e3);
+
+	/* every eventfd stays readable, so each round dispatches all of them */
+	b->dispatched = 0;
+	b->limit = NR_DISPATCH;
+	start = now();
+	lxc_test_assert_abort(lxc_mainloop(&descr, -1) == 0);
+	elapsed = now() - start;
+	printf("dispatched %lu events in %.3f ms (%.0f events/s, batch %d)\n",
+	       b->dispatched, elapsed * 1e3, b->dispatched / elapsed,
+	       descr.max_events);
+
+	for (i = 0; i < b->nr_fds; i++)
+		lxc_test_assert_abort(b->hits[b->fds[i]] > 0);
+
+	start = now();
+	for (i = 0; i < b->nr_fds; i++)
+		lxc_test_assert_abort(lxc_mainloop_del_handler(&descr, b->fds[i]) == 0);
+	elapsed = now() - start;
+	printf("removed %d handlers in %.3f ms\n", b->nr_fds, elapsed * 1e3);
+
+	lxc_test_assert_abort(descr.nr_handlers == 0);
+	lxc_test_assert_abort(lxc_mainloop_del_handler(&descr, b->fds[0]) < 0);
+
+	lxc_mainloop_close(&descr);
+}
+
+static void test_delete_in_callback(void)
+{
+	int i, fds[2];
+	struct bench b = { 0 };
+	struct lxc_epoll_descr descr;
+
+	lxc_test_assert_abort(lxc_mainloop_open(&descr) == 0);
+
+	for (i = 0; i < 2; i++) {
+		fds[i] = eventfd(1, EFD_CLOEXEC);
+		lxc_test_assert_abort(fds[i] >= 0);
+		lxc_test_assert_abort(lxc_mainloop_add_handler(&descr, fds[i], close_cb, &b) == 0);
+	}
+
+	/* both callbacks run, each removes itself, then the loop has
+	 * nothing left to wait for and returns */
+	lxc_test_assert_abort(lxc_mainloop(&descr, -1) == 0);
+	lxc_test_assert_abort(b.dispatched == 2);
+	lxc_test_assert_abort(descr.nr_handlers == 0);
+
+	lxc_mainloop_close(&descr);
+}
+
+int main(int argc, char *argv[])
+{
+	int i, maxfd = 0;
+	struct bench b = { 0 };
+
+	b.nr_fds = max_fds();
+	b.fds = malloc(b.nr_fds * sizeof(*b.fds));
+	lxc_test_assert_abort(b.fds);
+
+	for (i = 0; i < b.nr_fds; i++) {
+		b.fds[i] = eventfd(1, EFD_CLOEXEC);
+		lxc_test_assert_abort(b.fds[i] >= 0);
+		if (b.fds[i] > maxfd)
+			maxfd = b.fds[i];
+	}
+
+	b.hits = calloc(maxfd + 1, sizeof(*b.hits));
+	lxc_test_assert_abort(b.hits);
+
+	test_dispatch(&b);
+	test_delete_in_callback();
+
+	for (i = 0; i < b.nr_fds; i++)
+		close(b.fds[i]);
+	free(b.fds);
+	free(b.hits);
+
+	exit(EXIT_SUCCESS);
+}
@@ -0,0 +1,99 @@
+/*
+ * lxc: linux Container library
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "af_unix.h"
+#include "lxctest.h"
+#include "monitor.h"
+#include "state.h"
+#include "utils.h"
+
+static char oldpath[] = "/tmp/lxc-test-monitor-old-XXXXXX";
+static char newpath[] = "/tmp/lxc-test-monitor-new-XXXXXX";
+
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* a monitord predating the event stream only listens on the legacy socket */
+static void test_old_monitord(void)
+{
+	struct sockaddr_un addr;
+	int listenfd, fd;
+	double start;
+
+	lxc_test_assert_abort(mkdtemp(oldpath));
+	lxc_test_assert_abort(lxc_monitor_sock_name(oldpath, &addr) == 0);
+	listenfd = lxc_abstract_unix_open(addr.sun_path, SOCK_STREAM, O_TRUNC);
+	lxc_test_assert_abort(listenfd >= 0);
+
+	/* refused at once rather than after 160ms of retries */
+	start = now();
+	errno = 0;
+	lxc_test_assert_abort(lxc_monitor_open_events(oldpath) < 0);
+	lxc_test_assert_abort(errno == ECONNREFUSED);
+	lxc_test_assert_abort(now() - start < 0.05);
+
+	fd = lxc_monitor_open(oldpath);
+	lxc_test_assert_abort(fd >= 0);
+	close(fd);
+
+	/* lxc_wait falls back to the legacy socket */
+	lxc_test_assert_abort(lxc_wait("lxctest-monitor", "STOPPED", 5, oldpath) == 0);
+
+	close(listenfd);
+	lxc_rmdir_onedev(oldpath, NULL);
+}
+
+static void test_new_monitord(void)
+{
+	int fd;
+
+	lxc_test_assert_abort(mkdtemp(newpath));
+	lxc_test_assert_abort(lxc_monitord_spawn(newpath) == 0);
+
+	fd = lxc_monitor_open_events(newpath);
+	lxc_test_assert_abort(fd >= 0);
+	lxc_test_assert_abort(lxc_monitor_subscribe(fd, "lxctest-monitor", 0,
+						    1U << lxc_msg_state,
+						    1U << STOPPED) == 0);
+	close(fd);
+
+	lxc_test_assert_abort(lxc_wait("lxctest-monitor", "STOPPED", 5, newpath) == 0);
+	lxc_rmdir_onedev(newpath, NULL);
+}
+
+int main(int argc, char *argv[])
+{
+	test_old_monitord();
+	test_new_monitord();
+	exit(EXIT_SUCCESS);
+}
@@ -0,0 +1,89 @@
+/*
+ * lxc: linux Container library
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/param.h>
+#include <sys/stat.h>
+
+#include <lxc/lxccontainer.h>
+
+#include "lxctest.h"
+#include "utils.h"
+
+#define MYNAME "lxctest-pending-config"
+
+static char lxcpath[] = "/tmp/lxc-test-pending-config-XXXXXX";
+
+static void write_config(const char *content)
+{
+	char path[MAXPATHLEN];
+	FILE *f;
+
+	snprintf(path, sizeof(path), "%s/%s/config", lxcpath, MYNAME);
+	f = fopen(path, "w");
+	lxc_test_assert_abort(f);
+	fprintf(f, "%s", content);
+	fclose(f);
+}
+
+int main(int argc, char *argv[])
+{
+	const char *args[] = { "true", NULL };
+	lxc_attach_options_t opts = LXC_ATTACH_OPTIONS_DEFAULT;
+	struct lxc_snapshot *snaps;
+	struct lxc_container *c;
+	char path[MAXPATHLEN], buf[256];
+	int ttynum = -1, masterfd;
+
+	lxc_test_assert_abort(mkdtemp(lxcpath));
+	snprintf(path, sizeof(path), "%s/%s", lxcpath, MYNAME);
+	lxc_test_assert_abort(mkdir(path, 0755) == 0);
+	write_config("lxc.utsname = broken\nlxc.nosuchkey = 1\n");
+
+	/* the config is only read when it is needed */
+	c = lxc_container_new(MYNAME, lxcpath);
+	lxc_test_assert_abort(c);
+	lxc_test_assert_abort(c->is_defined(c));
+	lxc_test_assert_abort(strcmp(c->state(c), "STOPPED") == 0);
+
+	/* calls which need it fail instead of going on without it */
+	lxc_test_assert_abort(c->get_config_item(c, "lxc.utsname", buf, sizeof(buf)) == -1);
+	lxc_test_assert_abort(!c->set_config_item(c, "lxc.utsname", "other"));
+	lxc_test_assert_abort(!c->want_daemonize(c, true));
+	lxc_test_assert_abort(!c->get_interfaces(c));
+	lxc_test_assert_abort(c->snapshot_list(c, &snaps) == -1);
+	lxc_test_assert_abort(c->console_getfd(c, &ttynum, &masterfd) == -1);
+	lxc_test_assert_abort(!c->start(c, 0, NULL));
+	lxc_test_assert_abort(!c->startl(c, 0, NULL));
+	lxc_test_assert_abort(!c->clone(c, "copy", lxcpath, 0, NULL, NULL, 0, NULL));
+	lxc_test_assert_abort(c->attach_run_wait(c, &opts, "true", args) == -1);
+	lxc_test_assert_abort(c->attach_run_waitl(c, &opts, "true", "true", NULL) == -1);
+
+	/* and it is read again once it is fixed */
+	write_config("lxc.utsname = fixed\n");
+	lxc_test_assert_abort(c->get_config_item(c, "lxc.utsname", buf, sizeof(buf)) == 5);
+	lxc_test_assert_abort(strcmp(buf, "fixed") == 0);
+
+	lxc_container_put(c);
+	lxc_rmdir_onedev(lxcpath, NULL);
+	exit(EXIT_SUCCESS);
+}